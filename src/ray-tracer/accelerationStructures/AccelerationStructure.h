@@ -1,16 +1,48 @@
 #pragma once
+#include <ray-tracer/main/Geometry.h>
 #include <ray-tracer/main/Ray.h>
 
+#include <vector>
+
 namespace CHR
 {
+	//Counted by Intersect on the calling thread, collected and cleared by the ray tracer
+	struct TraversalStats
+	{
+		unsigned long long queries = 0;
+		unsigned long long nodes_visited = 0;//box tests of single rays, packets count each ray testing a node
+		unsigned long long primitive_tests = 0;
+		unsigned long long primitive_hits = 0;
+		unsigned long long instance_queries = 0;//traversals of instanced mesh BVHs, nodes and tests are added to the above
+		unsigned long long packets = 0;//ray packets traced together, their rays are counted in queries
+		unsigned long long packet_nodes = 0;//nodes fetched by packet traversal, once per packet
+	};
+	extern thread_local TraversalStats t_traversal_stats;
+
 	class AccelerationStructure
 	{
 	public:
+		virtual ~AccelerationStructure() {}
+
 		virtual bool Intersect(const Ray& ray, IntersectionData* intersection_data) const = 0;
-		virtual bool IntersectP(const Ray& ray) const = 0;
+		//Closest hit without the surface interaction, see Shape::FinalizeHit
+		virtual bool IntersectHit(const Ray& ray, SurfaceHit& hit) const = 0;
+		//Any hit closer than t_max, for occlusion queries
+		virtual bool IntersectP(const Ray& ray, float t_max = INFINITY) const = 0;
+		//Closest hits of the packet's rays, one intersection_data each. Traces them one at a time
+		//unless the structure has a packet traversal
+		virtual void Intersect(const RayPacket& packet, IntersectionData* intersection_data) const
+		{
+			for (int i = 0; i < packet.size; i++)
+				Intersect(packet.rays[i], &intersection_data[i]);
+		}
+		virtual Bounds3 WorldBound() const = 0;
+		//Updates the bounds after the scene objects with these model matrices moved,
+		//false when the structure has to be rebuilt instead
+		virtual bool Refit(const std::vector<const glm::mat4*>& moved) = 0;
 
 		// Total number of bytes required for storing
 		// this acceleration structure in memory.
-		virtual int GetSizeBytes() = 0;
+		virtual size_t GetSizeBytes() const = 0;
 	};
 }
\ No newline at end of file
@@ -1,9 +1,13 @@
 #include "BVH.h"
 
 #include <algorithm>
-#include <ctime>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <random>
+#include <unordered_set>
 
 #include <thirdparty/glm/glm/glm.hpp>
 #include <thirdparty/glm/glm/gtx/euler_angles.hpp>
@@ -12,12 +16,17 @@
 #include <thirdparty/glm/glm/gtc/matrix_transform.hpp>
 #include <thirdparty/glm/glm/gtc/type_ptr.hpp>
 
+#include <ray-tracer/editor/Profiler.h>
+#include <ray-tracer/editor/Settings.h>
 #include <ray-tracer/main/Scene.h>
+#include <ray-tracer/main/ThreadPool.h>
 
 //src:https://github.com/mmp/pbrt-v3/blob/master/src/accelerators/bvh.cpp
 
 namespace CHR
 {
+	thread_local TraversalStats t_traversal_stats;
+
 	struct BVHPrimitiveInfo {
 		BVHPrimitiveInfo() {}
 		BVHPrimitiveInfo(size_t primitiveNumber, const Bounds3& bounds)
@@ -47,11 +56,13 @@ namespace CHR
 		Bounds3 bounds;
 		BVHBuildNode* children[2];
 		int split_axis, first_prim_offset, n_primitives;
+		const int* sbvh_prims = nullptr;//Primitive numbers of an SBVH leaf before the leaves are laid out
+		float sah_cost;//Of the subtree, kept by the treelet restructuring
 	};
 
 	struct MortonPrimitive {
 		int primitiveIndex;
-		uint32_t mortonCode;
+		uint64_t mortonCode;
 	};
 
 	struct LBVHTreelet {
@@ -59,130 +70,373 @@ namespace CHR
 		BVHBuildNode* build_nodes;
 	};
 
+	// Which primitive paths a leaf needs
+	enum LEAF_FLAGS : uint8_t { LEAF_WORLD_TRIANGLES = 1, LEAF_SHAPES = 2 };
+
 	struct LinearBVHNode {
 		Bounds3 bounds;
 		union {
 			int primitives_offset;   // leaf
 			int second_child_offset;  // interior
+			int first_child_offset;   // interior, clustered layout: the first of its two adjacent children
 		};
 		uint16_t nPrimitives;  // 0 -> interior node
 		uint8_t axis;          // interior node: xyz
-		uint8_t pad[1];        // ensure 32 byte total size
+		uint8_t leaf_flags;    // leaf: LEAF_FLAGS, keeps the node at 32 bytes
+	};
+
+	// Node of a BVH with N children, their bounds are stored SoA so one slab test covers all of them
+	template <int N>
+	struct alignas(32) WideBVHNode {
+		static constexpr int width = N;
+		float bounds[6][N];         // min x, y, z then max x, y, z
+		int child[N];               // interior: wide node index, leaf: first primitive
+		uint16_t n_primitives[N];   // 0 -> interior child
+		uint8_t leaf_flags[N];      // leaf: LEAF_FLAGS
+		uint8_t n_children;
+	};
+
+	// Wide node with its children's bounds quantized to 8 bits within the node's own box and
+	// rounded outwards, 80 instead of 128 bytes for 4 children and 144 instead of 256 for 8.
+	// The scales are powers of two so origin + q * scale decodes with a single rounding
+	template <int N>
+	struct alignas(16) QuantizedBVHNode {
+		static constexpr int width = N;
+		float origin[3], scale[3];
+		uint8_t bounds[6][N];       // min x, y, z then max x, y, z
+		int child[N];
+		uint16_t n_primitives[N];
+		uint8_t leaf_flags[N];
+		uint8_t n_children;
+	};
+
+	// Bounds of a wide node's children at shutter open and close, kept next to the nodes of a BVH
+	// over moving primitives and indexed like them
+	template <int N>
+	struct alignas(32) WideMotionBounds {
+		float bounds[2][6][N];
 	};
 
+	template <int N>
+	static Bounds3 WideNodeBounds(const WideBVHNode<N>& node) {
+		Bounds3 b;
+		for (int c = 0; c < node.n_children; c++)
+			b.Extend(Bounds3(glm::vec3(node.bounds[0][c], node.bounds[1][c], node.bounds[2][c]),
+				glm::vec3(node.bounds[3][c], node.bounds[4][c], node.bounds[5][c])));
+		return b;
+	}
+
+	// Pending child of a wide node with the distance its box is entered at
+	struct WideNodeToVisit {
+		int child;
+		uint16_t n_primitives;
+		uint8_t leaf_flags;
+		float t_entry;
+	};
+
+	// Pending nodes of a traversal, inline up to Inline entries and on the heap for the rare deeper trees
+	template <typename T, int Inline>
+	class TraversalStack {
+	public:
+		explicit TraversalStack(int size) : m_data(size > Inline ? new T[size] : m_inline) {}
+		~TraversalStack() { if (m_data != m_inline) delete[] m_data; }
+		TraversalStack(const TraversalStack&) = delete;
+		TraversalStack& operator=(const TraversalStack&) = delete;
+		inline T& operator[](int i) { return m_data[i]; }
+	private:
+		T m_inline[Inline];
+		T* m_data;
+	};
+
+	// Emissive triangles add radiance in FinalizeHit and never occlude, hidden ones stay on the shape path,
+	// which skips them
+	const Triangle* BVH::WorldTriangle(const Shape* shape, bool bottomLevel) {
+		const Triangle* tri = dynamic_cast<const Triangle*>(shape);
+		if (!tri || dynamic_cast<const Light*>(tri) || !tri->m_transform || tri->m_motion ||
+			(!tri->m_visible && !bottomLevel))
+			return nullptr;
+		return tri;
+	}
+
+	static uint8_t LeafFlags(const TriangleBuffer& tris, int first, int count) {
+		uint8_t flags = 0;
+		for (int i = first; i < first + count; i++)
+			flags |= tris.triangles[i] ? LEAF_WORLD_TRIANGLES : LEAF_SHAPES;
+		return flags;
+	}
+
+	// Opens the interior child with the largest surface area until the wide node is full,
+	// so the binary levels with the most traversal work are the ones merged
+	template <int N>
+	static int CollapseBVHTree(BVHBuildNode* node, std::vector<WideBVHNode<N>>& nodes) {
+		BVHBuildNode* children[N];
+		int n = 0;
+		if (node->n_primitives > 0)
+			children[n++] = node;
+		else {
+			children[n++] = node->children[0];
+			children[n++] = node->children[1];
+		}
+		while (n < N) {
+			int open = -1;
+			float max_area = -1.0f;
+			for (int i = 0; i < n; i++) {
+				if (children[i]->n_primitives == 0 && children[i]->bounds.GetSurfaceArea() > max_area) {
+					max_area = children[i]->bounds.GetSurfaceArea();
+					open = i;
+				}
+			}
+			if (open < 0) break;
+			BVHBuildNode* interior = children[open];
+			children[open] = interior->children[0];
+			children[n++] = interior->children[1];
+		}
+
+		int index = nodes.size();
+		nodes.push_back(WideBVHNode<N>());
+		for (int i = 0; i < n; i++) {
+			// Children are collapsed first, they grow the vector
+			int child = children[i]->n_primitives > 0 ?
+				children[i]->first_prim_offset : CollapseBVHTree(children[i], nodes);
+			WideBVHNode<N>& wide = nodes[index];
+			for (int k = 0; k < 3; k++) {
+				wide.bounds[k][i] = children[i]->bounds.min[k];
+				wide.bounds[k + 3][i] = children[i]->bounds.max[k];
+			}
+			wide.child[i] = child;
+			wide.n_primitives[i] = children[i]->n_primitives;
+		}
+		nodes[index].n_children = n;
+		return index;
+	}
+
+	template <int N>
+	static QuantizedBVHNode<N>* QuantizeWideNodes(const WideBVHNode<N>* nodes, int count) {
+		QuantizedBVHNode<N>* quantized = AllocAligned<QuantizedBVHNode<N>>(count);
+		ThreadPool::GetInstance()->ParallelFor(count, [&](int n) {
+			const WideBVHNode<N>& node = nodes[n];
+			QuantizedBVHNode<N>& q = quantized[n];
+			q = QuantizedBVHNode<N>();
+			for (int k = 0; k < 3; k++) {
+				float lo = node.bounds[k][0], hi = node.bounds[k + 3][0];
+				for (int i = 1; i < node.n_children; i++) {
+					lo = std::min(lo, node.bounds[k][i]);
+					hi = std::max(hi, node.bounds[k + 3][i]);
+				}
+				// Smallest power of two step that spans the node in 255 steps
+				float scale = 0.0f;
+				if (hi > lo) {
+					scale = std::ldexp(1.0f, (int)std::ceil(std::log2((hi - lo) / 255)));
+					if (lo + 255 * scale < hi)
+						scale *= 2;
+				}
+				q.origin[k] = lo;
+				q.scale[k] = scale;
+				for (int i = 0; i < node.n_children; i++) {
+					int q_min = 0, q_max = 0;
+					if (scale > 0) {
+						q_min = std::max(0, std::min(255, (int)std::floor((node.bounds[k][i] - lo) / scale)));
+						q_max = std::max(0, std::min(255, (int)std::ceil((node.bounds[k + 3][i] - lo) / scale)));
+					}
+					while (q_min > 0 && lo + q_min * scale > node.bounds[k][i])
+						q_min--;
+					while (q_max < 255 && lo + q_max * scale < node.bounds[k + 3][i])
+						q_max++;
+					q.bounds[k][i] = (uint8_t)q_min;
+					q.bounds[k + 3][i] = (uint8_t)q_max;
+				}
+			}
+			std::copy(node.child, node.child + N, q.child);
+			std::copy(node.n_primitives, node.n_primitives + N, q.n_primitives);
+			std::copy(node.leaf_flags, node.leaf_flags + N, q.leaf_flags);
+			q.n_children = node.n_children;
+		}, 1024);
+		return quantized;
+	}
+
+	// Cost of one wide leaf triangle test relative to a scalar one, measured with chroma-kernel-bench
+	static float BatchCost(SIMD_T simd) {
+		switch (simd) {
+		case SIMD_T::avx: return 2.0f;
+		case SIMD_T::sse: return 1.5f;
+		default: return 1.0f;
+		}
+	}
+
 	// Bvh Utility Functions
-	inline uint32_t LeftShift3(uint32_t x) {
-		//CHECK_LE(x, (1 << 10));
-		if (x == (1 << 10)) --x;
-#ifdef PBRT_HAVE_BINARY_CONSTANTS
-		x = (x | (x << 16)) & 0b00000011000000000000000011111111;
-		// x = ---- --98 ---- ---- ---- ---- 7654 3210
-		x = (x | (x << 8)) & 0b00000011000000001111000000001111;
-		// x = ---- --98 ---- ---- 7654 ---- ---- 3210
-		x = (x | (x << 4)) & 0b00000011000011000011000011000011;
-		// x = ---- --98 ---- 76-- --54 ---- 32-- --10
-		x = (x | (x << 2)) & 0b00001001001001001001001001001001;
-		// x = ---- 9--8 --7- -6-- 5--4 --3- -2-- 1--0
-#else
-		x = (x | (x << 16)) & 0x30000ff;
-		// x = ---- --98 ---- ---- ---- ---- 7654 3210
-		x = (x | (x << 8)) & 0x300f00f;
-		// x = ---- --98 ---- ---- 7654 ---- ---- 3210
-		x = (x | (x << 4)) & 0x30c30c3;
-		// x = ---- --98 ---- 76-- --54 ---- 32-- --10
-		x = (x | (x << 2)) & 0x9249249;
-		// x = ---- 9--8 --7- -6-- 5--4 --3- -2-- 1--0
-#endif // PBRT_HAVE_BINARY_CONSTANTS
+	// Spreads the low 21 bits of x three bits apart
+	inline uint64_t LeftShift3(uint64_t x) {
+		//CHECK_LE(x, (1 << 21));
+		if (x == (1 << 21)) --x;
+		x = (x | (x << 32)) & 0x1f00000000ffff;
+		x = (x | (x << 16)) & 0x1f0000ff0000ff;
+		x = (x | (x << 8)) & 0x100f00f00f00f00f;
+		x = (x | (x << 4)) & 0x10c30c30c30c30c3;
+		x = (x | (x << 2)) & 0x1249249249249249;
+		// x = ---- 9--8 --7- -6-- 5--4 --3- -2-- 1--0, up to bit 60
 		return x;
 	}
 
-	inline uint32_t EncodeMorton3(const glm::vec3& v) {
+	inline uint64_t EncodeMorton3(const glm::vec3& v) {
 		//CHECK_GE(v.x, 0);
 		//CHECK_GE(v.y, 0);
 		//CHECK_GE(v.z, 0);
-		return (LeftShift3(v.z) << 2) | (LeftShift3(v.y) << 1) | LeftShift3(v.x);
+		return (LeftShift3((uint64_t)v.z) << 2) | (LeftShift3((uint64_t)v.y) << 1) | LeftShift3((uint64_t)v.x);
 	}
 
+	// LSD radix sort of the 63 bit Morton codes. Every pass counts the digits of each chunk in parallel,
+	// a prefix sum over (digit, chunk) gives each chunk its output positions and the chunks scatter in
+	// parallel, so the passes stay stable. Passes where every code has the same digit are skipped.
 	static void RadixSort(std::vector<MortonPrimitive>* v) {
 		std::vector<MortonPrimitive> tempVector(v->size());
-		constexpr int bitsPerPass = 6;
-		constexpr int nBits = 30;
+		constexpr int bitsPerPass = 9;
+		constexpr int nBits = 63;
 		static_assert((nBits % bitsPerPass) == 0,
 			"Radix sort bitsPerPass must evenly divide nBits");
 		constexpr int nPasses = nBits / bitsPerPass;
-
+		constexpr int nBuckets = 1 << bitsPerPass;
+		constexpr uint64_t bitMask = (1 << bitsPerPass) - 1;
+		constexpr int chunkSize = 16 * 1024;
+		const int n = (int)v->size();
+		const int nChunks = std::max(1, (n + chunkSize - 1) / chunkSize);
+		std::vector<int> chunkCounts(nChunks * nBuckets);
+
+		std::vector<MortonPrimitive>* in = v;
+		std::vector<MortonPrimitive>* out = &tempVector;
 		for (int pass = 0; pass < nPasses; ++pass) {
 			// Perform one pass of radix sort, sorting _bitsPerPass_ bits
 			int lowBit = pass * bitsPerPass;
 
-			// Set in and out vector pointers for radix sort pass
-			std::vector<MortonPrimitive>& in = (pass & 1) ? tempVector : *v;
-			std::vector<MortonPrimitive>& out = (pass & 1) ? *v : tempVector;
-
-			// Count number of zero bits in array for current radix sort bit
-			constexpr int nBuckets = 1 << bitsPerPass;
-			int bucketCount[nBuckets] = { 0 };
-			constexpr int bitMask = (1 << bitsPerPass) - 1;
-			for (const MortonPrimitive& mp : in) {
-				int bucket = (mp.mortonCode >> lowBit)& bitMask;
-				//CHECK_GE(bucket, 0);
-				//CHECK_LT(bucket, nBuckets);
-				++bucketCount[bucket];
+			// Count the digits of every chunk
+			std::fill(chunkCounts.begin(), chunkCounts.end(), 0);
+			ThreadPool::GetInstance()->ParallelFor(nChunks, [&](int c) {
+				int* counts = &chunkCounts[c * nBuckets];
+				for (int i = c * chunkSize; i < std::min(n, (c + 1) * chunkSize); i++)
+					++counts[((*in)[i].mortonCode >> lowBit) & bitMask];
+			});
+
+			// Compute starting index in output array for each chunk's bucket
+			int outIndex = 0;
+			bool oneBucket = false;
+			for (int b = 0; b < nBuckets; ++b) {
+				int bucketStart = outIndex;
+				for (int c = 0; c < nChunks; ++c) {
+					int count = chunkCounts[c * nBuckets + b];
+					chunkCounts[c * nBuckets + b] = outIndex;
+					outIndex += count;
+				}
+				oneBucket |= outIndex - bucketStart == n;
 			}
-
-			// Compute starting index in output array for each bucket
-			int outIndex[nBuckets];
-			outIndex[0] = 0;
-			for (int i = 1; i < nBuckets; ++i)
-				outIndex[i] = outIndex[i - 1] + bucketCount[i - 1];
+			if (oneBucket) continue;
 
 			// Store sorted values in output array
-			for (const MortonPrimitive& mp : in) {
-				int bucket = (mp.mortonCode >> lowBit)& bitMask;
-				out[outIndex[bucket]++] = mp;
-			}
+			ThreadPool::GetInstance()->ParallelFor(nChunks, [&](int c) {
+				int* offsets = &chunkCounts[c * nBuckets];
+				for (int i = c * chunkSize; i < std::min(n, (c + 1) * chunkSize); i++)
+					(*out)[offsets[((*in)[i].mortonCode >> lowBit) & bitMask]++] = (*in)[i];
+			});
+			std::swap(in, out);
 		}
 		// Copy final result from _tempVector_, if needed
-		if (nPasses & 1) std::swap(*v, tempVector);
+		if (in != v) std::swap(*v, tempVector);
 	}
 
 
-	BVH::BVH(Scene& scene,
-		int maxPrimsInNode, SplitMethod splitMethod)
-		: m_max_prims_in_node(std::min(255, maxPrimsInNode)),
-		m_split_method(splitMethod) {
+	static BVHBuildOptions ClampOptions(BVHBuildOptions options) {
+		options.max_prims_in_node = std::max(1, std::min(255, options.max_prims_in_node));
+		options.simd = std::min(options.simd, DetectSIMD());
+		options.width = options.width >= 8 ? 8 : options.width >= 4 ? 4 : 2;
+		options.sah_buckets = std::max(2, std::min(BVH::MAX_SAH_BUCKETS, options.sah_buckets));
+		options.sbvh_budget = std::max(0.0f, options.sbvh_budget);
+		options.treelet_passes = std::max(0, options.treelet_passes);
+		return options;
+	}
 
-		clock_t start_time = clock();
-		//ProfilePhase _(Prof::AccelConstruction);
+	BVH::BVH(Scene& scene, const BVHBuildOptions& options)
+		: m_options(ClampOptions(options)),
+		m_leaf_kernel(GetTriangleLeafKernel(m_options.simd)),
+		m_box_kernel(m_options.width > 2 ? GetBoxKernel(m_options.width, m_options.simd) : nullptr),
+		m_quantized_box_kernel(m_options.width > 2 ? GetQuantizedBoxKernel(m_options.width, m_options.simd) : nullptr) {
 
-		// Build BVH from _primitives_
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		ProfilePhase _(Prof::AccelConstruction);
 
-		// Initialize _primitiveInfo_ array for primitives
 		m_scene_ptr = &scene;
 
 		InitShapes();
+		Build(start);
+	}
+
+	BVH::BVH(const std::vector<std::shared_ptr<Shape>>& shapes, const BVHBuildOptions& options)
+		: m_options(ClampOptions(options)),
+		m_leaf_kernel(GetTriangleLeafKernel(m_options.simd)),
+		m_box_kernel(m_options.width > 2 ? GetBoxKernel(m_options.width, m_options.simd) : nullptr),
+		m_quantized_box_kernel(m_options.width > 2 ? GetQuantizedBoxKernel(m_options.width, m_options.simd) : nullptr) {
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		ProfilePhase _(Prof::AccelConstruction);
+
+		m_shapes = shapes;
+		m_bottom_level = true;
+		Build(start);
+	}
+
+	void BVH::Build(std::chrono::steady_clock::time_point start)
+	{
+		if (m_shapes.empty())
+			return;
 
+		// Build BVH from _primitives_
+
+		// Initialize _primitiveInfo_ array for primitives
 		std::vector<BVHPrimitiveInfo> primitiveInfo(m_shapes.size());
 
-		for (size_t i = 0; i < m_shapes.size(); ++i)
-		{
-			glm::vec3 b_min, b_max;
-			
+		ThreadPool::GetInstance()->ParallelFor((int)m_shapes.size(), [&](int i) {
 			Bounds3 b = m_shapes[i]->GetWorldBounds();
-			primitiveInfo[i] = { i, b};
+			primitiveInfo[i] = { (size_t)i, b };
+		}, 4096);
+
+		// A cached BVH of the same shapes and settings replaces the build
+		const std::string& cacheDir = Settings::GetInstance()->m_bvh_cache_dir;
+		uint64_t cacheKey = 0;
+		std::string cachePath;
+		if (!cacheDir.empty()) {
+			cacheKey = ComputeCacheKey(primitiveInfo);
+			cachePath = GetBVHCachePath(cacheDir, cacheKey);
+			if (LoadCache(cachePath, cacheKey)) {
+				BuildTriangleBuffer();
+				BuildMotionBounds();
+				LogBuild(start, true);
+				return;
+			}
 		}
 
-		// Build BVH tree for primitives using _primitiveInfo_
-		MemoryArena arena(1024 * 1024);
-		int totalNodes = 0;
-		std::vector<std::shared_ptr<Shape>> orderedPrims;
-		orderedPrims.reserve(m_shapes.size());
+		// Build BVH tree for primitives using _primitiveInfo_, one arena per thread of the pool
+		// and one for the threads outside it
+		std::vector<std::unique_ptr<MemoryArena>> arenas;
+		for (int i = 0; i <= ThreadPool::GetInstance()->GetThreadCount(); i++)
+			arenas.push_back(std::make_unique<MemoryArena>(1024 * 1024));
+		std::atomic<int> totalNodes(0);
+		std::vector<std::shared_ptr<Shape>> orderedPrims(m_shapes.size());
 		BVHBuildNode* root;
-		if (splitMethod == SplitMethod::HLBVH)
-			root = HLBVHBuild(arena, primitiveInfo, &totalNodes, orderedPrims);
+		if (m_options.split_method == SplitMethod::HLBVH)
+			root = HLBVHBuild(arenas, primitiveInfo, &totalNodes, orderedPrims);
+		else if (m_options.split_method == SplitMethod::SBVH)
+			root = SBVHBuild(arenas, primitiveInfo, &totalNodes, orderedPrims);
 		else
-			root = RecursiveBuild(arena, primitiveInfo, 0, m_shapes.size(),
+			root = RecursiveBuild(arenas, primitiveInfo, 0, m_shapes.size(),
 				&totalNodes, orderedPrims);
+		if (m_options.treelet_passes > 0 && root->n_primitives == 0) {
+			float rootArea = root->bounds.GetSurfaceArea();
+			float before = SAHCost(root) / rootArea;
+			for (int i = 0; i < m_options.treelet_passes; i++)
+				OptimizeTreelets(root, 0);
+			CH_TRACE("Treelet restructuring: SAH cost " + std::to_string(before) + " -> " +
+				std::to_string(root->sah_cost / rootArea) + " in " + std::to_string(m_options.treelet_passes) + " passes");
+		}
+		// The traversal stacks hold one entry per interior level, N - 1 for wide nodes which are never deeper
+		m_depth = TreeDepth(root);
+		// _orderedPrims_ keeps the shapes in their original order for the cache
 		m_shapes.swap(orderedPrims);
 		/*LOG(INFO) << StringPrintf("BVH created with %d nodes for %d "
 			"primitives (%.2f MB)", totalNodes,
@@ -193,73 +447,533 @@ namespace CHR
 			//// Compute representation of depth-first traversal of BVH tree
 			//treeBytes += totalNodes * sizeof(LinearBVHNode) + sizeof(*this) +
 			//    primitives.size() * sizeof(primitives[0]);
-		m_nodes = AllocAligned<LinearBVHNode>(totalNodes);
-		int offset = 0;
-		FlattenBVHTree(root, &offset);
+		m_bounds = root->bounds;
+		if (m_options.width == 8)
+			m_nodes8 = FlattenWideBVHTree<8>(root);
+		else if (m_options.width == 4)
+			m_nodes4 = FlattenWideBVHTree<4>(root);
+		else if (m_options.clustered_layout) {
+			// The root fills the first slot and one is left empty so every pair of siblings
+			// shares a cache line
+			m_nodes = AllocAligned<LinearBVHNode>(totalNodes + 1);
+			m_nodes[1] = LinearBVHNode();
+			int offset = 2;
+			FlattenClusteredBVHTree(root, 0, &offset);
+			m_total_nodes = totalNodes;
+		}
+		else {
+			m_nodes = AllocAligned<LinearBVHNode>(totalNodes);
+			int offset = 0;
+			FlattenBVHTree(root, &offset);
+			m_total_nodes = totalNodes;
+		}
+		BuildTriangleBuffer();
+		SetLeafFlags();
+		bool moving = std::any_of(m_shapes.begin(), m_shapes.end(),
+			[](const std::shared_ptr<Shape>& shape) { return shape->m_motion != nullptr; });
+		if (m_options.quantized_nodes && (m_nodes4 || m_nodes8)) {
+			// Quantized after the leaf flags are set, a box that large can not be quantized
+			bool finite = true;
+			for (int k = 0; k < 3; k++)
+				finite = finite && std::isfinite(m_bounds.min[k]) && std::isfinite(m_bounds.max[k]);
+			if (!finite)
+				CH_WARN("BVH bounds are not finite, nodes are left unquantized");
+			else if (moving)
+				CH_TRACE("Primitives move, nodes are left unquantized so their bounds can follow the ray time");
+			else if (m_nodes8) {
+				m_qnodes8 = QuantizeWideNodes(m_nodes8, m_total_nodes);
+				FreeAligned(m_nodes8);
+				m_nodes8 = nullptr;
+			}
+			else {
+				m_qnodes4 = QuantizeWideNodes(m_nodes4, m_total_nodes);
+				FreeAligned(m_nodes4);
+				m_nodes4 = nullptr;
+			}
+		}
+		BuildMotionBounds();
+		if (!cachePath.empty())
+			SaveCache(cachePath, cacheKey, orderedPrims);
+		LogBuild(start, false);
+	}
 
-		CH_TRACE("BVH info:\n\tNode count: " + 
-			std::to_string(totalNodes) +
-			"\n\tNode size:  " + std::to_string(sizeof(LinearBVHNode)) +
+	void BVH::LogBuild(std::chrono::steady_clock::time_point start, bool cached)
+	{
+		std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+		m_build_time = elapsed.count();
+
+		CH_TRACE(std::string(m_bottom_level ? "Instanced mesh BVH info:" : "BVH info:") + "\n\tNode count: " + 
+			std::to_string(m_total_nodes) + ", " + std::to_string(m_options.width) + " wide" +
+			(m_qnodes4 || m_qnodes8 ? ", quantized" : m_options.clustered_layout && m_nodes ? ", clustered" : "") +
+			", " + std::to_string(m_depth) + " deep" +
+			"\n\tNode size:  " + std::to_string(GetNodeSize()) +
 			"\n\tBVH size:  " +  
-			std::to_string((totalNodes * sizeof(LinearBVHNode)) 
-			/ (1024.0f * 1024.0f)) + "MB");
+			std::to_string((m_total_nodes * GetNodeSize()) 
+			/ (1024.0f * 1024.0f)) + "MB" +
+			"\n\tWorld space triangles: " + std::to_string(m_triangles.count) + "/" + std::to_string(m_shapes.size()) +
+			" (" + std::to_string(m_triangles.GetSizeBytes() / (1024.0f * 1024.0f)) + "MB)" +
+			(m_moving_prims > 0 ? "\n\tMoving primitives: " + std::to_string(m_moving_prims) + ", node bounds at shutter open and close (" +
+				std::to_string(GetMotionBoundsBytes() / (1024.0f * 1024.0f)) + "MB)" : "") +
+			"\n\tLeaf test:  " + ToString(m_options.simd) + ", up to " + std::to_string(m_options.max_prims_in_node) + " primitives" +
+			(m_options.split_method == SplitMethod::HLBVH ? "" : "\n\tSAH buckets: " + std::to_string(m_options.sah_buckets)) +
+			"\n\tTotal size: " + std::to_string(GetSizeBytes() / (1024.0f * 1024.0f)) + "MB" +
+			(cached ? "\n\tLoaded from cache in " : "\n\tBuilt in ") + std::to_string(m_build_time) + "s");
+	}
 
-		clock_t elapsed = clock() - start_time;
+	void BVH::BuildTriangleBuffer()
+	{
+		size_t n = m_shapes.size();
+		m_triangles.Resize(n);
+
+		std::atomic<int> count{ 0 };
+		ThreadPool::GetInstance()->ParallelFor((int)n, [&](int i) {
+			if (SetWorldTriangle(i))
+				count++;
+		}, 4096);
+		m_triangles.count = count;
+	}
+
+	bool BVH::SetWorldTriangle(int i)
+	{
+		const Triangle* tri = WorldTriangle(m_shapes[i].get(), m_bottom_level);
+		m_triangles.triangles[i] = tri;
+		if (!tri)
+		{
+			//Zero edges, a wide test always misses the entry
+			for (int k = 0; k < 3; k++)
+				m_triangles.v0[k][i] = m_triangles.edge1[k][i] = m_triangles.edge2[k][i] = 0.0f;
+			return false;
+		}
+
+		glm::vec3 v0 = *tri->m_transform * glm::vec4(tri->Vertex(0), 1.0f);
+		glm::vec3 v1 = *tri->m_transform * glm::vec4(tri->Vertex(1), 1.0f);
+		glm::vec3 v2 = *tri->m_transform * glm::vec4(tri->Vertex(2), 1.0f);
+		glm::vec3 e1 = v1 - v0, e2 = v2 - v0;
+		for (int k = 0; k < 3; k++)
+		{
+			m_triangles.v0[k][i] = v0[k];
+			m_triangles.edge1[k][i] = e1[k];
+			m_triangles.edge2[k][i] = e2[k];
+		}
+		return true;
+	}
+
+	void BVH::SetLeafFlags()
+	{
+		//The clustered layout has an empty slot after the root
+		int node_slots = m_nodes && m_options.clustered_layout ? m_total_nodes + 1 : m_total_nodes;
+		for (int i = 0; i < node_slots; i++)
+		{
+			if (m_nodes4 || m_nodes8)
+			{
+				int n_children = m_nodes4 ? m_nodes4[i].n_children : m_nodes8[i].n_children;
+				for (int c = 0; c < n_children; c++)
+				{
+					if (m_nodes4 && m_nodes4[i].n_primitives[c] > 0)
+						m_nodes4[i].leaf_flags[c] = LeafFlags(m_triangles, m_nodes4[i].child[c], m_nodes4[i].n_primitives[c]);
+					if (m_nodes8 && m_nodes8[i].n_primitives[c] > 0)
+						m_nodes8[i].leaf_flags[c] = LeafFlags(m_triangles, m_nodes8[i].child[c], m_nodes8[i].n_primitives[c]);
+				}
+				continue;
+			}
+			LinearBVHNode& node = m_nodes[i];
+			if (node.nPrimitives == 0)
+				continue;
+			node.leaf_flags = LeafFlags(m_triangles, node.primitives_offset, node.nPrimitives);
+		}
+	}
+
+	float BVH::LeafCost(int n) const
+	{
+		int width = GetSIMDWidth(m_options.simd);
+		//Single primitive leaves are tested one by one
+		if (width == 1 || m_options.max_prims_in_node == 1)
+			return n;
+		return ((n + width - 1) / width) * BatchCost(m_options.simd);
 	}
 
 	Bounds3 BVH::WorldBound() const {
-		return m_nodes ? m_nodes[0].bounds : Bounds3();
+		return m_bounds;
+	}
+
+	bool BVH::Refit(const std::vector<const glm::mat4*>& moved)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		ProfilePhase _(Prof::AccelConstruction);
+
+		// Instanced meshes first, a nested one is listed before the meshes that instance it
+		std::unordered_set<const AccelerationStructure*> changed;
+		for (auto& bvh : m_instanced_bvhs) {
+			if (!bvh->RefitNodes(moved, changed))
+				return false;
+		}
+		float before = m_refit_base_cost;
+		if (!RefitNodes(moved, changed))
+			return false;
+
+		std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+		if (changed.count(this))
+			CH_TRACE("BVH refit in " + std::to_string(elapsed.count()) + "s, SAH cost " +
+				std::to_string(before < 0.0f ? m_refit_base_cost : before) + " as built, " + std::to_string(m_refit_cost) + " now");
+		return true;
+	}
+
+	// Bounds of primitives [first, first + count) and whether any of them moved. Buffered triangles are
+	// bounded by their vertices as the leaf kernels see them, without transforming them again
+	static bool RangeBounds(const std::vector<std::shared_ptr<Shape>>& shapes, const TriangleBuffer& tris,
+		const std::vector<uint8_t>& moved, int first, int count, Bounds3& bounds) {
+		bool any = false;
+		for (int i = first; i < first + count && !any; i++)
+			any = moved[i] != 0;
+		if (!any)
+			return false;
+		bounds = Bounds3();
+		for (int i = first; i < first + count; i++) {
+			if (!tris.triangles[i]) {
+				bounds.Extend(shapes[i]->GetWorldBounds());
+				continue;
+			}
+			glm::vec3 v0(tris.v0[0][i], tris.v0[1][i], tris.v0[2][i]);
+			glm::vec3 e1(tris.edge1[0][i], tris.edge1[1][i], tris.edge1[2][i]);
+			glm::vec3 e2(tris.edge2[0][i], tris.edge2[1][i], tris.edge2[2][i]);
+			bounds.Extend(v0);
+			bounds.Extend(v0 + e1);
+			bounds.Extend(v0 + e2);
+		}
+		return true;
+	}
+
+	bool BVH::RefitNodes(const std::vector<const glm::mat4*>& moved, std::unordered_set<const AccelerationStructure*>& changed)
+	{
+		// Quantized bounds are relative to boxes that are not kept
+		if (m_qnodes4 || m_qnodes8)
+			return false;
+		if (m_shapes.empty())
+			return true;
+
+		// Primitives of the moved objects and instances of the moved or changed meshes, their world
+		// space triangles are updated here
+		auto isMoved = [&](const glm::mat4* transform) {
+			return std::find(moved.begin(), moved.end(), transform) != moved.end();
+		};
+		int n = (int)m_shapes.size();
+		std::vector<uint8_t> movedPrims(n, 0);
+		std::atomic<int> nMoved{ 0 };
+		ThreadPool::GetInstance()->ParallelFor(n, [&](int i) {
+			Shape* shape = m_shapes[i].get();
+			bool isDirty = isMoved(shape->m_transform);
+			if (shape->m_shape_type == SHAPE_T::instance) {
+				MeshInstance* instance = static_cast<MeshInstance*>(shape);
+				isDirty = isDirty || isMoved(instance->GetBaseTransform()) ||
+					changed.count(instance->GetAccelerationStructure().get());
+				if (isDirty)
+					instance->UpdateTransforms();
+			}
+			if (!isDirty)
+				return;
+			movedPrims[i] = 1;
+			nMoved++;
+			SetWorldTriangle(i);
+		}, 4096);
+		if (nMoved == 0)
+			return true;
+
+		// Cost of the tree as built, before the first refit changes its bounds
+		if (m_refit_base_cost < 0.0f)
+			m_refit_base_cost = NodeSAHCost();
+
+		// Children are stored after their parents in every layout, so a reverse pass sees a node after all of its children
+		if (m_nodes) {
+			int slots = m_options.clustered_layout ? m_total_nodes + 1 : m_total_nodes;
+			std::vector<uint8_t> refit(slots, 0);
+			for (int i = slots - 1; i >= 0; i--) {
+				//The clustered layout has an empty slot after the root
+				if (m_options.clustered_layout && i == 1)
+					continue;
+				LinearBVHNode& node = m_nodes[i];
+				if (node.nPrimitives > 0) {
+					if (!RangeBounds(m_shapes, m_triangles, movedPrims, node.primitives_offset, node.nPrimitives, node.bounds))
+						continue;
+					node.leaf_flags = LeafFlags(m_triangles, node.primitives_offset, node.nPrimitives);
+				}
+				else {
+					int first = m_options.clustered_layout ? node.first_child_offset : i + 1;
+					int second = m_options.clustered_layout ? first + 1 : node.second_child_offset;
+					if (!refit[first] && !refit[second])
+						continue;
+					node.bounds = Bounds3::Extend(m_nodes[first].bounds, m_nodes[second].bounds);
+				}
+				refit[i] = 1;
+			}
+			m_bounds = m_nodes[0].bounds;
+		}
+		else if (m_nodes8)
+			RefitWideNodes(m_nodes8, movedPrims);
+		else
+			RefitWideNodes(m_nodes4, movedPrims);
+
+		m_triangles.count = 0;
+		for (const Triangle* tri : m_triangles.triangles)
+			m_triangles.count += tri ? 1 : 0;
+		// The moved objects may have started or stopped moving too
+		BuildMotionBounds();
+		changed.insert(this);
+		m_refit_cost = NodeSAHCost();
+		return m_refit_cost <= m_refit_base_cost * MAX_REFIT_COST_GROWTH;
+	}
+
+	template <int N>
+	void BVH::RefitWideNodes(WideBVHNode<N>* nodes, const std::vector<uint8_t>& movedPrims)
+	{
+		std::vector<uint8_t> refit(m_total_nodes, 0);
+		for (int i = m_total_nodes - 1; i >= 0; i--) {
+			WideBVHNode<N>& node = nodes[i];
+			for (int c = 0; c < node.n_children; c++) {
+				Bounds3 b;
+				if (node.n_primitives[c] > 0) {
+					if (!RangeBounds(m_shapes, m_triangles, movedPrims, node.child[c], node.n_primitives[c], b))
+						continue;
+					node.leaf_flags[c] = LeafFlags(m_triangles, node.child[c], node.n_primitives[c]);
+				}
+				else {
+					if (!refit[node.child[c]])
+						continue;
+					b = WideNodeBounds(nodes[node.child[c]]);
+				}
+				for (int k = 0; k < 3; k++) {
+					node.bounds[k][c] = b.min[k];
+					node.bounds[k + 3][c] = b.max[k];
+				}
+				refit[i] = 1;
+			}
+		}
+		m_bounds = WideNodeBounds(nodes[0]);
+	}
+
+	float BVH::NodeSAHCost() const
+	{
+		// Traversal steps cost 1, leaves LeafCost, both weighted by their area relative to the root's
+		float cost = 0.0f;
+		float rootArea = m_bounds.GetSurfaceArea();
+		if (m_nodes) {
+			int slots = m_options.clustered_layout ? m_total_nodes + 1 : m_total_nodes;
+			for (int i = 0; i < slots; i++) {
+				if (m_options.clustered_layout && i == 1)
+					continue;
+				const LinearBVHNode& node = m_nodes[i];
+				cost += node.bounds.GetSurfaceArea() * (node.nPrimitives > 0 ? LeafCost(node.nPrimitives) : 1.0f);
+			}
+			rootArea = m_nodes[0].bounds.GetSurfaceArea();
+		}
+		else {
+			auto addWide = [&](const auto* nodes) {
+				rootArea = WideNodeBounds(nodes[0]).GetSurfaceArea();
+				cost += rootArea;
+				for (int i = 0; i < m_total_nodes; i++) {
+					for (int c = 0; c < nodes[i].n_children; c++) {
+						const auto& node = nodes[i];
+						Bounds3 b(glm::vec3(node.bounds[0][c], node.bounds[1][c], node.bounds[2][c]),
+							glm::vec3(node.bounds[3][c], node.bounds[4][c], node.bounds[5][c]));
+						cost += b.GetSurfaceArea() * (nodes[i].n_primitives[c] > 0 ? LeafCost(nodes[i].n_primitives[c]) : 1.0f);
+					}
+				}
+			};
+			if (m_nodes8)
+				addWide(m_nodes8);
+			else
+				addWide(m_nodes4);
+		}
+		return rootArea > 0.0f ? cost / rootArea : 0.0f;
+	}
+
+	void BVH::BuildMotionBounds()
+	{
+		FreeAligned(m_motion_nodes);
+		FreeAligned(m_motion_nodes4);
+		FreeAligned(m_motion_nodes8);
+		m_motion_nodes = nullptr;
+		m_motion_nodes4 = nullptr;
+		m_motion_nodes8 = nullptr;
+		m_moving_prims = 0;
+		for (const auto& shape : m_shapes)
+			m_moving_prims += shape->m_motion ? 1 : 0;
+		// Quantized nodes keep the bounds over the whole shutter
+		if (m_moving_prims == 0 || m_qnodes4 || m_qnodes8)
+			return;
+
+		int n = (int)m_shapes.size();
+		std::vector<LinearBounds> primBounds(n);
+		ThreadPool::GetInstance()->ParallelFor(n, [&](int i) {
+			primBounds[i] = m_shapes[i]->GetMotionBounds();
+		}, 1024);
+		auto rangeBounds = [&](int first, int count) {
+			LinearBounds b;
+			for (int i = first; i < first + count; i++)
+				b.Extend(primBounds[i]);
+			return b;
+		};
+
+		// Children are stored after their parents, a reverse pass sees a node after all of its children
+		if (m_nodes) {
+			int slots = m_options.clustered_layout ? m_total_nodes + 1 : m_total_nodes;
+			m_motion_nodes = AllocAligned<LinearBounds>(slots);
+			for (int i = slots - 1; i >= 0; i--) {
+				const LinearBVHNode& node = m_nodes[i];
+				LinearBounds& b = m_motion_nodes[i];
+				//The clustered layout has an empty slot after the root
+				if (m_options.clustered_layout && i == 1)
+					b = { { node.bounds, node.bounds } };
+				else if (node.nPrimitives > 0)
+					b = rangeBounds(node.primitives_offset, node.nPrimitives);
+				else {
+					int first = m_options.clustered_layout ? node.first_child_offset : i + 1;
+					int second = m_options.clustered_layout ? first + 1 : node.second_child_offset;
+					b = m_motion_nodes[first];
+					b.Extend(m_motion_nodes[second]);
+				}
+			}
+		}
+		else if (m_nodes8)
+			m_motion_nodes8 = BuildWideMotionBounds(m_nodes8, rangeBounds);
+		else
+			m_motion_nodes4 = BuildWideMotionBounds(m_nodes4, rangeBounds);
+	}
+
+	template <int N, typename RangeBounds>
+	WideMotionBounds<N>* BVH::BuildWideMotionBounds(const WideBVHNode<N>* nodes, const RangeBounds& rangeBounds) const
+	{
+		WideMotionBounds<N>* motion = AllocAligned<WideMotionBounds<N>>(m_total_nodes);
+		// Bounds of every node's children together, for the child slots of its parent
+		std::vector<LinearBounds> nodeBounds(m_total_nodes);
+		for (int i = m_total_nodes - 1; i >= 0; i--) {
+			const WideBVHNode<N>& node = nodes[i];
+			// Unused slots are zeroed so their tests stay cheap
+			std::memset(&motion[i], 0, sizeof(motion[i]));
+			for (int c = 0; c < node.n_children; c++) {
+				LinearBounds b = node.n_primitives[c] > 0 ?
+					rangeBounds(node.child[c], node.n_primitives[c]) : nodeBounds[node.child[c]];
+				for (int t = 0; t < 2; t++) {
+					for (int k = 0; k < 3; k++) {
+						motion[i].bounds[t][k][c] = b.bounds[t].min[k];
+						motion[i].bounds[t][k + 3][c] = b.bounds[t].max[k];
+					}
+				}
+				nodeBounds[i].Extend(b);
+			}
+		}
+		return motion;
+	}
+
+	template <int N>
+	inline const WideMotionBounds<N>* BVH::WideMotionNodes() const {
+		if constexpr (N == 8)
+			return m_motion_nodes8;
+		else
+			return m_motion_nodes4;
+	}
+
+	inline Bounds3 BVH::NodeBounds(int index, float time) const {
+		return m_motion_nodes ? m_motion_nodes[index].At(time) : m_nodes[index].bounds;
+	}
+
+	size_t BVH::GetMotionBoundsBytes() const
+	{
+		if (m_motion_nodes)
+			return (m_options.clustered_layout ? m_total_nodes + 1 : m_total_nodes) * sizeof(LinearBounds);
+		if (m_motion_nodes8)
+			return m_total_nodes * sizeof(WideMotionBounds<8>);
+		if (m_motion_nodes4)
+			return m_total_nodes * sizeof(WideMotionBounds<4>);
+		return 0;
 	}
 
 	struct BucketInfo {
 		int count = 0;
-		Bounds3 bounds;
+		Bounds3 bounds, centroid_bounds;
 	};
 
+	// Ranges at least this large are reduced and binned over chunks in parallel
+	static constexpr int PARALLEL_REDUCE_MIN = 64 * 1024;
+	static constexpr int PARALLEL_REDUCE_CHUNK = 16 * 1024;
+	// Nodes with at least this many primitives build their children as separate tasks
+	static constexpr int PARALLEL_SUBTREE_MIN = 4 * 1024;
+
+	static int ReduceChunkCount(int nPrimitives) {
+		return nPrimitives >= PARALLEL_REDUCE_MIN ?
+			(nPrimitives + PARALLEL_REDUCE_CHUNK - 1) / PARALLEL_REDUCE_CHUNK : 1;
+	}
+
+	static void ComputeRangeBounds(const std::vector<BVHPrimitiveInfo>& primitiveInfo, int start, int end,
+		Bounds3& bounds, Bounds3& centroidBounds) {
+		auto reduce = [&](int begin, int finish, Bounds3& b, Bounds3& cb) {
+			for (int i = begin; i < finish; ++i) {
+				b.Extend(primitiveInfo[i].bounds);
+				cb.Extend(primitiveInfo[i].centroid);
+			}
+		};
+		int nChunks = ReduceChunkCount(end - start);
+		if (nChunks == 1) {
+			reduce(start, end, bounds, centroidBounds);
+			return;
+		}
+		std::vector<Bounds3> chunkBounds(nChunks), chunkCentroidBounds(nChunks);
+		ThreadPool::GetInstance()->ParallelFor(nChunks, [&](int c) {
+			int begin = start + c * PARALLEL_REDUCE_CHUNK;
+			reduce(begin, std::min(end, begin + PARALLEL_REDUCE_CHUNK), chunkBounds[c], chunkCentroidBounds[c]);
+		});
+		for (int c = 0; c < nChunks; c++) {
+			bounds.Extend(chunkBounds[c]);
+			centroidBounds.Extend(chunkCentroidBounds[c]);
+		}
+	}
+
 	BVHBuildNode* BVH::RecursiveBuild(
-		MemoryArena& arena, std::vector<BVHPrimitiveInfo>& primitiveInfo, int start,
-		int end, int* totalNodes,
-		std::vector<std::shared_ptr<Shape>>& orderedPrims) {
+		std::vector<std::unique_ptr<MemoryArena>>& arenas, std::vector<BVHPrimitiveInfo>& primitiveInfo,
+		int start, int end, std::atomic<int>* totalNodes,
+		std::vector<std::shared_ptr<Shape>>& orderedPrims,
+		const Bounds3* rangeBounds, const Bounds3* rangeCentroidBounds) {
 		//CHECK_NE(start, end);
+		// Workers only allocate from their own arena, threads outside the pool share the first one
+		MemoryArena& arena = *arenas[ThreadPool::GetWorkerIndex() + 1];
 		BVHBuildNode* node = arena.Alloc<BVHBuildNode>();
 		(*totalNodes)++;
-		// Compute bounds of all primitives in BVH node
-		Bounds3 bounds;
-		for (int i = start; i < end; ++i)
-			bounds.Extend(primitiveInfo[i].bounds);
+		// A leaf keeps the primitives of its range where they are, so subtrees built in parallel
+		// fill disjoint parts of _orderedPrims_
+		auto initLeaf = [&](const Bounds3& leafBounds) {
+			for (int i = start; i < end; ++i)
+				orderedPrims[i] = m_shapes[primitiveInfo[i].primitiveNumber];
+			node->InitLeaf(start, end - start, leafBounds);
+			return node;
+		};
+		// Compute bounds of all primitives in BVH node and of their centroids,
+		// an SAH split passes both down from its buckets
+		Bounds3 bounds, centroidBounds;
+		if (rangeBounds) {
+			bounds = *rangeBounds;
+			centroidBounds = *rangeCentroidBounds;
+		}
+		else
+			ComputeRangeBounds(primitiveInfo, start, end, bounds, centroidBounds);
 		int nPrimitives = end - start;
 		if (nPrimitives == 1) {
 			// Create leaf _BVHBuildNode_
-			int firstPrimOffset = orderedPrims.size();
-			for (int i = start; i < end; ++i) {
-				int primNum = primitiveInfo[i].primitiveNumber;
-				orderedPrims.push_back(m_shapes[primNum]);
-			}
-			node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
-			return node;
+			return initLeaf(bounds);
 		}
 		else {
-			// Compute bound of primitive centroids, choose split dimension _dim_
-			Bounds3 centroidBounds;
-			for (int i = start; i < end; ++i)
-				centroidBounds.Extend(primitiveInfo[i].centroid);
+			// Choose split dimension _dim_
 			int dim = centroidBounds.MaxExtent();
 
 			// Partition primitives into two sets and build children
 			int mid = (start + end) / 2;
+			Bounds3 childBounds[2], childCentroidBounds[2];
+			bool childBoundsKnown = false;
 			if (centroidBounds.max[dim] == centroidBounds.min[dim]) {
 				// Create leaf _BVHBuildNode_
-				int firstPrimOffset = orderedPrims.size();
-				for (int i = start; i < end; ++i) {
-					int primNum = primitiveInfo[i].primitiveNumber;
-					orderedPrims.push_back(m_shapes[primNum]);
-				}
-				node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
-				return node;
+				return initLeaf(bounds);
 			}
 			else {
 				// Partition primitives based on _splitMethod_
-				switch (m_split_method) {
+				switch (m_options.split_method) {
 				case SplitMethod::Middle: {
 					// Partition primitives through node's midpoint
 					float pmid =
@@ -303,39 +1017,68 @@ namespace CHR
 					}
 					else {
 						// Allocate _BucketInfo_ for SAH partition buckets
-						constexpr int nBuckets = 12;
-						BucketInfo buckets[nBuckets];
-
-						// Initialize _BucketInfo_ for SAH partition buckets
-						for (int i = start; i < end; ++i) {
-							int b = nBuckets *
-								centroidBounds.Offset(
-									primitiveInfo[i].centroid)[dim];
+						const int nBuckets = m_options.sah_buckets;
+						BucketInfo buckets[MAX_SAH_BUCKETS];
+						// Same value as centroidBounds.Offset(pi.centroid)[dim], without the other two axes
+						const float dimMin = centroidBounds.min[dim];
+						const float dimExtent = centroidBounds.max[dim] - centroidBounds.min[dim];
+						auto bucketIndex = [=](const BVHPrimitiveInfo& pi) {
+							int b = nBuckets * ((pi.centroid[dim] - dimMin) / dimExtent);
 							if (b == nBuckets) b = nBuckets - 1;
 							//CHECK_GE(b, 0);
 							//CHECK_LT(b, nBuckets);
-							buckets[b].count++;
-							buckets[b].bounds.Extend(primitiveInfo[i].bounds);
+							return b;
+						};
+
+						// Initialize _BucketInfo_ for SAH partition buckets,
+						// large ranges are binned per chunk and merged
+						auto bin = [&](int begin, int finish, BucketInfo* out) {
+							for (int i = begin; i < finish; ++i) {
+								int b = bucketIndex(primitiveInfo[i]);
+								out[b].count++;
+								out[b].bounds.Extend(primitiveInfo[i].bounds);
+								out[b].centroid_bounds.Extend(primitiveInfo[i].centroid);
+							}
+						};
+						int nChunks = ReduceChunkCount(nPrimitives);
+						if (nChunks == 1)
+							bin(start, end, buckets);
+						else {
+							std::vector<BucketInfo> chunkBuckets(nChunks * nBuckets);
+							ThreadPool::GetInstance()->ParallelFor(nChunks, [&](int c) {
+								int begin = start + c * PARALLEL_REDUCE_CHUNK;
+								bin(begin, std::min(end, begin + PARALLEL_REDUCE_CHUNK), &chunkBuckets[c * nBuckets]);
+							});
+							for (int c = 0; c < nChunks; c++) {
+								for (int b = 0; b < nBuckets; b++) {
+									const BucketInfo& chunk = chunkBuckets[c * nBuckets + b];
+									buckets[b].count += chunk.count;
+									buckets[b].bounds.Extend(chunk.bounds);
+									buckets[b].centroid_bounds.Extend(chunk.centroid_bounds);
+								}
+							}
 						}
 
-						// Compute costs for splitting after each bucket
-						float cost[nBuckets - 1];
+						// Compute costs for splitting after each bucket, a prefix sweep
+						// adds the side below the split and a suffix sweep the side above
+						float cost[MAX_SAH_BUCKETS - 1];
+						Bounds3 boundsBelow[MAX_SAH_BUCKETS - 1], boundsAbove[MAX_SAH_BUCKETS - 1];
+						Bounds3 b0, b1;
+						int count0 = 0, count1 = 0;
 						for (int i = 0; i < nBuckets - 1; ++i) {
-							Bounds3 b0, b1;
-							int count0 = 0, count1 = 0;
-							for (int j = 0; j <= i; ++j) {
-								b0.Extend(buckets[j].bounds);
-								count0 += buckets[j].count;
-							}
-							for (int j = i + 1; j < nBuckets; ++j) {
-								b1.Extend(buckets[j].bounds);
-								count1 += buckets[j].count;
-							}
-							cost[i] = 1 +
-								(count0 * b0.GetSurfaceArea() +
-									count1 * b1.GetSurfaceArea()) /
-								bounds.GetSurfaceArea();
+							b0.Extend(buckets[i].bounds);
+							count0 += buckets[i].count;
+							boundsBelow[i] = b0;
+							cost[i] = LeafCost(count0) * b0.GetSurfaceArea();
 						}
+						for (int i = nBuckets - 2; i >= 0; --i) {
+							b1.Extend(buckets[i + 1].bounds);
+							count1 += buckets[i + 1].count;
+							boundsAbove[i] = b1;
+							cost[i] += LeafCost(count1) * b1.GetSurfaceArea();
+						}
+						for (int i = 0; i < nBuckets - 1; ++i)
+							cost[i] = 1 + cost[i] / bounds.GetSurfaceArea();
 
 						// Find bucket to split at that minimizes SAH metric
 						float minCost = cost[0];
@@ -349,111 +1092,467 @@ namespace CHR
 
 						// Either create leaf or split primitives at selected SAH
 						// bucket
-						float leafCost = nPrimitives;
-						if (nPrimitives > m_max_prims_in_node || minCost < leafCost) {
+						float leafCost = LeafCost(nPrimitives);
+						if (nPrimitives > m_options.max_prims_in_node || minCost < leafCost) {
 							BVHPrimitiveInfo* pmid = std::partition(
 								&primitiveInfo[start], &primitiveInfo[end - 1] + 1,
 								[=](const BVHPrimitiveInfo& pi) {
-								int b = nBuckets *
-									centroidBounds.Offset(pi.centroid)[dim];
-								if (b == nBuckets) b = nBuckets - 1;
-								//CHECK_GE(b, 0);
-								//CHECK_LT(b, nBuckets);
-								return b <= minCostSplitBucket;
+								return bucketIndex(pi) <= minCostSplitBucket;
 							});
 							mid = pmid - &primitiveInfo[0];
+							// The children's bounds are their buckets' bounds
+							childBounds[0] = boundsBelow[minCostSplitBucket];
+							childBounds[1] = boundsAbove[minCostSplitBucket];
+							for (int i = 0; i < nBuckets; ++i)
+								childCentroidBounds[i <= minCostSplitBucket ? 0 : 1].Extend(buckets[i].centroid_bounds);
+							childBoundsKnown = true;
 						}
 						else {
 							// Create leaf _BVHBuildNode_
-							int firstPrimOffset = orderedPrims.size();
-							for (int i = start; i < end; ++i) {
-								int primNum = primitiveInfo[i].primitiveNumber;
-								orderedPrims.push_back(m_shapes[primNum]);
-							}
-							node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
-							return node;
+							return initLeaf(bounds);
 						}
 					}
 					break;
 				}
 				}
-				node->InitInterior(dim,
-					RecursiveBuild(arena, primitiveInfo, start, mid,
-						totalNodes, orderedPrims),
-					RecursiveBuild(arena, primitiveInfo, mid, end,
-						totalNodes, orderedPrims));
+				// Large nodes build their first child as a task, the waiting thread
+				// runs pending build tasks until it is done
+				const Bounds3* c0Bounds = childBoundsKnown ? &childBounds[0] : nullptr;
+				const Bounds3* c1Bounds = childBoundsKnown ? &childBounds[1] : nullptr;
+				const Bounds3* c0CentroidBounds = childBoundsKnown ? &childCentroidBounds[0] : nullptr;
+				const Bounds3* c1CentroidBounds = childBoundsKnown ? &childCentroidBounds[1] : nullptr;
+				BVHBuildNode* children[2];
+				if (nPrimitives >= PARALLEL_SUBTREE_MIN) {
+					ThreadPool::TaskGroup group;
+					ThreadPool::GetInstance()->Submit([&]() {
+						children[0] = RecursiveBuild(arenas, primitiveInfo, start, mid,
+							totalNodes, orderedPrims, c0Bounds, c0CentroidBounds);
+					}, &group);
+					children[1] = RecursiveBuild(arenas, primitiveInfo, mid, end,
+						totalNodes, orderedPrims, c1Bounds, c1CentroidBounds);
+					ThreadPool::GetInstance()->Wait(group);
+				}
+				else {
+					children[0] = RecursiveBuild(arenas, primitiveInfo, start, mid,
+						totalNodes, orderedPrims, c0Bounds, c0CentroidBounds);
+					children[1] = RecursiveBuild(arenas, primitiveInfo, mid, end,
+						totalNodes, orderedPrims, c1Bounds, c1CentroidBounds);
+				}
+				node->InitInterior(dim, children[0], children[1]);
+			}
+		}
+		return node;
+	}
+
+	// Spatial splits stop at this depth, below it duplicates could only pile up in ever thinner slabs
+	static constexpr int SBVH_MAX_DEPTH = 48;
+	// Overlap of an object split's children, relative to the root's area, above which spatial
+	// splits are tried
+	static constexpr float SBVH_MIN_OVERLAP = 1e-5f;
+
+	struct SBVHContext {
+		std::vector<std::unique_ptr<MemoryArena>>* arenas;
+		// World space corners of the triangles a spatial split may divide, 3 per shape. Other shapes,
+		// instances above all, cost too much to test more than once and always stay whole
+		std::vector<glm::vec3> corners;
+		std::vector<uint8_t> splittable;
+		// Spatial splits are only tried where the best object split's children overlap more than this area
+		float min_overlap;
+		std::atomic<int> total_nodes{ 0 };
+		std::atomic<int> total_refs{ 0 };
+	};
+
+	static bool IsEmpty(const Bounds3& b) {
+		return b.min.x > b.max.x || b.min.y > b.max.y || b.min.z > b.max.z;
+	}
+
+	// Bounds of the part of a triangle reference between lo and hi along axis: the corners inside
+	// the slab and the points where the edges cross its planes, within the reference's bounds.
+	// Empty when nothing is left
+	static Bounds3 ClipReference(const SBVHContext& ctx, const BVHPrimitiveInfo& ref, int axis, float lo, float hi) {
+		const glm::vec3* v = &ctx.corners[3 * ref.primitiveNumber];
+		Bounds3 clipped;
+		for (int i = 0; i < 3; i++) {
+			const glm::vec3& v0 = v[i];
+			const glm::vec3& v1 = v[(i + 1) % 3];
+			float p0 = v0[axis], p1 = v1[axis];
+			if (p0 >= lo && p0 <= hi)
+				clipped.Extend(v0);
+			for (float plane : { lo, hi }) {
+				if ((p0 < plane && plane < p1) || (p1 < plane && plane < p0)) {
+					glm::vec3 p = glm::mix(v0, v1, (plane - p0) / (p1 - p0));
+					p[axis] = plane;
+					clipped.Extend(p);
+				}
+			}
+		}
+		Bounds3 b;
+		b.min = glm::max(ref.bounds.min, clipped.min);
+		b.max = glm::min(ref.bounds.max, clipped.max);
+		b.min[axis] = std::max(b.min[axis], lo);
+		b.max[axis] = std::min(b.max[axis], hi);
+		return b;
+	}
+
+	BVHBuildNode* BVH::SBVHRecursiveBuild(SBVHContext& ctx, std::vector<BVHPrimitiveInfo>& refs,
+		const Bounds3& bounds, int budget, int depth) {
+		MemoryArena& arena = *(*ctx.arenas)[ThreadPool::GetWorkerIndex() + 1];
+		BVHBuildNode* node = arena.Alloc<BVHBuildNode>();
+		ctx.total_nodes++;
+		int nRefs = (int)refs.size();
+		// Leaves keep their primitive numbers until LayoutSBVHLeaves gives them their range
+		// of the ordered primitives
+		auto initLeaf = [&]() {
+			int* prims = arena.Alloc<int>(nRefs, false);
+			for (int i = 0; i < nRefs; ++i)
+				prims[i] = (int)refs[i].primitiveNumber;
+			node->InitLeaf(0, nRefs, bounds);
+			node->sbvh_prims = prims;
+			ctx.total_refs += nRefs;
+			return node;
+		};
+		if (nRefs == 1)
+			return initLeaf();
+
+		struct Split {
+			float cost = INFINITY;
+			int axis = -1, bucket = 0;
+		};
+		const int nBuckets = m_options.sah_buckets;
+		const float invArea = 1 / bounds.GetSurfaceArea();
+		// Large nodes bin the three axes in parallel, the best split is picked in axis order
+		auto forAxes = [&](const std::function<void(int)>& func) {
+			if (nRefs >= PARALLEL_REDUCE_MIN)
+				ThreadPool::GetInstance()->ParallelFor(3, func);
+			else
+				for (int axis = 0; axis < 3; ++axis)
+					func(axis);
+		};
+
+		// Find the best object split over all three axes
+		Bounds3 centroidBounds;
+		for (const BVHPrimitiveInfo& ref : refs)
+			centroidBounds.Extend(ref.centroid);
+		auto bucketIndex = [&](const BVHPrimitiveInfo& ref, int axis) {
+			int b = nBuckets * centroidBounds.Offset(ref.centroid)[axis];
+			return std::min(b, nBuckets - 1);
+		};
+		Split objectSplits[3];
+		Bounds3 objectBounds[3][2];
+		forAxes([&](int axis) {
+			if (centroidBounds.max[axis] == centroidBounds.min[axis])
+				return;
+			BucketInfo buckets[MAX_SAH_BUCKETS];
+			for (const BVHPrimitiveInfo& ref : refs) {
+				int b = bucketIndex(ref, axis);
+				buckets[b].count++;
+				buckets[b].bounds.Extend(ref.bounds);
+			}
+			Bounds3 boundsBelow[MAX_SAH_BUCKETS - 1], b0, b1;
+			int countBelow[MAX_SAH_BUCKETS - 1], count0 = 0, count1 = 0;
+			for (int i = 0; i < nBuckets - 1; ++i) {
+				b0.Extend(buckets[i].bounds);
+				count0 += buckets[i].count;
+				boundsBelow[i] = b0;
+				countBelow[i] = count0;
+			}
+			for (int i = nBuckets - 2; i >= 0; --i) {
+				b1.Extend(buckets[i + 1].bounds);
+				count1 += buckets[i + 1].count;
+				if (countBelow[i] == 0 || count1 == 0)
+					continue;
+				float cost = 1 + (LeafCost(countBelow[i]) * boundsBelow[i].GetSurfaceArea() +
+					LeafCost(count1) * b1.GetSurfaceArea()) * invArea;
+				if (cost < objectSplits[axis].cost) {
+					objectSplits[axis] = { cost, axis, i };
+					objectBounds[axis][0] = boundsBelow[i];
+					objectBounds[axis][1] = b1;
+				}
+			}
+		});
+		int bestAxis = 0;
+		for (int axis = 1; axis < 3; ++axis)
+			if (objectSplits[axis].cost < objectSplits[bestAxis].cost)
+				bestAxis = axis;
+		const Split& objectSplit = objectSplits[bestAxis];
+
+		// Try spatial splits where the object split leaves overlapping children, each reference
+		// is clipped to every bin it spans and counted where it enters and exits
+		Split spatialSplits[3];
+		bool overlapping = objectSplit.axis < 0;
+		if (!overlapping) {
+			Bounds3 overlap;
+			overlap.min = glm::max(objectBounds[bestAxis][0].min, objectBounds[bestAxis][1].min);
+			overlap.max = glm::min(objectBounds[bestAxis][0].max, objectBounds[bestAxis][1].max);
+			overlapping = !IsEmpty(overlap) && overlap.GetSurfaceArea() > ctx.min_overlap;
+		}
+		float binWidth[3];
+		auto binIndex = [&](float p, int axis) {
+			int b = (int)((p - bounds.min[axis]) / binWidth[axis]);
+			return std::max(0, std::min(b, nBuckets - 1));
+		};
+		auto binPlane = [&](int b, int axis) {
+			return b == nBuckets ? bounds.max[axis] : bounds.min[axis] + b * binWidth[axis];
+		};
+		// First and last bin a reference spans, shapes that are never split fall in the bin of their centroid
+		auto binRange = [&](const BVHPrimitiveInfo& ref, int axis, int* first, int* last) {
+			if (ctx.splittable[ref.primitiveNumber]) {
+				*first = binIndex(ref.bounds.min[axis], axis);
+				*last = binIndex(ref.bounds.max[axis], axis);
+			}
+			else
+				*first = *last = binIndex(ref.centroid[axis], axis);
+		};
+		if (overlapping && budget > 0 && depth < SBVH_MAX_DEPTH) {
+			for (int axis = 0; axis < 3; ++axis)
+				binWidth[axis] = (bounds.max[axis] - bounds.min[axis]) / nBuckets;
+			forAxes([&](int axis) {
+				if (!(binWidth[axis] > 0))
+					return;
+				Bounds3 bins[MAX_SAH_BUCKETS];
+				int enter[MAX_SAH_BUCKETS] = {}, exit[MAX_SAH_BUCKETS] = {};
+				for (const BVHPrimitiveInfo& ref : refs) {
+					int first, last;
+					binRange(ref, axis, &first, &last);
+					if (first == last)
+						bins[first].Extend(ref.bounds);
+					else {
+						for (int b = first; b <= last; ++b) {
+							Bounds3 clipped = ClipReference(ctx, ref, axis, binPlane(b, axis), binPlane(b + 1, axis));
+							if (!IsEmpty(clipped))
+								bins[b].Extend(clipped);
+						}
+					}
+					enter[first]++;
+					exit[last]++;
+				}
+				Bounds3 boundsBelow[MAX_SAH_BUCKETS - 1], b0, b1;
+				int countBelow[MAX_SAH_BUCKETS - 1], count0 = 0, count1 = 0;
+				for (int i = 0; i < nBuckets - 1; ++i) {
+					b0.Extend(bins[i]);
+					count0 += enter[i];
+					boundsBelow[i] = b0;
+					countBelow[i] = count0;
+				}
+				for (int i = nBuckets - 2; i >= 0; --i) {
+					b1.Extend(bins[i + 1]);
+					count1 += exit[i + 1];
+					if (countBelow[i] == 0 || count1 == 0)
+						continue;
+					float cost = 1 + (LeafCost(countBelow[i]) * boundsBelow[i].GetSurfaceArea() +
+						LeafCost(count1) * b1.GetSurfaceArea()) * invArea;
+					if (cost < spatialSplits[axis].cost)
+						spatialSplits[axis] = { cost, axis, i };
+				}
+			});
+		}
+		Split spatialSplit;
+		for (int axis = 0; axis < 3; ++axis)
+			if (spatialSplits[axis].cost < spatialSplit.cost)
+				spatialSplit = spatialSplits[axis];
+
+		// Either create leaf or split the references with the cheaper split
+		float minCost = std::min(objectSplit.cost, spatialSplit.cost);
+		if (minCost == INFINITY || (nRefs <= m_options.max_prims_in_node && minCost >= LeafCost(nRefs)))
+			return initLeaf();
+
+		std::vector<BVHPrimitiveInfo> childRefs[2];
+		Bounds3 childBounds[2];
+		auto add = [&](int side, const BVHPrimitiveInfo& ref) {
+			childRefs[side].push_back(ref);
+			childBounds[side].Extend(ref.bounds);
+		};
+		int axis = objectSplit.axis;
+		if (spatialSplit.cost < objectSplit.cost) {
+			axis = spatialSplit.axis;
+			float plane = binPlane(spatialSplit.bucket + 1, axis);
+			std::vector<const BVHPrimitiveInfo*> straddling;
+			for (const BVHPrimitiveInfo& ref : refs) {
+				int first, last;
+				binRange(ref, axis, &first, &last);
+				if (last <= spatialSplit.bucket)
+					add(0, ref);
+				else if (first > spatialSplit.bucket)
+					add(1, ref);
+				else
+					straddling.push_back(&ref);
+			}
+			// A straddling reference is duplicated unless moving it whole to one side is cheaper,
+			// or the budget of duplicates is used up
+			int duplicates = 0;
+			for (const BVHPrimitiveInfo* ref : straddling) {
+				Bounds3 clipped[2] = {
+					ClipReference(ctx, *ref, axis, -INFINITY, plane),
+					ClipReference(ctx, *ref, axis, plane, INFINITY) };
+				int n0 = (int)childRefs[0].size(), n1 = (int)childRefs[1].size();
+				float costWhole[2] = {
+					Bounds3::Extend(childBounds[0], ref->bounds).GetSurfaceArea() * LeafCost(n0 + 1) +
+					childBounds[1].GetSurfaceArea() * LeafCost(n1),
+					childBounds[0].GetSurfaceArea() * LeafCost(n0) +
+					Bounds3::Extend(childBounds[1], ref->bounds).GetSurfaceArea() * LeafCost(n1 + 1) };
+				int whole = costWhole[0] <= costWhole[1] ? 0 : 1;
+				if (IsEmpty(clipped[0]) || IsEmpty(clipped[1]))
+					add(IsEmpty(clipped[0]) ? 1 : 0, *ref);
+				else if (duplicates >= budget)
+					add(whole, *ref);
+				else {
+					float costSplit =
+						Bounds3::Extend(childBounds[0], clipped[0]).GetSurfaceArea() * LeafCost(n0 + 1) +
+						Bounds3::Extend(childBounds[1], clipped[1]).GetSurfaceArea() * LeafCost(n1 + 1);
+					if (costSplit < costWhole[whole]) {
+						add(0, BVHPrimitiveInfo(ref->primitiveNumber, clipped[0]));
+						add(1, BVHPrimitiveInfo(ref->primitiveNumber, clipped[1]));
+						duplicates++;
+					}
+					else
+						add(whole, *ref);
+				}
 			}
 		}
+		if (childRefs[0].empty() || childRefs[1].empty()) {
+			// Spatial split with every reference on one side, use the object split
+			if (objectSplit.axis < 0)
+				return initLeaf();
+			axis = objectSplit.axis;
+			for (int side = 0; side < 2; ++side) {
+				childRefs[side].clear();
+				childBounds[side] = Bounds3();
+			}
+		}
+		if (childRefs[0].empty()) {
+			for (const BVHPrimitiveInfo& ref : refs)
+				add(bucketIndex(ref, axis) <= objectSplit.bucket ? 0 : 1, ref);
+		}
+		std::vector<BVHPrimitiveInfo>().swap(refs);
+
+		// The children share what is left of the budget by their reference counts
+		int n0 = (int)childRefs[0].size(), n1 = (int)childRefs[1].size();
+		int remaining = std::max(0, budget - (n0 + n1 - nRefs));
+		int budget0 = (int)((int64_t)remaining * n0 / (n0 + n1));
+		BVHBuildNode* children[2];
+		if (nRefs >= PARALLEL_SUBTREE_MIN) {
+			ThreadPool::TaskGroup group;
+			ThreadPool::GetInstance()->Submit([&]() {
+				children[0] = SBVHRecursiveBuild(ctx, childRefs[0], childBounds[0], budget0, depth + 1);
+			}, &group);
+			children[1] = SBVHRecursiveBuild(ctx, childRefs[1], childBounds[1], remaining - budget0, depth + 1);
+			ThreadPool::GetInstance()->Wait(group);
+		}
+		else {
+			children[0] = SBVHRecursiveBuild(ctx, childRefs[0], childBounds[0], budget0, depth + 1);
+			children[1] = SBVHRecursiveBuild(ctx, childRefs[1], childBounds[1], remaining - budget0, depth + 1);
+		}
+		node->InitInterior(axis, children[0], children[1]);
 		return node;
 	}
 
+	// Gives the SBVH leaves their ranges of _orderedPrims_ in the depth first order the
+	// tree is flattened in
+	static void LayoutSBVHLeaves(BVHBuildNode* node, const std::vector<std::shared_ptr<Shape>>& shapes,
+		std::vector<std::shared_ptr<Shape>>& orderedPrims) {
+		if (node->n_primitives > 0) {
+			node->first_prim_offset = (int)orderedPrims.size();
+			for (int i = 0; i < node->n_primitives; ++i)
+				orderedPrims.push_back(shapes[node->sbvh_prims[i]]);
+			return;
+		}
+		LayoutSBVHLeaves(node->children[0], shapes, orderedPrims);
+		LayoutSBVHLeaves(node->children[1], shapes, orderedPrims);
+	}
+
+	BVHBuildNode* BVH::SBVHBuild(
+		std::vector<std::unique_ptr<MemoryArena>>& arenas, std::vector<BVHPrimitiveInfo>& primitiveInfo,
+		std::atomic<int>* totalNodes,
+		std::vector<std::shared_ptr<Shape>>& orderedPrims) {
+		SBVHContext ctx;
+		ctx.arenas = &arenas;
+		ctx.corners.resize(3 * m_shapes.size());
+		ctx.splittable.resize(m_shapes.size(), 0);
+		ThreadPool::GetInstance()->ParallelFor((int)m_shapes.size(), [&](int i) {
+			const Triangle* tri = dynamic_cast<const Triangle*>(m_shapes[i].get());
+			if (!tri || !tri->m_transform || tri->m_motion)
+				return;
+			for (int k = 0; k < 3; k++)
+				ctx.corners[3 * i + k] = *tri->m_transform * glm::vec4(tri->Vertex(k), 1.0f);
+			ctx.splittable[i] = 1;
+		}, 4096);
+
+		Bounds3 bounds, centroidBounds;
+		ComputeRangeBounds(primitiveInfo, 0, (int)primitiveInfo.size(), bounds, centroidBounds);
+		ctx.min_overlap = SBVH_MIN_OVERLAP * bounds.GetSurfaceArea();
+		int budget = (int)std::min(m_options.sbvh_budget * m_shapes.size(), (float)(INT_MAX / 2));
+		BVHBuildNode* root = SBVHRecursiveBuild(ctx, primitiveInfo, bounds, budget, 0);
+		*totalNodes = ctx.total_nodes.load();
+
+		// Duplicated references make the ordered primitives longer than _m_shapes_
+		orderedPrims.clear();
+		orderedPrims.reserve(ctx.total_refs);
+		LayoutSBVHLeaves(root, m_shapes, orderedPrims);
+		CH_TRACE("SBVH references: " + std::to_string(orderedPrims.size()) + " for " +
+			std::to_string(m_shapes.size()) + " primitives");
+		return root;
+	}
+
 	BVHBuildNode* BVH::HLBVHBuild(
-		MemoryArena& arena, const std::vector<BVHPrimitiveInfo>& primitiveInfo,
-		int* totalNodes,
+		std::vector<std::unique_ptr<MemoryArena>>& arenas, const std::vector<BVHPrimitiveInfo>& primitiveInfo,
+		std::atomic<int>* totalNodes,
 		std::vector<std::shared_ptr<Shape>>& orderedPrims) const {
 		// Compute bounding box of all primitive centroids
-		Bounds3 bounds;
-		for (const BVHPrimitiveInfo& pi : primitiveInfo)
-			bounds.Extend(pi.centroid);
+		Bounds3 bounds, primBounds;
+		ComputeRangeBounds(primitiveInfo, 0, (int)primitiveInfo.size(), primBounds, bounds);
 
 		// Compute Morton indices of primitives
 		std::vector<MortonPrimitive> mortonPrims(primitiveInfo.size());
-		for (int i = 0; i < primitiveInfo.size(); i++) {
+		ThreadPool::GetInstance()->ParallelFor((int)primitiveInfo.size(), [&](int i) {
 			// Initialize _mortonPrims[i]_ for _i_th primitive
-			constexpr int mortonBits = 10;
+			constexpr int mortonBits = 21;
 			constexpr int mortonScale = 1 << mortonBits;
 			mortonPrims[i].primitiveIndex = primitiveInfo[i].primitiveNumber;
 			glm::vec3 centroidOffset = bounds.Offset(primitiveInfo[i].centroid);
 			mortonPrims[i].mortonCode = EncodeMorton3(centroidOffset * (float)mortonScale);
-		}//, primitiveInfo.size(), 512);
+		}, 4096);
 
 		// Radix sort primitive Morton indices
 		RadixSort(&mortonPrims);
 
 		// Create LBVH treelets at bottom of BVH
 
-		// Find intervals of primitives for each treelet
+		// Find intervals of primitives for each treelet, split by the top 12 bits of the codes
 		std::vector<LBVHTreelet> treeletsToBuild;
+		constexpr int treeletBits = 12;
+		constexpr uint64_t mask = ((1ull << treeletBits) - 1) << (63 - treeletBits);
 		for (int start = 0, end = 1; end <= (int)mortonPrims.size(); ++end) {
-#ifdef PBRT_HAVE_BINARY_CONSTANTS
-			uint32_t mask = 0b00111111111111000000000000000000;
-#else
-			uint32_t mask = 0x3ffc0000;
-#endif
 			if (end == (int)mortonPrims.size() ||
 				((mortonPrims[start].mortonCode & mask) !=
 				(mortonPrims[end].mortonCode & mask))) {
 				// Add entry to _treeletsToBuild_ for this treelet
 				int nPrimitives = end - start;
 				int maxBVHNodes = 2 * nPrimitives;
-				BVHBuildNode* nodes = arena.Alloc<BVHBuildNode>(maxBVHNodes, false);
+				BVHBuildNode* nodes = arenas[0]->Alloc<BVHBuildNode>(maxBVHNodes, false);
 				treeletsToBuild.push_back({ start, nPrimitives, nodes });
 				start = end;
 			}
 		}
 
 		// Create LBVHs for treelets in parallel
-		std::atomic<int> atomicTotal(0), orderedPrimsOffset(0);
-		orderedPrims.resize(m_shapes.size());
-		for (int i = 0; i < treeletsToBuild.size(); i++) {
+		ThreadPool::GetInstance()->ParallelFor((int)treeletsToBuild.size(), [&](int i) {
 			// Generate _i_th LBVH treelet
 			int nodesCreated = 0;
-			const int firstBitIndex = 29 - 12;
+			const int firstBitIndex = 62 - treeletBits;
 			LBVHTreelet& tr = treeletsToBuild[i];
 			tr.build_nodes =
 				EmitLBVH(tr.build_nodes, primitiveInfo, &mortonPrims[tr.start_index],
 					tr.n_primitives, &nodesCreated, orderedPrims,
-					&orderedPrimsOffset, firstBitIndex);
-			atomicTotal += nodesCreated;
-		}//, treeletsToBuild.size());
-		*totalNodes = atomicTotal;
+					tr.start_index, firstBitIndex);
+			*totalNodes += nodesCreated;
+		});
 
 		// Create and return SAH BVH from LBVH treelets
 		std::vector<BVHBuildNode*> finishedTreelets;
 		finishedTreelets.reserve(treeletsToBuild.size());
 		for (LBVHTreelet& treelet : treeletsToBuild)
 			finishedTreelets.push_back(treelet.build_nodes);
-		return BuildUpperSAH(arena, finishedTreelets, 0, finishedTreelets.size(),
+		return BuildUpperSAH(arenas, finishedTreelets, 0, finishedTreelets.size(),
 			totalNodes);
 	}
 
@@ -462,14 +1561,14 @@ namespace CHR
 		const std::vector<BVHPrimitiveInfo>& primitiveInfo,
 		MortonPrimitive* mortonPrims, int nPrimitives, int* totalNodes,
 		std::vector<std::shared_ptr<Shape>>& orderedPrims,
-		std::atomic<int>* orderedPrimsOffset, int bitIndex) const {
+		int firstPrimOffset, int bitIndex) const {
 		//CHECK_GT(nPrimitives, 0);
-		if (bitIndex == -1 || nPrimitives < m_max_prims_in_node) {
-			// Create and return leaf node of LBVH treelet
+		if (bitIndex == -1 || nPrimitives <= m_options.max_prims_in_node) {
+			// Create and return leaf node of LBVH treelet, its primitives keep their place
+			// in Morton order
 			(*totalNodes)++;
 			BVHBuildNode* node = buildNodes++;
 			Bounds3 bounds;
-			int firstPrimOffset = orderedPrimsOffset->fetch_add(nPrimitives);
 			for (int i = 0; i < nPrimitives; ++i) {
 				int primitiveIndex = mortonPrims[i].primitiveIndex;
 				orderedPrims[firstPrimOffset + i] = m_shapes[primitiveIndex];
@@ -479,12 +1578,12 @@ namespace CHR
 			return node;
 		}
 		else {
-			int mask = 1 << bitIndex;
+			uint64_t mask = 1ull << bitIndex;
 			// Advance to next subtree level if there's no LBVH split for this bit
 			if ((mortonPrims[0].mortonCode & mask) ==
 				(mortonPrims[nPrimitives - 1].mortonCode & mask))
 				return EmitLBVH(buildNodes, primitiveInfo, mortonPrims, nPrimitives,
-					totalNodes, orderedPrims, orderedPrimsOffset,
+					totalNodes, orderedPrims, firstPrimOffset,
 					bitIndex - 1);
 
 			// Find LBVH split point for this dimension
@@ -511,26 +1610,26 @@ namespace CHR
 			BVHBuildNode* node = buildNodes++;
 			BVHBuildNode* lbvh[2] = {
 				EmitLBVH(buildNodes, primitiveInfo, mortonPrims, splitOffset,
-				totalNodes, orderedPrims, orderedPrimsOffset,
+				totalNodes, orderedPrims, firstPrimOffset,
 				bitIndex - 1),
 				EmitLBVH(buildNodes, primitiveInfo, &mortonPrims[splitOffset],
 				nPrimitives - splitOffset, totalNodes, orderedPrims,
-				orderedPrimsOffset, bitIndex - 1) };
+				firstPrimOffset + splitOffset, bitIndex - 1) };
 			int axis = bitIndex % 3;
 			node->InitInterior(axis, lbvh[0], lbvh[1]);
 			return node;
 		}
 	}
 
-	BVHBuildNode* BVH::BuildUpperSAH(MemoryArena& arena,
+	BVHBuildNode* BVH::BuildUpperSAH(std::vector<std::unique_ptr<MemoryArena>>& arenas,
 		std::vector<BVHBuildNode*>& treeletRoots,
 		int start, int end,
-		int* totalNodes) const {
+		std::atomic<int>* totalNodes) const {
 		//CHECK_LT(start, end);
 		int nNodes = end - start;
 		if (nNodes == 1) return treeletRoots[start];
 		(*totalNodes)++;
-		BVHBuildNode* node = arena.Alloc<BVHBuildNode>();
+		BVHBuildNode* node = arenas[ThreadPool::GetWorkerIndex() + 1]->Alloc<BVHBuildNode>();
 
 		// Compute bounds of all nodes under this HLBVH node
 		Bounds3 bounds;
@@ -546,84 +1645,219 @@ namespace CHR
 			centroidBounds.Extend(centroid);
 		}
 		int dim = centroidBounds.MaxExtent();
-		// FIXME: if this hits, what do we need to do?
-		// Make sure the SAH split below does something... ?
-		//CHECK_NE(centroidBounds.max[dim], centroidBounds.min[dim]);
-
-		// Allocate _BucketInfo_ for SAH partition buckets
-		constexpr int nBuckets = 12;
-		struct BucketInfo {
-			int count = 0;
-			Bounds3 bounds;
-		};
-		BucketInfo buckets[nBuckets];
 
-		// Initialize _BucketInfo_ for HLBVH SAH partition buckets
-		for (int i = start; i < end; ++i) {
-			float centroid = (treeletRoots[i]->bounds.min[dim] +
-				treeletRoots[i]->bounds.max[dim]) *
-				0.5f;
-			int b =
-				nBuckets * ((centroid - centroidBounds.min[dim]) /
-				(centroidBounds.max[dim] - centroidBounds.min[dim]));
-			if (b == nBuckets) b = nBuckets - 1;
-			/*CHECK_GE(b, 0);
-			CHECK_LT(b, nBuckets);*/
-			buckets[b].count++;
-			buckets[b].bounds.Extend(treeletRoots[i]->bounds);
-		}
-
-		// Compute costs for splitting after each bucket
-		float cost[nBuckets - 1];
-		for (int i = 0; i < nBuckets - 1; ++i) {
+		int mid = (start + end) / 2;
+		if (centroidBounds.max[dim] > centroidBounds.min[dim]) {
+			// Allocate _BucketInfo_ for SAH partition buckets
+			const int nBuckets = m_options.sah_buckets;
+			BucketInfo buckets[MAX_SAH_BUCKETS];
+			auto bucketIndex = [=](const BVHBuildNode* node) {
+				float centroid = (node->bounds.min[dim] + node->bounds.max[dim]) * 0.5f;
+				int b = nBuckets * ((centroid - centroidBounds.min[dim]) /
+					(centroidBounds.max[dim] - centroidBounds.min[dim]));
+				if (b == nBuckets) b = nBuckets - 1;
+				//CHECK_GE(b, 0);
+				//CHECK_LT(b, nBuckets);
+				return b;
+			};
+
+			// Initialize _BucketInfo_ for HLBVH SAH partition buckets
+			for (int i = start; i < end; ++i) {
+				int b = bucketIndex(treeletRoots[i]);
+				buckets[b].count++;
+				buckets[b].bounds.Extend(treeletRoots[i]->bounds);
+			}
+
+			// Compute costs for splitting after each bucket with a prefix and a suffix sweep
+			float cost[MAX_SAH_BUCKETS - 1];
 			Bounds3 b0, b1;
 			int count0 = 0, count1 = 0;
-			for (int j = 0; j <= i; ++j) {
-				b0.Extend(buckets[j].bounds);
-				count0 += buckets[j].count;
-			}
-			for (int j = i + 1; j < nBuckets; ++j) {
-				b1.Extend(buckets[j].bounds);
-				count1 += buckets[j].count;
-			}
-			cost[i] = .125f +
-				(count0 * b0.GetSurfaceArea() + count1 * b1.GetSurfaceArea()) /
-				bounds.GetSurfaceArea();
-		}
-
-		// Find bucket to split at that minimizes SAH metric
-		float minCost = cost[0];
-		int minCostSplitBucket = 0;
-		for (int i = 1; i < nBuckets - 1; ++i) {
-			if (cost[i] < minCost) {
-				minCost = cost[i];
-				minCostSplitBucket = i;
-			}
-		}
-
-		// Split nodes and create interior HLBVH SAH node
-		BVHBuildNode** pmid = std::partition(
-			&treeletRoots[start], &treeletRoots[end - 1] + 1,
-			[=](const BVHBuildNode* node) {
-			float centroid =
-				(node->bounds.min[dim] + node->bounds.max[dim]) * 0.5f;
-			int b = nBuckets *
-				((centroid - centroidBounds.min[dim]) /
-				(centroidBounds.max[dim] - centroidBounds.min[dim]));
-			if (b == nBuckets) b = nBuckets - 1;
-			//CHECK_GE(b, 0);
-			//CHECK_LT(b, nBuckets);
-			return b <= minCostSplitBucket;
-		});
-		int mid = pmid - &treeletRoots[0];
+			for (int i = 0; i < nBuckets - 1; ++i) {
+				b0.Extend(buckets[i].bounds);
+				count0 += buckets[i].count;
+				cost[i] = count0 * b0.GetSurfaceArea();
+			}
+			for (int i = nBuckets - 2; i >= 0; --i) {
+				b1.Extend(buckets[i + 1].bounds);
+				count1 += buckets[i + 1].count;
+				cost[i] += count1 * b1.GetSurfaceArea();
+			}
+			for (int i = 0; i < nBuckets - 1; ++i)
+				cost[i] = .125f + cost[i] / bounds.GetSurfaceArea();
+
+			// Find bucket to split at that minimizes SAH metric
+			float minCost = cost[0];
+			int minCostSplitBucket = 0;
+			for (int i = 1; i < nBuckets - 1; ++i) {
+				if (cost[i] < minCost) {
+					minCost = cost[i];
+					minCostSplitBucket = i;
+				}
+			}
+
+			// Split nodes and create interior HLBVH SAH node
+			BVHBuildNode** pmid = std::partition(
+				&treeletRoots[start], &treeletRoots[end - 1] + 1,
+				[=](const BVHBuildNode* node) {
+				return bucketIndex(node) <= minCostSplitBucket;
+			});
+			mid = pmid - &treeletRoots[0];
+		}
+		// Treelets with equal centroids, or all in one bucket, are split by count
+		if (mid == start || mid == end)
+			mid = (start + end) / 2;
 		//CHECK_GT(mid, start);
 		//CHECK_LT(mid, end);
-		node->InitInterior(
-			dim, this->BuildUpperSAH(arena, treeletRoots, start, mid, totalNodes),
-			this->BuildUpperSAH(arena, treeletRoots, mid, end, totalNodes));
+
+		// The upper tree of a large scene has thousands of treelets, its large nodes
+		// build their first child as a task
+		BVHBuildNode* children[2];
+		if (nNodes >= 256) {
+			ThreadPool::TaskGroup group;
+			ThreadPool::GetInstance()->Submit([&]() {
+				children[0] = BuildUpperSAH(arenas, treeletRoots, start, mid, totalNodes);
+			}, &group);
+			children[1] = BuildUpperSAH(arenas, treeletRoots, mid, end, totalNodes);
+			ThreadPool::GetInstance()->Wait(group);
+		}
+		else {
+			children[0] = BuildUpperSAH(arenas, treeletRoots, start, mid, totalNodes);
+			children[1] = BuildUpperSAH(arenas, treeletRoots, mid, end, totalNodes);
+		}
+		node->InitInterior(dim, children[0], children[1]);
 		return node;
 	}
 
+	// Leaves of a restructured treelet, its 2^7 subsets are small enough to search exhaustively
+	static constexpr int TREELET_LEAVES = 7;
+	// Subtrees below this depth are optimized by the task that reached them
+	static constexpr int TREELET_TASK_DEPTH = 10;
+
+	// Points the split axis along the children's centroids, with the lower child first
+	static void OrderChildren(BVHBuildNode* node) {
+		glm::vec3 c0 = node->children[0]->bounds.min + node->children[0]->bounds.max;
+		glm::vec3 c1 = node->children[1]->bounds.min + node->children[1]->bounds.max;
+		glm::vec3 d = glm::abs(c1 - c0);
+		node->split_axis = d.x > d.y && d.x > d.z ? 0 : d.y > d.z ? 1 : 2;
+		if (c0[node->split_axis] > c1[node->split_axis])
+			std::swap(node->children[0], node->children[1]);
+	}
+
+	float BVH::SAHCost(const BVHBuildNode* node) const {
+		if (node->n_primitives > 0)
+			return node->bounds.GetSurfaceArea() * LeafCost(node->n_primitives);
+		return node->bounds.GetSurfaceArea() + SAHCost(node->children[0]) + SAHCost(node->children[1]);
+	}
+
+	float BVH::OptimizeTreelets(BVHBuildNode* node, int depth) const {
+		if (node->n_primitives > 0) {
+			node->sah_cost = node->bounds.GetSurfaceArea() * LeafCost(node->n_primitives);
+			return node->sah_cost;
+		}
+		// The treelet rooted here is restructured after the ones below it
+		if (depth < TREELET_TASK_DEPTH) {
+			ThreadPool::TaskGroup group;
+			ThreadPool::GetInstance()->Submit([&]() {
+				OptimizeTreelets(node->children[0], depth + 1);
+			}, &group);
+			OptimizeTreelets(node->children[1], depth + 1);
+			ThreadPool::GetInstance()->Wait(group);
+		}
+		else {
+			OptimizeTreelets(node->children[0], depth + 1);
+			OptimizeTreelets(node->children[1], depth + 1);
+		}
+		node->sah_cost = node->bounds.GetSurfaceArea() +
+			node->children[0]->sah_cost + node->children[1]->sah_cost;
+		RestructureTreelet(node);
+		return node->sah_cost;
+	}
+
+	void BVH::RestructureTreelet(BVHBuildNode* root) const {
+		// Grow the treelet by opening the largest interior leaf until it has TREELET_LEAVES leaves
+		BVHBuildNode* leaves[TREELET_LEAVES] = { root->children[0], root->children[1] };
+		BVHBuildNode* interiors[TREELET_LEAVES - 1] = { root };
+		int nLeaves = 2, nInteriors = 1;
+		while (nLeaves < TREELET_LEAVES) {
+			int largest = -1;
+			float largestArea = 0;
+			for (int i = 0; i < nLeaves; ++i) {
+				float area = leaves[i]->bounds.GetSurfaceArea();
+				if (leaves[i]->n_primitives == 0 && (largest < 0 || area > largestArea)) {
+					largest = i;
+					largestArea = area;
+				}
+			}
+			if (largest < 0)
+				break;
+			BVHBuildNode* opened = leaves[largest];
+			interiors[nInteriors++] = opened;
+			leaves[largest] = opened->children[0];
+			leaves[nLeaves++] = opened->children[1];
+		}
+		if (nLeaves < 3)
+			return;
+
+		// Optimal SAH cost of every subset of the leaves, a subset's partitions are smaller
+		// subsets so increasing order visits them first
+		const int nSubsets = 1 << nLeaves;
+		float cost[1 << TREELET_LEAVES];
+		int partition[1 << TREELET_LEAVES];
+		Bounds3 subsetBounds[1 << TREELET_LEAVES];
+		for (int s = 1; s < nSubsets; ++s) {
+			int low = s & -s;
+			int leaf = 0;
+			while ((1 << leaf) != low)
+				++leaf;
+			subsetBounds[s] = s == low ? leaves[leaf]->bounds :
+				Bounds3::Extend(subsetBounds[s ^ low], leaves[leaf]->bounds);
+			if (s == low) {
+				cost[s] = leaves[leaf]->sah_cost;
+				continue;
+			}
+			// Each partition is tried once, as the side holding the lowest leaf
+			float best = INFINITY;
+			for (int p = (s - 1) & s; p > 0; p = (p - 1) & s) {
+				if (!(p & low))
+					continue;
+				float c = cost[p] + cost[s ^ p];
+				if (c < best) {
+					best = c;
+					partition[s] = p;
+				}
+			}
+			cost[s] = subsetBounds[s].GetSurfaceArea() + best;
+		}
+		if (!(cost[nSubsets - 1] < root->sah_cost * 0.9999f))
+			return;
+
+		// Rebuild the treelet from the optimal partitions, reusing its interior nodes
+		int nextInterior = 1;
+		std::function<BVHBuildNode*(int, BVHBuildNode*)> emit = [&](int s, BVHBuildNode* node) {
+			if ((s & (s - 1)) == 0) {
+				int leaf = 0;
+				while ((1 << leaf) != s)
+					++leaf;
+				return leaves[leaf];
+			}
+			BVHBuildNode* c0 = emit(partition[s], partition[s] & (partition[s] - 1) ? interiors[nextInterior++] : nullptr);
+			BVHBuildNode* c1 = emit(s ^ partition[s], (s ^ partition[s]) & ((s ^ partition[s]) - 1) ? interiors[nextInterior++] : nullptr);
+			node->children[0] = c0;
+			node->children[1] = c1;
+			node->bounds = subsetBounds[s];
+			node->sah_cost = cost[s];
+			OrderChildren(node);
+			return node;
+		};
+		emit(nSubsets - 1, root);
+	}
+
+	int BVH::TreeDepth(const BVHBuildNode* node) {
+		if (node->n_primitives > 0)
+			return 0;
+		return 1 + std::max(TreeDepth(node->children[0]), TreeDepth(node->children[1]));
+	}
+
 	int BVH::FlattenBVHTree(BVHBuildNode* node, int* offset) {
 		LinearBVHNode* linearNode = &m_nodes[*offset];
 		linearNode->bounds = node->bounds;
@@ -645,9 +1879,50 @@ namespace CHR
 		return myOffset;
 	}
 
+	int BVH::FlattenClusteredBVHTree(BVHBuildNode* node, int index, int* offset) {
+		LinearBVHNode* linearNode = &m_nodes[index];
+		linearNode->bounds = node->bounds;
+		if (node->n_primitives > 0) {
+			linearNode->primitives_offset = node->first_prim_offset;
+			linearNode->nPrimitives = node->n_primitives;
+		}
+		else {
+			// The children take the next pair of slots, their subtrees follow depth first
+			// so every subtree is one contiguous block
+			int first = *offset;
+			*offset += 2;
+			linearNode->axis = node->split_axis;
+			linearNode->nPrimitives = 0;
+			linearNode->first_child_offset = first;
+			FlattenClusteredBVHTree(node->children[0], first, offset);
+			FlattenClusteredBVHTree(node->children[1], first + 1, offset);
+		}
+		return index;
+	}
+
+	template <int N>
+	WideBVHNode<N>* BVH::FlattenWideBVHTree(BVHBuildNode* root) {
+		std::vector<WideBVHNode<N>> nodes;
+		CollapseBVHTree(root, nodes);
+		WideBVHNode<N>* flat = AllocAligned<WideBVHNode<N>>(nodes.size());
+		std::copy(nodes.begin(), nodes.end(), flat);
+		m_total_nodes = nodes.size();
+		return flat;
+	}
+
 	BVH::~BVH()
 	{
+		FreeAligned(m_motion_nodes);
+		FreeAligned(m_motion_nodes4);
+		FreeAligned(m_motion_nodes8);
+		//Nodes loaded from the cache are in its mapping
+		if (m_cache_file)
+			return;
 		FreeAligned(m_nodes);
+		FreeAligned(m_nodes4);
+		FreeAligned(m_nodes8);
+		FreeAligned(m_qnodes4);
+		FreeAligned(m_qnodes8);
 
 		//for (Face face : faces)
 		//{
@@ -656,56 +1931,496 @@ namespace CHR
 	}
 
 	bool BVH::Intersect(const Ray& ray, IntersectionData* intersection_data) const {
+		SurfaceHit hit;
+		hit.t = intersection_data->t;
+		if (!IntersectHit(ray, hit))
+			return intersection_data->hit;
+		// Shading data is only built for the closest hit
+		hit.Below(nullptr)->FinalizeHit(ray, hit, intersection_data);
+		return true;
+	}
+
+	inline int BVH::IntersectLeaf(int first, int count, uint8_t leaf_flags, Ray& probe_ray, SurfaceHit& hit) const {
+		int primitive_hits = 0;
+		if (leaf_flags & LEAF_WORLD_TRIANGLES)
+		{
+			// One wide pass over the leaf, the other shapes miss in it
+			float t, u, v;
+			int i = count == 1 ?
+				(IntersectWorldTriangle(m_triangles, first, probe_ray, t, u, v) ? 0 : -1) :
+				m_leaf_kernel(m_triangles, first, count, probe_ray, t, u, v);
+			if (i >= 0)
+			{
+				primitive_hits++;
+				hit.t = t;
+				hit.barycentric = { u, v };
+				hit.shape = m_triangles.triangles[first + i];
+				hit.instance_depth = 0;
+				probe_ray.t_max = t;
+			}
+		}
+		if (leaf_flags & LEAF_SHAPES)
+		{
+			SurfaceHit probe_hit;
+			for (int i = first; i < first + count; ++i)
+			{
+				const auto& s = m_shapes[i];
+				//Instances carry the visibility of their base mesh
+				if (m_triangles.triangles[i] || (!s->m_visible && !m_bottom_level))
+					continue;
+				if (s->IntersectHit(probe_ray, probe_hit) && probe_hit.t < probe_ray.t_max)
+				{
+					primitive_hits++;
+					hit = probe_hit;
+					probe_ray.t_max = probe_hit.t;
+				}
+			}
+		}
+		return primitive_hits;
+	}
+
+	inline bool BVH::IntersectLeafP(int first, int count, uint8_t leaf_flags, const Ray& probe_ray) const {
+		//Any hit will do, stop at the first one
+		if (leaf_flags & LEAF_WORLD_TRIANGLES)
+		{
+			float t, u, v;
+			if (count == 1 ?
+				IntersectWorldTriangle(m_triangles, first, probe_ray, t, u, v) :
+				m_leaf_kernel(m_triangles, first, count, probe_ray, t, u, v) >= 0)
+				return true;
+		}
+		if (leaf_flags & LEAF_SHAPES)
+		{
+			for (int i = first; i < first + count; ++i)
+			{
+				const auto& s = m_shapes[i];
+				if (m_triangles.triangles[i] || (!s->m_visible && !m_bottom_level))
+					continue;
+				if (s->IntersectP(probe_ray, probe_ray.t_max))
+					return true;
+			}
+		}
+		return false;
+	}
+
+	template <int N>
+	inline int BVH::IntersectChildren(const WideBVHNode<N>* nodes, int index, const BoxRay& ray, float time,
+		float t_max, float* t_entry) const {
+		const WideBVHNode<N>& node = nodes[index];
+		const WideMotionBounds<N>* motion = WideMotionNodes<N>();
+		if (!motion)
+			return m_box_kernel(&node.bounds[0][0], node.n_children, ray, t_max, t_entry);
+
+		// The children's boxes at the ray's time
+		alignas(32) float bounds[6 * N];
+		const float* open = &motion[index].bounds[0][0][0];
+		const float* close = &motion[index].bounds[1][0][0];
+		for (int k = 0; k < 6 * N; k++)
+			bounds[k] = open[k] + time * (close[k] - open[k]);
+		return m_box_kernel(bounds, node.n_children, ray, t_max, t_entry);
+	}
+
+	// Nodes are never quantized when anything moves, the time is only taken to share the call with the
+	// unquantized overload
+	template <int N>
+	inline int BVH::IntersectChildren(const QuantizedBVHNode<N>* nodes, int index, const BoxRay& ray, float /*time*/,
+		float t_max, float* t_entry) const {
+		const QuantizedBVHNode<N>& node = nodes[index];
+		return m_quantized_box_kernel(&node.bounds[0][0], node.origin, node.scale, node.n_children, ray, t_max, t_entry);
+	}
+
+	template <typename Node>
+	bool BVH::IntersectHitWide(const Node* nodes, const Ray& ray, SurfaceHit& hit) const {
+		constexpr int N = Node::width;
+		ProfilePhase p(Prof::AccelIntersect);
+		BoxRay box_ray = { { ray.origin.x, ray.origin.y, ray.origin.z },
+			{ 1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z }, ray.intersect_eps };
+		Ray probe_ray(ray);
+		probe_ray.t_max = std::min(ray.t_max, hit.t);
+		// Each level pushes at most N - 1 children
+		TraversalStack<WideNodeToVisit, MAX_DEPTH * (N - 1)> nodesToVisit(m_depth * (N - 1));
+		int toVisitOffset = 0;
+		unsigned int nodes_visited = 0, primitive_tests = 0, primitive_hits = 0;
+
+		// The root's own box is not stored, its children are tested when it is entered
+		WideNodeToVisit current = { 0, 0, 0, -INFINITY };
+		while (true)
+		{
+			if (current.n_primitives > 0) {
+				primitive_tests += current.n_primitives;
+				primitive_hits += IntersectLeaf(current.child, current.n_primitives, current.leaf_flags, probe_ray, hit);
+			}
+			else {
+				// One slab test for all children, the hit ones are pushed far to near
+				// and the nearest one is entered
+				const Node& node = nodes[current.child];
+				alignas(32) float t_entry[N];
+				int mask = IntersectChildren(nodes, current.child, box_ray, ray.jitter_t, probe_ray.t_max, t_entry);
+				nodes_visited += node.n_children;
+				if (mask) {
+					WideNodeToVisit hit_children[N];
+					int n_hit = 0;
+					for (int i = 0; i < node.n_children; i++) {
+						if (!(mask >> i & 1)) continue;
+						WideNodeToVisit child = { node.child[i], node.n_primitives[i], node.leaf_flags[i], t_entry[i] };
+						int j = n_hit++;
+						for (; j > 0 && hit_children[j - 1].t_entry < child.t_entry; j--)
+							hit_children[j] = hit_children[j - 1];
+						hit_children[j] = child;
+					}
+					for (int i = 0; i < n_hit - 1; i++)
+						nodesToVisit[toVisitOffset++] = hit_children[i];
+					current = hit_children[n_hit - 1];
+					continue;
+				}
+			}
+			// Pop the next node that is not behind the closest hit
+			bool next_found = false;
+			while (toVisitOffset > 0) {
+				const WideNodeToVisit& next = nodesToVisit[--toVisitOffset];
+				if (next.t_entry < probe_ray.t_max) {
+					current = next;
+					next_found = true;
+					break;
+				}
+			}
+			if (!next_found) break;
+		}
+		TraversalStats& stats = t_traversal_stats;
+		if (m_bottom_level)
+			stats.instance_queries++;
+		else
+			stats.queries++;
+		stats.nodes_visited += nodes_visited;
+		stats.primitive_tests += primitive_tests;
+		stats.primitive_hits += primitive_hits;
+		return primitive_hits > 0;
+	}
+
+	template <typename Node>
+	bool BVH::IntersectPWide(const Node* nodes, const Ray& ray, float t_max) const {
+		constexpr int N = Node::width;
+		ProfilePhase p(Prof::AccelIntersect);
+		BoxRay box_ray = { { ray.origin.x, ray.origin.y, ray.origin.z },
+			{ 1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z }, ray.intersect_eps };
+		Ray probe_ray(ray);
+		probe_ray.t_max = std::min(ray.t_max, t_max);
+		TraversalStack<WideNodeToVisit, MAX_DEPTH * (N - 1)> nodesToVisit(m_depth * (N - 1));
+		int toVisitOffset = 0;
+		unsigned int nodes_visited = 0, primitive_tests = 0;
+		bool hit = false;
+
+		WideNodeToVisit current = { 0, 0, 0, -INFINITY };
+		while (true)
+		{
+			if (current.n_primitives > 0) {
+				primitive_tests += current.n_primitives;
+				if (IntersectLeafP(current.child, current.n_primitives, current.leaf_flags, probe_ray)) {
+					hit = true;
+					break;
+				}
+			}
+			else {
+				// Any hit ends the query, the children are visited in node order
+				const Node& node = nodes[current.child];
+				alignas(32) float t_entry[N];
+				int mask = IntersectChildren(nodes, current.child, box_ray, ray.jitter_t, probe_ray.t_max, t_entry);
+				nodes_visited += node.n_children;
+				if (mask) {
+					int last = -1;
+					for (int i = 0; i < node.n_children; i++) {
+						if (!(mask >> i & 1)) continue;
+						if (last >= 0)
+							nodesToVisit[toVisitOffset++] = { node.child[last], node.n_primitives[last], node.leaf_flags[last], 0.0f };
+						last = i;
+					}
+					current = { node.child[last], node.n_primitives[last], node.leaf_flags[last], 0.0f };
+					continue;
+				}
+			}
+			if (toVisitOffset == 0) break;
+			current = nodesToVisit[--toVisitOffset];
+		}
+		TraversalStats& stats = t_traversal_stats;
+		if (m_bottom_level)
+			stats.instance_queries++;
+		else
+			stats.queries++;
+		stats.nodes_visited += nodes_visited;
+		stats.primitive_tests += primitive_tests;
+		stats.primitive_hits += hit ? 1 : 0;
+		return hit;
+	}
+
+	bool BVH::IntersectHit(const Ray& ray, SurfaceHit& hit) const {
+		if (m_qnodes8) return IntersectHitWide(m_qnodes8, ray, hit);
+		if (m_qnodes4) return IntersectHitWide(m_qnodes4, ray, hit);
+		if (m_nodes8) return IntersectHitWide(m_nodes8, ray, hit);
+		if (m_nodes4) return IntersectHitWide(m_nodes4, ray, hit);
 		if (!m_nodes) return false;
-		//ProfilePhase p(Prof::AccelIntersect);
+		ProfilePhase p(Prof::AccelIntersect);
 		glm::vec3 invDir = glm::vec3(1.0f/ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
 		int dirIsNeg[3] = { invDir.x < ray.intersect_eps, invDir.y < ray.intersect_eps, invDir.z < ray.intersect_eps };
-		// Follow ray through BVH nodes to find primitive intersections
+		// Every accepted hit shrinks probe_ray.t_max, boxes entered past it are skipped
+		Ray probe_ray(ray);
+		probe_ray.t_max = std::min(ray.t_max, hit.t);
+		// Pending far children with the distance their boxes are entered at
+		struct NodeToVisit { int index; float t_entry; };
+		TraversalStack<NodeToVisit, MAX_DEPTH> nodesToVisit(m_depth);
 		int toVisitOffset = 0, currentNodeIndex = 0;
-		int nodesToVisit[64];
-		float t_min = std::numeric_limits<float>().max();
-		IntersectionData probe_data;
-
-		std::random_device rd;
-		std::mt19937 gen(rd());
-		std::uniform_real_distribution<float> dis(0.0, 1.0);
+		unsigned int nodes_visited = 1, primitive_tests = 0, primitive_hits = 0;
 
-		while (true) 
+		const float time = ray.jitter_t;
+		bool traverse = NodeBounds(0, time).IntersectP(probe_ray, invDir, dirIsNeg);
+		while (traverse)
 		{
 			const LinearBVHNode* node = &m_nodes[currentNodeIndex];
-			// Check ray against BVH node
-			if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
-				if (node->nPrimitives > 0) {
-					// Intersect ray with primitives in leaf BVH node
-					for (int i = 0; i < node->nPrimitives; ++i)
-					{
-						const auto s =
-							m_shapes[node->primitives_offset + i];
-						// Check one primitive inside leaf node
-						probe_data.t = INFINITY;
-						if (s->Intersect(ray, &probe_data) && s->m_visible)
-						{
-							if (probe_data.t < intersection_data->t /*&& probe_data->t >ray.intersect_eps*/)
-							{
-								*intersection_data = probe_data;
-							}
+			if (node->nPrimitives > 0) {
+				// Intersect ray with primitives in leaf BVH node
+				primitive_tests += node->nPrimitives;
+				primitive_hits += IntersectLeaf(node->primitives_offset, node->nPrimitives, node->leaf_flags, probe_ray, hit);
+			}
+			else {
+				// Test both children here so the nearer one is entered first,
+				// the other one waits on the stack with its entry distance
+				int first = m_options.clustered_layout ? node->first_child_offset : currentNodeIndex + 1;
+				int second = m_options.clustered_layout ? first + 1 : node->second_child_offset;
+				float t_first, t_second;
+				bool hit_first = NodeBounds(first, time).IntersectP(probe_ray, invDir, dirIsNeg, &t_first);
+				bool hit_second = NodeBounds(second, time).IntersectP(probe_ray, invDir, dirIsNeg, &t_second);
+				nodes_visited += 2;
+				if (hit_first && hit_second) {
+					if (t_second < t_first) {
+						std::swap(first, second);
+						std::swap(t_first, t_second);
+					}
+					nodesToVisit[toVisitOffset++] = { second, t_second };
+					currentNodeIndex = first;
+					continue;
+				}
+				if (hit_first || hit_second) {
+					currentNodeIndex = hit_first ? first : second;
+					continue;
+				}
+			}
+			// Pop the next node that is not behind the closest hit
+			traverse = false;
+			while (toVisitOffset > 0) {
+				const NodeToVisit& next = nodesToVisit[--toVisitOffset];
+				if (next.t_entry < probe_ray.t_max) {
+					currentNodeIndex = next.index;
+					traverse = true;
+					break;
+				}
+			}
+		}
+		TraversalStats& stats = t_traversal_stats;
+		if (m_bottom_level)
+			stats.instance_queries++;
+		else
+			stats.queries++;
+		stats.nodes_visited += nodes_visited;
+		stats.primitive_tests += primitive_tests;
+		stats.primitive_hits += primitive_hits;
+		return primitive_hits > 0;
+	}
 
-							//intersection_data->hit = true;
-						}
+	// Bounds of a packet's origins and inverse directions, the slab distances of all of its rays lie in their products
+	struct PacketInterval {
+		glm::vec3 originMin, originMax, invDirMin, invDirMax;
+		float tMax;//Largest t_max of the rays
+	};
+
+	// Interval product [a0, a1] * [b0, b1]
+	static inline void IntervalMul(float a0, float a1, float b0, float b1, float& lo, float& hi) {
+		float p0 = a0 * b0, p1 = a0 * b1, p2 = a1 * b0, p3 = a1 * b1;
+		lo = std::min(std::min(p0, p1), std::min(p2, p3));
+		hi = std::max(std::max(p0, p1), std::max(p2, p3));
+	}
+
+	// False only when no ray of the packet can enter the box
+	static bool PacketMayEnter(const Bounds3& bounds, const PacketInterval& interval, const int dirIsNeg[3]) {
+		float tNear = 0.0f, tFar = interval.tMax;
+		for (int a = 0; a < 3; a++) {
+			float nearLo, nearHi, farLo, farHi;
+			float nearPlane = bounds[dirIsNeg[a]][a], farPlane = bounds[1 - dirIsNeg[a]][a];
+			IntervalMul(nearPlane - interval.originMax[a], nearPlane - interval.originMin[a],
+				interval.invDirMin[a], interval.invDirMax[a], nearLo, nearHi);
+			IntervalMul(farPlane - interval.originMax[a], farPlane - interval.originMin[a],
+				interval.invDirMin[a], interval.invDirMax[a], farLo, farHi);
+			tNear = std::max(tNear, nearLo);
+			tFar = std::min(tFar, farHi * (float)(1 + 2 * ((3 * MACHINE_EPSILON) / (1 - 3 * MACHINE_EPSILON))));
+		}
+		return tNear <= tFar;
+	}
+
+	inline int BVH::FirstRayEntering(int index, const RayPacket& packet, const glm::vec3* invDir, const int dirIsNeg[3],
+		const PacketInterval& interval, int first, unsigned int& boxTests) const {
+		// The first ray usually decides, the interval test only runs when it misses
+		const Bounds3& bounds = m_nodes[index].bounds;
+		boxTests++;
+		if (bounds.IntersectP(packet.rays[first], invDir[first], dirIsNeg))
+			return first;
+		if (!PacketMayEnter(bounds, interval, dirIsNeg))
+			return packet.size;
+		for (int i = first + 1; i < packet.size; i++) {
+			boxTests++;
+			if (bounds.IntersectP(packet.rays[i], invDir[i], dirIsNeg))
+				return i;
+		}
+		return packet.size;
+	}
+
+	void BVH::Intersect(const RayPacket& packet, IntersectionData* intersection_data) const {
+		SurfaceHit hits[RayPacket::MAX_SIZE];
+		for (int i = 0; i < packet.size; i++)
+			hits[i].t = intersection_data[i].t;
+		IntersectHit(packet, hits);
+		for (int i = 0; i < packet.size; i++)
+			if (hits[i].shape)
+				hits[i].Below(nullptr)->FinalizeHit(packet.rays[i], hits[i], &intersection_data[i]);
+	}
+
+	void BVH::IntersectHit(const RayPacket& packet, SurfaceHit* hits) const {
+		// The rays share one traversal order, which needs the signs of their directions to agree
+		glm::vec3 invDir[RayPacket::MAX_SIZE];
+		int dirIsNeg[3] = { 0, 0, 0 };
+		bool coherent = m_nodes && !m_motion_nodes && packet.size > 1;
+		for (int i = 0; i < packet.size && coherent; i++) {
+			const Ray& ray = packet.rays[i];
+			invDir[i] = glm::vec3(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+			for (int a = 0; a < 3; a++) {
+				int isNeg = invDir[i][a] < ray.intersect_eps;
+				if (i == 0)
+					dirIsNeg[a] = isNeg;
+				// An axis parallel ray has no finite interval
+				coherent = coherent && isNeg == dirIsNeg[a] && std::isfinite(invDir[i][a]);
+			}
+		}
+		if (!coherent) {
+			for (int i = 0; i < packet.size; i++)
+				IntersectHit(packet.rays[i], hits[i]);
+			return;
+		}
+
+		ProfilePhase p(Prof::AccelIntersect);
+		// Every accepted hit shrinks its probe ray's t_max
+		RayPacket probe;
+		probe.size = packet.size;
+		PacketInterval interval = { glm::vec3(INFINITY), glm::vec3(-INFINITY), glm::vec3(INFINITY), glm::vec3(-INFINITY), 0.0f };
+		for (int i = 0; i < packet.size; i++) {
+			probe.rays[i] = packet.rays[i];
+			probe.rays[i].t_max = std::min(packet.rays[i].t_max, hits[i].t);
+			interval.originMin = glm::min(interval.originMin, probe.rays[i].origin);
+			interval.originMax = glm::max(interval.originMax, probe.rays[i].origin);
+			interval.invDirMin = glm::min(interval.invDirMin, invDir[i]);
+			interval.invDirMax = glm::max(interval.invDirMax, invDir[i]);
+			interval.tMax = std::max(interval.tMax, probe.rays[i].t_max);
+		}
+		// Pending far children with the first ray that enters them, the rays before it miss the node
+		struct PacketNodeToVisit { int index; int first; };
+		TraversalStack<PacketNodeToVisit, MAX_DEPTH> nodesToVisit(m_depth);
+		int toVisitOffset = 0, currentNodeIndex = 0;
+		// Box tests of single rays, comparable to the nodes a ray visits alone, and the nodes the packet fetched
+		unsigned int box_tests = 0, packet_nodes = 1, primitive_tests = 0, primitive_hits = 0;
+
+		int first = FirstRayEntering(0, probe, invDir, dirIsNeg, interval, 0, box_tests);
+		bool traverse = first < probe.size;
+		while (traverse)
+		{
+			const LinearBVHNode* node = &m_nodes[currentNodeIndex];
+			if (node->nPrimitives > 0) {
+				// Each ray that enters the leaf tests its primitives on its own
+				for (int i = first; i < probe.size; i++) {
+					if (i > first) {
+						box_tests++;
+						if (!node->bounds.IntersectP(probe.rays[i], invDir[i], dirIsNeg))
+							continue;
 					}
-					if (toVisitOffset == 0) break;
+					primitive_tests += node->nPrimitives;
+					primitive_hits += IntersectLeaf(node->primitives_offset, node->nPrimitives, node->leaf_flags, probe.rays[i], hits[i]);
+				}
+				interval.tMax = 0.0f;
+				for (int i = 0; i < probe.size; i++)
+					interval.tMax = std::max(interval.tMax, probe.rays[i].t_max);
+			}
+			else {
+				// The shared direction signs order the children front to back for every ray
+				int nearChild = m_options.clustered_layout ? node->first_child_offset : currentNodeIndex + 1;
+				int farChild = m_options.clustered_layout ? nearChild + 1 : node->second_child_offset;
+				if (dirIsNeg[node->axis])
+					std::swap(nearChild, farChild);
+				int firstNear = FirstRayEntering(nearChild, probe, invDir, dirIsNeg, interval, first, box_tests);
+				int firstFar = FirstRayEntering(farChild, probe, invDir, dirIsNeg, interval, first, box_tests);
+				packet_nodes += 2;
+				if (firstNear < probe.size && firstFar < probe.size)
+					nodesToVisit[toVisitOffset++] = { farChild, firstFar };
+				if (firstNear < probe.size || firstFar < probe.size) {
+					bool enterNear = firstNear < probe.size;
+					currentNodeIndex = enterNear ? nearChild : farChild;
+					first = enterNear ? firstNear : firstFar;
+					continue;
+				}
+			}
+			// Pop the next node some ray still enters, closer hits may have culled it since it was pushed
+			traverse = false;
+			while (toVisitOffset > 0) {
+				const PacketNodeToVisit& next = nodesToVisit[--toVisitOffset];
+				first = FirstRayEntering(next.index, probe, invDir, dirIsNeg, interval, next.first, box_tests);
+				if (first < probe.size) {
+					currentNodeIndex = next.index;
+					traverse = true;
+					break;
+				}
+			}
+		}
+		TraversalStats& stats = t_traversal_stats;
+		stats.queries += probe.size;
+		stats.packets++;
+		stats.packet_nodes += packet_nodes;
+		stats.nodes_visited += box_tests;
+		stats.primitive_tests += primitive_tests;
+		stats.primitive_hits += primitive_hits;
+	}
+
+	bool BVH::IntersectP(const Ray& ray, float t_max) const
+	{
+		if (m_qnodes8) return IntersectPWide(m_qnodes8, ray, t_max);
+		if (m_qnodes4) return IntersectPWide(m_qnodes4, ray, t_max);
+		if (m_nodes8) return IntersectPWide(m_nodes8, ray, t_max);
+		if (m_nodes4) return IntersectPWide(m_nodes4, ray, t_max);
+		if (!m_nodes) return false;
+		ProfilePhase p(Prof::AccelIntersect);
+		glm::vec3 invDir = glm::vec3(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+		int dirIsNeg[3] = { invDir.x < ray.intersect_eps, invDir.y < ray.intersect_eps, invDir.z < ray.intersect_eps };
+		Ray probe_ray(ray);
+		probe_ray.t_max = std::min(ray.t_max, t_max);
+		int toVisitOffset = 0, currentNodeIndex = 0;
+		TraversalStack<int, MAX_DEPTH> nodesToVisit(m_depth);
+		unsigned int nodes_visited = 0, primitive_tests = 0;
+		bool hit = false;
+
+		while (true)
+		{
+			const LinearBVHNode* node = &m_nodes[currentNodeIndex];
+			nodes_visited++;
+			if (NodeBounds(currentNodeIndex, ray.jitter_t).IntersectP(probe_ray, invDir, dirIsNeg)) {
+				if (node->nPrimitives > 0) {
+					primitive_tests += node->nPrimitives;
+					hit = IntersectLeafP(node->primitives_offset, node->nPrimitives, node->leaf_flags, probe_ray);
+					if (hit || toVisitOffset == 0) break;
 					currentNodeIndex = nodesToVisit[--toVisitOffset];
 				}
 				else {
-					// Put far BVH node on _nodesToVisit_ stack, advance to near
-					// node
+					int first = m_options.clustered_layout ? node->first_child_offset : currentNodeIndex + 1;
+					int second = m_options.clustered_layout ? first + 1 : node->second_child_offset;
 					if (dirIsNeg[node->axis]) {
-						nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
-						currentNodeIndex = node->second_child_offset;
+						nodesToVisit[toVisitOffset++] = first;
+						currentNodeIndex = second;
 					}
 					else {
-						nodesToVisit[toVisitOffset++] = node->second_child_offset;
-						currentNodeIndex = currentNodeIndex + 1;
+						nodesToVisit[toVisitOffset++] = second;
+						currentNodeIndex = first;
 					}
 				}
 			}
@@ -714,22 +2429,209 @@ namespace CHR
 				currentNodeIndex = nodesToVisit[--toVisitOffset];
 			}
 		}
-		return intersection_data->hit;
+		TraversalStats& stats = t_traversal_stats;
+		if (m_bottom_level)
+			stats.instance_queries++;
+		else
+			stats.queries++;
+		stats.nodes_visited += nodes_visited;
+		stats.primitive_tests += primitive_tests;
+		stats.primitive_hits += hit ? 1 : 0;
+		return hit;
 	}
 
-	bool BVH::IntersectP(const Ray& ray) const
+	size_t BVH::GetNodeSize() const
 	{
-		return false;
+		if (m_qnodes8) return sizeof(QuantizedBVHNode<8>);
+		if (m_qnodes4) return sizeof(QuantizedBVHNode<4>);
+		if (m_nodes8) return sizeof(WideBVHNode<8>);
+		if (m_nodes4) return sizeof(WideBVHNode<4>);
+		return sizeof(LinearBVHNode);
 	}
 
-	int BVH::GetSizeBytes()
+	size_t BVH::GetSizeBytes() const
 	{
-		return 0;
+		//Nodes with their motion bounds, world space triangles and the ordered primitive list, instanced meshes' BVHs not included
+		size_t node_bytes = m_total_nodes * GetNodeSize() + GetMotionBoundsBytes();
+		return node_bytes + m_triangles.GetSizeBytes() + m_shapes.size() * sizeof(m_shapes[0]);
+	}
+
+	// Cached BVH file: the header, the nodes at nodes_offset and at order_offset the original index of
+	// every primitive in leaf order. Nodes are stored as laid out in memory, so a file is only valid
+	// for the build that wrote it
+	struct BVHCacheHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t node_size;
+		uint64_t key;
+		int32_t width, quantized;
+		int32_t node_slots, total_nodes, n_shapes, n_ordered;
+		int32_t depth;
+		float bounds[6];
+		uint64_t nodes_offset, order_offset, file_size;
+	};
+
+	static constexpr char BVH_CACHE_MAGIC[8] = "CHRBVH";
+	static constexpr uint32_t BVH_CACHE_VERSION = 2;
+	// Shapes hashed per task when the cache key is computed
+	static constexpr int CACHE_HASH_CHUNK = 16 * 1024;
+
+	uint64_t BVH::ComputeCacheKey(const std::vector<BVHPrimitiveInfo>& primitiveInfo) const
+	{
+		// Everything that changes the tree or its node layout
+		ContentHash key(BVH_CACHE_VERSION);
+		key.Add((uint64_t)m_options.max_prims_in_node);
+		key.Add((uint64_t)m_options.split_method);
+		key.Add((uint64_t)m_options.simd);
+		key.Add((uint64_t)m_options.width);
+		key.Add((uint64_t)m_options.sah_buckets);
+		key.Add(m_options.sbvh_budget);
+		key.Add((uint64_t)m_options.treelet_passes);
+		key.Add((uint64_t)m_options.clustered_layout);
+		key.Add((uint64_t)m_options.quantized_nodes);
+		key.Add((uint64_t)m_bottom_level);
+		key.Add((uint64_t)m_shapes.size());
+
+		// The world bounds of every shape and the world space vertices of the triangles, which the SBVH
+		// clips and the leaf flags depend on. Chunks are hashed in parallel and combined in order,
+		// so the key does not depend on the thread count
+		int nShapes = (int)m_shapes.size();
+		int nChunks = (nShapes + CACHE_HASH_CHUNK - 1) / CACHE_HASH_CHUNK;
+		std::vector<uint64_t> chunkKeys(nChunks);
+		ThreadPool::GetInstance()->ParallelFor(nChunks, [&](int c) {
+			ContentHash h(c);
+			int end = std::min(nShapes, (c + 1) * CACHE_HASH_CHUNK);
+			for (int i = c * CACHE_HASH_CHUNK; i < end; i++) {
+				const Shape* shape = m_shapes[i].get();
+				const Bounds3& b = primitiveInfo[i].bounds;
+				h.Add((uint64_t)shape->m_shape_type);
+				h.Add(&b.min[0], 3);
+				h.Add(&b.max[0], 3);
+				if (const Triangle* tri = dynamic_cast<const Triangle*>(shape)) {
+					for (int v = 0; v < 3; v++) {
+						glm::vec3 p = tri->m_transform ? glm::vec3(*tri->m_transform * glm::vec4(tri->Vertex(v), 1.0f)) : tri->Vertex(v);
+						h.Add(&p[0], 3);
+					}
+					h.Add((uint64_t)(WorldTriangle(shape, m_bottom_level) != nullptr));
+				}
+			}
+			chunkKeys[c] = h.Get();
+		});
+		for (uint64_t chunkKey : chunkKeys)
+			key.Add(chunkKey);
+		return key.Get();
+	}
+
+	bool BVH::LoadCache(const std::string& path, uint64_t key)
+	{
+		std::unique_ptr<MappedFile> file = std::make_unique<MappedFile>();
+		if (!file->Open(path))
+			return false;
+
+		uint8_t* data = file->GetData();
+		const BVHCacheHeader* header = (const BVHCacheHeader*)data;
+		bool valid = file->GetSize() >= sizeof(BVHCacheHeader) &&
+			std::memcmp(header->magic, BVH_CACHE_MAGIC, sizeof(BVH_CACHE_MAGIC)) == 0 &&
+			header->version == BVH_CACHE_VERSION && header->key == key &&
+			header->file_size == file->GetSize() && header->width == m_options.width &&
+			header->n_shapes == (int)m_shapes.size() && header->n_ordered >= header->n_shapes &&
+			header->depth >= 0 &&
+			header->nodes_offset % 64 == 0 && header->order_offset % sizeof(int32_t) == 0 &&
+			header->nodes_offset + (uint64_t)header->node_slots * header->node_size <= header->order_offset &&
+			header->order_offset + (uint64_t)header->n_ordered * sizeof(int32_t) <= header->file_size;
+		if (valid) {
+			size_t nodeSize = m_options.width == 8 ? (header->quantized ? sizeof(QuantizedBVHNode<8>) : sizeof(WideBVHNode<8>)) :
+				m_options.width == 4 ? (header->quantized ? sizeof(QuantizedBVHNode<4>) : sizeof(WideBVHNode<4>)) : sizeof(LinearBVHNode);
+			valid = header->node_size == nodeSize;
+		}
+		std::vector<std::shared_ptr<Shape>> orderedPrims;
+		if (valid) {
+			const int32_t* order = (const int32_t*)(data + header->order_offset);
+			orderedPrims.resize(header->n_ordered);
+			for (int i = 0; i < header->n_ordered && valid; i++) {
+				valid = order[i] >= 0 && order[i] < header->n_shapes;
+				if (valid)
+					orderedPrims[i] = m_shapes[order[i]];
+			}
+		}
+		if (!valid) {
+			CH_WARN("Ignoring the invalid BVH cache " + path);
+			return false;
+		}
+
+		void* nodes = data + header->nodes_offset;
+		if (m_options.width == 8 && header->quantized)
+			m_qnodes8 = (QuantizedBVHNode<8>*)nodes;
+		else if (m_options.width == 8)
+			m_nodes8 = (WideBVHNode<8>*)nodes;
+		else if (m_options.width == 4 && header->quantized)
+			m_qnodes4 = (QuantizedBVHNode<4>*)nodes;
+		else if (m_options.width == 4)
+			m_nodes4 = (WideBVHNode<4>*)nodes;
+		else
+			m_nodes = (LinearBVHNode*)nodes;
+		m_total_nodes = header->total_nodes;
+		m_depth = header->depth;
+		m_bounds = Bounds3(glm::vec3(header->bounds[0], header->bounds[1], header->bounds[2]),
+			glm::vec3(header->bounds[3], header->bounds[4], header->bounds[5]));
+		m_shapes.swap(orderedPrims);
+		m_cache_file = std::move(file);
+		return true;
+	}
+
+	void BVH::SaveCache(const std::string& path, uint64_t key,
+		const std::vector<std::shared_ptr<Shape>>& originalPrims) const
+	{
+		// Original index of every primitive in leaf order, an SBVH references some of them more than once
+		std::unordered_map<const Shape*, int32_t> index;
+		index.reserve(originalPrims.size());
+		for (size_t i = 0; i < originalPrims.size(); i++)
+			index.emplace(originalPrims[i].get(), (int32_t)i);
+		std::vector<int32_t> order(m_shapes.size());
+		ThreadPool::GetInstance()->ParallelFor((int)m_shapes.size(), [&](int i) {
+			order[i] = index.at(m_shapes[i].get());
+		}, 4096);
+
+		BVHCacheHeader header = {};
+		std::memcpy(header.magic, BVH_CACHE_MAGIC, sizeof(BVH_CACHE_MAGIC));
+		header.version = BVH_CACHE_VERSION;
+		header.node_size = (uint32_t)GetNodeSize();
+		header.key = key;
+		header.width = m_options.width;
+		header.quantized = m_qnodes4 || m_qnodes8;
+		//The clustered layout has an empty slot after the root
+		header.node_slots = m_nodes && m_options.clustered_layout ? m_total_nodes + 1 : m_total_nodes;
+		header.total_nodes = m_total_nodes;
+		header.depth = m_depth;
+		header.n_shapes = (int)originalPrims.size();
+		header.n_ordered = (int)m_shapes.size();
+		for (int k = 0; k < 3; k++) {
+			header.bounds[k] = m_bounds.min[k];
+			header.bounds[k + 3] = m_bounds.max[k];
+		}
+		// Nodes start on a cache line of the page aligned mapping
+		size_t nodeBytes = (size_t)header.node_slots * header.node_size;
+		header.nodes_offset = (sizeof(BVHCacheHeader) + 63) & ~(uint64_t)63;
+		header.order_offset = header.nodes_offset + nodeBytes;
+		header.file_size = header.order_offset + order.size() * sizeof(int32_t);
+
+		const void* nodes = m_qnodes8 ? (const void*)m_qnodes8 : m_qnodes4 ? (const void*)m_qnodes4 :
+			m_nodes8 ? (const void*)m_nodes8 : m_nodes4 ? (const void*)m_nodes4 : (const void*)m_nodes;
+		static const uint8_t padding[64] = {};
+		if (WriteFileAtomic(path, {
+				{ &header, sizeof(header) },
+				{ padding, header.nodes_offset - sizeof(header) },
+				{ nodes, nodeBytes },
+				{ order.data(), order.size() * sizeof(int32_t) } }))
+			CH_TRACE("BVH cached to " + path);
+		else
+			CH_WARN("Can not write the BVH cache " + path);
 	}
 
 	void BVH::InitShapes()
 	{
 		Scene& scene = *m_scene_ptr;
+		std::unordered_map<const Mesh*, std::shared_ptr<BVH>> instanced_meshes;
 
 		for (auto obj : scene.m_scene_objects)
 		{
@@ -742,6 +2644,8 @@ namespace CHR
 			glm::mat4 m = t * r * s;*/
 			for (auto shape : obj.second->m_mesh->m_shapes)
 			{
+				if (shape->m_shape_type == SHAPE_T::instance)
+					PrepareInstance(static_cast<MeshInstance*>(shape.get()), instanced_meshes);
 				m_shapes.push_back(shape);
 			}
 		}
@@ -752,5 +2656,27 @@ namespace CHR
 				m_shapes.push_back(std::dynamic_pointer_cast<Shape>(li.second));
 			}
 		}
+		if (!instanced_meshes.empty())
+			CH_TRACE(std::to_string(instanced_meshes.size()) + " instanced meshes");
+	}
+
+	void BVH::PrepareInstance(MeshInstance* instance,
+		std::unordered_map<const Mesh*, std::shared_ptr<BVH>>& instanced_meshes)
+	{
+		const Mesh* base_mesh = instance->GetBaseMesh().get();
+		auto it = instanced_meshes.find(base_mesh);
+		if (it == instanced_meshes.end())
+		{
+			//The base may itself be an instance
+			for (auto shape : base_mesh->m_shapes)
+			{
+				if (shape->m_shape_type == SHAPE_T::instance)
+					PrepareInstance(static_cast<MeshInstance*>(shape.get()), instanced_meshes);
+			}
+			it = instanced_meshes.emplace(base_mesh,
+				std::make_shared<BVH>(base_mesh->m_shapes, m_options)).first;
+			m_instanced_bvhs.push_back(it->second);
+		}
+		instance->SetAccelerationStructure(it->second);
 	}
 }
\ No newline at end of file
@@ -1,11 +1,17 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <ray-tracer/accelerationStructures/AccelerationStructure.h>
 #include <ray-tracer/main/Shape.h>
 #include <ray-tracer/main/Geometry.h>
 #include <ray-tracer/accelerationStructures/Memory.h>
+#include <ray-tracer/accelerationStructures/TriangleKernels.h>
+#include <ray-tracer/accelerationStructures/BoxKernels.h>
+#include <ray-tracer/accelerationStructures/BVHCache.h>
 
 #include <memory>
 #include <vector>
@@ -22,52 +28,193 @@ namespace CHR
 	struct BVHPrimitiveInfo;
 	struct MortonPrimitive;
 	struct LinearBVHNode;
+	struct SBVHContext;
+	template <int N> struct WideBVHNode;
+	template <int N> struct QuantizedBVHNode;
+	template <int N> struct WideMotionBounds;
+	struct PacketInterval;
+
+	enum class SplitMethod { SAH, HLBVH, Middle, EqualCounts, SBVH, count };
+
+	//Settings of a BVH build, out of range values are clamped by the BVH
+	struct BVHBuildOptions
+	{
+		int max_prims_in_node = 1;	//up to 255
+		SplitMethod split_method = SplitMethod::SAH;
+		SIMD_T simd = SIMD_T::avx;	//caps the instruction set of the leaf and node tests, the cpu's widest one is used up to it
+		int width = 2;	//4 or 8 collapses the binary tree into nodes with that many children, tested in one pass
+		int sah_buckets = 12;	//centroid bins an SAH split is chosen from, 2 to BVH::MAX_SAH_BUCKETS
+		float sbvh_budget = 0.3f;	//references an SBVH may add by splitting primitives, as a fraction of the primitive count
+		int treelet_passes = 0;	//restructures the built tree this many times to lower its SAH cost
+		bool clustered_layout = false;	//a binary tree's siblings in one cache line, its subtrees in contiguous blocks
+		bool quantized_nodes = false;	//4 and 8 wide nodes with 8 bit child bounds, unless primitives move
+	};
 
-	enum class SplitMethod { SAH, HLBVH, Middle, EqualCounts, count };
 	// Bvh Declarations
 	class BVH : public AccelerationStructure
 	{
 	public:
 		// Bvh Public Methods
-		BVH(Scene& scene,
-			int maxPrimsInNode = 1,
-			SplitMethod splitMethod = SplitMethod::SAH);
+		//Nodes over moving primitives also keep their bounds at shutter open and close, a ray tests them at its time.
+		//With Settings::m_bvh_cache_dir set the built nodes are written there and a later build of the same
+		//shapes with the same options maps them instead
+		BVH(Scene& scene, const BVHBuildOptions& options = BVHBuildOptions());
+		//Bottom level BVH of an instanced mesh, in the space of the mesh's base object
+		BVH(const std::vector<std::shared_ptr<Shape>>& shapes, const BVHBuildOptions& options = BVHBuildOptions());
 		Bounds3 WorldBound() const;
 		~BVH();
 		bool Intersect(const Ray& ray, IntersectionData* intersection_data) const;
-		bool IntersectP(const Ray& ray) const;
+		bool IntersectHit(const Ray& ray, SurfaceHit& hit) const;
+		bool IntersectP(const Ray& ray, float t_max = INFINITY) const;
+		//One traversal of a binary BVH for the whole packet, with interval culling of the nodes none of its rays
+		//can enter. Wide nodes, moving primitives and packets whose directions differ in sign trace ray by ray
+		void Intersect(const RayPacket& packet, IntersectionData* intersection_data) const;
+		void IntersectHit(const RayPacket& packet, SurfaceHit* hits) const;
+		//Bottom up refit of the nodes over the moved objects' primitives, instanced meshes included.
+		//False when the SAH cost grew past MAX_REFIT_COST_GROWTH times the cost as built, or for quantized nodes
+		bool Refit(const std::vector<const glm::mat4*>& moved);
+		static constexpr float MAX_REFIT_COST_GROWTH = 1.5f;
 
-		int GetSizeBytes();
+		//Bytes of the nodes, the world space triangles and the primitive list
+		size_t GetSizeBytes() const;
+		inline float GetBuildTime() const { return m_build_time; }
+		inline int GetNodeCount() const { return m_total_nodes; }
+		inline int GetWidth() const { return m_options.width; }
+		inline const BVHBuildOptions& GetBuildOptions() const { return m_options; }
 
 		void InitShapes();
+		void PrepareInstance(MeshInstance* instance,
+			std::unordered_map<const Mesh*, std::shared_ptr<BVH>>& instanced_meshes);
+		void Build(std::chrono::steady_clock::time_point start);
+		void LogBuild(std::chrono::steady_clock::time_point start, bool cached);
+		static constexpr int MAX_SAH_BUCKETS = 64;
+		//Interior levels the traversal stacks hold without a heap allocation, deeper trees allocate theirs
+		static constexpr int MAX_DEPTH = 64;
+
 		// Bvh Private Methods
+		//Builds the subtrees of large nodes in parallel, rangeBounds and rangeCentroidBounds
+		//are computed here when the parent did not pass them
 		BVHBuildNode* RecursiveBuild(
-			MemoryArena& arena, std::vector<BVHPrimitiveInfo>& primitiveInfo,
-			int start, int end, int* totalNodes,
-			std::vector<std::shared_ptr<Shape>>& orderedPrims);
+			std::vector<std::unique_ptr<MemoryArena>>& arenas, std::vector<BVHPrimitiveInfo>& primitiveInfo,
+			int start, int end, std::atomic<int>* totalNodes,
+			std::vector<std::shared_ptr<Shape>>& orderedPrims,
+			const Bounds3* rangeBounds = nullptr, const Bounds3* rangeCentroidBounds = nullptr);
+		//Linear BVH over 63 bit Morton codes with an SAH tree over its treelets, every stage runs in parallel.
+		//Builds much faster than RecursiveBuild for a somewhat worse tree
 		BVHBuildNode* HLBVHBuild(
-			MemoryArena& arena, const std::vector<BVHPrimitiveInfo>& primitiveInfo,
-			int* totalNodes,
+			std::vector<std::unique_ptr<MemoryArena>>& arenas, const std::vector<BVHPrimitiveInfo>& primitiveInfo,
+			std::atomic<int>* totalNodes,
 			std::vector<std::shared_ptr<Shape>>& orderedPrims) const;
 		BVHBuildNode* EmitLBVH(
 			BVHBuildNode*& buildNodes,
 			const std::vector<BVHPrimitiveInfo>& primitiveInfo,
 			MortonPrimitive* mortonPrims, int nPrimitives, int* totalNodes,
 			std::vector<std::shared_ptr<Shape>>& orderedPrims,
-			std::atomic<int>* orderedPrimsOffset, int bitIndex) const;
-		BVHBuildNode* BuildUpperSAH(MemoryArena& arena,
+			int firstPrimOffset, int bitIndex) const;
+		BVHBuildNode* BuildUpperSAH(std::vector<std::unique_ptr<MemoryArena>>& arenas,
 			std::vector<BVHBuildNode*>& treeletRoots,
-			int start, int end, int* totalNodes) const;
+			int start, int end, std::atomic<int>* totalNodes) const;
+		//SAH build that also splits primitives by planes when the children of the best object split
+		//overlap, the split primitive is referenced from both sides. Builds slower than RecursiveBuild
+		//for a tree with less overlap on long, thin or skewed triangles
+		BVHBuildNode* SBVHBuild(
+			std::vector<std::unique_ptr<MemoryArena>>& arenas, std::vector<BVHPrimitiveInfo>& primitiveInfo,
+			std::atomic<int>* totalNodes,
+			std::vector<std::shared_ptr<Shape>>& orderedPrims);
+		//budget is the number of references the subtree may still add
+		BVHBuildNode* SBVHRecursiveBuild(SBVHContext& ctx, std::vector<BVHPrimitiveInfo>& refs,
+			const Bounds3& bounds, int budget, int depth);
+		float SAHCost(const BVHBuildNode* node) const;
+		//Interior nodes on the longest path from node to a leaf
+		static int TreeDepth(const BVHBuildNode* node);
+		//Bottom up pass that replaces every treelet of up to TREELET_LEAVES subtrees by the arrangement
+		//with the lowest SAH cost, subtrees near the root are processed in parallel. Returns the node's cost
+		float OptimizeTreelets(BVHBuildNode* node, int depth) const;
+		void RestructureTreelet(BVHBuildNode* root) const;
 		int FlattenBVHTree(BVHBuildNode* node, int* offset);
+		int FlattenClusteredBVHTree(BVHBuildNode* node, int index, int* offset);
+		template <int N>
+		WideBVHNode<N>* FlattenWideBVHTree(BVHBuildNode* root);
+		//Slab test of a wide node's children at the ray's time, returns the mask of the ones hit
+		template <int N>
+		int IntersectChildren(const WideBVHNode<N>* nodes, int index, const BoxRay& ray, float time,
+			float t_max, float* t_entry) const;
+		template <int N>
+		int IntersectChildren(const QuantizedBVHNode<N>* nodes, int index, const BoxRay& ray, float time,
+			float t_max, float* t_entry) const;
+		//Box of a binary node at a ray's time
+		Bounds3 NodeBounds(int index, float time) const;
+		//Index of the first of the packet's rays from first on that enters the binary node, packet.size for none.
+		//Adds the single ray box tests it made to boxTests
+		int FirstRayEntering(int index, const RayPacket& packet, const glm::vec3* invDir, const int dirIsNeg[3],
+			const PacketInterval& interval, int first, unsigned int& boxTests) const;
+		//Node is a WideBVHNode or a QuantizedBVHNode
+		template <typename Node>
+		bool IntersectHitWide(const Node* nodes, const Ray& ray, SurfaceHit& hit) const;
+		template <typename Node>
+		bool IntersectPWide(const Node* nodes, const Ray& ray, float t_max) const;
+		//Closest hit in a leaf's primitives, shrinks probe_ray.t_max, returns the number of hits accepted
+		int IntersectLeaf(int first, int count, uint8_t leaf_flags, Ray& probe_ray, SurfaceHit& hit) const;
+		bool IntersectLeafP(int first, int count, uint8_t leaf_flags, const Ray& probe_ray) const;
+		//Triangles the leaves test from the world space buffer, nullptr for the shapes that keep the object space path
+		static const Triangle* WorldTriangle(const Shape* shape, bool bottomLevel);
+		void BuildTriangleBuffer();
+		//Entry i of the world space triangle buffer from m_shapes[i], false when it has none
+		bool SetWorldTriangle(int i);
+		//Refits this BVH only, the instanced meshes in changed are already refit
+		bool RefitNodes(const std::vector<const glm::mat4*>& moved, std::unordered_set<const AccelerationStructure*>& changed);
+		template <int N>
+		void RefitWideNodes(WideBVHNode<N>* nodes, const std::vector<uint8_t>& movedPrims);
+		//SAH cost of the flattened nodes relative to the root's area
+		float NodeSAHCost() const;
+		//Bounds of the nodes at shutter open and close when any primitive moves, released otherwise
+		void BuildMotionBounds();
+		template <int N, typename RangeBounds>
+		WideMotionBounds<N>* BuildWideMotionBounds(const WideBVHNode<N>* nodes, const RangeBounds& rangeBounds) const;
+		template <int N>
+		const WideMotionBounds<N>* WideMotionNodes() const;
+		size_t GetMotionBoundsBytes() const;
+		void SetLeafFlags();
+		//Hash of the shapes' world space geometry and of the build settings
+		uint64_t ComputeCacheKey(const std::vector<BVHPrimitiveInfo>& primitiveInfo) const;
+		//Maps the nodes and the primitive order of a cached build, false when the file is missing or stale
+		bool LoadCache(const std::string& path, uint64_t key);
+		void SaveCache(const std::string& path, uint64_t key,
+			const std::vector<std::shared_ptr<Shape>>& originalPrims) const;
+		//SAH cost of testing n primitives in one leaf, relative to one scalar primitive test
+		float LeafCost(int n) const;
+		size_t GetNodeSize() const;
 
 		std::vector<Bounds3> m_prim_bounds, m_leaf_bounds;
-		Scene* m_scene_ptr;
+		Scene* m_scene_ptr = nullptr;
+		bool m_bottom_level = false;
 		std::vector<std::shared_ptr<Shape>> m_shapes;
+		TriangleBuffer m_triangles;
 
 		// Bvh Private Data
-		const int m_max_prims_in_node;
-		const SplitMethod m_split_method;
+		const BVHBuildOptions m_options;//Clamped, with a width of 2, 4 or 8 and the simd the cpu supports
+		const TriangleLeafKernel m_leaf_kernel;
+		const BoxKernel m_box_kernel;
+		const QuantizedBoxKernel m_quantized_box_kernel;
 		//std::vector<Face> faces;
+		//Only the one matching the width and quantized_nodes options is kept
 		LinearBVHNode* m_nodes = nullptr;
+		WideBVHNode<4>* m_nodes4 = nullptr;
+		WideBVHNode<8>* m_nodes8 = nullptr;
+		QuantizedBVHNode<4>* m_qnodes4 = nullptr;
+		QuantizedBVHNode<8>* m_qnodes8 = nullptr;
+		//Per node of the layout kept, with moving primitives only
+		LinearBounds* m_motion_nodes = nullptr;
+		WideMotionBounds<4>* m_motion_nodes4 = nullptr;
+		WideMotionBounds<8>* m_motion_nodes8 = nullptr;
+		int m_moving_prims = 0;
+		std::unique_ptr<MappedFile> m_cache_file;//Holds the nodes when they were loaded from the cache
+		std::vector<std::shared_ptr<BVH>> m_instanced_bvhs;//Of the top level BVH, nested meshes before the meshes instancing them
+		float m_refit_base_cost = -1.0f;//NodeSAHCost as built, taken before the first refit
+		float m_refit_cost = 0.0f;
+		Bounds3 m_bounds;
+		int m_total_nodes = 0;
+		int m_depth = 0;
+		float m_build_time = 0.0f;//seconds, wall clock
 	};
 }
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include "BVHCache.h"
+
+#include <cstdio>
+#include <fstream>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace CHR
+{
+	bool MappedFile::Open(const std::string& path)
+	{
+		Close();
+#if defined(_WIN32)
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		HANDLE mapping = nullptr;
+		if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+			mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		CloseHandle(file);
+		if (!mapping)
+			return false;
+		m_data = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+		CloseHandle(mapping);
+		if (!m_data)
+			return false;
+		m_size = (size_t)size.QuadPart;
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		void* data = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+			data = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED)
+			return false;
+		m_data = (uint8_t*)data;
+		m_size = (size_t)st.st_size;
+#endif
+		return true;
+	}
+
+	void MappedFile::Close()
+	{
+		if (!m_data)
+			return;
+#if defined(_WIN32)
+		UnmapViewOfFile(m_data);
+#else
+		munmap(m_data, m_size);
+#endif
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+	std::string GetBVHCachePath(const std::string& dir, uint64_t key)
+	{
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx.bvh", (unsigned long long)key);
+		if (dir.empty() || dir.back() == '/' || dir.back() == '\\')
+			return dir + name;
+		return dir + "/" + name;
+	}
+
+	bool WriteFileAtomic(const std::string& path, const std::vector<std::pair<const void*, size_t>>& chunks)
+	{
+#if defined(_WIN32)
+		std::string tmp_path = path + ".tmp" + std::to_string(GetCurrentProcessId());
+#else
+		std::string tmp_path = path + ".tmp" + std::to_string(getpid());
+#endif
+		{
+			std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+			for (auto& chunk : chunks)
+				out.write((const char*)chunk.first, chunk.second);
+			if (!out.good())
+			{
+				out.close();
+				std::remove(tmp_path.c_str());
+				return false;
+			}
+		}
+#if defined(_WIN32)
+		//rename does not replace an existing file there
+		std::remove(path.c_str());
+#endif
+		if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+		{
+			std::remove(tmp_path.c_str());
+			return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace CHR
+{
+	//64 bit hash of a stream of words, keys the on disk BVH cache
+	class ContentHash
+	{
+	public:
+		explicit ContentHash(uint64_t seed = 0) : m_state(seed ^ 0x9E3779B97F4A7C15ull) {}
+
+		inline void Add(uint64_t word)
+		{
+			m_state = (m_state ^ word) * 0xBF58476D1CE4E5B9ull;
+			m_state ^= m_state >> 31;
+		}
+		inline void Add(float value)
+		{
+			uint32_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			Add((uint64_t)bits);
+		}
+		inline void Add(const float* values, int count)
+		{
+			for (int i = 0; i < count; i++)
+				Add(values[i]);
+		}
+		inline uint64_t Get() const
+		{
+			//splitmix64 finalizer, spreads the last words over all bits
+			uint64_t h = m_state;
+			h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+			h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+			return h ^ (h >> 31);
+		}
+
+	private:
+		uint64_t m_state;
+	};
+
+	//Copy on write mapping of a whole file: it is read lazily and writes stay private to the process
+	class MappedFile
+	{
+	public:
+		MappedFile() {}
+		~MappedFile() { Close(); }
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		bool Open(const std::string& path);
+		void Close();
+		inline uint8_t* GetData() const { return m_data; }
+		inline size_t GetSize() const { return m_size; }
+
+	private:
+		uint8_t* m_data = nullptr;
+		size_t m_size = 0;
+	};
+
+	//<dir>/<key as 16 hex digits>.bvh
+	std::string GetBVHCachePath(const std::string& dir, uint64_t key);
+	//Writes the chunks to a temporary file next to path and renames it, so a reader never sees a partial
+	//file and concurrent renders of the same scene don't corrupt it
+	bool WriteFileAtomic(const std::string& path, const std::vector<std::pair<const void*, size_t>>& chunks);
+}
@@ -0,0 +1,189 @@
+#include "BoxKernels.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <ray-tracer/main/Geometry.h>
+
+#ifdef CHR_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace CHR
+{
+	//Far distances are pushed out as in Bounds3::IntersectP so rounding never drops a box the ray touches
+	static const float ROBUST_FAR = 1 + 2 * ((3 * MACHINE_EPSILON) / (1 - 3 * MACHINE_EPSILON));
+
+	template <int N>
+	static int IntersectBoxesScalar(const float* bounds, int count, const BoxRay& ray, float t_max, float* t_entry)
+	{
+		int mask = 0;
+		for (int i = 0; i < count; i++)
+		{
+			float t_near = -INFINITY, t_far = INFINITY;
+			for (int k = 0; k < 3; k++)
+			{
+				float t0 = (bounds[k * N + i] - ray.origin[k]) * ray.inv_dir[k];
+				float t1 = (bounds[(k + 3) * N + i] - ray.origin[k]) * ray.inv_dir[k];
+				t_near = std::max(t_near, std::min(t0, t1));
+				t_far = std::min(t_far, std::max(t0, t1) * ROBUST_FAR);
+			}
+			t_entry[i] = t_near;
+			if (t_near < t_far && t_far > ray.eps && t_near < t_max)
+				mask |= 1 << i;
+		}
+		return mask;
+	}
+
+	template <int N>
+	static int IntersectQuantizedBoxesScalar(const uint8_t* bounds, const float* origin, const float* scale, int count,
+		const BoxRay& ray, float t_max, float* t_entry)
+	{
+		alignas(32) float decoded[6 * N];
+		for (int k = 0; k < 3; k++)
+		{
+			for (int i = 0; i < count; i++)
+			{
+				decoded[k * N + i] = origin[k] + bounds[k * N + i] * scale[k];
+				decoded[(k + 3) * N + i] = origin[k] + bounds[(k + 3) * N + i] * scale[k];
+			}
+		}
+		return IntersectBoxesScalar<N>(decoded, count, ray, t_max, t_entry);
+	}
+
+#ifdef CHR_SIMD_X86
+	//Four quantized bounds to floats
+	CHR_TARGET("sse2")
+	static inline __m128 DecodeSSE(const uint8_t* q, __m128 origin, __m128 scale)
+	{
+		int packed;
+		std::memcpy(&packed, q, 4);
+		__m128i zero = _mm_setzero_si128();
+		__m128i x = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+		return _mm_add_ps(origin, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+	}
+
+	//N is 4 or 8, an 8 wide node is tested as two halves
+	template <int N>
+	CHR_TARGET("sse2")
+	static int IntersectBoxesSSE(const float* bounds, int count, const BoxRay& ray, float t_max, float* t_entry)
+	{
+		const __m128 eps = _mm_set1_ps(ray.eps), far_max = _mm_set1_ps(t_max), robust = _mm_set1_ps(ROBUST_FAR);
+		int mask = 0;
+		for (int b = 0; b < count; b += 4)
+		{
+			__m128 t_near = _mm_set1_ps(-INFINITY), t_far = _mm_set1_ps(INFINITY);
+			for (int k = 0; k < 3; k++)
+			{
+				__m128 o = _mm_set1_ps(ray.origin[k]), inv = _mm_set1_ps(ray.inv_dir[k]);
+				__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&bounds[k * N + b]), o), inv);
+				__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&bounds[(k + 3) * N + b]), o), inv);
+				t_near = _mm_max_ps(t_near, _mm_min_ps(t0, t1));
+				t_far = _mm_min_ps(t_far, _mm_mul_ps(_mm_max_ps(t0, t1), robust));
+			}
+			_mm_storeu_ps(&t_entry[b], t_near);
+			__m128 hit = _mm_and_ps(_mm_cmplt_ps(t_near, t_far),
+				_mm_and_ps(_mm_cmpgt_ps(t_far, eps), _mm_cmplt_ps(t_near, far_max)));
+			mask |= _mm_movemask_ps(hit) << b;
+		}
+		return mask & ((1 << count) - 1);
+	}
+
+	template <int N>
+	CHR_TARGET("sse2")
+	static int IntersectQuantizedBoxesSSE(const uint8_t* bounds, const float* origin, const float* scale, int count,
+		const BoxRay& ray, float t_max, float* t_entry)
+	{
+		const __m128 eps = _mm_set1_ps(ray.eps), far_max = _mm_set1_ps(t_max), robust = _mm_set1_ps(ROBUST_FAR);
+		int mask = 0;
+		for (int b = 0; b < count; b += 4)
+		{
+			__m128 t_near = _mm_set1_ps(-INFINITY), t_far = _mm_set1_ps(INFINITY);
+			for (int k = 0; k < 3; k++)
+			{
+				__m128 o = _mm_set1_ps(ray.origin[k]), inv = _mm_set1_ps(ray.inv_dir[k]);
+				__m128 base = _mm_set1_ps(origin[k]), step = _mm_set1_ps(scale[k]);
+				__m128 t0 = _mm_mul_ps(_mm_sub_ps(DecodeSSE(&bounds[k * N + b], base, step), o), inv);
+				__m128 t1 = _mm_mul_ps(_mm_sub_ps(DecodeSSE(&bounds[(k + 3) * N + b], base, step), o), inv);
+				t_near = _mm_max_ps(t_near, _mm_min_ps(t0, t1));
+				t_far = _mm_min_ps(t_far, _mm_mul_ps(_mm_max_ps(t0, t1), robust));
+			}
+			_mm_storeu_ps(&t_entry[b], t_near);
+			__m128 hit = _mm_and_ps(_mm_cmplt_ps(t_near, t_far),
+				_mm_and_ps(_mm_cmpgt_ps(t_far, eps), _mm_cmplt_ps(t_near, far_max)));
+			mask |= _mm_movemask_ps(hit) << b;
+		}
+		return mask & ((1 << count) - 1);
+	}
+
+	CHR_TARGET("avx")
+	static int IntersectQuantizedBoxes8AVX(const uint8_t* bounds, const float* origin, const float* scale, int count,
+		const BoxRay& ray, float t_max, float* t_entry)
+	{
+		__m256 t_near = _mm256_set1_ps(-INFINITY), t_far = _mm256_set1_ps(INFINITY);
+		for (int k = 0; k < 3; k++)
+		{
+			__m128 base = _mm_set1_ps(origin[k]), step = _mm_set1_ps(scale[k]);
+			__m256 lo = _mm256_insertf128_ps(_mm256_castps128_ps256(DecodeSSE(&bounds[k * 8], base, step)),
+				DecodeSSE(&bounds[k * 8 + 4], base, step), 1);
+			__m256 hi = _mm256_insertf128_ps(_mm256_castps128_ps256(DecodeSSE(&bounds[(k + 3) * 8], base, step)),
+				DecodeSSE(&bounds[(k + 3) * 8 + 4], base, step), 1);
+			__m256 o = _mm256_set1_ps(ray.origin[k]), inv = _mm256_set1_ps(ray.inv_dir[k]);
+			__m256 t0 = _mm256_mul_ps(_mm256_sub_ps(lo, o), inv);
+			__m256 t1 = _mm256_mul_ps(_mm256_sub_ps(hi, o), inv);
+			t_near = _mm256_max_ps(t_near, _mm256_min_ps(t0, t1));
+			t_far = _mm256_min_ps(t_far, _mm256_mul_ps(_mm256_max_ps(t0, t1), _mm256_set1_ps(ROBUST_FAR)));
+		}
+		_mm256_storeu_ps(t_entry, t_near);
+		__m256 hit = _mm256_and_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LT_OQ),
+			_mm256_and_ps(_mm256_cmp_ps(t_far, _mm256_set1_ps(ray.eps), _CMP_GT_OQ),
+				_mm256_cmp_ps(t_near, _mm256_set1_ps(t_max), _CMP_LT_OQ)));
+		return _mm256_movemask_ps(hit) & ((1 << count) - 1);
+	}
+
+	CHR_TARGET("avx")
+	static int IntersectBoxes8AVX(const float* bounds, int count, const BoxRay& ray, float t_max, float* t_entry)
+	{
+		__m256 t_near = _mm256_set1_ps(-INFINITY), t_far = _mm256_set1_ps(INFINITY);
+		for (int k = 0; k < 3; k++)
+		{
+			__m256 o = _mm256_set1_ps(ray.origin[k]), inv = _mm256_set1_ps(ray.inv_dir[k]);
+			__m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(&bounds[k * 8]), o), inv);
+			__m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(&bounds[(k + 3) * 8]), o), inv);
+			t_near = _mm256_max_ps(t_near, _mm256_min_ps(t0, t1));
+			t_far = _mm256_min_ps(t_far, _mm256_mul_ps(_mm256_max_ps(t0, t1), _mm256_set1_ps(ROBUST_FAR)));
+		}
+		_mm256_storeu_ps(t_entry, t_near);
+		__m256 hit = _mm256_and_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LT_OQ),
+			_mm256_and_ps(_mm256_cmp_ps(t_far, _mm256_set1_ps(ray.eps), _CMP_GT_OQ),
+				_mm256_cmp_ps(t_near, _mm256_set1_ps(t_max), _CMP_LT_OQ)));
+		return _mm256_movemask_ps(hit) & ((1 << count) - 1);
+	}
+#endif
+
+	BoxKernel GetBoxKernel(int width, SIMD_T isa)
+	{
+		if ((int)isa > (int)DetectSIMD())
+			isa = DetectSIMD();
+#ifdef CHR_SIMD_X86
+		if (width == 8 && isa == SIMD_T::avx)
+			return IntersectBoxes8AVX;
+		if (isa != SIMD_T::scalar)
+			return width == 8 ? IntersectBoxesSSE<8> : IntersectBoxesSSE<4>;
+#endif
+		return width == 8 ? IntersectBoxesScalar<8> : IntersectBoxesScalar<4>;
+	}
+
+	QuantizedBoxKernel GetQuantizedBoxKernel(int width, SIMD_T isa)
+	{
+		if ((int)isa > (int)DetectSIMD())
+			isa = DetectSIMD();
+#ifdef CHR_SIMD_X86
+		if (width == 8 && isa == SIMD_T::avx)
+			return IntersectQuantizedBoxes8AVX;
+		if (isa != SIMD_T::scalar)
+			return width == 8 ? IntersectQuantizedBoxesSSE<8> : IntersectQuantizedBoxesSSE<4>;
+#endif
+		return width == 8 ? IntersectQuantizedBoxesScalar<8> : IntersectQuantizedBoxesScalar<4>;
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <ray-tracer/accelerationStructures/TriangleKernels.h>
+
+namespace CHR
+{
+	//Ray data the child box tests of a wide BVH node share
+	struct BoxRay
+	{
+		float origin[3], inv_dir[3];
+		float eps;
+	};
+
+	//Slab test against the first count of width boxes stored as min x, y, z then max x, y, z, width floats each.
+	//Returns the bit mask of the boxes the ray enters in front of t_max, t_entry receives their entry distances
+	typedef int (*BoxKernel)(const float* bounds, int count, const BoxRay& ray, float t_max, float* t_entry);
+
+	//Same test on boxes quantized to 8 bits: a bound is origin[axis] + q * scale[axis],
+	//stored as width bytes per bound in the order of BoxKernel's floats
+	typedef int (*QuantizedBoxKernel)(const uint8_t* bounds, const float* origin, const float* scale, int count,
+		const BoxRay& ray, float t_max, float* t_entry);
+
+	//width 4 or 8, falls back to the widest instruction set the cpu supports
+	BoxKernel GetBoxKernel(int width, SIMD_T isa);
+	QuantizedBoxKernel GetQuantizedBoxKernel(int width, SIMD_T isa);
+}
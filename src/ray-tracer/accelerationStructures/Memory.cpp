@@ -1,6 +1,12 @@
-#include "memory.h"
+#include "Memory.h"
 
+#include <stdlib.h>
+
+#if defined(_MSC_VER)
 #define HAVE_ALIGNED_MALLOC
+#else
+#define HAVE_POSIX_MEMALIGN
+#endif
 
 namespace CHR
 {
@@ -0,0 +1,226 @@
+#include "TriangleKernels.h"
+
+#ifdef CHR_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace CHR
+{
+	static int IntersectLeafScalar(const TriangleBuffer& tris, int first, int count, const Ray& ray,
+		float& t, float& u, float& v)
+	{
+		Ray probe_ray(ray);
+		int hit_index = -1;
+		for (int i = 0; i < count; i++)
+		{
+			float t_i, u_i, v_i;
+			if (IntersectWorldTriangle(tris, first + i, probe_ray, t_i, u_i, v_i))
+			{
+				hit_index = i;
+				t = t_i; u = u_i; v = v_i;
+				probe_ray.t_max = t_i;
+			}
+		}
+		return hit_index;
+	}
+
+#ifdef CHR_SIMD_X86
+	//Same operations in the same order as IntersectWorldTriangle, so every lane gives the scalar result.
+	//Hit lanes are resolved in entry order, ties go to the first entry as in the scalar loop.
+	CHR_TARGET("sse2")
+	static int IntersectLeafSSE(const TriangleBuffer& tris, int first, int count, const Ray& ray,
+		float& t, float& u, float& v)
+	{
+		const __m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+		const __m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+		const __m128 eps = _mm_set1_ps(ray.intersect_eps);
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+		const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		const __m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+
+		float t_max = ray.t_max;
+		int hit_index = -1;
+		for (int b = 0; b < count; b += 4)
+		{
+			int i = first + b;
+			__m128 e1x = _mm_loadu_ps(&tris.edge1[0][i]), e1y = _mm_loadu_ps(&tris.edge1[1][i]), e1z = _mm_loadu_ps(&tris.edge1[2][i]);
+			__m128 e2x = _mm_loadu_ps(&tris.edge2[0][i]), e2y = _mm_loadu_ps(&tris.edge2[1][i]), e2z = _mm_loadu_ps(&tris.edge2[2][i]);
+
+			__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+			__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+			__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+			__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+			__m128 mask = _mm_cmpgt_ps(_mm_and_ps(det, abs_mask), eps);
+			mask = _mm_and_ps(mask, _mm_cmplt_ps(lane, _mm_set1_ps((float)(count - b))));
+			if (_mm_movemask_ps(mask) == 0)
+				continue;
+			__m128 inv_det = _mm_div_ps(one, det);
+
+			__m128 tx = _mm_sub_ps(ox, _mm_loadu_ps(&tris.v0[0][i]));
+			__m128 ty = _mm_sub_ps(oy, _mm_loadu_ps(&tris.v0[1][i]));
+			__m128 tz = _mm_sub_ps(oz, _mm_loadu_ps(&tris.v0[2][i]));
+			__m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+			mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(uu, zero), _mm_cmple_ps(uu, one)));
+
+			__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+			__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+			__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+			__m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+			mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(vv, zero), _mm_cmple_ps(_mm_add_ps(uu, vv), one)));
+
+			__m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+			mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(tt, eps), _mm_cmplt_ps(tt, _mm_set1_ps(t_max))));
+
+			int bits = _mm_movemask_ps(mask);
+			if (bits == 0)
+				continue;
+			alignas(16) float ts[4], us[4], vs[4];
+			_mm_store_ps(ts, tt);
+			_mm_store_ps(us, uu);
+			_mm_store_ps(vs, vv);
+			for (int k = 0; k < 4; k++)
+			{
+				if ((bits >> k & 1) && ts[k] < t_max)
+				{
+					t_max = ts[k];
+					hit_index = b + k;
+					t = ts[k]; u = us[k]; v = vs[k];
+				}
+			}
+		}
+		return hit_index;
+	}
+
+	CHR_TARGET("avx")
+	static int IntersectLeafAVX(const TriangleBuffer& tris, int first, int count, const Ray& ray,
+		float& t, float& u, float& v)
+	{
+		const __m256 dx = _mm256_set1_ps(ray.direction.x), dy = _mm256_set1_ps(ray.direction.y), dz = _mm256_set1_ps(ray.direction.z);
+		const __m256 ox = _mm256_set1_ps(ray.origin.x), oy = _mm256_set1_ps(ray.origin.y), oz = _mm256_set1_ps(ray.origin.z);
+		const __m256 eps = _mm256_set1_ps(ray.intersect_eps);
+		const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+		const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+		const __m256 lane = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+
+		float t_max = ray.t_max;
+		int hit_index = -1;
+		for (int b = 0; b < count; b += 8)
+		{
+			int i = first + b;
+			__m256 e1x = _mm256_loadu_ps(&tris.edge1[0][i]), e1y = _mm256_loadu_ps(&tris.edge1[1][i]), e1z = _mm256_loadu_ps(&tris.edge1[2][i]);
+			__m256 e2x = _mm256_loadu_ps(&tris.edge2[0][i]), e2y = _mm256_loadu_ps(&tris.edge2[1][i]), e2z = _mm256_loadu_ps(&tris.edge2[2][i]);
+
+			__m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+			__m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+			__m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+			__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+			__m256 mask = _mm256_cmp_ps(_mm256_and_ps(det, abs_mask), eps, _CMP_GT_OQ);
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(lane, _mm256_set1_ps((float)(count - b)), _CMP_LT_OQ));
+			if (_mm256_movemask_ps(mask) == 0)
+				continue;
+			__m256 inv_det = _mm256_div_ps(one, det);
+
+			__m256 tx = _mm256_sub_ps(ox, _mm256_loadu_ps(&tris.v0[0][i]));
+			__m256 ty = _mm256_sub_ps(oy, _mm256_loadu_ps(&tris.v0[1][i]));
+			__m256 tz = _mm256_sub_ps(oz, _mm256_loadu_ps(&tris.v0[2][i]));
+			__m256 uu = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), inv_det);
+			mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(uu, zero, _CMP_GE_OQ), _mm256_cmp_ps(uu, one, _CMP_LE_OQ)));
+
+			__m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+			__m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+			__m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+			__m256 vv = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inv_det);
+			mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(vv, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(uu, vv), one, _CMP_LE_OQ)));
+
+			__m256 tt = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inv_det);
+			mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(tt, eps, _CMP_GE_OQ), _mm256_cmp_ps(tt, _mm256_set1_ps(t_max), _CMP_LT_OQ)));
+
+			int bits = _mm256_movemask_ps(mask);
+			if (bits == 0)
+				continue;
+			alignas(32) float ts[8], us[8], vs[8];
+			_mm256_store_ps(ts, tt);
+			_mm256_store_ps(us, uu);
+			_mm256_store_ps(vs, vv);
+			for (int k = 0; k < 8; k++)
+			{
+				if ((bits >> k & 1) && ts[k] < t_max)
+				{
+					t_max = ts[k];
+					hit_index = b + k;
+					t = ts[k]; u = us[k]; v = vs[k];
+				}
+			}
+		}
+		return hit_index;
+	}
+
+	static bool CPUHasAVX()
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx");
+#elif defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		bool avx = (info[2] & (1 << 28)) != 0;
+		bool os_saves_ymm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+		return avx && os_saves_ymm;
+#else
+		return false;
+#endif
+	}
+#endif
+
+	SIMD_T DetectSIMD()
+	{
+#ifdef CHR_SIMD_X86
+		static const SIMD_T detected = CPUHasAVX() ? SIMD_T::avx : SIMD_T::sse;
+		return detected;
+#else
+		return SIMD_T::scalar;
+#endif
+	}
+
+	TriangleLeafKernel GetTriangleLeafKernel(SIMD_T isa)
+	{
+		if ((int)isa > (int)DetectSIMD())
+			isa = DetectSIMD();
+#ifdef CHR_SIMD_X86
+		if (isa == SIMD_T::avx)
+			return IntersectLeafAVX;
+		if (isa == SIMD_T::sse)
+			return IntersectLeafSSE;
+#endif
+		return IntersectLeafScalar;
+	}
+
+	int GetSIMDWidth(SIMD_T isa)
+	{
+		switch (isa)
+		{
+		case SIMD_T::avx:
+			return 8;
+		case SIMD_T::sse:
+			return 4;
+		default:
+			return 1;
+		}
+	}
+
+	std::string ToString(SIMD_T isa)
+	{
+		switch (isa)
+		{
+		case SIMD_T::avx:
+			return "avx";
+		case SIMD_T::sse:
+			return "sse";
+		default:
+			return "scalar";
+		}
+	}
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <ray-tracer/main/Ray.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CHR_SIMD_X86
+#endif
+
+//Wide kernels are compiled for their instruction set only, the build flags stay at the baseline
+#if defined(CHR_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CHR_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CHR_TARGET(isa)
+#endif
+
+namespace CHR
+{
+	class Triangle;
+
+	//World space triangles in BVH leaf order, entry i belongs to m_shapes[i]. Leaves test these with
+	//Moller-Trumbore directly, without a virtual call or moving the ray to object space.
+	//Lights, triangles with motion blur and other shapes have no entry and keep the object space path,
+	//their edges are zero so a wide test always misses them.
+	struct TriangleBuffer
+	{
+		//Entries past the end a full 8 wide load may read
+		static constexpr int PADDING = 8;
+
+		std::vector<float> v0[3], edge1[3], edge2[3];
+		std::vector<const Triangle*> triangles;	//nullptr for the shapes without an entry
+		int count = 0;
+
+		void Resize(size_t n)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				v0[k].assign(n + PADDING, 0.0f);
+				edge1[k].assign(n + PADDING, 0.0f);
+				edge2[k].assign(n + PADDING, 0.0f);
+			}
+			triangles.assign(n, nullptr);
+		}
+
+		inline size_t GetSizeBytes() const
+		{
+			return v0[0].size() * 9 * sizeof(float) + triangles.size() * sizeof(const Triangle*);
+		}
+	};
+
+	enum class SIMD_T { scalar, sse, avx, count };
+
+	//Tests entries [first, first + count) of the buffer, returns the offset from first of the closest
+	//hit in front of ray.t_max with its t and barycentrics, -1 for a miss
+	typedef int (*TriangleLeafKernel)(const TriangleBuffer& tris, int first, int count, const Ray& ray,
+		float& t, float& u, float& v);
+
+	//Widest instruction set the cpu supports, checked once
+	SIMD_T DetectSIMD();
+	//scalar, sse (4 wide) or avx (8 wide), falls back to the widest supported one
+	TriangleLeafKernel GetTriangleLeafKernel(SIMD_T isa);
+	int GetSIMDWidth(SIMD_T isa);
+	std::string ToString(SIMD_T isa);
+
+	//Moller-Trumbore against entry i of the world space triangle buffer,
+	//same barycentrics and t as Triangle::IntersectHit
+	inline bool IntersectWorldTriangle(const TriangleBuffer& tris, int i, const Ray& ray,
+		float& t, float& u, float& v)
+	{
+		const glm::vec3& d = ray.direction;
+		float e1x = tris.edge1[0][i], e1y = tris.edge1[1][i], e1z = tris.edge1[2][i];
+		float e2x = tris.edge2[0][i], e2y = tris.edge2[1][i], e2z = tris.edge2[2][i];
+
+		float px = d.y * e2z - d.z * e2y;
+		float py = d.z * e2x - d.x * e2z;
+		float pz = d.x * e2y - d.y * e2x;
+		float det = e1x * px + e1y * py + e1z * pz;
+		if (fabs(det) <= ray.intersect_eps) return false;
+		float inv_det = 1.0f / det;
+
+		float tx = ray.origin.x - tris.v0[0][i];
+		float ty = ray.origin.y - tris.v0[1][i];
+		float tz = ray.origin.z - tris.v0[2][i];
+		u = (tx * px + ty * py + tz * pz) * inv_det;
+		if (u < 0.0f || u > 1.0f) return false;
+
+		float qx = ty * e1z - tz * e1y;
+		float qy = tz * e1x - tx * e1z;
+		float qz = tx * e1y - ty * e1x;
+		v = (d.x * qx + d.y * qy + d.z * qz) * inv_det;
+		if (v < 0.0f || u + v > 1.0f) return false;
+
+		t = (e2x * qx + e2y * qy + e2z * qz) * inv_det;
+		return t >= ray.intersect_eps && t < ray.t_max;
+	}
+}
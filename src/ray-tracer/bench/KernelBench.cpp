@@ -0,0 +1,516 @@
+//Intersection kernel microbenchmark: times the primitive, bounding box and BVH intersection
+//routines on seeded synthetic ray sets, single threaded and without shading or image output.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <thirdparty/glm/glm/glm.hpp>
+#include <thirdparty/glm/glm/gtc/constants.hpp>
+#include <thirdparty/glm/glm/gtc/matrix_transform.hpp>
+#include <thirdparty/glm/glm/gtx/component_wise.hpp>
+
+#include <ray-tracer/accelerationStructures/BVH.h>
+#include <ray-tracer/editor/AssetImporter.h>
+#include <ray-tracer/editor/Logger.h>
+#include <ray-tracer/editor/Settings.h>
+#include <ray-tracer/main/Scene.h>
+#include <ray-tracer/main/SceneObject.h>
+#include <ray-tracer/main/Shape.h>
+
+struct RaySet
+{
+	std::string name;
+	std::vector<CHR::Ray> rays;
+};
+
+struct KernelResult
+{
+	double seconds = 0.0;//best pass
+	unsigned long long tests = 0;//per pass
+	unsigned long long hits = 0;//per pass
+};
+
+//Primitives every ray of the primitive kernels is tested against
+struct PrimitivePool
+{
+	std::shared_ptr<CHR::SceneObject> tri_object;
+	std::vector<const CHR::Shape*> triangles;
+	CHR::TriangleBuffer triangle_buffer;//the pool triangles for the BVH leaf kernels
+	std::vector<std::shared_ptr<CHR::Sphere>> spheres;
+	std::vector<CHR::Bounds3> boxes;
+	//Shapes keep pointers to their transforms, reserved up front so they never move
+	std::vector<glm::mat4> transforms;
+};
+
+static void PrintUsage()
+{
+	std::cout << "usage: chroma-kernel-bench [options]\n"
+		<< "\t-r <count>\trays per ray set, default 65536\n"
+		<< "\t-n <count>\ttimed passes per kernel, the fastest is reported, default 5\n"
+		<< "\t-g <count>\tsegments of the synthetic BVH mesh, default 256 (65k triangles)\n"
+		<< "\t-k <count>\tsegments of the primitive pool mesh, default 8 (64 primitives)\n"
+		<< "\t-p <count>\tmax primitives in a BVH leaf, default 8\n"
+		<< "\t-w <2|4|8>\tchildren per BVH node, default 2\n"
+		<< "\t-u <count>\tSAH buckets per BVH split, 2 to 64, default 12\n"
+		<< "\t-f <dfs|clustered|quantized>\tBVH node format: depth first, cache line clustered binary nodes\n"
+		<< "\t\t\tor quantized wide nodes, default dfs\n"
+		<< "\t-i <scene.xml>\talso time BVH::Intersect on the scene's BVH\n"
+		<< "\t-x <seed>\tray set seed, default 1\n";
+}
+
+//========================================================================================================================//
+
+//Bumpy uv sphere of radius ~1 around the origin, deterministic for a given segment count.
+//The bumps are deep enough for some diffuse bounces to hit the surface again.
+static std::shared_ptr<CHR::Mesh> CreateBumpySphere(int segments)
+{
+	const float pi = glm::pi<float>();
+	int rings = std::max(2, segments / 2);
+	segments = std::max(3, segments);
+
+	std::vector<glm::vec3> positions, normals, colors;
+	std::vector<glm::vec2> uvs;
+	std::vector<unsigned int> indices;
+
+	for (int j = 0; j <= rings; j++)
+	{
+		float theta = pi * j / rings;
+		for (int i = 0; i <= segments; i++)
+		{
+			float phi = 2.0f * pi * i / segments;
+			glm::vec3 n = { std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) };
+			float r = 1.0f + 0.2f * std::sin(5.0f * theta) * std::sin(6.0f * phi);
+			positions.push_back(r * n);
+			normals.push_back(n);
+		}
+	}
+	for (int j = 0; j < rings; j++)
+	{
+		for (int i = 0; i < segments; i++)
+		{
+			unsigned int a = j * (segments + 1) + i;
+			unsigned int b = a + segments + 1;
+			indices.insert(indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+		}
+	}
+	return std::make_shared<CHR::Mesh>(positions, normals, uvs, colors, indices);
+}
+
+static PrimitivePool CreatePrimitivePool(int segments)
+{
+	PrimitivePool pool;
+	pool.tri_object = std::make_shared<CHR::SceneObject>(CreateBumpySphere(segments), "pool");
+	for (auto& shape : pool.tri_object->m_mesh->m_shapes)
+		pool.triangles.push_back(shape.get());
+
+	size_t count = pool.triangles.size();
+	pool.transforms.reserve(2 * count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const CHR::Triangle* tri = static_cast<const CHR::Triangle*>(pool.triangles[i]);
+		glm::vec3 centroid = (tri->Vertex(0) + tri->Vertex(1) + tri->Vertex(2)) / 3.0f;
+
+		auto sphere = std::make_shared<CHR::Sphere>(nullptr);
+		pool.transforms.push_back(glm::scale(glm::translate(glm::mat4(1.0f), centroid), glm::vec3(0.2f)));
+		pool.transforms.push_back(glm::inverse(pool.transforms.back()));
+		sphere->SetTransform(&pool.transforms[pool.transforms.size() - 2], &pool.transforms.back());
+		pool.spheres.push_back(sphere);
+		pool.boxes.push_back(sphere->GetWorldBounds());
+
+		//The pool object has no transform, object space is world space
+		glm::vec3 v0 = tri->Vertex(0), e1 = tri->Vertex(1) - v0, e2 = tri->Vertex(2) - v0;
+		if (i == 0)
+			pool.triangle_buffer.Resize(count);
+		for (int k = 0; k < 3; k++)
+		{
+			pool.triangle_buffer.v0[k][i] = v0[k];
+			pool.triangle_buffer.edge1[k][i] = e1[k];
+			pool.triangle_buffer.edge2[k][i] = e2[k];
+		}
+		pool.triangle_buffer.triangles[i] = tri;
+	}
+	return pool;
+}
+
+//========================================================================================================================//
+
+//Coherent camera rays at the bvh, diffuse bounces off their hits and shadow rays from the hits to a point light
+static std::vector<RaySet> CreateRaySets(const CHR::BVH& bvh, int ray_count, unsigned int seed)
+{
+	std::mt19937 gen(seed);
+	std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+	auto settings = CHR::Settings::GetInstance();
+
+	CHR::Bounds3 bounds = bvh.WorldBound();
+	glm::vec3 center = 0.5f * (bounds.min + bounds.max);
+	float radius = 0.5f * glm::compMax(bounds.Diagonal());
+	float offset_eps = 1e-3f * radius;
+
+	std::vector<RaySet> sets(3);
+	sets[0].name = "coherent";
+	sets[1].name = "incoherent";
+	sets[2].name = "shadow";
+
+	//Pinhole camera on +z, scanline order over a square grid framing the bounds
+	int side = std::max(1, (int)std::sqrt((double)ray_count));
+	glm::vec3 eye = center + glm::vec3(0.0f, 0.0f, 0.5f * bounds.Diagonal().z + 2.0f * radius);
+	std::vector<glm::vec3> hit_positions, hit_normals;
+	for (int j = 0; j < side; j++)
+	{
+		for (int i = 0; i < side; i++)
+		{
+			glm::vec3 target = center + radius * glm::vec3(2.0f * (i + 0.5f) / side - 1.0f, 1.0f - 2.0f * (j + 0.5f) / side, 0.0f);
+			CHR::Ray ray(eye, glm::normalize(target - eye));
+			sets[0].rays.push_back(ray);
+
+			CHR::IntersectionData data;
+			if (bvh.Intersect(ray, &data))
+			{
+				glm::vec3 n = glm::normalize(data.normal);
+				hit_positions.push_back(data.position);
+				hit_normals.push_back(glm::dot(n, ray.direction) > 0.0f ? -n : n);
+			}
+		}
+	}
+
+	glm::vec3 light_pos = center + radius * glm::vec3(1.0f, 3.0f, 2.0f);
+	for (int k = 0; k < side * side; k++)
+	{
+		glm::vec3 p, n;
+		if (hit_positions.empty())
+		{
+			//Nothing was hit, fall back to random rays from inside the bounds
+			p = bounds.min + glm::vec3(dis(gen), dis(gen), dis(gen)) * bounds.Diagonal();
+			n = glm::normalize(glm::vec3(dis(gen), dis(gen), dis(gen)) - 0.5f);
+		}
+		else
+		{
+			p = hit_positions[k % hit_positions.size()];
+			n = hit_normals[k % hit_normals.size()];
+		}
+
+		//Cosine weighted direction around the normal
+		float r = std::sqrt(dis(gen));
+		float phi = 2.0f * glm::pi<float>() * dis(gen);
+		glm::vec3 t = glm::normalize(glm::abs(n.x) > 0.9f ? glm::cross(n, glm::vec3(0, 1, 0)) : glm::cross(n, glm::vec3(1, 0, 0)));
+		glm::vec3 b = glm::cross(n, t);
+		glm::vec3 dir = r * std::cos(phi) * t + r * std::sin(phi) * b + std::sqrt(std::max(0.0f, 1.0f - r * r)) * n;
+
+		CHR::Ray bounce(p + n * offset_eps, glm::normalize(dir));
+		bounce.intersect_eps = settings->m_intersection_eps;
+		sets[1].rays.push_back(bounce);
+
+		CHR::Ray shadow(p + n * offset_eps, glm::normalize(light_pos - p));
+		shadow.intersect_eps = settings->m_intersection_eps;
+		sets[2].rays.push_back(shadow);
+	}
+	return sets;
+}
+
+//========================================================================================================================//
+
+//Runs kernel over the ray set passes times, kernel returns the number of hits and adds its tests
+template <typename Kernel>
+static KernelResult TimeKernel(const std::vector<CHR::Ray>& rays, int passes, Kernel kernel)
+{
+	KernelResult result;
+	result.seconds = INFINITY;
+	for (int pass = 0; pass < passes; pass++)
+	{
+		unsigned long long tests = 0;
+		auto start = std::chrono::steady_clock::now();
+		unsigned long long hits = kernel(rays, tests);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		result.seconds = std::min(result.seconds, elapsed.count());
+		result.tests = tests;
+		result.hits = hits;
+	}
+	return result;
+}
+
+static void Report(const std::string& kernel, const RaySet& set, const KernelResult& result)
+{
+	char line[256];
+	snprintf(line, sizeof(line), "%-30s %-10s %10.2f ns/ray %10.2f Mtests/s %8.3f hits/ray",
+		kernel.c_str(), set.name.c_str(),
+		1e9 * result.seconds / set.rays.size(),
+		result.tests / (1e6 * result.seconds),
+		(double)result.hits / set.rays.size());
+	CH_INFO(line);
+}
+
+static unsigned long long IntersectShapes(const std::vector<CHR::Ray>& rays, unsigned long long& tests,
+	const std::vector<const CHR::Shape*>& shapes)
+{
+	unsigned long long hits = 0;
+	CHR::IntersectionData data;
+	for (const CHR::Ray& ray : rays)
+		for (const CHR::Shape* shape : shapes)
+			hits += shape->Intersect(ray, &data) ? 1 : 0;
+	tests = rays.size() * shapes.size();
+	return hits;
+}
+
+//any_hit times IntersectP with an unbounded t_max instead of the closest hit query
+static void BenchBVH(const std::string& name, const CHR::BVH& bvh, const std::vector<RaySet>& sets, int passes, bool any_hit = false)
+{
+	for (const RaySet& set : sets)
+	{
+		Report(name, set, TimeKernel(set.rays, passes, [&](const std::vector<CHR::Ray>& rays, unsigned long long& tests) {
+			//A BVH test is a node or a primitive visited
+			unsigned long long hits = 0;
+			CHR::t_traversal_stats = CHR::TraversalStats();
+			for (const CHR::Ray& ray : rays)
+			{
+				CHR::IntersectionData data;
+				hits += (any_hit ? bvh.IntersectP(ray) : bvh.Intersect(ray, &data)) ? 1 : 0;
+			}
+			tests = CHR::t_traversal_stats.nodes_visited + CHR::t_traversal_stats.primitive_tests;
+			return hits;
+		}));
+	}
+}
+
+//Closest hit distance per ray, INFINITY for a miss, and the nodes visited per ray
+static std::vector<float> TraceHits(const CHR::AccelerationStructure& accel, const std::vector<RaySet>& sets, double& nodes_per_ray)
+{
+	std::vector<float> hits;
+	CHR::t_traversal_stats = CHR::TraversalStats();
+	for (const RaySet& set : sets)
+	{
+		for (const CHR::Ray& ray : set.rays)
+		{
+			CHR::IntersectionData data;
+			hits.push_back(accel.Intersect(ray, &data) ? data.t : INFINITY);
+		}
+	}
+	nodes_per_ray = CHR::t_traversal_stats.nodes_visited / (double)std::max<size_t>(1, hits.size());
+	return hits;
+}
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+//Moves a mesh next to a larger one, and an instance of it, further in every step, refits the BVH and compares it
+//with a BVH built at the same position: update times, rays whose hits differ (should be none) and nodes per ray
+static void BenchRefit(int segments, const CHR::BVHBuildOptions& bvh_options, int ray_count, unsigned int seed)
+{
+	CHR::Scene scene("kernel-bench-refit");
+	auto moving = std::make_shared<CHR::SceneObject>(CreateBumpySphere(segments / 2), "moving");
+	auto instance = std::shared_ptr<CHR::SceneObject>(CHR::SceneObject::CreateInstance("instance", moving));
+	scene.AddSceneObject("fixed", std::make_shared<CHR::SceneObject>(CreateBumpySphere(segments), "fixed"));
+	scene.AddSceneObject("moving", moving);
+	scene.AddSceneObject("instance", instance);
+	auto build = [&]() {
+		scene.InitBVH(bvh_options);
+	};
+
+	const glm::vec3 moving_start(2.5f, 0.0f, 0.0f), instance_start(-2.5f, 0.0f, 0.0f);
+	moving->SetPosition(moving_start);
+	instance->SetPosition(instance_start);
+	build();
+	std::vector<RaySet> sets = CreateRaySets(*static_cast<const CHR::BVH*>(scene.GetAccelerationStructure()), ray_count, seed);
+
+	const float offsets[] = { 0.05f, 0.25f, 1.0f, 4.0f };
+	for (float offset : offsets)
+	{
+		moving->SetPosition(moving_start);
+		instance->SetPosition(instance_start);
+		build();
+
+		moving->SetPosition(moving_start + glm::vec3(0.0f, offset, 0.0f));
+		instance->SetPosition(instance_start - glm::vec3(0.0f, 0.0f, offset));
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool rebuilt = scene.UpdateBVH();
+		double update_ms = MillisecondsSince(start);
+		double refit_nodes, build_nodes;
+		std::vector<float> refit_hits = TraceHits(*scene.GetAccelerationStructure(), sets, refit_nodes);
+
+		start = std::chrono::steady_clock::now();
+		build();
+		double build_ms = MillisecondsSince(start);
+		std::vector<float> build_hits = TraceHits(*scene.GetAccelerationStructure(), sets, build_nodes);
+
+		int differ = 0;
+		for (size_t i = 0; i < refit_hits.size(); i++)
+			differ += refit_hits[i] == build_hits[i] ? 0 : 1;
+
+		char line[256];
+		std::snprintf(line, sizeof(line), "BVH refit, offset %5.2f   %s %8.2f ms   build %8.2f ms   %d/%d hits differ   %6.2f vs %6.2f nodes/ray",
+			offset, rebuilt ? "rebuild" : "refit  ", update_ms, build_ms, differ, (int)refit_hits.size(), refit_nodes, build_nodes);
+		CH_INFO(line);
+	}
+}
+
+//========================================================================================================================//
+
+int main(int argc, char** argv)
+{
+	CHR::Logger::Init("1.19.0");
+
+	int ray_count = 1 << 16;
+	int passes = 5;
+	int bvh_segments = 256;
+	int pool_segments = 8;
+	CHR::BVHBuildOptions bvh_options;
+	bvh_options.max_prims_in_node = 8;
+	unsigned int seed = 1;
+	std::string scene_path = "";
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg.compare("-h") == 0)
+		{
+			PrintUsage();
+			return 0;
+		}
+		if (i + 1 >= argc)
+		{
+			CH_ERROR("Missing value for option " + arg);
+			PrintUsage();
+			return 1;
+		}
+		std::string val = argv[++i];
+
+		if (arg.compare("-r") == 0)
+			ray_count = std::max(1, std::atoi(val.c_str()));
+		else if (arg.compare("-n") == 0)
+			passes = std::max(1, std::atoi(val.c_str()));
+		else if (arg.compare("-g") == 0)
+			bvh_segments = std::max(3, std::atoi(val.c_str()));
+		else if (arg.compare("-k") == 0)
+			pool_segments = std::max(3, std::atoi(val.c_str()));
+		else if (arg.compare("-p") == 0)
+			bvh_options.max_prims_in_node = std::max(1, std::atoi(val.c_str()));
+		else if (arg.compare("-u") == 0)
+			bvh_options.sah_buckets = std::atoi(val.c_str());
+		else if (arg.compare("-w") == 0)
+			bvh_options.width = std::atoi(val.c_str());
+		else if (arg.compare("-f") == 0)
+		{
+			bvh_options.clustered_layout = val.compare("clustered") == 0;
+			bvh_options.quantized_nodes = val.compare("quantized") == 0;
+			if (!bvh_options.clustered_layout && !bvh_options.quantized_nodes && val.compare("dfs") != 0)
+			{
+				CH_ERROR("Unknown node format " + val);
+				return 1;
+			}
+		}
+		else if (arg.compare("-x") == 0)
+			seed = (unsigned int)std::atoi(val.c_str());
+		else if (arg.compare("-i") == 0)
+			scene_path = val;
+		else
+		{
+			CH_ERROR("Unknown option " + arg);
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	//Synthetic scene: the bvh mesh and the primitive pool are both spheres of radius ~1 at the origin,
+	//so the ray sets generated against the bvh hit the pool as well
+	CHR::Scene scene("kernel-bench");
+	scene.AddSceneObject("mesh", std::make_shared<CHR::SceneObject>(CreateBumpySphere(bvh_segments), "mesh"));
+	scene.InitBVH(bvh_options);
+	const CHR::BVH& bvh = *static_cast<const CHR::BVH*>(scene.GetAccelerationStructure());
+
+	PrimitivePool pool = CreatePrimitivePool(pool_segments);
+	std::vector<RaySet> sets = CreateRaySets(bvh, ray_count, seed);
+
+	std::vector<const CHR::Shape*> spheres;
+	for (auto& s : pool.spheres)
+		spheres.push_back(s.get());
+
+	CH_INFO(std::to_string(sets[0].rays.size()) + " rays per set, " + std::to_string(pool.triangles.size()) +
+		" primitives per pool, " + std::to_string(bvh.GetNodeCount()) + " " + std::to_string(bvh.GetWidth()) + " wide BVH nodes (" +
+		std::to_string(bvh.GetSizeBytes() / 1024) + " KB), best of " + std::to_string(passes) + " passes");
+
+	for (const RaySet& set : sets)
+	{
+		Report("Triangle::Intersect", set, TimeKernel(set.rays, passes, [&](const std::vector<CHR::Ray>& rays, unsigned long long& tests) {
+			return IntersectShapes(rays, tests, pool.triangles);
+		}));
+		Report("Sphere::Intersect", set, TimeKernel(set.rays, passes, [&](const std::vector<CHR::Ray>& rays, unsigned long long& tests) {
+			return IntersectShapes(rays, tests, spheres);
+		}));
+		//The whole pool as one leaf, a hit is the closest of the pool
+		for (int isa = 0; isa <= (int)CHR::DetectSIMD(); isa++)
+		{
+			CHR::TriangleLeafKernel leaf_kernel = CHR::GetTriangleLeafKernel((CHR::SIMD_T)isa);
+			int count = (int)pool.triangles.size();
+			Report("TriangleLeafKernel (" + CHR::ToString((CHR::SIMD_T)isa) + ")", set, TimeKernel(set.rays, passes, [&](const std::vector<CHR::Ray>& rays, unsigned long long& tests) {
+				unsigned long long hits = 0;
+				float t, u, v;
+				for (const CHR::Ray& ray : rays)
+					hits += leaf_kernel(pool.triangle_buffer, 0, count, ray, t, u, v) >= 0 ? 1 : 0;
+				tests = rays.size() * count;
+				return hits;
+			}));
+		}
+		Report("Bounds3::IntersectP", set, TimeKernel(set.rays, passes, [&](const std::vector<CHR::Ray>& rays, unsigned long long& tests) {
+			unsigned long long hits = 0;
+			float t0, t1;
+			for (const CHR::Ray& ray : rays)
+				for (const CHR::Bounds3& box : pool.boxes)
+					hits += box.IntersectP(ray, &t0, &t1) ? 1 : 0;
+			tests = rays.size() * pool.boxes.size();
+			return hits;
+		}));
+
+		//The BVH computes the reciprocal direction once per ray, so it is kept out of the timed loop here too
+		std::vector<glm::vec3> inv_dirs(set.rays.size());
+		std::vector<glm::ivec3> dir_is_neg(set.rays.size());
+		for (size_t i = 0; i < set.rays.size(); i++)
+		{
+			const CHR::Ray& ray = set.rays[i];
+			inv_dirs[i] = 1.0f / ray.direction;
+			dir_is_neg[i] = { inv_dirs[i].x < ray.intersect_eps, inv_dirs[i].y < ray.intersect_eps, inv_dirs[i].z < ray.intersect_eps };
+		}
+		Report("Bounds3::IntersectP(inv_dir)", set, TimeKernel(set.rays, passes, [&](const std::vector<CHR::Ray>& rays, unsigned long long& tests) {
+			unsigned long long hits = 0;
+			for (size_t i = 0; i < rays.size(); i++)
+				for (const CHR::Bounds3& box : pool.boxes)
+					hits += box.IntersectP(rays[i], inv_dirs[i], &dir_is_neg[i].x) ? 1 : 0;
+			tests = rays.size() * pool.boxes.size();
+			return hits;
+		}));
+	}
+	BenchBVH("BVH::Intersect", bvh, sets, passes);
+	BenchBVH("BVH::IntersectP", bvh, sets, passes, true);
+
+	//Same mesh through a MeshInstance: a top level BVH with one instance over the mesh's own BVH.
+	//The base object is kept out of the scene so only the instance is traced.
+	CHR::Scene inst_scene("kernel-bench-instanced");
+	auto base = std::make_shared<CHR::SceneObject>(CreateBumpySphere(bvh_segments), "mesh");
+	inst_scene.AddSceneObject("instance", std::shared_ptr<CHR::SceneObject>(CHR::SceneObject::CreateInstance("instance", base)));
+	inst_scene.InitBVH(bvh_options);
+	BenchBVH("BVH::Intersect (instanced)", *static_cast<const CHR::BVH*>(inst_scene.GetAccelerationStructure()), sets, passes);
+
+	BenchRefit(bvh_segments, bvh_options, ray_count, seed);
+
+	if (!scene_path.empty())
+	{
+		CHR::Scene* file_scene = CHR::AssetImporter::LoadSceneFromXML(nullptr, scene_path);
+		file_scene->InitBVH(bvh_options);
+		const CHR::BVH& file_bvh = *static_cast<const CHR::BVH*>(file_scene->GetAccelerationStructure());
+
+		CH_INFO(scene_path + ": " + std::to_string(file_bvh.GetNodeCount()) + " " + std::to_string(file_bvh.GetWidth()) + " wide BVH nodes (" +
+			std::to_string(file_bvh.GetSizeBytes() / 1024) + " KB)");
+		std::vector<RaySet> file_sets = CreateRaySets(file_bvh, ray_count, seed);
+		BenchBVH("BVH::Intersect (scene)", file_bvh, file_sets, passes);
+		BenchBVH("BVH::IntersectP (scene)", file_bvh, file_sets, passes, true);
+		delete file_scene;
+	}
+	return 0;
+}
@@ -0,0 +1,555 @@
+//Scene benchmark: renders the shipped scenes headless, writes the timings as json
+//and optionally flags regressions against a previous run.
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <ray-tracer/accelerationStructures/BVH.h>
+#include <ray-tracer/editor/AssetImporter.h>
+#include <ray-tracer/editor/Logger.h>
+#include <ray-tracer/editor/Profiler.h>
+#include <ray-tracer/editor/Settings.h>
+#include <ray-tracer/main/RayTracer.h>
+#include <ray-tracer/main/Scene.h>
+
+struct BenchResult
+{
+	std::string scene;
+	std::string camera;
+	std::string mode;
+	double parse_time = 0.0;//seconds
+	double bvh_build_time = 0.0;//seconds
+	int bvh_nodes = 0;
+	double render_time = 0.0;//seconds
+	double primary_mrays = 0.0;//per second
+	double secondary_mrays = 0.0;//per second
+	double peak_rss_mb = 0.0;
+
+	unsigned long long camera_rays = 0;
+	unsigned long long shadow_rays = 0;
+	unsigned long long reflection_rays = 0;
+	unsigned long long dielectric_reflection_rays = 0;
+	unsigned long long refraction_rays = 0;
+	unsigned long long gi_rays = 0;
+	unsigned long long rr_terminations = 0;
+	double nodes_per_ray = 0.0;
+	double prim_tests_per_ray = 0.0;
+	unsigned long long prim_hits = 0;
+
+	//Why the scene could not be benchmarked, empty on success. Failed scenes have no camera or metrics
+	std::string error;
+
+	inline std::string Key() const { return scene + "|" + camera + "|" + mode; }
+};
+
+static const char* s_mode_names[] = { "cast", "rt", "pt", "wpt" };
+
+static void PrintUsage()
+{
+	std::cout << "usage: chroma-bench [options]\n"
+		<< "\t-r <dir>\tscenes root, default ../../assets/scenes\n"
+		<< "\t-f <text>\tonly scenes whose path contains text\n"
+		<< "\t-o <file>\tjson output, default bench.json\n"
+		<< "\t-b <file>\tbaseline json to compare the run against\n"
+		<< "\t-d <base> <new>\tcompare two result files without rendering\n"
+		<< "\t-x <percent>\tallowed slowdown before a metric is flagged, default 10\n"
+		<< "\t-t <count>\tthread count\n"
+		<< "\t-s <scale>\tresolution scale, default 1\n"
+		<< "\t-n <count>\tsamples per pixel override\n"
+		<< "\t-a <1|4|8|16>\tcamera rays of neighbouring pixels traced as one packet, default 16\n"
+		<< "\t-m <cast|rt|pt|wpt>\trender mode override, default from the camera's Renderer tag\n"
+		<< "\t-p <count>\tmax primitives in a BVH leaf, default 8\n"
+		<< "\t-w <2|4|8>\tchildren per BVH node, default 2\n"
+		<< "\t-u <count>\tSAH buckets per BVH split, 2 to 64, default 12\n"
+		<< "\t-P\t\tlog a per phase time breakdown for every camera\n";
+}
+
+//Peak resident set size since the last reset, in MB
+static void ResetPeakRSS()
+{
+#if !defined(_WIN32)
+	//Writing 5 to clear_refs resets VmHWM, Windows has no equivalent so peaks are process wide there
+	std::ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+static double GetPeakRSS()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return pmc.PeakWorkingSetSize / (1024.0 * 1024.0);
+	return 0.0;
+#else
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line))
+		if (line.compare(0, 6, "VmHWM:") == 0)
+			return std::stod(line.substr(6)) / 1024.0;
+	return 0.0;
+#endif
+}
+
+//========================================================================================================================//
+
+//Quoted json string, names are free text and paths may contain backslashes
+static std::string JsonString(const std::string& value)
+{
+	std::ostringstream out;
+	out << '"';
+	for (char c : value)
+	{
+		if (c == '"' || c == '\\')
+			out << '\\' << c;
+		else if (c == '\n')
+			out << "\\n";
+		else if (c == '\t')
+			out << "\\t";
+		else if (c == '\r')
+			out << "\\r";
+		else if ((unsigned char)c < 0x20)
+			out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec;
+		else
+			out << c;
+	}
+	out << '"';
+	return out.str();
+}
+
+//Reads the json string whose opening quote is at text[pos], pos is left past the closing quote
+static std::string ReadJsonString(const std::string& text, size_t& pos)
+{
+	std::string value;
+	for (pos++; pos < text.size() && text[pos] != '"'; pos++)
+	{
+		char c = text[pos];
+		if (c != '\\' || pos + 1 >= text.size())
+		{
+			value += c;
+			continue;
+		}
+		switch (c = text[++pos])
+		{
+		case 'n': value += '\n'; break;
+		case 't': value += '\t'; break;
+		case 'r': value += '\r'; break;
+		case 'b': value += '\b'; break;
+		case 'f': value += '\f'; break;
+		case 'u':
+		{
+			//Only what JsonString writes is expected, other code points are kept as '?'
+			int code = (int)std::strtol(text.substr(pos + 1, 4).c_str(), nullptr, 16);
+			value += code < 0x80 ? (char)code : '?';
+			pos = std::min(pos + 4, text.size() - 1);
+			break;
+		}
+		default: value += c; break;//quote, backslash and slash
+		}
+	}
+	pos++;
+	return value;
+}
+
+static void WriteResults(const std::string& path, const std::vector<BenchResult>& results)
+{
+	std::ofstream out(path);
+	out << std::fixed << std::setprecision(4);
+	out << "{\n\t\"threads\": " << CHR::Settings::GetInstance()->m_thread_count << ",\n\t\"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult& r = results[i];
+		out << "\t\t{ \"scene\": " << JsonString(r.scene);
+		if (!r.error.empty())
+		{
+			out << ", \"error\": " << JsonString(r.error) << " }" << (i + 1 < results.size() ? ",\n" : "\n");
+			continue;
+		}
+		out << ", \"camera\": " << JsonString(r.camera) << ", \"mode\": " << JsonString(r.mode)
+			<< ", \"parse_s\": " << r.parse_time
+			<< ", \"bvh_build_s\": " << r.bvh_build_time
+			<< ", \"bvh_nodes\": " << r.bvh_nodes
+			<< ", \"render_s\": " << r.render_time
+			<< ", \"primary_mrays_s\": " << r.primary_mrays
+			<< ", \"secondary_mrays_s\": " << r.secondary_mrays
+			<< ", \"peak_rss_mb\": " << r.peak_rss_mb
+			<< ", \"camera_rays\": " << r.camera_rays
+			<< ", \"shadow_rays\": " << r.shadow_rays
+			<< ", \"reflection_rays\": " << r.reflection_rays
+			<< ", \"dielectric_reflection_rays\": " << r.dielectric_reflection_rays
+			<< ", \"refraction_rays\": " << r.refraction_rays
+			<< ", \"gi_rays\": " << r.gi_rays
+			<< ", \"rr_terminations\": " << r.rr_terminations
+			<< ", \"nodes_per_ray\": " << r.nodes_per_ray
+			<< ", \"prim_tests_per_ray\": " << r.prim_tests_per_ray
+			<< ", \"prim_hits\": " << r.prim_hits << " }"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	out << "\t]\n}\n";
+}
+
+//Reads back the files written by WriteResults: a list of flat objects of strings and numbers
+static std::vector<BenchResult> ReadResults(const std::string& path)
+{
+	std::vector<BenchResult> results;
+	std::ifstream in(path);
+	if (!in.good())
+	{
+		CH_ERROR("Can not open bench results " + path);
+		return results;
+	}
+	std::stringstream buffer;
+	buffer << in.rdbuf();
+	std::string text = buffer.str();
+
+	auto skip_space = [&text](size_t pos) {
+		size_t next = text.find_first_not_of(" \t\n\r", pos);
+		return next == std::string::npos ? text.size() : next;
+	};
+
+	size_t pos = text.find('[');
+	while (pos != std::string::npos && (pos = text.find_first_of("{]", pos)) != std::string::npos && text[pos] == '{')
+	{
+		//"key": value pairs up to the closing brace, values are strings or numbers
+		std::map<std::string, std::string> fields;
+		pos = skip_space(pos + 1);
+		while (pos < text.size() && text[pos] == '"')
+		{
+			std::string key = ReadJsonString(text, pos);
+			pos = skip_space(pos);
+			if (pos >= text.size() || text[pos] != ':')
+				break;
+			pos = skip_space(pos + 1);
+			if (pos < text.size() && text[pos] == '"')
+				fields[key] = ReadJsonString(text, pos);
+			else
+			{
+				size_t end = std::min(text.find_first_of(",}", pos), text.size());
+				std::string number = text.substr(pos, end - pos);
+				number.erase(number.find_last_not_of(" \t\n\r") + 1);
+				fields[key] = number;
+				pos = end;
+			}
+			pos = skip_space(pos);
+			if (pos < text.size() && text[pos] == ',')
+				pos = skip_space(pos + 1);
+		}
+		if (pos >= text.size() || text[pos] != '}')
+		{
+			CH_ERROR("Malformed bench results " + path);
+			break;
+		}
+		pos++;
+
+		BenchResult r;
+		r.scene = fields["scene"];
+		r.camera = fields["camera"];
+		r.mode = fields["mode"];
+		r.error = fields["error"];
+		r.parse_time = std::atof(fields["parse_s"].c_str());
+		r.bvh_build_time = std::atof(fields["bvh_build_s"].c_str());
+		r.bvh_nodes = std::atoi(fields["bvh_nodes"].c_str());
+		r.render_time = std::atof(fields["render_s"].c_str());
+		r.primary_mrays = std::atof(fields["primary_mrays_s"].c_str());
+		r.secondary_mrays = std::atof(fields["secondary_mrays_s"].c_str());
+		r.peak_rss_mb = std::atof(fields["peak_rss_mb"].c_str());
+		r.camera_rays = std::strtoull(fields["camera_rays"].c_str(), nullptr, 10);
+		r.shadow_rays = std::strtoull(fields["shadow_rays"].c_str(), nullptr, 10);
+		r.reflection_rays = std::strtoull(fields["reflection_rays"].c_str(), nullptr, 10);
+		r.dielectric_reflection_rays = std::strtoull(fields["dielectric_reflection_rays"].c_str(), nullptr, 10);
+		r.refraction_rays = std::strtoull(fields["refraction_rays"].c_str(), nullptr, 10);
+		r.gi_rays = std::strtoull(fields["gi_rays"].c_str(), nullptr, 10);
+		r.rr_terminations = std::strtoull(fields["rr_terminations"].c_str(), nullptr, 10);
+		r.nodes_per_ray = std::atof(fields["nodes_per_ray"].c_str());
+		r.prim_tests_per_ray = std::atof(fields["prim_tests_per_ray"].c_str());
+		r.prim_hits = std::strtoull(fields["prim_hits"].c_str(), nullptr, 10);
+		results.push_back(r);
+	}
+	return results;
+}
+
+//Returns the number of regressed metrics
+static int CompareResults(const std::vector<BenchResult>& base, const std::vector<BenchResult>& current, double tolerance)
+{
+	std::map<std::string, BenchResult> base_map;
+	std::map<std::string, bool> base_loaded;//scenes that loaded and rendered in the baseline
+	for (const BenchResult& r : base)
+	{
+		base_map[r.Key()] = r;
+		base_loaded[r.scene] = r.error.empty();
+	}
+
+	int regressions = 0;
+	//lower is better, small absolute changes are timer noise. Metrics missing from older baselines read as 0
+	auto check_cost = [&](const BenchResult& r, const char* name, double b, double c, double min_delta) {
+		if (b > 0.0 && c - b > min_delta && c > b * (1.0 + tolerance))
+		{
+			CH_WARN(r.Key() + ": " + name + " regressed " + std::to_string(b) + " -> " + std::to_string(c));
+			regressions++;
+		}
+	};
+	//higher is better
+	auto check_rate = [&](const BenchResult& r, const char* name, double b, double c) {
+		if (b > 0.0 && c < b * (1.0 - tolerance))
+		{
+			CH_WARN(r.Key() + ": " + name + " regressed " + std::to_string(b) + " -> " + std::to_string(c));
+			regressions++;
+		}
+	};
+
+	for (const BenchResult& r : current)
+	{
+		if (!r.error.empty())
+		{
+			auto loaded = base_loaded.find(r.scene);
+			if (loaded != base_loaded.end() && loaded->second)
+			{
+				CH_WARN(r.scene + ": failed, it rendered in the baseline: " + r.error);
+				regressions++;
+			}
+			continue;
+		}
+		auto it = base_map.find(r.Key());
+		if (it == base_map.end())
+		{
+			CH_INFO(r.Key() + ": not in baseline");
+			continue;
+		}
+		const BenchResult& b = it->second;
+		check_cost(r, "parse_s", b.parse_time, r.parse_time, 0.01);
+		check_cost(r, "bvh_build_s", b.bvh_build_time, r.bvh_build_time, 0.01);
+		check_cost(r, "render_s", b.render_time, r.render_time, 0.01);
+		check_cost(r, "peak_rss_mb", b.peak_rss_mb, r.peak_rss_mb, 1.0);
+		check_rate(r, "primary_mrays_s", b.primary_mrays, r.primary_mrays);
+		check_rate(r, "secondary_mrays_s", b.secondary_mrays, r.secondary_mrays);
+		//traversal work per ray, a worse BVH shows up here before it shows up in the timings
+		check_cost(r, "nodes_per_ray", b.nodes_per_ray, r.nodes_per_ray, 0.5);
+		check_cost(r, "prim_tests_per_ray", b.prim_tests_per_ray, r.prim_tests_per_ray, 0.5);
+		if (b.bvh_nodes != r.bvh_nodes)
+			CH_INFO(r.Key() + ": bvh_nodes " + std::to_string(b.bvh_nodes) + " -> " + std::to_string(r.bvh_nodes));
+	}
+
+	if (regressions == 0)
+		CH_INFO("No regressions against baseline");
+	else
+		CH_WARN(std::to_string(regressions) + " regressed metrics");
+	return regressions;
+}
+
+//========================================================================================================================//
+
+int main(int argc, char** argv)
+{
+	CHR::Logger::Init("1.19.0");
+
+	std::string root = "../../assets/scenes";
+	std::string filter = "";
+	std::string out_path = "bench.json";
+	std::string baseline_path = "";
+	double tolerance = 0.10;
+	float res_scale = 1.0f;
+	int spp = 0;
+	CHR::BVHBuildOptions bvh_options;
+	bvh_options.max_prims_in_node = 8;
+	std::optional<CHR::RT_MODE> mode;//Unset: picked per camera
+
+	auto settings = CHR::Settings::GetInstance();
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg.compare("-h") == 0)
+		{
+			PrintUsage();
+			return 0;
+		}
+		if (arg.compare("-P") == 0)
+		{
+			CHR::Profiler::SetEnabled(true);
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			CH_ERROR("Missing value for option " + arg);
+			PrintUsage();
+			return 1;
+		}
+		std::string val = argv[++i];
+
+		if (arg.compare("-r") == 0)
+			root = val;
+		else if (arg.compare("-f") == 0)
+			filter = val;
+		else if (arg.compare("-o") == 0)
+			out_path = val;
+		else if (arg.compare("-b") == 0)
+			baseline_path = val;
+		else if (arg.compare("-x") == 0)
+			tolerance = std::atof(val.c_str()) / 100.0;
+		else if (arg.compare("-t") == 0)
+			settings->m_thread_count = std::max(1, std::atoi(val.c_str()));
+		else if (arg.compare("-s") == 0)
+			res_scale = std::max(0.01f, (float)std::atof(val.c_str()));
+		else if (arg.compare("-n") == 0)
+			spp = std::max(0, std::atoi(val.c_str()));
+		else if (arg.compare("-a") == 0)
+			settings->m_packet_size = std::atoi(val.c_str());
+		else if (arg.compare("-p") == 0)
+			bvh_options.max_prims_in_node = std::max(1, std::atoi(val.c_str()));
+		else if (arg.compare("-u") == 0)
+			bvh_options.sah_buckets = std::atoi(val.c_str());
+		else if (arg.compare("-w") == 0)
+			bvh_options.width = std::atoi(val.c_str());
+		else if (arg.compare("-m") == 0)
+		{
+			mode.reset();
+			for (int m = 0; m < CHR::RT_MODE::rt_size; m++)
+				if (val.compare(s_mode_names[m]) == 0)
+					mode = (CHR::RT_MODE)m;
+			if (!mode)
+			{
+				CH_ERROR("Unknown render mode " + val);
+				return 1;
+			}
+		}
+		else if (arg.compare("-d") == 0)
+		{
+			if (i + 1 >= argc)
+			{
+				PrintUsage();
+				return 1;
+			}
+			std::string new_path = argv[++i];
+			return CompareResults(ReadResults(val), ReadResults(new_path), tolerance) == 0 ? 0 : 2;
+		}
+		else
+		{
+			CH_ERROR("Unknown option " + arg);
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	std::vector<std::string> scene_paths;
+	std::error_code ec;
+	for (auto& entry : std::filesystem::recursive_directory_iterator(root, ec))
+	{
+		std::string path = entry.path().generic_string();
+		if (entry.path().extension() == ".xml" && path.find(filter) != std::string::npos)
+			scene_paths.push_back(path);
+	}
+	if (ec || scene_paths.empty())
+	{
+		CH_ERROR("No scenes found under " + root);
+		return 1;
+	}
+	std::sort(scene_paths.begin(), scene_paths.end());
+
+	CHR::RayTracer ray_tracer;
+	settings->Attach(&ray_tracer);
+	settings->m_ldr_post_process = CHR::IM_POST_PROC_T::none;
+
+	std::vector<BenchResult> results;
+	int failed = 0;
+	for (const std::string& path : scene_paths)
+	{
+		std::string scene_name = std::filesystem::relative(path, root).generic_string();
+		CH_INFO("Benchmarking " + scene_name);
+		ResetPeakRSS();
+
+		//A scene that fails to load or render is recorded and skipped, the rest still run
+		CHR::Scene* scene = nullptr;
+		try
+		{
+			auto parse_start = std::chrono::steady_clock::now();
+			scene = CHR::AssetImporter::LoadSceneFromXML(nullptr, path);
+			std::chrono::duration<double> parse_time = std::chrono::steady_clock::now() - parse_start;
+
+			scene->InitBVH(bvh_options);
+			const CHR::BVH* bvh = dynamic_cast<const CHR::BVH*>(scene->GetAccelerationStructure());
+
+			for (auto it = scene->GetCameras().begin(); it != scene->GetCameras().end(); it++)
+			{
+				CHR::Camera* cam = it->second;
+				if (spp > 0)
+					cam->SetNumberOfSamples(spp);
+
+				glm::ivec2 res = glm::max(glm::ivec2(glm::vec2(cam->GetResolution()) * res_scale), glm::ivec2(1, 1));
+				settings->SetResolution(res);
+				settings->m_act_rt_cam_name = it->first;
+
+				CHR::RT_MODE cam_mode = mode ? *mode :
+					(cam->m_path_trace ? CHR::RT_MODE::path_trace : CHR::RT_MODE::recursive_trace);
+				ray_tracer.SetRenderMode(cam_mode);
+				ray_tracer.Render(cam, *scene, false);
+
+				const CHR::RayTracer::RenderStats& stats = ray_tracer.GetRenderStats();
+				BenchResult r;
+				r.scene = scene_name;
+				r.camera = it->first;
+				r.mode = s_mode_names[cam_mode];
+				r.parse_time = parse_time.count();
+				r.bvh_build_time = bvh ? bvh->GetBuildTime() : 0.0;
+				r.bvh_nodes = bvh ? bvh->GetNodeCount() : 0;
+				r.render_time = stats.render_time;
+				r.primary_mrays = stats.render_time > 0.0f ? stats.GetPrimaryRays() / (1e6 * stats.render_time) : 0.0;
+				r.secondary_mrays = stats.render_time > 0.0f ? stats.GetSecondaryRays() / (1e6 * stats.render_time) : 0.0;
+				r.peak_rss_mb = GetPeakRSS();
+				r.camera_rays = stats.camera_rays;
+				r.shadow_rays = stats.shadow_rays;
+				r.reflection_rays = stats.reflection_rays;
+				r.dielectric_reflection_rays = stats.dielectric_reflection_rays;
+				r.refraction_rays = stats.refraction_rays;
+				r.gi_rays = stats.gi_rays;
+				r.rr_terminations = stats.rr_terminations;
+				r.nodes_per_ray = stats.traversal.queries > 0 ? stats.traversal.nodes_visited / (double)stats.traversal.queries : 0.0;
+				r.prim_tests_per_ray = stats.traversal.queries > 0 ? stats.traversal.primitive_tests / (double)stats.traversal.queries : 0.0;
+				r.prim_hits = stats.traversal.primitive_hits;
+				results.push_back(r);
+
+				CH_INFO("\t" + r.camera + " (" + r.mode + "): " + std::to_string(r.render_time) + "s, " +
+					std::to_string(r.primary_mrays) + " primary Mrays/s, " + std::to_string(r.secondary_mrays) + " secondary Mrays/s");
+				if (CHR::Profiler::IsEnabled())
+					CH_INFO(CHR::Profiler::GetReport());
+			}
+		}
+		catch (const std::exception& e)
+		{
+			CH_ERROR("Skipping " + scene_name + ": " + e.what());
+			BenchResult r;
+			r.scene = scene_name;
+			r.error = e.what();
+			results.push_back(r);
+			failed++;
+		}
+		delete scene;
+	}
+	settings->Detach(&ray_tracer);
+
+	WriteResults(out_path, results);
+	CH_INFO("Results written to " + out_path);
+
+	if (!baseline_path.empty() && CompareResults(ReadResults(baseline_path), results, tolerance) != 0)
+		return 2;
+	if (failed > 0)
+	{
+		CH_WARN(std::to_string(failed) + " scenes failed");
+		return 1;
+	}
+	return 0;
+}
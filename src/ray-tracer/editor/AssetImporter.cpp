@@ -3,6 +3,8 @@
 #include <iostream>
 #include <sstream>
 #include <string> 
+#include <unordered_map>
+#include <unordered_set>
 
 #include <ray-tracer/editor/Logger.h>
 #include <ray-tracer/main/Shape.h>
@@ -15,6 +17,7 @@
 #include <ray-tracer/main/ImageTextureMap.h>
 #include <ray-tracer/main/NoiseTextureMap.h>
 #include <ray-tracer/main/ProceduralTextureMap.h>
+#include <ray-tracer/main/ThreadPool.h>
 
 
 namespace CHR
@@ -109,18 +112,18 @@ namespace CHR
             objl::Mesh curMesh = Loader.LoadedMeshes[0];
             for (int j = 0; j < curMesh.Vertices.size(); j++)
             {
-                mesh->m_vertex_positions.push_back(std::make_shared<glm::vec3>(
+                mesh->m_data->positions.push_back(glm::vec3(
 					glm::eulerAngleYXZ(r.y, r.x, r.z) * glm::vec4(glm::vec3(curMesh.Vertices[j].Position.X,
                     curMesh.Vertices[j].Position.Y, curMesh.Vertices[j].Position.Z )*s + t, 1.0f)) );
-                mesh->m_vertex_normals.push_back(std::make_shared < glm::vec3>(glm::eulerAngleYXZ(r.y, r.x, r.z) * glm::vec4(curMesh.Vertices[j].Normal.X,
+                mesh->m_data->normals.push_back(glm::vec3(glm::eulerAngleYXZ(r.y, r.x, r.z) * glm::vec4(curMesh.Vertices[j].Normal.X,
                     curMesh.Vertices[j].Normal.Y,
                     curMesh.Vertices[j].Normal.Z,1)));
-                mesh->m_vertex_texcoords.push_back(std::make_shared<glm::vec2>(curMesh.Vertices[j].TextureCoordinate.X,
+                mesh->m_data->texcoords.push_back(glm::vec2(curMesh.Vertices[j].TextureCoordinate.X,
                     curMesh.Vertices[j].TextureCoordinate.Y ));
             }
 
-            mesh->m_indices = curMesh.Indices;
-			mesh->SetFaceCount(mesh->m_indices.size() / 3);
+            mesh->m_data->indices = curMesh.Indices;
+			mesh->SetFaceCount(mesh->m_data->indices.size() / 3);
 			mesh->m_shading_mode = SHADING_MODE::smooth;
 
         }
@@ -145,12 +148,20 @@ namespace CHR
 		{
 			if (std::string(node->Value()).compare(IMGS) == 0)
 			{
+				std::vector<std::string> image_paths;
 				tinyxml2::XMLNode* child_node = node->FirstChild();
 				while (child_node)
 				{
-					textures.push_back(std::make_shared<Texture>(file_path + std::string(child_node->FirstChild()->Value())));
+					image_paths.push_back(file_path + std::string(child_node->FirstChild()->Value()));
 					child_node = child_node->NextSibling();
 				}
+
+				//Decode the images on the thread pool, in their xml order
+				size_t first = textures.size();
+				textures.resize(first + image_paths.size());
+				ThreadPool::GetInstance()->ParallelFor((int)image_paths.size(), [&](int i) {
+					textures[first + i] = std::make_shared<Texture>(image_paths[i]);
+				});
 			}
 			else if (std::string(node->Value()).compare(TEX_MAP) == 0)
 			{
@@ -350,6 +361,30 @@ namespace CHR
 
 	//========================================================================================================================//
 
+	//A MotionBlur element is a motion key, its text the translation. The time attribute defaults to
+	//shutter close, rotation is an angle in degrees and an axis like a Rotation and scaling a scale per axis
+	MotionKey ParseMotionKey(tinyxml2::XMLNode* node)
+	{
+		MotionKey key;
+		sscanf(node->FirstChild()->Value(), "%f %f %f", &key.translation.x, &key.translation.y, &key.translation.z);
+
+		tinyxml2::XMLElement* element = node->ToElement();
+		if (auto time = element->FindAttribute("time"))
+			key.time = time->FloatValue();
+		if (auto rotation = element->FindAttribute("rotation"))
+		{
+			float angle_d;
+			glm::vec3 axis;
+			sscanf(rotation->Value(), "%f %f %f %f", &angle_d, &axis.x, &axis.y, &axis.z);
+			key.rotation = glm::angleAxis(glm::radians(angle_d), glm::normalize(axis));
+		}
+		if (auto scaling = element->FindAttribute("scaling"))
+			sscanf(scaling->Value(), "%f %f %f", &key.scale.x, &key.scale.y, &key.scale.z);
+		return key;
+	}
+
+	//========================================================================================================================//
+
 	glm::mat4 CalculateTransforms(
 		std::vector<glm::mat4> translations,
 		std::vector<glm::mat4> rotations, 
@@ -389,9 +424,9 @@ namespace CHR
 
 	Mesh* AssetImporter::LoadMeshFromPly(std::string ply_path)
 	{
-		std::vector<std::shared_ptr<glm::vec3>> mesh_verts;
-		std::vector<std::shared_ptr<glm::vec2>> mesh_uvs;
-		std::vector<std::shared_ptr<glm::vec3>> mesh_normals;
+		std::vector<glm::vec3> mesh_verts;
+		std::vector<glm::vec2> mesh_uvs;
+		std::vector<glm::vec3> mesh_normals;
 		std::vector<unsigned int> mesh_indices;
 
 		happly::PLYData ply_in(ply_path);
@@ -410,41 +445,41 @@ namespace CHR
 
 		for (int i = 0; i < v_pos.size(); i++)
 		{
-			mesh_verts.push_back(std::make_shared<glm::vec3>(v_pos[i][0], v_pos[i][1], v_pos[i][2]));
+			mesh_verts.push_back(glm::vec3(v_pos[i][0], v_pos[i][1], v_pos[i][2]));
 			if(ply_in.hasElement("vertex") &&
 				ply_in.getElement("vertex").hasProperty("u") &&
 				ply_in.getElement("vertex").hasProperty("v"))
-				mesh_uvs.push_back(std::make_shared<glm::vec2>(us[i], vs[i]));
+				mesh_uvs.push_back(glm::vec2(us[i], vs[i]));
 			/*mesh_verts.push_back({ v_pos[i+1][0], v_pos[i+1][1], v_pos[i+1][2] });
 			mesh_verts.push_back({ v_pos[i+2][0], v_pos[i+2][1], v_pos[i+2][2] });*/
 		}
 		for (auto faces : f_ind)
 		{
-			glm::vec3 a = (*mesh_verts[faces[1]] - *mesh_verts[faces[0]]);
-			glm::vec3 b = (*mesh_verts[faces[2]] - *mesh_verts[faces[0]]);
+			glm::vec3 a = (mesh_verts[faces[1]] - mesh_verts[faces[0]]);
+			glm::vec3 b = (mesh_verts[faces[2]] - mesh_verts[faces[0]]);
 			glm::vec3 normal = glm::normalize(glm::cross(-a, -b));
 			if(faces.size() ==3)		//triangle faces
 				for (int i = 0; i < faces.size(); i ++)
 				{
-					mesh_normals.push_back(std::make_shared<glm::vec3>(normal));
+					mesh_normals.push_back(normal);
 					mesh_indices.push_back(faces[i]);
 				}
 			else if(faces.size() == 4)	//quad faces
 			{
 				for (int start_ind = 1; start_ind+2 <= faces.size(); start_ind++)
 				{
-					mesh_normals.push_back(std::make_shared<glm::vec3>(normal));
+					mesh_normals.push_back(normal);
 					mesh_indices.push_back(faces[0]);
 					for (int i = start_ind; i < start_ind + 2; i++)
 					{
-						mesh_normals.push_back(std::make_shared<glm::vec3>(normal));
+						mesh_normals.push_back(normal);
 						mesh_indices.push_back(faces[i]);
 					}
 				}
 			}
 
 		}
-		return new Mesh(mesh_verts, mesh_normals, mesh_uvs, std::vector<std::shared_ptr<glm::vec3>>(), mesh_indices);
+		return new Mesh(std::move(mesh_verts), std::move(mesh_normals), std::move(mesh_uvs), std::vector<glm::vec3>(), std::move(mesh_indices));
 	}
 
 	//========================================================================================================================//
@@ -525,6 +560,11 @@ namespace CHR
 				cam->SetApertureSize(d);
 			}
 			//---------------Render params-----------------
+			else if (std::string(cam_prop->Value()).compare("Renderer") == 0)
+			{
+				std::string data = cam_prop->FirstChild()->Value();
+				cam->m_path_trace = data.compare("PathTracing") == 0;
+			}
 			else if (std::string(cam_prop->Value()).compare("RendererParams") == 0)
 			{
 				std::string data;
@@ -636,9 +676,9 @@ namespace CHR
 
 	//========================================================================================================================//
 
-	std::vector<std::shared_ptr<glm::vec3>> ParseVertexData(tinyxml2::XMLNode* node)
+	std::vector<glm::vec3> ParseVertexData(tinyxml2::XMLNode* node)
 	{
-		std::vector<std::shared_ptr<glm::vec3>> vertices;
+		std::vector<glm::vec3> vertices;
 		std::string data = node->Value();
 		std::string line;
 		std::istringstream stream(data);
@@ -649,7 +689,7 @@ namespace CHR
 			iss >> vertex.x >> vertex.y >> vertex.z;
 
 			if (iss)
-				vertices.push_back(std::make_shared<glm::vec3>(vertex));
+				vertices.push_back(vertex);
 		}
 
 		return vertices;
@@ -657,9 +697,9 @@ namespace CHR
 
 	//========================================================================================================================//
 
-	std::vector<std::shared_ptr<glm::vec2>> ParseTextureCoords(tinyxml2::XMLNode* node)
+	std::vector<glm::vec2> ParseTextureCoords(tinyxml2::XMLNode* node)
 	{
-		std::vector<std::shared_ptr<glm::vec2>> tex_coords;
+		std::vector<glm::vec2> tex_coords;
 		std::string data = node->Value();
 		std::string line;
 		std::istringstream stream(data);
@@ -670,7 +710,7 @@ namespace CHR
 			iss >> tex_coord.x >> tex_coord.y;
 
 			if (iss)
-				tex_coords.push_back(std::make_shared<glm::vec2>(tex_coord));
+				tex_coords.push_back(tex_coord);
 		}
 
 		return tex_coords;
@@ -678,6 +718,84 @@ namespace CHR
 
 	//========================================================================================================================//
 
+	//Faces of a mesh indexing the scene wide vertex data, only the vertices and uvs the mesh uses are copied
+	Mesh* ParseFaceData(tinyxml2::XMLNode* node, const std::vector<glm::vec3>& vertices,
+		const std::vector<glm::vec2>& texture_coords, bool has_tex, std::vector<unsigned int>& tex_inds)
+	{
+		std::string data = node->FirstChild()->Value();
+		std::vector<glm::vec3> mesh_verts;
+		std::vector<glm::vec2> mesh_uvs;
+		std::vector<glm::vec3> mesh_normals;
+		std::vector<unsigned int> mesh_indices;
+		std::unordered_map<unsigned int, unsigned int> local_vertex_inds;
+		std::unordered_map<unsigned int, unsigned int> local_uv_inds;
+
+		int t_off = 0, v_off = 0;
+
+		auto vertex_offset = node->ToElement()->FindAttribute("vertexOffset");
+		auto texture_offset = node->ToElement()->FindAttribute("textureOffset");
+
+		if (vertex_offset != NULL)
+			v_off = vertex_offset->IntValue();
+
+		if (texture_offset != NULL)
+			t_off = texture_offset->IntValue();
+
+		//Uvs share the vertex indices unless the vertices are offset
+		bool vertex_uvs = has_tex && !texture_coords.empty() && v_off == 0;
+		bool indexed_uvs = has_tex && !texture_coords.empty() && v_off != 0;
+
+		std::string line;
+		std::istringstream stream(data);
+
+		while (std::getline(stream, line)) //read faces line by line
+		{
+			unsigned int ind[3];
+			std::istringstream iss(line);
+			iss >> ind[0] >> ind[1] >> ind[2];
+
+			if (iss) {
+
+				glm::vec3 a = (vertices[ind[0] - 1 + v_off] - vertices[ind[1] - 1 + v_off]);
+				glm::vec3 b = (vertices[ind[0] - 1 + v_off] - vertices[ind[2] - 1 + v_off]);
+
+				glm::vec3 normal = (glm::cross(-a, -b));//calculate face normal
+
+				for (int j = 0; j < 3; j++)
+				{
+					unsigned int vertex_ind = ind[j] - 1 + v_off;
+					auto local = local_vertex_inds.find(vertex_ind);
+					if (local == local_vertex_inds.end())
+					{
+						local = local_vertex_inds.emplace(vertex_ind, (unsigned int)mesh_verts.size()).first;
+						mesh_verts.push_back(vertices[vertex_ind]);
+						mesh_normals.push_back(glm::vec3(0.0f));
+						if (vertex_uvs)
+							mesh_uvs.push_back(vertex_ind < texture_coords.size() ? texture_coords[vertex_ind] : glm::vec2(0.0f));
+					}
+					mesh_indices.push_back(local->second);
+					mesh_normals[local->second] = glm::normalize(normal);
+
+					if (indexed_uvs)
+					{
+						unsigned int uv_ind = ind[j] - 1 + t_off;
+						auto local_uv = local_uv_inds.find(uv_ind);
+						if (local_uv == local_uv_inds.end())
+						{
+							local_uv = local_uv_inds.emplace(uv_ind, (unsigned int)mesh_uvs.size()).first;
+							mesh_uvs.push_back(uv_ind < texture_coords.size() ? texture_coords[uv_ind] : glm::vec2(0.0f));
+						}
+						tex_inds.push_back(local_uv->second);
+					}
+				}
+			}
+		}
+
+		return new Mesh(std::move(mesh_verts), std::move(mesh_normals), std::move(mesh_uvs), std::vector<glm::vec3>(), std::move(mesh_indices));
+	}
+
+	//========================================================================================================================//
+
 	Scene* AssetImporter::LoadSceneFromXML(Shader* shader, const std::string& file_path)
 	{
 		//Get Settings pointer
@@ -695,8 +813,8 @@ namespace CHR
 		std::vector<std::shared_ptr<Material>> materials;
 		std::vector<std::shared_ptr<TextureMap>> texturemaps;
 		std::vector<std::shared_ptr<Texture>> textures;		//just incase of a env. light
-		std::vector<std::shared_ptr<glm::vec3>> vertices;
-		std::vector<std::shared_ptr<glm::vec2>>texture_coords;
+		std::vector<glm::vec3> vertices;
+		std::vector<glm::vec2> texture_coords;
 
 		std::vector<glm::mat4> translations;
 		std::vector<glm::mat4> rotations;
@@ -1186,7 +1304,7 @@ namespace CHR
 							std::string().compare(SMOOTH) == 0;
 						glm::mat4 transform = glm::mat4(1.0f);
 
-						glm::vec3 m_b = {0,0,0};
+						std::vector<MotionKey> motion_keys;
 
 						bool has_tex = false;
 						std::vector<unsigned int> tex_inds(0);
@@ -1216,66 +1334,7 @@ namespace CHR
 								}
 								else
 								{
-									std::string data = object_prop->FirstChild()->Value();
-									std::vector<std::shared_ptr<glm::vec3>> mesh_verts;
-									std::vector<std::shared_ptr<glm::vec2>> mesh_uvs;
-									std::vector<std::shared_ptr<glm::vec3>> mesh_normals;
-									std::vector<unsigned int> mesh_indices;
-
-									int t_off = 0, v_off = 0;
-
-									auto vertex_offset = object_prop->ToElement()->FindAttribute("vertexOffset");
-									auto texture_offset = object_prop->ToElement()->FindAttribute("textureOffset");
-
-									if (vertex_offset != NULL)
-										v_off = vertex_offset->IntValue();
-
-									if (texture_offset != NULL)
-										t_off = texture_offset->IntValue();
-
-									std::string line;
-									std::istringstream stream(data);
-									mesh_verts = vertices;
-									if (has_tex)
-									{
-										mesh_uvs = texture_coords;
-									}
-									mesh_normals.reserve(vertices.size());
-									mesh_normals.resize(vertices.size());
-									
-
-									while (std::getline(stream, line)) //read faces line by line
-									{
-										unsigned int ind[3];
-										std::istringstream iss(line);
-										iss >> ind[0] >> ind[1] >> ind[2];
-
-										if (iss) {
-
-											glm::vec3 a = (*vertices[ind[0] - 1 + v_off] - *vertices[ind[1] - 1 + v_off]);
-											glm::vec3 b = (*vertices[ind[0] - 1 + v_off] - *vertices[ind[2] - 1 + v_off]);
-
-											glm::vec3 normal = glm::vec3(0.0f, 0.0f, 0.0f);//glm::normalize(glm::cross(a, b));//calculate face normal
-
-											normal = (glm::cross(-a, -b));
-
-											for (int j = 0; j < 3; j++)
-											{
-												mesh_indices.push_back(ind[j] - 1 + v_off);
-												mesh_normals[ind[j] - 1 + v_off] = std::make_shared<glm::vec3>(glm::normalize(normal));
-												if (has_tex)
-												{
-													if (v_off != 0)
-													{
-														tex_inds.push_back(ind[j]-1 + t_off);
-													}
-												}
-											}
-										}
-									}
-									
-									mesh = std::shared_ptr<Mesh>
-										(new Mesh(mesh_verts, mesh_normals, mesh_uvs, std::vector<std::shared_ptr<glm::vec3>>(), mesh_indices));
+									mesh = std::shared_ptr<Mesh>(ParseFaceData(object_prop, vertices, texture_coords, has_tex, tex_inds));
 								}
 
 							}
@@ -1285,8 +1344,7 @@ namespace CHR
 							}
 							else if (std::string(object_prop->Value()).compare(MOTION_B) == 0)
 							{
-								std::string data = object_prop->FirstChild()->Value();
-								sscanf(data.c_str(), "%f %f %f", &m_b.x, &m_b.y, &m_b.z);
+								motion_keys.push_back(ParseMotionKey(object_prop));
 							}
 							object_prop = object_prop->NextSibling();
 						}
@@ -1294,7 +1352,7 @@ namespace CHR
 							(new SceneObject(mesh, name, glm::vec3(), glm::vec3(), glm::vec3(1.0, 1.0, 1.0), SHAPE_T::triangle, tex_inds));
 						scene_obj->SetMaterial(materials[mat_ind]);
 						scene_obj->SetTransforms(transform);
-						scene_obj->SetMotionBlur(m_b);
+						scene_obj->SetMotion(motion_keys);
 						if (tex_map_ind_1 > -1)
 							scene_obj->SetTextureMap(texturemaps[tex_map_ind_1]);
 						if (tex_map_ind_2 > -1)
@@ -1314,7 +1372,7 @@ namespace CHR
 						int mat_ind = 0, tex_map_ind_1 = -1, tex_map_ind_2 = -1;
 						glm::mat4 transform = glm::mat4(1.0f);
 
-						glm::vec3 m_b = { 0,0,0 };
+						std::vector<MotionKey> motion_keys;
 
 						while (object_prop)
 						{
@@ -1336,24 +1394,24 @@ namespace CHR
 								int indices[3];
 								std::string data = object_prop->FirstChild()->Value();
 								sscanf(data.c_str(), "%d %d %d", &indices[0], &indices[1], &indices[2]);
-								std::vector<std::shared_ptr<glm::vec3>> mesh_verts;
-								std::vector<std::shared_ptr<glm::vec2>> mesh_uvs;
-								std::vector<std::shared_ptr<glm::vec3>> mesh_normals;
+								std::vector<glm::vec3> mesh_verts;
+								std::vector<glm::vec2> mesh_uvs;
+								std::vector<glm::vec3> mesh_normals;
 								std::vector<unsigned int> mesh_indices;
 								for (int i = 0; i < 3; i++)
 								{
 									indices[i]--;
  									mesh_verts.push_back(vertices[indices[i]]);
-									glm::vec3 normal = glm::normalize(glm::cross((*vertices[indices[(i) % 3]] - *vertices[indices[(i + 1) % 3]]), 
-										(*vertices[indices[(i) % 3]] - *vertices[indices[(i + 2) % 3]])));
-									mesh_normals.push_back(std::make_shared<glm::vec3>(normal));
+									glm::vec3 normal = glm::normalize(glm::cross((vertices[indices[(i) % 3]] - vertices[indices[(i + 1) % 3]]), 
+										(vertices[indices[(i) % 3]] - vertices[indices[(i + 2) % 3]])));
+									mesh_normals.push_back(normal);
 									mesh_indices.push_back(i);
 								}
-								mesh_uvs.push_back(std::make_shared<glm::vec2>( 0.0f, 0.0f ));
-								mesh_uvs.push_back(std::make_shared<glm::vec2>(1.0f, 0.0f));
-								mesh_uvs.push_back(std::make_shared<glm::vec2>(0.0f, 1.0f));
+								mesh_uvs.push_back(glm::vec2( 0.0f, 0.0f ));
+								mesh_uvs.push_back(glm::vec2(1.0f, 0.0f));
+								mesh_uvs.push_back(glm::vec2(0.0f, 1.0f));
 								mesh = std::shared_ptr<Mesh>
-									(new Mesh(mesh_verts, mesh_normals, mesh_uvs, std::vector<std::shared_ptr<glm::vec3>>(), mesh_indices));
+									(new Mesh(mesh_verts, mesh_normals, mesh_uvs, std::vector<glm::vec3>(), mesh_indices));
 							}
 							else if (std::string(object_prop->Value()).compare(TRANSFORMS) == 0)
 							{
@@ -1361,8 +1419,7 @@ namespace CHR
 							}
 							else if (std::string(object_prop->Value()).compare(MOTION_B) == 0)
 							{
-								std::string data = object_prop->FirstChild()->Value();
-								sscanf(data.c_str(), "%f %f %f", &m_b.x, &m_b.y, &m_b.z);
+								motion_keys.push_back(ParseMotionKey(object_prop));
 							}
 							object_prop = object_prop->NextSibling();
 						}
@@ -1371,7 +1428,7 @@ namespace CHR
 								glm::vec3(), glm::vec3(1.0,1.0,1.0), SHAPE_T::triangle));
 						scene_obj->SetMaterial(materials[mat_ind]);
 						scene_obj->SetTransforms(transform);
-						scene_obj->SetMotionBlur(m_b); 
+						scene_obj->SetMotion(motion_keys);
 						if (tex_map_ind_1 > -1)
 							scene_obj->SetTextureMap(texturemaps[tex_map_ind_1]);
 						if (tex_map_ind_2 > -1)
@@ -1385,7 +1442,7 @@ namespace CHR
 						glm::mat4 transform = glm::mat4(1.0f);
 						auto s = std::make_shared<Sphere>(nullptr, true);
 
-						glm::vec3 m_b = { 0,0,0 };
+						std::vector<MotionKey> motion_keys;
 						glm::vec3 center = { 0,0,0 };
 						glm::vec3 rad_scale = { 1,1,1 };
 
@@ -1415,7 +1472,7 @@ namespace CHR
 								int ind;
 								sscanf(data.c_str(), "%d", &ind);
 								ind = ind - 1;
-								center = *vertices[ind];
+								center = vertices[ind];
 							}
 							else if (std::string(object_prop->Value()).compare(RAD) == 0)
 							{
@@ -1430,15 +1487,14 @@ namespace CHR
 							}
 							else if (std::string(object_prop->Value()).compare(MOTION_B) == 0)
 							{
-								std::string data = object_prop->FirstChild()->Value();
-								sscanf(data.c_str(), "%f %f %f", &m_b.x, &m_b.y, &m_b.z);
+								motion_keys.push_back(ParseMotionKey(object_prop));
 							}
 							object_prop = object_prop->NextSibling();
 						}
 						transform *= glm::scale(glm::translate(glm::mat4(1.0f), center), rad_scale);
 						auto scene_obj = std::shared_ptr<SceneObject>(SceneObject::CreateSphere(name, s, glm::vec3(), glm::vec3(), glm::vec3()));
 						scene_obj->SetTransforms(transform);
-						scene_obj->SetMotionBlur(m_b); 
+						scene_obj->SetMotion(motion_keys);
 						if (tex_map_ind_1 > -1)
 							scene_obj->SetTextureMap(texturemaps[tex_map_ind_1]);
 						if (tex_map_ind_2 > -1)
@@ -1457,7 +1513,7 @@ namespace CHR
 							scene->m_scene_objects[base_mesh_index], reset_transform));
 
 						glm::mat4 transform = glm::mat4(1.0f);
-						glm::vec3 m_b = { 0,0,0 };
+						std::vector<MotionKey> motion_keys;
 
 						int tex_map_ind_1 = -1, tex_map_ind_2 = -1;
 
@@ -1484,15 +1540,14 @@ namespace CHR
 							}
 							else if (std::string(object_prop->Value()).compare(MOTION_B) == 0)
 							{
-								std::string data = object_prop->FirstChild()->Value();
-								sscanf(data.c_str(), "%f %f %f", &m_b.x, &m_b.y, &m_b.z);
+								motion_keys.push_back(ParseMotionKey(object_prop));
 							}
 							object_prop = object_prop->NextSibling();
 						}
 						if (!reset_transform)
 							transform = transform * scene->m_scene_objects[base_mesh_index]->GetModelMatrix();
 						scene_obj->SetTransforms(transform);
-						scene_obj->SetMotionBlur(m_b);
+						scene_obj->SetMotion(motion_keys);
 						if (tex_map_ind_1 > -1)
 							scene_obj->SetTextureMap(texturemaps[tex_map_ind_1]);
 						if (tex_map_ind_2 > -1)
@@ -1505,7 +1560,7 @@ namespace CHR
 						glm::mat4 transform = glm::mat4(1.0f);
 						auto s = std::make_shared<LightSphere>(glm::vec3(0,0,0), nullptr, true);
 
-						glm::vec3 m_b = { 0,0,0 };
+						std::vector<MotionKey> motion_keys;
 						glm::vec3 center = { 0,0,0 };
 						glm::vec3 rad_scale = { 1,1,1 };
 
@@ -1542,7 +1597,7 @@ namespace CHR
 								int ind;
 								sscanf(data.c_str(), "%d", &ind);
 								ind = ind - 1;
-								center = *vertices[ind];
+								center = vertices[ind];
 							}
 							else if (std::string(object_prop->Value()).compare(RAD) == 0)
 							{
@@ -1557,15 +1612,14 @@ namespace CHR
 							}
 							else if (std::string(object_prop->Value()).compare(MOTION_B) == 0)
 							{
-								std::string data = object_prop->FirstChild()->Value();
-								sscanf(data.c_str(), "%f %f %f", &m_b.x, &m_b.y, &m_b.z);
+								motion_keys.push_back(ParseMotionKey(object_prop));
 							}
 							object_prop = object_prop->NextSibling();
 						}
 						transform *= glm::scale(glm::translate(glm::mat4(1.0f), center), rad_scale);
 						auto scene_obj = std::shared_ptr<SceneObject>(SceneObject::CreateSphere(name, s, glm::vec3(), glm::vec3(), glm::vec3()));
 						scene_obj->SetTransforms(transform);
-						scene_obj->SetMotionBlur(m_b);
+						scene_obj->SetMotion(motion_keys);
 						if (tex_map_ind_1 > -1)
 							scene_obj->SetTextureMap(texturemaps[tex_map_ind_1]);
 						if (tex_map_ind_2 > -1)
@@ -1585,7 +1639,7 @@ namespace CHR
 						std::string().compare(SMOOTH) == 0;
 						glm::mat4 transform = glm::mat4(1.0f);
 
-						glm::vec3 m_b = { 0,0,0 };
+						std::vector<MotionKey> motion_keys;
 						glm::vec3 rad = { 0,0,0 };
 
 						bool has_tex = false;
@@ -1621,66 +1675,7 @@ namespace CHR
 								}
 								else
 								{
-									std::string data = object_prop->FirstChild()->Value();
-									std::vector<std::shared_ptr<glm::vec3>> mesh_verts;
-									std::vector<std::shared_ptr<glm::vec2>> mesh_uvs;
-									std::vector<std::shared_ptr<glm::vec3>> mesh_normals;
-									std::vector<unsigned int> mesh_indices;
-
-									int t_off = 0, v_off = 0;
-
-									auto vertex_offset = object_prop->ToElement()->FindAttribute("vertexOffset");
-									auto texture_offset = object_prop->ToElement()->FindAttribute("textureOffset");
-
-									if (vertex_offset != NULL)
-										v_off = vertex_offset->IntValue();
-
-									if (texture_offset != NULL)
-										t_off = texture_offset->IntValue();
-
-									std::string line;
-									std::istringstream stream(data);
-									mesh_verts = vertices;
-									if (has_tex)
-									{
-										mesh_uvs = texture_coords;
-									}
-									mesh_normals.reserve(vertices.size());
-									mesh_normals.resize(vertices.size());
-
-
-									while (std::getline(stream, line)) //read faces line by line
-									{
-										unsigned int ind[3];
-										std::istringstream iss(line);
-										iss >> ind[0] >> ind[1] >> ind[2];
-
-										if (iss) {
-
-											glm::vec3 a = (*vertices[ind[0] - 1 + v_off] - *vertices[ind[1] - 1 + v_off]);
-											glm::vec3 b = (*vertices[ind[0] - 1 + v_off] - *vertices[ind[2] - 1 + v_off]);
-
-											glm::vec3 normal = glm::vec3(0.0f, 0.0f, 0.0f);//glm::normalize(glm::cross(a, b));//calculate face normal
-
-											normal = (glm::cross(-a, -b));
-
-											for (int j = 0; j < 3; j++)
-											{
-												mesh_indices.push_back(ind[j] - 1 + v_off);
-												mesh_normals[ind[j] - 1 + v_off] = std::make_shared<glm::vec3>(glm::normalize(normal));
-												if (has_tex)
-												{
-													if (v_off != 0)
-													{
-														tex_inds.push_back(ind[j] - 1 + t_off);
-													}
-												}
-											}
-										}
-									}
-
-									mesh = std::shared_ptr<Mesh>
-										(new Mesh(mesh_verts, mesh_normals, mesh_uvs, std::vector<std::shared_ptr<glm::vec3>>(), mesh_indices));
+									mesh = std::shared_ptr<Mesh>(ParseFaceData(object_prop, vertices, texture_coords, has_tex, tex_inds));
 								}
 
 							}
@@ -1690,8 +1685,7 @@ namespace CHR
 							}
 							else if (std::string(object_prop->Value()).compare(MOTION_B) == 0)
 							{
-								std::string data = object_prop->FirstChild()->Value();
-								sscanf(data.c_str(), "%f %f %f", &m_b.x, &m_b.y, &m_b.z);
+								motion_keys.push_back(ParseMotionKey(object_prop));
 							}
 							object_prop = object_prop->NextSibling();
 						}
@@ -1699,7 +1693,7 @@ namespace CHR
 							(new SceneObject(mesh, name, glm::vec3(), glm::vec3(), glm::vec3(1.0, 1.0, 1.0), SHAPE_T::triangle, tex_inds, rad));
 						scene_obj->SetMaterial(materials[mat_ind]);
 						scene_obj->SetTransforms(transform);
-						scene_obj->SetMotionBlur(m_b);
+						scene_obj->SetMotion(motion_keys);
 						if (tex_map_ind_1 > -1)
 							scene_obj->SetTextureMap(texturemaps[tex_map_ind_1]);
 						if (tex_map_ind_2 > -1)
@@ -1716,7 +1710,7 @@ namespace CHR
 							tmp.push_back(std::dynamic_pointer_cast<LightTriangle>(tri));
 						}
 						//Add as LightMesh
-						auto li_mesh = std::make_shared<LightMesh>(rad, tmp);
+						auto li_mesh = std::make_shared<LightMesh>(rad, tmp, scene_obj->m_mesh->m_data);
 						scene->AddLight(name, li_mesh);
 					}
 					child_node = child_node->NextSibling();
@@ -1724,6 +1718,27 @@ namespace CHR
 			}
 			node = node->NextSibling();
 		}
+
+		//Instances share the data of their base mesh, visit every mesh data once
+		std::unordered_set<MeshData*> mesh_datas;
+		for (auto& obj : scene->m_scene_objects)
+			if (obj.second->m_mesh)
+				mesh_datas.insert(obj.second->m_mesh->m_data.get());
+		for (auto& light : scene->m_lights)
+			if (auto li_mesh = std::dynamic_pointer_cast<LightMesh>(light.second))
+				mesh_datas.insert(li_mesh->m_mesh_data.get());
+		mesh_datas.erase(nullptr);
+
+		size_t mesh_bytes = 0;
+		for (auto mesh_data : mesh_datas)
+		{
+			if (settings->m_compress_mesh_data)
+				mesh_data->Compress();
+			mesh_bytes += mesh_data->GetSizeBytes();
+		}
+		CH_TRACE("Mesh data: " + std::to_string(mesh_datas.size()) + " meshes, " + std::to_string(mesh_bytes / 1024) + " KB" +
+			(settings->m_compress_mesh_data ? " (compressed)" : ""));
+
 		return scene;
 	}
 }
\ No newline at end of file
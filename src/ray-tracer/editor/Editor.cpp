@@ -227,7 +227,7 @@ namespace CHR
 
 		ImGui::TextColored(CHR_COLOR::DARK_ORANGE, std::string("Settings").c_str());
 
-		static std::string rt_mode_names[] = { "Ray Casting", "RT w\\ Direct Lighting", "Path Tracing" };
+		static std::string rt_mode_names[] = { "Ray Casting", "RT w\\ Direct Lighting", "Path Tracing", "Wavefront Path Tracing" };
 		static RT_MODE selected_rt_method = RT_MODE::recursive_trace;
 
 
@@ -246,7 +246,7 @@ namespace CHR
 			ImGui::EndCombo();
 		}
 
-		if (selected_rt_method == RT_MODE::path_trace)//draw check boxes for path tracer
+		if (selected_rt_method == RT_MODE::path_trace || selected_rt_method == RT_MODE::wavefront_path_trace)//draw check boxes for path tracer
 		{
 			ImGui::Separator();
 			bool tmp = m_scene->GetCamera(m_settings->m_act_rt_cam_name)->IsImportanceSamplingOn();
@@ -304,6 +304,12 @@ namespace CHR
 		m_scene->GetCamera(m_settings->m_act_rt_cam_name)->SetNumberOfSamples(n_sample);
 
 		ImGui::InputInt("Thread Count", &m_settings->m_thread_count);
+
+		static const int packet_sizes[] = { 1, 4, 8, 16 };
+		int selected_packet = m_settings->m_packet_size >= 16 ? 3 : m_settings->m_packet_size >= 8 ? 2 :
+			m_settings->m_packet_size >= 4 ? 1 : 0;
+		if (ImGui::Combo("Ray Packet", &selected_packet, "1\0" "4\0" "8\0" "16\0"))
+			m_settings->m_packet_size = packet_sizes[selected_packet];
 		ImGui::PopItemWidth();
 		ImGui::Separator();
 
@@ -331,10 +337,16 @@ namespace CHR
 		}
 
 		ImGui::Separator();
-		static std::string split_names[] = { "SAH", "HLBVH", "Middle", "Eq. counts" };
+		static std::string split_names[] = { "SAH", "HLBVH", "Middle", "Eq. counts", "SBVH" };
 		static int selected_split = 0;
 
-		static int max_num_prim = 1;
+		static BVHBuildOptions bvh_options = []() {
+			BVHBuildOptions options;
+			options.max_prims_in_node = 8;
+			return options;
+		}();
+		static const int bvh_widths[] = { 2, 4, 8 };
+		static int selected_width = 0;
 		ImGui::PushItemWidth(120);
 		if (ImGui::BeginCombo("Split type", split_names[selected_split].c_str(), ImGuiComboFlags_None))
 		{
@@ -349,12 +361,23 @@ namespace CHR
 			}
 			ImGui::EndCombo();
 		}
-		ImGui::InputInt("Max. # of prims", &max_num_prim);
+		ImGui::InputInt("Max. # of prims", &bvh_options.max_prims_in_node);
+		ImGui::Combo("BVH width", &selected_width, "2\0" "4\0" "8\0");
+		ImGui::InputInt("SAH buckets", &bvh_options.sah_buckets);
+		if (static_cast<SplitMethod>(selected_split) == SplitMethod::SBVH)
+			ImGui::DragFloat("SBVH budget", &bvh_options.sbvh_budget, 0.01f, 0.0f, 4.0f, "%.2f");
+		ImGui::InputInt("Treelet passes", &bvh_options.treelet_passes);
+		if (selected_width == 0)
+			ImGui::Checkbox("Clustered layout", &bvh_options.clustered_layout);
+		else
+			ImGui::Checkbox("Quantized nodes", &bvh_options.quantized_nodes);
 		ImGui::PopItemWidth();
 
 		if (ImGui::Button("Init BVH"))
 		{
-			m_scene->InitBVH(max_num_prim, static_cast<SplitMethod>(selected_split));
+			bvh_options.split_method = static_cast<SplitMethod>(selected_split);
+			bvh_options.width = bvh_widths[selected_width];
+			m_scene->InitBVH(bvh_options);
 			CH_INFO("BVH initialized");
 		}
 
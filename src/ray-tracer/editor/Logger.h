@@ -19,4 +19,10 @@ namespace CHR {
 #define CH_WARN(...)     ::CHR::Logger::GetLogger()->warn(__VA_ARGS__)
 #define CH_ERROR(...)    ::CHR::Logger::GetLogger()->error(__VA_ARGS__)
 #define CH_FATAL(...)    ::CHR::Logger::GetLogger()->critical(__VA_ARGS__)
-#define CH_ASSERT(x, ...) { if(!(x)) { CH_ERROR("Assertion Failed: {0}", __VA_ARGS__); __debugbreak(); } }
+#if defined(_MSC_VER)
+#define CH_DEBUG_BREAK() __debugbreak()
+#else
+#include <csignal>
+#define CH_DEBUG_BREAK() std::raise(SIGTRAP)
+#endif
+#define CH_ASSERT(x, ...) { if(!(x)) { CH_ERROR("Assertion Failed: {0}", __VA_ARGS__); CH_DEBUG_BREAK(); } }
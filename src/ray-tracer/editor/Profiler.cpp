@@ -0,0 +1,116 @@
+#include "Profiler.h"
+
+#include <chrono>
+#include <cstdio>
+
+namespace CHR
+{
+	std::atomic<bool> Profiler::s_enabled{ false };
+	std::mutex Profiler::s_mutex;
+	Profiler::PhaseTimes Profiler::s_times;
+
+	static const char* s_phase_names[] = { "Integrate", "AccelConstruction", "AccelIntersect", "ShadowTest",
+		"Shade", "TextureSampling", "LightSampling", "PostProcess" };
+	static_assert(sizeof(s_phase_names) / sizeof(s_phase_names[0]) == (int)Prof::count, "Missing phase name");
+
+	//Only the thread owning the counters touches them until MergeThread
+	struct ProfilerThreadState
+	{
+		static constexpr int max_depth = 32;
+		Prof stack[max_depth];
+		int depth = 0;
+		int open[(int)Prof::count] = {};//a phase nested in itself is timed from the outermost scope
+		std::chrono::steady_clock::time_point last;
+		std::chrono::steady_clock::time_point enter[(int)Prof::count];
+		Profiler::PhaseTimes times;
+	};
+	thread_local ProfilerThreadState t_prof;
+
+	void Profiler::Enter(Prof phase)
+	{
+		auto now = std::chrono::steady_clock::now();
+		ProfilerThreadState& t = t_prof;
+		int p = (int)phase;
+
+		if (t.depth > 0 && t.depth <= ProfilerThreadState::max_depth)
+			t.times.self[(int)t.stack[t.depth - 1]] += std::chrono::duration<double>(now - t.last).count();
+		t.last = now;
+
+		if (t.open[p]++ == 0)
+			t.enter[p] = now;
+		t.times.calls[p]++;
+
+		if (t.depth < ProfilerThreadState::max_depth)
+			t.stack[t.depth] = phase;
+		t.depth++;
+	}
+
+	void Profiler::Exit()
+	{
+		auto now = std::chrono::steady_clock::now();
+		ProfilerThreadState& t = t_prof;
+
+		t.depth--;
+		if (t.depth < 0 || t.depth >= ProfilerThreadState::max_depth)
+		{
+			t.depth = t.depth < 0 ? 0 : t.depth;
+			return;
+		}
+		int p = (int)t.stack[t.depth];
+		t.times.self[p] += std::chrono::duration<double>(now - t.last).count();
+		t.last = now;
+
+		if (--t.open[p] == 0)
+			t.times.total[p] += std::chrono::duration<double>(now - t.enter[p]).count();
+	}
+
+	void Profiler::MergeThread()
+	{
+		std::lock_guard<std::mutex> lock(s_mutex);
+		for (int i = 0; i < (int)Prof::count; i++)
+		{
+			s_times.self[i] += t_prof.times.self[i];
+			s_times.total[i] += t_prof.times.total[i];
+			s_times.calls[i] += t_prof.times.calls[i];
+		}
+		t_prof.times = PhaseTimes();
+	}
+
+	void Profiler::Reset()
+	{
+		std::lock_guard<std::mutex> lock(s_mutex);
+		s_times = PhaseTimes();
+	}
+
+	Profiler::PhaseTimes Profiler::GetTimes()
+	{
+		std::lock_guard<std::mutex> lock(s_mutex);
+		return s_times;
+	}
+
+	const char* Profiler::GetPhaseName(Prof phase)
+	{
+		return s_phase_names[(int)phase];
+	}
+
+	std::string Profiler::GetReport()
+	{
+		PhaseTimes times = GetTimes();
+		double sum = 0.0;
+		for (int i = 0; i < (int)Prof::count; i++)
+			sum += times.self[i];
+
+		std::string report = "Profile (thread seconds, self / total):";
+		char line[160];
+		for (int i = 0; i < (int)Prof::count; i++)
+		{
+			if (times.calls[i] == 0)
+				continue;
+			snprintf(line, sizeof(line), "\n\t%-18s %10.4fs %5.1f%% / %10.4fs  %llu calls",
+				s_phase_names[i], times.self[i], sum > 0.0 ? 100.0 * times.self[i] / sum : 0.0,
+				times.total[i], times.calls[i]);
+			report += line;
+		}
+		return report;
+	}
+}
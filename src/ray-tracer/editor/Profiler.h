@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <string>
+
+namespace CHR
+{
+	//Phases timed by ProfilePhase markers. Integrate covers the render workers,
+	//everything a worker does outside the other phases is charged to it.
+	enum class Prof { Integrate, AccelConstruction, AccelIntersect, ShadowTest, Shade, TextureSampling, LightSampling, PostProcess, count };
+
+	class Profiler
+	{
+	public:
+		struct PhaseTimes
+		{
+			double self[(int)Prof::count] = {};//seconds spent in the phase itself, nested phases excluded
+			double total[(int)Prof::count] = {};//seconds from entering the phase to leaving it
+			unsigned long long calls[(int)Prof::count] = {};
+		};
+
+		inline static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+		inline static void SetEnabled(bool enabled) { s_enabled = enabled; }
+
+		static void Enter(Prof phase);
+		static void Exit();
+
+		//Adds the calling thread's counters to the merged times and clears them
+		static void MergeThread();
+		static void Reset();
+
+		static PhaseTimes GetTimes();
+		static std::string GetReport();
+		static const char* GetPhaseName(Prof phase);
+
+	private:
+		static std::atomic<bool> s_enabled;
+		static std::mutex s_mutex;
+		static PhaseTimes s_times;
+	};
+
+	//Scoped marker, times its scope as the given phase while the profiler is enabled
+	class ProfilePhase
+	{
+	public:
+		ProfilePhase(Prof phase)
+			:m_active(Profiler::IsEnabled())
+		{
+			if (m_active)
+				Profiler::Enter(phase);
+		}
+		~ProfilePhase()
+		{
+			if (m_active)
+				Profiler::Exit();
+		}
+
+		ProfilePhase(const ProfilePhase&) = delete;
+		ProfilePhase& operator=(const ProfilePhase&) = delete;
+
+	private:
+		bool m_active;
+	};
+}
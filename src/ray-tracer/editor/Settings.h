@@ -1,6 +1,7 @@
 #pragma once
 #include <string>
 #include <list>
+#include <thread>
 #include <thirdparty/glm/glm/glm.hpp>
 
 #include "Observer.h"
@@ -26,7 +27,8 @@ namespace CHR
 		void Detach(Observer* observer) ;
 		void Notify();
 
-		int m_thread_count = 8;
+		//Render thread count, sizes the process wide ThreadPool
+		int m_thread_count = std::thread::hardware_concurrency() > 0 ? (int)std::thread::hardware_concurrency() : 8;
 		std::string m_act_editor_cam_name = "";
 		std::string m_act_rt_cam_name = "";
 		float m_camera_move_speed = 0.4;
@@ -37,6 +39,9 @@ namespace CHR
 		bool m_calc_reflections = true;
 		bool m_calc_refractions = true;
 		int m_recur_depth = 6;
+		int m_packet_size = 16;	//camera rays of neighbouring pixels traced as one packet: 1, 4, 8 or 16
+		bool m_compress_mesh_data = false;	//octahedral normals and half uvs, 4 bytes each
+		std::string m_bvh_cache_dir = "";	//built BVHs are cached here and reused by later runs, empty: always build
 		IM_POST_PROC_T m_ldr_post_process = none;
 
 	private:
@@ -1,5 +1,5 @@
 #include "Shader.h"
-#include <thirdparty\glad\include\glad\glad.h>
+#include <thirdparty/glad/include/glad/glad.h>
 
 
 #include <fstream>
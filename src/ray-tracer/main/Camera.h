@@ -142,6 +142,7 @@ namespace CHR
 		float m_burn_perc = 1.0f;
 
 		bool m_left_handed = false;
+		bool m_path_trace = false;//<Renderer>PathTracing</Renderer>
 
 
 	private:
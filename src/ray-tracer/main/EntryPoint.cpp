@@ -1,4 +1,4 @@
-//#include <thirdparty\glad\include\glad\glad.h>
+//#include <thirdparty/glad/include/glad/glad.h>
 //#include <thirdparty/glfw-3.3/include/GLFW/glfw3.h>
 
 //#define _CRTDBG_MAP_ALLOC  
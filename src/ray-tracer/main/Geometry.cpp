@@ -22,18 +22,6 @@ namespace CHR
 		return diag.x * diag.y * diag.z;
 	}
 
-	void Bounds3::Extend(const Bounds3& bounds)
-	{
-		min = glm::min(min, bounds.min);
-		max = glm::max(max, bounds.max);
-	}
-
-	void Bounds3::Extend(const glm::vec3& point)
-	{
-		min = glm::min(min, point);
-		max = glm::max(max, point);
-	}
-
 	Bounds3 Bounds3::Extend(const Bounds3& b1, const Bounds3& b2)
 	{
 		glm::vec3 min = glm::min(b1.min, b2.min);
@@ -41,4 +29,15 @@ namespace CHR
 
 		return Bounds3(min, max);
 	}
+
+	Bounds3 Bounds3::Transform(const glm::mat4& m) const
+	{
+		Bounds3 b;
+		for (int i = 0; i < 8; i++)
+		{
+			glm::vec3 corner = { (i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z };
+			b.Extend(glm::vec3(m * glm::vec4(corner, 1.0f)));
+		}
+		return b;
+	}
 }
@@ -71,8 +71,9 @@ namespace CHR
 			return (i == 0) ? min : max;
 		}
 
+		//Boxes entered beyond ray.t_max are culled, hit_t0 receives the entry distance
 		bool IntersectP(const Ray& ray, const glm::vec3& inv_dir,
-			const int dirIsNeg[3]) const {
+			const int dirIsNeg[3], float* hit_t0 = nullptr) const {
 			const Bounds3& bounds = *this;
 			// Check for ray intersection against $x$ and $y$ slabs
 			float t_min = (bounds[dirIsNeg[0]].x - ray.origin.x) * inv_dir.x;
@@ -96,12 +97,23 @@ namespace CHR
 			if (t_min > tz_max || tz_min > t_max) return false;
 			if (tz_min > t_min) t_min = tz_min;
 			if (tz_max < t_max) t_max = tz_max;
-			return (t_min < t_max) && (t_max > ray.intersect_eps);
+			if (hit_t0)
+				*hit_t0 = t_min;
+			return (t_min < t_max) && (t_max > ray.intersect_eps) && (t_min < ray.t_max);
 		}
 
 
-		void Extend(const Bounds3& bounds);
-		void Extend(const glm::vec3& point);
+		//Inline, the BVH build calls these once or twice per primitive and level
+		void Extend(const Bounds3& bounds)
+		{
+			min = glm::min(min, bounds.min);
+			max = glm::max(max, bounds.max);
+		}
+		void Extend(const glm::vec3& point)
+		{
+			min = glm::min(min, point);
+			max = glm::max(max, point);
+		}
 
 		glm::vec3 Offset(const glm::vec3& p) const {
 			glm::vec3 o = p - min;
@@ -113,6 +125,9 @@ namespace CHR
 
 		static Bounds3 Extend(const Bounds3& b1, const Bounds3& b2);
 
+		//Bounds of the 8 transformed corners
+		Bounds3 Transform(const glm::mat4& m) const;
+
 		glm::vec3 min;
 		glm::vec3 max;
 	};
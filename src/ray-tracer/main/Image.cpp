@@ -3,6 +3,7 @@
 #include <algorithm>
 
 #include <ray-tracer/editor/Logger.h>
+#include <ray-tracer/main/ThreadPool.h>
 #include <thirdparty/glm/glm/glm.hpp>
 #include <thirdparty/glm/glm/common.hpp>
 #include <thirdparty/glm/glm/gtx/color_space.hpp>
@@ -72,13 +73,13 @@ namespace CHR
 		if (ret != TINYEXR_SUCCESS) {
 			//fprintf(stderr, "Save EXR err: %s\n", err);
 			FreeEXRErrorMessage(err); // free's buffer for an error message
-			return ret;
+			return false;
 		}
 
 		free(header.channels);
 		free(header.pixel_types);
 		free(header.requested_pixel_types);
-
+		return true;
 	}
 
 	Image::Image(int width, int height, bool is_hdr)
@@ -114,43 +115,50 @@ namespace CHR
 	}
 	void Image::ToneMap(float key_v, float burn_per, float satur, float gamma)
 	{
-		float tmp = 0.0f;
+		ThreadPool* pool = ThreadPool::GetInstance();
 
 		std::vector<float> luminances(m_width * m_height);
-		//Calculate L_w_hat
-		for (int i = 0; i < m_width * m_height; i++)
-		{
-			if (!glm::any(glm::isnan(m_hdr_pixels[i])))
-				tmp += std::logf(0.00001f + luminosity(m_hdr_pixels[i]));
-		}
+		//Calculate L_w_hat, summed per row so rows can run in parallel
+		std::vector<float> row_log_sums(m_height, 0.0f);
+		pool->ParallelFor(m_height, [&](int y) {
+			for (int i = y * m_width; i < (y + 1) * m_width; i++)
+			{
+				if (!glm::any(glm::isnan(m_hdr_pixels[i])))
+					row_log_sums[y] += std::log(0.00001f + luminosity(m_hdr_pixels[i]));
+			}
+		});
+		float tmp = 0.0f;
+		for (float row_sum : row_log_sums)
+			tmp += row_sum;
 		float l_w_hat = expf(tmp / ((float)m_width * m_height));
 
-		for (int i = 0; i < m_width * m_height; i++)
-		{
-			luminances[i] = key_v * (luminosity(m_hdr_pixels[i])) / l_w_hat;
-		}
+		pool->ParallelFor(m_height, [&](int y) {
+			for (int i = y * m_width; i < (y + 1) * m_width; i++)
+				luminances[i] = key_v * (luminosity(m_hdr_pixels[i])) / l_w_hat;
+		});
 
 		//sort luminaces to find L_white
 		std::sort(luminances.begin(), luminances.end());
 		float l_white = luminances[glm::clamp((int)round((m_width * m_height) * (1.0f - burn_per / 100.0f)), 
 			0, (int)luminances.size()-1)];
 
-		for (int i = 0; i < m_width * m_height; i++)
-		{
-			float l_scaled = key_v * (luminosity(m_hdr_pixels[i])) / l_w_hat ;
+		pool->ParallelFor(m_height, [&](int y) {
+			for (int i = y * m_width; i < (y + 1) * m_width; i++)
+			{
+				float l_scaled = key_v * (luminosity(m_hdr_pixels[i])) / l_w_hat ;
 
-			float l_out = (l_scaled * (1.0f + l_scaled / (pow(l_white,2 )))) / (1.0f + l_scaled);
+				float l_out = (l_scaled * (1.0f + l_scaled / (pow(l_white,2 )))) / (1.0f + l_scaled);
 
-			glm::vec3 color;
-			if (luminosity(m_hdr_pixels[i]) > 0.0f && glm::compAdd(m_hdr_pixels[i])> 0.0)
-				color = l_out * glm::pow(m_hdr_pixels[i] / luminosity(m_hdr_pixels[i]), glm::vec3(1, 1, 1) * satur);
-			else
-				color = { 0,0,0 };
+				glm::vec3 color;
+				if (luminosity(m_hdr_pixels[i]) > 0.0f && glm::compAdd(m_hdr_pixels[i])> 0.0)
+					color = l_out * glm::pow(m_hdr_pixels[i] / luminosity(m_hdr_pixels[i]), glm::vec3(1, 1, 1) * satur);
+				else
+					color = { 0,0,0 };
 
-			//gamma correction
-			m_ldr_pixels[i] = glm::clamp(255.0f * glm::pow(color, glm::vec3(1,1,1) / gamma),0.0f, 255.0f);
-		}
-		
+				//gamma correction
+				m_ldr_pixels[i] = glm::clamp(255.0f * glm::pow(color, glm::vec3(1,1,1) / gamma),0.0f, 255.0f);
+			}
+		});
 	}
 	void Image::SetPixel(int x, int y, const glm::vec3& pixel)
 	{
@@ -1,6 +1,7 @@
 #include "ImageTextureMap.h"
 
 #include <thirdparty/glm/glm/gtx/component_wise.hpp>
+#include <ray-tracer/editor/Profiler.h>
 
 
 namespace CHR
@@ -14,6 +15,7 @@ namespace CHR
 
 	glm::vec3 ImageTextureMap::SampleAt(glm::vec3 uv) const
 	{
+		ProfilePhase _(Prof::TextureSampling);
 		glm::vec2 uv_r = { uv.x- floor(uv.x),  uv.y - floor(uv.y) };
 
 		glm::vec2 s = { uv_r.x * m_texture->GetWidth(), uv_r.y * m_texture->GetHeigth() };
@@ -48,6 +50,7 @@ namespace CHR
 
 	glm::vec3 ImageTextureMap::BumpAt(glm::vec3 uv) const
 	{
+		ProfilePhase _(Prof::TextureSampling);
 		glm::vec2 uv_r = { uv.x - floor(uv.x),  uv.y - floor(uv.y) };
 
 		glm::vec2 s = { uv_r.x * m_texture->GetWidth(), uv_r.y * m_texture->GetHeigth() };
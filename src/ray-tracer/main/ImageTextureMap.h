@@ -1,5 +1,6 @@
 #pragma once
 #include "TextureMap.h"
+#include <memory>
 #include "Texture.h"
 
 namespace CHR
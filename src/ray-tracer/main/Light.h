@@ -23,7 +23,8 @@ namespace CHR
 
 		SET_INTENSITY(m_ambient, m_diffuse, m_specular, m_inten)
 
-		virtual glm::vec3 SampleRadianceAt(const glm::vec3 isect_pos, glm::vec3& l_vec) const = 0;	//Returns radiance at given point.Samples a point to construct a direction to the light.USE ISEC. NORMAL FOR ENV. LIGHT
+		//l_distance is set to the distance of the sampled point, INFINITY for lights at infinity
+		virtual glm::vec3 SampleRadianceAt(const glm::vec3 isect_pos, glm::vec3& l_vec, float& l_distance) const = 0;	//Returns radiance at given point.Samples a point to construct a direction to the light.USE ISEC. NORMAL FOR ENV. LIGHT
 
 		std::string m_shader_var_name;
 		glm::vec3 m_ambient = {0,0,0};
@@ -61,9 +62,10 @@ namespace CHR
 			m_li_type = LIGHT_T::directional;
 		}
 
-		glm::vec3 SampleRadianceAt(const glm::vec3 isect_pos, glm::vec3& l_vec) const
+		glm::vec3 SampleRadianceAt(const glm::vec3 /*isect_pos*/, glm::vec3& l_vec, float& l_distance) const
 		{
 			l_vec = glm::normalize(-m_direction);
+			l_distance = INFINITY;
 			return m_inten;
 		}
 
@@ -145,10 +147,11 @@ namespace CHR
 			m_li_type = LIGHT_T::point;
 		}
 
-		glm::vec3 SampleRadianceAt(const glm::vec3 isect_pos, glm::vec3& l_vec) const
+		glm::vec3 SampleRadianceAt(const glm::vec3 isect_pos, glm::vec3& l_vec, float& l_distance) const
 		{
 			float d = glm::distance(m_position, isect_pos);
 			l_vec = glm::normalize(m_position - isect_pos);
+			l_distance = d;
 			return m_inten / (d * d);
 		}
 
@@ -243,11 +246,12 @@ namespace CHR
 			m_li_type = LIGHT_T::spot;
 		}
 
-		glm::vec3 SampleRadianceAt(const glm::vec3 isect_pos, glm::vec3& l_vec) const
+		glm::vec3 SampleRadianceAt(const glm::vec3 isect_pos, glm::vec3& l_vec, float& l_distance) const
 		{
 			l_vec = glm::normalize(m_position - isect_pos);
 
 			float d = glm::distance(m_position, isect_pos);
+			l_distance = d;
 			glm::vec3 intensity = m_inten;
 			float theta = acos(glm::dot(l_vec, normalize(-m_direction)));
 			float epsilon = m_fall_off / 2 - m_cut_off / 2;
@@ -339,7 +343,7 @@ namespace CHR
 			m_li_type = LIGHT_T::area;
 		}
 
-		glm::vec3 SampleRadianceAt(const glm::vec3 isect_pos, glm::vec3& l_vec) const
+		glm::vec3 SampleRadianceAt(const glm::vec3 isect_pos, glm::vec3& l_vec, float& l_distance) const
 		{
 			glm::vec3 u, v;
 			CHR_UTILS::GenerateONB(m_normal, u, v);
@@ -351,6 +355,7 @@ namespace CHR
 			float cos_t = glm::max(0.0f, glm::dot(l_vec, glm::normalize(m_normal)));
 
 			float d = glm::distance(sample_pos, isect_pos);
+			l_distance = d;
 			return m_inten * cos_t * m_size * m_size / (d * d);
 		}
 
@@ -419,9 +424,10 @@ namespace CHR
 			m_li_type = LIGHT_T::environment;
 		}
 
-		glm::vec3 SampleRadianceAt(const glm::vec3 isect_normal, glm::vec3& l_vec) const  // NOT POSITION. NORMAL!!!
+		glm::vec3 SampleRadianceAt(const glm::vec3 isect_normal, glm::vec3& l_vec, float& l_distance) const  // NOT POSITION. NORMAL!!!
 		{
 			l_vec = CHR_UTILS::UnifSampleUnitHemisphere(isect_normal);
+			l_distance = INFINITY;
 
 			float u, v;
 			u = (0.5f - atan2f(l_vec.z, l_vec.x) * (0.5f / CHR_UTILS::PI)) * m_tex->GetWidth();
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <vector>
+#include <thirdparty/glm/glm/glm.hpp>
+#include <thirdparty/glm/glm/gtc/packing.hpp>
+
+namespace CHR
+{
+	//Vertex attributes of a mesh in contiguous arrays, three 32 bit indices per face.
+	//Triangles refer to their face in here instead of holding vertices of their own,
+	//instances of a mesh share the data of their base mesh.
+	struct MeshData
+	{
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec3> normals;
+		std::vector<glm::vec3> colors;
+		std::vector<glm::vec2> texcoords;
+		std::vector<unsigned int> indices;
+		std::vector<unsigned int> texcoord_indices;	//only when uvs are indexed apart from the positions
+
+		//Filled by Compress, which drops the full precision arrays
+		std::vector<unsigned int> packed_normals;	//octahedral, 2x16 bit snorm
+		std::vector<unsigned int> packed_texcoords;	//2x16 bit half
+
+		inline unsigned int GetFaceCount() const { return (unsigned int)indices.size() / 3; }
+		inline bool HasTexCoords() const { return !texcoords.empty() || !packed_texcoords.empty(); }
+
+		inline const glm::vec3& Position(unsigned int face, int corner) const
+		{
+			return positions[indices[3 * face + corner]];
+		}
+
+		inline glm::vec3 Normal(unsigned int face, int corner) const
+		{
+			unsigned int i = indices[3 * face + corner];
+			return packed_normals.empty() ? normals[i] : DecodeOctahedral(packed_normals[i]);
+		}
+
+		inline glm::vec2 TexCoord(unsigned int face, int corner) const
+		{
+			unsigned int i = texcoord_indices.empty() ? indices[3 * face + corner] : texcoord_indices[3 * face + corner];
+			return packed_texcoords.empty() ? texcoords[i] : glm::unpackHalf2x16(packed_texcoords[i]);
+		}
+
+		//Vertex attribute by vertex index, for uploading the whole mesh
+		inline glm::vec3 NormalAt(unsigned int i) const
+		{
+			return packed_normals.empty() ? normals[i] : DecodeOctahedral(packed_normals[i]);
+		}
+
+		inline glm::vec2 TexCoordAt(unsigned int i) const
+		{
+			return packed_texcoords.empty() ? texcoords[i] : glm::unpackHalf2x16(packed_texcoords[i]);
+		}
+
+		inline size_t GetNormalCount() const { return packed_normals.empty() ? normals.size() : packed_normals.size(); }
+		inline size_t GetTexCoordCount() const { return packed_texcoords.empty() ? texcoords.size() : packed_texcoords.size(); }
+
+		//Normals to 4 bytes (octahedral) and uvs to 4 bytes (half), call after the normals are final
+		void Compress(bool compress_normals = true, bool compress_texcoords = true)
+		{
+			if (compress_normals && !normals.empty())
+			{
+				packed_normals.resize(normals.size());
+				for (size_t i = 0; i < normals.size(); i++)
+					packed_normals[i] = EncodeOctahedral(normals[i]);
+				std::vector<glm::vec3>().swap(normals);
+			}
+			if (compress_texcoords && !texcoords.empty())
+			{
+				packed_texcoords.resize(texcoords.size());
+				for (size_t i = 0; i < texcoords.size(); i++)
+					packed_texcoords[i] = glm::packHalf2x16(texcoords[i]);
+				std::vector<glm::vec2>().swap(texcoords);
+			}
+		}
+
+		size_t GetSizeBytes() const
+		{
+			return positions.capacity() * sizeof(glm::vec3) + normals.capacity() * sizeof(glm::vec3) +
+				colors.capacity() * sizeof(glm::vec3) + texcoords.capacity() * sizeof(glm::vec2) +
+				(indices.capacity() + texcoord_indices.capacity() +
+					packed_normals.capacity() + packed_texcoords.capacity()) * sizeof(unsigned int);
+		}
+
+		static unsigned int EncodeOctahedral(glm::vec3 n)
+		{
+			float l1 = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+			if (l1 == 0.0f)//normals of unreferenced vertices
+				return glm::packSnorm2x16(glm::vec2(0.0f));
+			glm::vec2 p = glm::vec2(n.x, n.y) / l1;
+			if (n.z < 0.0f)
+				p = (1.0f - glm::abs(glm::vec2(p.y, p.x))) * glm::vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+			return glm::packSnorm2x16(p);
+		}
+
+		static glm::vec3 DecodeOctahedral(unsigned int packed)
+		{
+			glm::vec2 p = glm::unpackSnorm2x16(packed);
+			glm::vec3 n(p.x, p.y, 1.0f - glm::abs(p.x) - glm::abs(p.y));
+			float t = glm::max(-n.z, 0.0f);
+			n.x += n.x >= 0.0f ? -t : t;
+			n.y += n.y >= 0.0f ? -t : t;
+			return glm::normalize(n);
+		}
+	};
+}
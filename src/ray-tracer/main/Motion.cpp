@@ -0,0 +1,189 @@
+#include "Motion.h"
+
+#include <algorithm>
+
+#include <thirdparty/glm/glm/gtc/matrix_transform.hpp>
+#include <thirdparty/glm/glm/gtx/component_wise.hpp>
+
+namespace CHR
+{
+	// Inverse of a rotation and a scale, rotated back first
+	static glm::mat3 UndoRotationScale(const glm::quat& rotation, const glm::vec3& scale)
+	{
+		glm::mat3 undo = glm::mat3_cast(glm::conjugate(rotation));
+		for (int r = 0; r < 3; r++)
+			for (int c = 0; c < 3; c++)
+				undo[c][r] /= scale[r];
+		return undo;
+	}
+
+	Motion::Motion(std::vector<MotionKey> keys)
+		:m_keys(std::move(keys))
+	{
+		for (MotionKey& key : m_keys)
+			key.time = glm::clamp(key.time, 0.0f, 1.0f);
+		std::stable_sort(m_keys.begin(), m_keys.end(),
+			[](const MotionKey& a, const MotionKey& b) { return a.time < b.time; });
+		if (m_keys.empty() || m_keys.front().time > 0.0f)
+		{
+			MotionKey rest;
+			rest.time = 0.0f;
+			m_keys.insert(m_keys.begin(), rest);
+		}
+		for (const MotionKey& key : m_keys)
+		{
+			m_translation = m_translation && key.scale == glm::vec3(1.0f) && std::abs(key.rotation.w) == 1.0f;
+			m_key_undo.push_back(UndoRotationScale(key.rotation, key.scale));
+		}
+		for (size_t i = 0; i + 1 < m_keys.size(); i++)
+			m_interval_curved.push_back(m_keys[i].rotation != m_keys[i + 1].rotation || m_keys[i].scale != m_keys[i + 1].scale);
+	}
+
+	size_t Motion::IntervalAt(float time, float& u) const
+	{
+		// Two keys are the common case, the MotionBlur offset of the scene files
+		size_t i = 0;
+		if (m_keys.size() > 2)
+		{
+			auto next = std::upper_bound(m_keys.begin() + 1, m_keys.end() - 1, time,
+				[](float t, const MotionKey& key) { return t < key.time; });
+			i = next - m_keys.begin() - 1;
+		}
+		const MotionKey& a = m_keys[i];
+		const MotionKey& b = m_keys[i + 1];
+		u = b.time > a.time ? glm::clamp((time - a.time) / (b.time - a.time), 0.0f, 1.0f) : 1.0f;
+		return i;
+	}
+
+	MotionKey Motion::KeyAt(float time) const
+	{
+		if (time <= m_keys.front().time)
+			return m_keys.front();
+		if (time >= m_keys.back().time)
+			return m_keys.back();
+
+		float u;
+		size_t i = IntervalAt(time, u);
+		const MotionKey& a = m_keys[i];
+		const MotionKey& b = m_keys[i + 1];
+
+		MotionKey key;
+		key.time = time;
+		key.translation = glm::mix(a.translation, b.translation, u);
+		if (!m_translation)
+		{
+			key.rotation = glm::slerp(a.rotation, b.rotation, u);
+			key.scale = glm::mix(a.scale, b.scale, u);
+		}
+		return key;
+	}
+
+	glm::mat4 Motion::TransformAt(const glm::mat4& transform, float time) const
+	{
+		MotionKey key = KeyAt(time);
+		glm::vec3 origin = transform[3];
+		glm::mat4 motion = glm::translate(glm::mat4(1.0f), origin + key.translation) * glm::mat4_cast(key.rotation);
+		motion = glm::scale(motion, key.scale);
+		motion = glm::translate(motion, -origin);
+		return motion * transform;
+	}
+
+	glm::mat4 Motion::InverseTransformAt(const glm::mat4& inverse, const glm::vec3& origin, float time) const
+	{
+		if (m_keys.size() == 1)
+			return inverse;
+		float u;
+		size_t i = IntervalAt(time, u);
+		glm::vec3 translation = glm::mix(m_keys[i].translation, m_keys[i + 1].translation, u);
+		// Translations only update the last column
+		if (m_translation)
+			return glm::translate(inverse, -translation);
+
+		glm::mat3 undo = m_interval_curved[i] ?
+			UndoRotationScale(glm::slerp(m_keys[i].rotation, m_keys[i + 1].rotation, u), glm::mix(m_keys[i].scale, m_keys[i + 1].scale, u)) :
+			m_key_undo[i];
+		// The motion is undone in reverse, inverse * T(origin) * undo * T(-origin - translation), composed as
+		// affine maps since inverse is one
+		glm::mat3 linear = glm::mat3(inverse);
+		glm::mat4 result = glm::mat4(linear * undo);
+		result[3] = glm::vec4(linear * (origin - undo * (origin + translation)) + glm::vec3(inverse[3]), 1.0f);
+		return result;
+	}
+
+	LinearBounds Motion::Bound(const glm::mat4& transform, const std::function<Bounds3(const glm::mat4&)>& bounds_under) const
+	{
+		// Distance of the shape's farthest point from the origin its keys rotate and scale about
+		glm::vec3 origin = transform[3];
+		float reach = -1.0f;
+		auto getReach = [&]() {
+			if (reach < 0.0f)
+			{
+				Bounds3 rest = bounds_under(transform);
+				reach = glm::length(glm::max(glm::abs(rest.min - origin), glm::abs(rest.max - origin)));
+			}
+			return reach;
+		};
+
+		struct Sample { float time; Bounds3 bounds; };
+		std::vector<Sample> samples;
+		samples.push_back({ 0.0f, bounds_under(TransformAt(transform, 0.0f)) });
+		for (size_t i = 0; i + 1 < m_keys.size(); i++)
+		{
+			const MotionKey& a = m_keys[i];
+			const MotionKey& b = m_keys[i + 1];
+			// A point moves on a straight line unless the interval rotates or scales. Then, with theta the rotation
+			// angle and ds the largest scale change, its acceleration over the interval is bounded by
+			// reach * (theta^2 * scale + 2 * theta * ds), and h^2 / 8 of that bounds the error of a chord of length h
+			float theta = 2.0f * std::acos(std::min(1.0f, std::abs(glm::dot(a.rotation, b.rotation))));
+			float ds = glm::compMax(glm::abs(b.scale - a.scale));
+			float scale = std::max(glm::compMax(glm::abs(a.scale)), glm::compMax(glm::abs(b.scale)));
+			bool curved = theta > 0.0f || ds > 0.0f;
+			int steps = curved ? CURVED_SEGMENT_SAMPLES : 1;
+			float pad = curved ? getReach() * (theta * theta * scale + 2.0f * theta * ds) / (8.0f * steps * steps) : 0.0f;
+			for (int k = 1; k <= steps; k++)
+			{
+				float time = glm::mix(a.time, b.time, (float)k / steps);
+				Bounds3 bounds = bounds_under(TransformAt(transform, time));
+				bounds.min -= glm::vec3(pad);
+				bounds.max += glm::vec3(pad);
+				samples.push_back({ time, bounds });
+			}
+			// The chord from the interval's start is padded too
+			if (pad > 0.0f)
+			{
+				Bounds3& start = samples[samples.size() - steps - 1].bounds;
+				start.min -= glm::vec3(pad);
+				start.max += glm::vec3(pad);
+			}
+		}
+		if (samples.back().time < 1.0f)
+			samples.push_back({ 1.0f, samples.back().bounds });
+
+		// Start from the end poses and move both ends of a bound out by what a sample lacks, which keeps
+		// every sample seen before inside
+		LinearBounds fit = { { samples.front().bounds, samples.back().bounds } };
+		for (const Sample& sample : samples)
+		{
+			Bounds3 at = fit.At(sample.time);
+			glm::vec3 below = glm::max(at.min - sample.bounds.min, glm::vec3(0.0f));
+			glm::vec3 above = glm::max(sample.bounds.max - at.max, glm::vec3(0.0f));
+			for (Bounds3& b : fit.bounds)
+			{
+				b.min -= below;
+				b.max += above;
+			}
+		}
+		return fit;
+	}
+
+	bool Motion::IsStatic() const
+	{
+		for (const MotionKey& key : m_keys)
+		{
+			if (key.translation != glm::vec3(0.0f) || key.scale != glm::vec3(1.0f) ||
+				std::abs(key.rotation.w) != 1.0f)
+				return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <thirdparty/glm/glm/glm.hpp>
+#include <thirdparty/glm/glm/gtc/quaternion.hpp>
+
+#include <ray-tracer/main/Geometry.h>
+
+namespace CHR
+{
+	//Bounds at shutter open and close, a moving shape is inside their interpolation at every time in between
+	struct LinearBounds
+	{
+		Bounds3 bounds[2];
+
+		inline Bounds3 At(float time) const
+		{
+			return Bounds3(glm::mix(bounds[0].min, bounds[1].min, time), glm::mix(bounds[0].max, bounds[1].max, time));
+		}
+		inline Bounds3 Union() const { return Bounds3::Extend(bounds[0], bounds[1]); }
+		inline void Extend(const LinearBounds& b)
+		{
+			bounds[0].Extend(b.bounds[0]);
+			bounds[1].Extend(b.bounds[1]);
+		}
+	};
+
+	//Pose of a moving object at a time of the shutter interval, relative to its pose when the shutter opens
+	struct MotionKey
+	{
+		float time = 1.0f;//0 shutter open, 1 shutter close
+		glm::vec3 translation = glm::vec3(0.0f);
+		glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+		glm::vec3 scale = glm::vec3(1.0f);
+
+		bool operator==(const MotionKey& other) const
+		{
+			return time == other.time && translation == other.translation &&
+				rotation == other.rotation && scale == other.scale;
+		}
+		bool operator!=(const MotionKey& other) const { return !(*this == other); }
+	};
+
+	//Keyframed motion of an object over the shutter interval. Between two keys the translation and the scale
+	//are interpolated linearly and the rotation spherically, the object rests at its first and last key.
+	//Rotation and scale act in world axes about the object's origin, so a single translation key at time 1
+	//is the MotionBlur offset of the scene files
+	class Motion
+	{
+	public:
+		//Keys are sorted by time, a rest key at time 0 is added when they start later
+		Motion(std::vector<MotionKey> keys);
+
+		//Model matrix at time, transform is the one at shutter open
+		glm::mat4 TransformAt(const glm::mat4& transform, float time) const;
+		//inverse times the inverse of the motion at time, with origin the object's origin at shutter open.
+		//For the inverse model matrix, or a matrix that ends with it, this gives the one at time. Nothing is
+		//inverted, the keys keep their inverse rotation and scale and only a rotating or scaling interval slerps
+		glm::mat4 InverseTransformAt(const glm::mat4& inverse, const glm::vec3& origin, float time) const;
+		//Linear bounds of a shape with the transform at shutter open, bounds_under gives its world bounds under
+		//a model matrix. Poses are sampled along every key interval, more densely when it rotates or scales,
+		//and grown by how far the shape can stray from a straight line between two samples
+		LinearBounds Bound(const glm::mat4& transform, const std::function<Bounds3(const glm::mat4&)>& bounds_under) const;
+
+		//True when no key moves the object
+		bool IsStatic() const;
+		//True when no key rotates or scales the object
+		inline bool IsTranslation() const { return m_translation; }
+		inline const std::vector<MotionKey>& GetKeys() const { return m_keys; }
+
+		//Samples of a key interval that rotates or scales
+		static constexpr int CURVED_SEGMENT_SAMPLES = 8;
+
+	private:
+		MotionKey KeyAt(float time) const;
+		//Index of the key interval holding time and how far along it the time is
+		size_t IntervalAt(float time, float& u) const;
+
+		std::vector<MotionKey> m_keys;
+		std::vector<glm::mat3> m_key_undo;//Inverse rotation and scale of every key
+		std::vector<uint8_t> m_interval_curved;//Whether a key interval rotates or scales
+		bool m_translation = true;
+	};
+}
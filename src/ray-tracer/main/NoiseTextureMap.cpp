@@ -1,7 +1,9 @@
 #include "NoiseTextureMap.h"
 
+#include <algorithm>
 #include <random>
 #include <time.h>
+#include <ray-tracer/editor/Profiler.h>
 
 namespace CHR
 {
@@ -31,6 +33,7 @@ namespace CHR
 
 	glm::vec3 NoiseTextureMap::SampleAt(glm::vec3 p) const
 	{
+		ProfilePhase _(Prof::TextureSampling);
 		p = p * m_scale;
 		float x_min = floor(p.x), x_max = ceil(p.x),
 			y_min = floor(p.y), y_max = ceil(p.y),
@@ -61,6 +64,7 @@ namespace CHR
 
 	glm::vec3 NoiseTextureMap::BumpAt(glm::vec3 p) const
 	{
+		ProfilePhase _(Prof::TextureSampling);
 		glm::vec3 noise_o, noise_x, noise_y, noise_z;
 		noise_o = SampleAt(p);
 		noise_x = SampleAt(p + glm::vec3(EPSILON, 0, 0));
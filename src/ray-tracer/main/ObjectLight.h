@@ -16,15 +16,19 @@ namespace CHR
 			m_li_type = LIGHT_T::object;
 		}
 		
-		bool Intersect(const Ray ray, IntersectionData* data) const
+		void FinalizeHit(const Ray& ray, const SurfaceHit& hit, IntersectionData* data) const
 		{
-			bool hit = Sphere::Intersect(ray, data);
-			if (hit)
-				data->radiance = m_inten; //RadianceAt(data->position, ray.direction);
-			return hit;
+			Sphere::FinalizeHit(ray, hit, data);
+			data->radiance = m_inten; //RadianceAt(data->position, ray.direction);
 		}
 
-		glm::vec3 SampleRadianceAt(const glm::vec3 isect_pos, glm::vec3& l_vec) const
+		//Lights do not cast shadows
+		bool IntersectP(const Ray, float) const
+		{
+			return false;
+		}
+
+		glm::vec3 SampleRadianceAt(const glm::vec3 isect_pos, glm::vec3& l_vec, float& l_distance) const
 		{
 			//Transform intersenction position to object space
 			glm::vec3 obj_isect_pos = *m_inv_transform * glm::vec4(isect_pos, 1.0f);
@@ -35,7 +39,7 @@ namespace CHR
 
 			glm::vec3 w = glm::normalize(glm::vec3(0, 0, 0) - obj_isect_pos), u, v;
 			CHR_UTILS::GenerateONB(w, u, v);
-			glm::vec3 l_local = w * cos(theta) + v * sin(theta) * cos(phi) + u * sin(theta) * sin(phi);
+			glm::vec3 l_local = w * std::cos(theta) + v * std::sin(theta) * std::cos(phi) + u * std::sin(theta) * std::sin(phi);
 
 			Ray ray(isect_pos + l_local * 0.00001f, glm::normalize(*m_transform * glm::vec4(l_local, 0.0f)));//p_world, l_world
 			IntersectionData light_isect;
@@ -43,6 +47,7 @@ namespace CHR
 
 			l_vec = glm::normalize(light_isect.position - isect_pos);
 			float d = glm::distance(light_isect.position, isect_pos);
+			l_distance = d;
 			return m_inten / (d * d) * ((float)CHR_UTILS::PI * 2.0f * (1.0f - cos_t_max));
 		}
 
@@ -56,15 +61,13 @@ namespace CHR
 	public:
 
 		LightTriangle(glm::vec3 radiance, 
-			std::vector<std::shared_ptr<glm::vec3>>verts,
-			std::vector<std::shared_ptr<glm::vec3>> norms,
-			std::vector<std::shared_ptr<glm::vec2>> uvs, 
+			const MeshData* mesh_data, unsigned int face,
 			std::shared_ptr<Material> mat, bool visible = true)
-			: Triangle(verts, norms, uvs, mat, visible)
+			: Triangle(mesh_data, face, mat, visible)
 		{
 			m_inten = radiance;
 			m_li_type = LIGHT_T::object;
-			m_area = CHR_UTILS::CalculateTriangleArea(*m_vertices[0], *m_vertices[1], *m_vertices[2]);
+			m_area = CHR_UTILS::CalculateTriangleArea(Vertex(0), Vertex(1), Vertex(2));
 			m_shading_mode = SHADING_MODE::smooth;
 		}
 
@@ -74,32 +77,37 @@ namespace CHR
 		{
 			m_inten = radiance;
 			m_li_type = LIGHT_T::object;
-			m_area = CHR_UTILS::CalculateTriangleArea(*m_vertices[0], *m_vertices[1], *m_vertices[2]);
+			m_area = CHR_UTILS::CalculateTriangleArea(Vertex(0), Vertex(1), Vertex(2));
 			m_shading_mode = SHADING_MODE::smooth;
 		}
 
 		float GetArea()
 		{
-			return m_area > 0.0f ? m_area : CHR_UTILS::CalculateTriangleArea(*m_vertices[0], *m_vertices[1], *m_vertices[2]);
+			return m_area > 0.0f ? m_area : CHR_UTILS::CalculateTriangleArea(Vertex(0), Vertex(1), Vertex(2));
 		}
 
-		bool Intersect(const Ray ray, IntersectionData* data) const
+		void FinalizeHit(const Ray& ray, const SurfaceHit& hit, IntersectionData* data) const
 		{
-			bool hit = Triangle::Intersect(ray, data);
-			if (hit)
-				data->radiance = m_inten; //RadianceAt(data->position, ray.direction);
-			return hit;
+			Triangle::FinalizeHit(ray, hit, data);
+			data->radiance = m_inten; //RadianceAt(data->position, ray.direction);
 		}
 
-		glm::vec3 SampleRadianceAt(const glm::vec3 isect_pos, glm::vec3& l_vec) const
+		//Lights do not cast shadows
+		bool IntersectP(const Ray, float) const
+		{
+			return false;
+		}
+
+		glm::vec3 SampleRadianceAt(const glm::vec3 isect_pos, glm::vec3& l_vec, float& l_distance) const
 		{
 			float chi_1 = CHR_UTILS::RandFloat(), chi_2 = CHR_UTILS::RandFloat();
-			glm::vec3 p = (1.0f - chi_2) * glm::vec3(*m_transform * glm::vec4(*m_vertices[1], 1.0f)) +
-				chi_2 * glm::vec3(*m_transform * glm::vec4(*m_vertices[2], 1.0f));
-			glm::vec3 q = sqrt(chi_1) * p +
-				(1.0f - sqrt(chi_1)) * glm::vec3(*m_transform * glm::vec4(*m_vertices[0], 1.0f));
+			glm::vec3 p = (1.0f - chi_2) * glm::vec3(*m_transform * glm::vec4(Vertex(1), 1.0f)) +
+				chi_2 * glm::vec3(*m_transform * glm::vec4(Vertex(2), 1.0f));
+			glm::vec3 q = std::sqrt(chi_1) * p +
+				(1.0f - std::sqrt(chi_1)) * glm::vec3(*m_transform * glm::vec4(Vertex(0), 1.0f));
 
 			l_vec = glm::normalize(q - isect_pos);
+			l_distance = glm::distance(q, isect_pos);
 
 			Ray ray(isect_pos, l_vec);
 			ray.intersect_eps = 0.0000001f;
@@ -111,7 +119,7 @@ namespace CHR
 
 				float cos_t = abs(glm::dot(-l_vec, data.normal));
 				/*if (isnan(cos_t))
-					cos_t = abs(glm::dot(-l_vec, glm::normalize(*m_normals[2] + *m_normals[1] + *m_normals[0])));*/
+					cos_t = abs(glm::dot(-l_vec, glm::normalize(Normal(2) + Normal(1) + Normal(0))));*/
 
 				float d = glm::distance(ray.origin, data.position);
 				return m_inten * cos_t / (d * d) * m_area;	//TODO:Fix
@@ -130,10 +138,11 @@ namespace CHR
 	{
 	public:
 		std::vector<std::shared_ptr<LightTriangle>> m_triangles;
+		std::shared_ptr<MeshData> m_mesh_data;	//the triangles point into it
 		float m_surface_area = 0.0;
 
-		LightMesh(glm::vec3 radiance, std::vector<std::shared_ptr<LightTriangle>> tris)
-			: Shape(tris[0]->m_material, tris[0]->m_visible), m_triangles(tris)
+		LightMesh(glm::vec3 radiance, std::vector<std::shared_ptr<LightTriangle>> tris, std::shared_ptr<MeshData> mesh_data = nullptr)
+			: Shape(tris[0]->m_material, tris[0]->m_visible), m_triangles(tris), m_mesh_data(mesh_data)
 		{
 			m_inten = radiance;
 			m_li_type = LIGHT_T::object;
@@ -167,6 +176,11 @@ namespace CHR
 			return data->hit;
 		}
 
+		bool IntersectP(const Ray, float) const
+		{
+			return false;
+		}
+
 		Bounds3 GetWorldBounds() const
 		{
 			auto b_min = m_triangles[0]->GetWorldBounds().min;
@@ -194,10 +208,10 @@ namespace CHR
 			return m_triangles[0]->ObjectSpaceNormalAt(p, normal, uv);	//OBVIOUSLY WRONG
 		}
 
-		glm::vec3 SampleRadianceAt(const glm::vec3 isect_pos, glm::vec3& l_vec) const
+		glm::vec3 SampleRadianceAt(const glm::vec3 isect_pos, glm::vec3& l_vec, float& l_distance) const
 		{
 			float r = CHR_UTILS::RandFloat() * (m_surface_area - 0.00001f);
-			auto rad = m_triangles[m_cumulative_areas.upper_bound(r)->second]->SampleRadianceAt(isect_pos, l_vec);
+			auto rad = m_triangles[m_cumulative_areas.upper_bound(r)->second]->SampleRadianceAt(isect_pos, l_vec, l_distance);
 			return rad * m_surface_area / m_triangles[m_cumulative_areas.upper_bound(r)->second]->GetArea();
 		}
 
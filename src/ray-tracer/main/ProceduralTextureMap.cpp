@@ -1,5 +1,7 @@
 #include "ProceduralTextureMap.h"
 
+#include <ray-tracer/editor/Profiler.h>
+
 namespace CHR
 {
 	ProcedurelTextureMap::ProcedurelTextureMap(DECAL_M d_mode, glm::vec3 b, glm::vec3 w, float s, float o)
@@ -11,6 +13,7 @@ namespace CHR
 
 	glm::vec3 ProcedurelTextureMap::SampleAt(glm::vec3 uv) const
 	{
+		ProfilePhase _(Prof::TextureSampling);
 		bool x = (int)((uv.x + m_offset) * m_scale) % 2;
 		bool y = (int)((uv.y + m_offset) * m_scale) % 2;
 		bool z = (int)((uv.z + m_offset) * m_scale) % 2;
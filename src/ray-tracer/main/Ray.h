@@ -3,6 +3,7 @@
 #include "Material.h"
 #include "TextureMap.h"
 #include "Light.h"
+#include <ray-tracer/editor/Profiler.h>
 
 namespace CHR
 {
@@ -13,6 +14,8 @@ namespace CHR
 		glm::vec3 direction;
 
 		float intersect_eps = 0.0f;
+		//Hits at or beyond t_max are ignored, traversal shrinks it to the closest hit found so far
+		float t_max = INFINITY;
 
 		mutable float jitter_t = 0.0f;
 		mutable float throughput = 1.0f;
@@ -21,15 +24,61 @@ namespace CHR
 			:origin(orig), direction(dir)
 		{}
 
+		//Copies start a path of their own, the throughput is not copied
 		Ray(const Ray& ray)
 			:origin(ray.origin), direction(ray.direction), 
-			intersect_eps(ray.intersect_eps), jitter_t(ray.jitter_t)
+			intersect_eps(ray.intersect_eps), t_max(ray.t_max), jitter_t(ray.jitter_t)
 		{}
 
+		Ray& operator=(const Ray& ray)
+		{
+			origin = ray.origin;
+			direction = ray.direction;
+			intersect_eps = ray.intersect_eps;
+			t_max = ray.t_max;
+			jitter_t = ray.jitter_t;
+			throughput = 1.0f;
+			return *this;
+		}
+
 
 		glm::vec3 PointAt(float t) const { return origin + t * glm::normalize(direction); }
 	};
 
+	//Camera rays of neighbouring pixels traced together, see Settings::m_packet_size
+	struct RayPacket
+	{
+		static const int MAX_SIZE = 16;
+
+		Ray rays[MAX_SIZE];
+		int size = 0;
+	};
+
+	class Shape;
+
+	//What the closest hit search keeps per candidate. Only the winning one is turned
+	//into IntersectionData, by Shape::FinalizeHit.
+	struct SurfaceHit
+	{
+		static const int MAX_INSTANCE_DEPTH = 4;
+
+		float t = INFINITY;
+		glm::vec2 barycentric = { 0,0 };
+		const Shape* shape = nullptr;
+		//MeshInstances the hit was found through, outermost first
+		const Shape* instances[MAX_INSTANCE_DEPTH];
+		int instance_depth = 0;
+
+		//The shape one level inside the given instance, the outermost shape for nullptr
+		inline const Shape* Below(const Shape* instance) const
+		{
+			int level = 0;
+			if (instance)
+				while (level < instance_depth && instances[level++] != instance);
+			return level < instance_depth ? instances[level] : shape;
+		}
+	};
+
 	struct IntersectionData
 	{
 		float t = INFINITY;
@@ -47,6 +96,7 @@ namespace CHR
 		glm::vec3 Shade(glm::vec3 radiance,
 			 glm::vec3 e_vec, glm::vec3 l_vec)
 		{
+			ProfilePhase _(Prof::Shade);
 			glm::vec3 kd = material->m_diffuse;
 			bool shade = true;
 
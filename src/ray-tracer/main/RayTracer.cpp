@@ -1,101 +1,146 @@
 #include "RayTracer.h"
 
-#include <future>
+#include <algorithm>
+#include <chrono>
 #include <limits>
 #include "ObjectLight.h"
+#include "ThreadPool.h"
+#include <ray-tracer/editor/Profiler.h>
 
-#include <thirdparty\glm\glm\glm.hpp>
-#include <thirdparty\glm\glm\gtx\norm.hpp>
-#include <thirdparty\glm\glm\gtx\component_wise.hpp>
+#include <thirdparty/glm/glm/glm.hpp>
+#include <thirdparty/glm/glm/gtx/norm.hpp>
+#include <thirdparty/glm/glm/gtx/component_wise.hpp>
 #include <iostream>
 
 namespace CHR
 {
-	std::atomic<float> progress_pers;
-	bool done = false;
-	bool run_bar = true;//TODO: FIX ASYNC CALLS
-	void PrintProgressBar(std::string tag)
+	void PrintProgressBar(std::string tag, int percent)
 	{
-		if (run_bar)
-		{
-			while (progress_pers <= 9.89999999 && !done) 
-			{
-				int barWidth = 70;
-				int pos = barWidth * progress_pers;
+		int barWidth = 70;
+		int pos = barWidth * percent / 100;
+
+		std::cout << tag + std::string(" [");
+		for (int i = 0; i < barWidth; i++) {
+			if (i < pos) std::cout << "=";
+			else if (i == pos) std::cout << ">";
+			else std::cout << " ";
+		}
+		std::cout << "]" << percent << " %\r";
+		if (percent >= 100)
+			std::cout << std::endl;
+		std::cout.flush();
+	}
 
-				Sleep(100);
+	//Each worker counts into its own copy, merged at the end of every tile it renders
+	thread_local RayTracer::RenderStats t_stats;
 
-				std::cout << tag + std::string(" [");
-				for (int i = 0; i < barWidth; i++) {
-					if (i < pos) std::cout << "=";
-					else if (i == pos) std::cout << ">";
-					else std::cout << " ";
-				}
-				std::cout << "]" << int(progress_pers * 100.0) << " %\r";
-				std::cout.flush();
-			}
-			std::cout << std::endl;
-		}
+	void RayTracer::MergeThreadStats()
+	{
+		std::lock_guard<std::mutex> lock(m_stats_mutex);
+		m_stats.camera_rays += t_stats.camera_rays;
+		m_stats.shadow_rays += t_stats.shadow_rays;
+		m_stats.reflection_rays += t_stats.reflection_rays;
+		m_stats.dielectric_reflection_rays += t_stats.dielectric_reflection_rays;
+		m_stats.refraction_rays += t_stats.refraction_rays;
+		m_stats.gi_rays += t_stats.gi_rays;
+		m_stats.rr_terminations += t_stats.rr_terminations;
+
+		m_stats.traversal.queries += t_traversal_stats.queries;
+		m_stats.traversal.nodes_visited += t_traversal_stats.nodes_visited;
+		m_stats.traversal.primitive_tests += t_traversal_stats.primitive_tests;
+		m_stats.traversal.instance_queries += t_traversal_stats.instance_queries;
+		m_stats.traversal.primitive_hits += t_traversal_stats.primitive_hits;
+		m_stats.traversal.packets += t_traversal_stats.packets;
+		m_stats.traversal.packet_nodes += t_traversal_stats.packet_nodes;
+
+		t_stats = RenderStats();
+		t_traversal_stats = TraversalStats();
 	}
 
-	bool RayTracer::TestShadow(const Scene& scene, const IntersectionData* isect_data, const std::shared_ptr<Light> li, const Ray shadow_ray)
+	bool RayTracer::TestShadow(const Scene& scene, const Ray shadow_ray, float li_distance)
 	{
+		ProfilePhase _(Prof::ShadowTest);
 		//shadow_ray.jitter_t = ray.jitter_t; // Uncomment if problems occur
-		float li_distance = 0.0f;
-		float prod1, prod2, prod3;
-		switch (li->m_li_type)
+		if (!m_settings->m_calc_shadows)
+			return false;
+		t_stats.shadow_rays++;
+		//Emissive shapes never occlude, anything else in front of the light sample does
+		return scene.IntersectP(shadow_ray, li_distance);
+	}
+
+	Ray RayTracer::LightSampleRay(const IntersectionData& isect_data, const std::shared_ptr<Light>& li,
+		glm::vec3& radiance, float& li_distance) const
+	{
+		glm::vec3 param = li->m_li_type != LIGHT_T::environment ?
+			isect_data.position : glm::normalize(isect_data.normal);
+		glm::vec3 l_vec = {0,0,0};
+		li_distance = INFINITY;
 		{
-		case LIGHT_T::point:
-			li_distance = glm::distance(isect_data->position, dynamic_cast<PointLight*>(li.get())->m_position);
-			break;
-		case LIGHT_T::directional:
-			li_distance = INFINITY;
-			break;
-		case LIGHT_T::spot:
-			li_distance = glm::distance(isect_data->position, dynamic_cast<SpotLight*>(li.get())->m_position);
-			break;
-		case LIGHT_T::area:
-			//recalculate light sample position from light vector
-			glm::vec3 difference = isect_data->position - dynamic_cast<AreaLight*>(li.get())->m_position;
-			prod1 = glm::dot(difference, dynamic_cast<AreaLight*>(li.get())->m_normal);
-			prod2 = glm::dot(shadow_ray.direction, dynamic_cast<AreaLight*>(li.get())->m_normal);
-			prod3 = prod1 / prod2;
+			ProfilePhase _(Prof::LightSampling);
+			radiance = li->SampleRadianceAt(param, l_vec, li_distance);
+		}
+		Ray shadow_ray(isect_data.position + isect_data.normal * m_settings->m_shadow_eps);
+		shadow_ray.direction = l_vec;
+		return shadow_ray;
+	}
 
-			glm::vec3 sample_l_point = isect_data->position - shadow_ray.direction * prod3;
+	Ray RayTracer::ReflectionRay(const Ray& ray, const IntersectionData& isect_data, const glm::vec3& offset_normal) const
+	{
+		Ray reflection_ray(isect_data.position + offset_normal * m_settings->m_shadow_eps);
+		//For glossy objects
+		glm::vec3 r = glm::normalize(glm::reflect(ray.direction, isect_data.normal));
+		glm::vec3 u, v;
+		CHR_UTILS::GenerateONB(r, u, v);
+		reflection_ray.direction = glm::normalize(r + isect_data.material->m_roughness *
+			(CHR_UTILS::RandFloat(-0.5, 0.5) * u + CHR_UTILS::RandFloat(-0.5, 0.5) * v));
+		reflection_ray.intersect_eps = m_settings->m_intersection_eps;
+		reflection_ray.jitter_t = CHR_UTILS::RandFloat();
+		return reflection_ray;
+	}
 
-			li_distance = glm::distance(isect_data->position, sample_l_point);
-			break;
-		case LIGHT_T::environment:
-			li_distance = INFINITY;
-			break;
-		case LIGHT_T::object:
-			/*IntersectionData data;
-			dynamic_cast<Shape*>(li.get())->Intersect(shadow_ray, &data) - 0.0001f;*/
+	Ray RayTracer::RefractionRay(const Ray& ray, const IntersectionData& isect_data, const glm::vec3& proper_normal, float eta) const
+	{
+		Ray refraction_ray(isect_data.position - proper_normal * m_settings->m_shadow_eps);
+		refraction_ray.direction = glm::normalize(glm::refract(ray.direction, proper_normal, eta));
+		refraction_ray.intersect_eps = m_settings->m_intersection_eps;
+		refraction_ray.jitter_t = CHR_UTILS::RandFloat();
+		return refraction_ray;
+	}
 
-			li_distance = INFINITY;
-			break;
-		/*default:
-			break;*/
+	glm::vec3 RayTracer::Absorption(const Ray& ray, const IntersectionData& isect_data) const
+	{
+		glm::vec3 absorbance = -((Dielectric*)(isect_data.material))->m_absorption_coeff *
+			glm::distance(ray.origin, isect_data.position);
+		return exp(absorbance);
+	}
+
+	Ray RayTracer::GlobalIlluminationRay(const IntersectionData& isect_data, bool importance_sampling, float& p_wi) const
+	{
+		glm::vec3 rand_dir;
+		if (importance_sampling)
+		{
+			rand_dir = CHR_UTILS::CosSampleUnitHemisphere(isect_data.normal);
+			//Kept above zero for directions grazing the surface, whose weight would be 0 / 0
+			p_wi = 1 / (CHR_UTILS::PI) * glm::abs(glm::dot(rand_dir, isect_data.normal)) + 0.0000001f;
 		}
-		IntersectionData shadow_data;
-		bool shadowed = m_settings->m_calc_shadows &&
-			(scene.Intersect(shadow_ray, &shadow_data) && glm::compAdd(shadow_data.radiance) <= 0.0f &&
-			(glm::distance(isect_data->position, shadow_data.position) - li_distance <= 0.0f));
-		return shadowed;
+		else
+		{
+			rand_dir = CHR_UTILS::UnifSampleUnitHemisphere(isect_data.normal);
+			p_wi = 1 / (2.0f * CHR_UTILS::PI);
+		}
+		return Ray(isect_data.position + isect_data.normal * m_settings->m_shadow_eps, rand_dir);
 	}
 
 	glm::vec3 RayTracer::CastLightRay(Scene& scene, IntersectionData isect_data, std::shared_ptr<Light> li, Ray ray)
 	{
 		glm::vec3 e_vec = glm::normalize(ray.origin - isect_data.position);
 
-		glm::vec3 param = li->m_li_type != LIGHT_T::environment ?
-			isect_data.position : glm::normalize(isect_data.normal);
-		glm::vec3 l_vec = {0,0,0};
-		glm::vec3 radiance = li->SampleRadianceAt(param, l_vec);
-		Ray shadow_ray(isect_data.position + isect_data.normal * m_settings->m_shadow_eps);
-		shadow_ray.direction = l_vec;
+		glm::vec3 radiance;
+		float li_distance;
+		Ray shadow_ray = LightSampleRay(isect_data, li, radiance, li_distance);
+		glm::vec3 l_vec = shadow_ray.direction;
 
-		if (!TestShadow(scene, &isect_data, li, shadow_ray))
+		if (!TestShadow(scene, shadow_ray, li_distance))
 			return isect_data.Shade(radiance, e_vec, l_vec);
 		else
 			return { 0,0,0 };
@@ -117,38 +162,60 @@ namespace CHR
 	}
 
 
+	void RayTracer::ReportProgress()
+	{
+		int done = ++m_tiles_done;
+		if (!m_print_progress)
+			return;
+
+		int percent = (int)(100LL * done / m_tile_count);
+		if (percent <= m_progress_shown)
+			return;
+		std::lock_guard<std::mutex> lock(m_progress_mutex);
+		if (percent <= m_progress_shown)
+			return;
+		m_progress_shown = percent;
+		PrintProgressBar("Rendering", percent);
+	}
+
+	int tile_size = 8;
 	void RayTracer::Render(Camera* cam, Scene& scene, bool print_progress)
 	{
 		if (!scene.IsAccelerationReady())
 		{
 			return;
 		}
+		scene.UpdateBVH();
 
-		progress_pers = 0.0f;
-		done = false;
-		job_index = { 0 };
-		run_bar = print_progress;
-		auto future_function = async(std::launch::async, PrintProgressBar, "Rendering");
+		const int tile_count_x = (m_settings->GetResolution().x + tile_size - 1) / tile_size;
+		const int tile_count_y = (m_settings->GetResolution().y + tile_size - 1) / tile_size;
+		m_tile_count = tile_count_x * tile_count_y;
+		m_tiles_done = 0;
+		m_progress_shown = -1;
+		m_print_progress = print_progress;
+		m_stats = RenderStats();
+		Profiler::Reset();
 
-		std::thread** threads = new std::thread * [m_settings->m_thread_count];
+		ThreadPool* pool = ThreadPool::GetInstance();
+		pool->SetThreadCount(m_settings->m_thread_count);
 
 		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-		for (int i = 0; i < m_settings->m_thread_count; i++)
-			threads[i] = new std::thread(m_rt_worker, this, cam, std::ref(scene), i);
-
-		for (int i = 0; i < m_settings->m_thread_count; i++)
-		{
-			threads[i]->join();
-			delete threads[i];
-		}
+		pool->ParallelFor(m_tile_count, [this, cam, &scene](int tile_idx) {
+			{
+				ProfilePhase _(Prof::Integrate);
+				(this->*m_rt_worker)(cam, scene, tile_idx);
+			}
+			MergeThreadStats();
+			Profiler::MergeThread();
+			ReportProgress();
+		});
 
 		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
 
-		delete[] threads;
-
 		std::chrono::duration<float> fs = end - start;
 		std::chrono::milliseconds d = std::chrono::duration_cast<std::chrono::milliseconds>(fs);
+		m_stats.render_time = fs.count();
 
 
 		unsigned int triangle_count = 0;
@@ -163,6 +230,7 @@ namespace CHR
 		}
 		if (m_rendered_image->IsHDR())
 		{
+			ProfilePhase _(Prof::PostProcess);
 			if (m_settings->m_ldr_post_process == IM_POST_PROC_T::tone_map)
 				m_rendered_image->ToneMap(cam->m_key_val, cam->m_burn_perc,
 					cam->m_saturation, cam->m_gamma);
@@ -170,294 +238,488 @@ namespace CHR
 				m_rendered_image->Clamp(0, 255);
 		}
 
-		done = true;
+		//BVH construction and post processing ran on this thread
+		Profiler::MergeThread();
+
 		if (print_progress)
 		{
-			Sleep(200);
 			CH_TRACE("Render info:\n\tTriangles :" + std::to_string(triangle_count) +
 				"\n\tResolution: (" + std::to_string(cam->GetResolution().x) + ", " + std::to_string(cam->GetResolution().y)
 				+")\n\tSample per pixel: " + std::to_string(cam->GetNumberOfSamples()) + 
 				"\n\tRendered in " + std::to_string(fs.count()) + "s" 
-				+ "\n\tThreads: " + std::to_string(m_settings->m_thread_count));
+				+ "\n\tThreads: " + std::to_string(pool->GetThreadCount())
+				+ "\n\tRays: " + std::to_string(m_stats.GetPrimaryRays()) + " primary, " + std::to_string(m_stats.GetSecondaryRays()) + " secondary ("
+				+ std::to_string((m_stats.GetPrimaryRays() + m_stats.GetSecondaryRays()) / (1e6 * fs.count())) + " Mrays/s)"
+				+ "\n\tRay types: " + std::to_string(m_stats.camera_rays) + " camera, " + std::to_string(m_stats.shadow_rays) + " shadow, "
+				+ std::to_string(m_stats.reflection_rays) + " reflection, " + std::to_string(m_stats.dielectric_reflection_rays) + " dielectric reflection, "
+				+ std::to_string(m_stats.refraction_rays) + " refraction, " + std::to_string(m_stats.gi_rays) + " GI"
+				+ "\n\tRussian roulette terminations: " + std::to_string(m_stats.rr_terminations)
+				+ "\n\tBVH: " + std::to_string(m_stats.traversal.nodes_visited / std::max(1.0, (double)m_stats.traversal.queries)) + " nodes/ray, "
+				+ std::to_string(m_stats.traversal.primitive_tests / std::max(1.0, (double)m_stats.traversal.queries)) + " primitive tests/ray, "
+				+ std::to_string(m_stats.traversal.primitive_hits) + " primitive hits, "
+				+ std::to_string(m_stats.traversal.instance_queries) + " instance traversals, "
+				+ std::to_string(m_stats.traversal.packets) + " camera ray packets ("
+				+ std::to_string(m_stats.traversal.packet_nodes / std::max(1.0, (double)m_stats.traversal.packets)) + " nodes/packet)");
+			if (Profiler::IsEnabled())
+				CH_TRACE(Profiler::GetReport());
 		}
 	}
 
-	void RayTracer::RayCastWorker(Camera* cam, Scene& scene, int idx)
-	{
-		//glm::vec3 cam_pos = cam->GetPosition();
-		//glm::vec2 top_left = cam->GetNearPlane()[0];
-		//glm::vec2 bottom_right = cam->GetNearPlane()[1];
-		//float dist = cam->GetNearDist();
-
-		//glm::vec3 up = glm::normalize(cam->GetUp());
-		//glm::vec3 forward = glm::normalize(cam->GetGaze());
-		//glm::vec3 down = -up;
-		//glm::vec3 right = glm::normalize(glm::cross(forward, up));
-		//glm::vec3 left = -right;
-
-		//const glm::vec3 top_left_w = cam_pos + forward * dist + up * top_left.y + left * glm::abs(top_left.x);
-		//Ray primary_ray(cam_pos);
-
-		//const glm::vec3 right_step = (right)*glm::abs(top_left.x - bottom_right.x) / (float)m_settings->m_resolution.x;
-		//const glm::vec3 down_step = (down)*glm::abs(top_left.y - bottom_right.y) / (float)m_settings->m_resolution.y;
-
-		//IntersectionData isect_data;
-		//IntersectionData shadow_data;
-
-		//int col_start = (float)idx / (float)m_settings->m_thread_count * m_settings->m_resolution.x;
-		//int col_end = idx == m_settings->m_thread_count -1 ? m_settings->m_resolution.x :
-		//	(float)(idx + 1) / (float)m_settings->m_thread_count * m_settings->m_resolution.x;
-
-		//for (int i = col_start; i < col_end; i++)
-		//{
-		//	for (int j = 0; j < m_settings->m_resolution.y; j++)
-		//	{
-		//		glm::vec3 color = scene.m_sky_color;
-
-		//		primary_ray.direction = glm::normalize(top_left_w + right_step * (i + 0.5f) + down_step * (j + 0.5f) - primary_ray.origin);
-		//		//Go over scene objects and lights
-		//		if (scene.m_accel_structure->Intersect(primary_ray, &isect_data))//Hit
-		//		{
-		//			color = { 0,0,0 };
-		//			//lighting calculation
-		//			std::map<std::string, std::shared_ptr<PointLight>>::iterator it2;
-		//			for (it2 = scene.m_point_lights.begin(); it2 != scene.m_point_lights.end(); it2++)
-		//			{
-		//				std::shared_ptr<PointLight> pl = it2->second;
-		//				glm::vec3 e_vec = glm::normalize(primary_ray.origin - isect_data.position);
-		//				glm::vec3 l_vec = glm::normalize(pl->position - isect_data.position);
-
-		//				//Shadow calculation	
-		//				bool shadowed = false;
-		//				Ray shadow_ray(isect_data.position + isect_data.normal * m_settings->m_shadow_eps);
-		//				shadow_ray.direction = glm::normalize(pl->position - shadow_ray.origin);
-		//					
-		//				shadowed = m_settings->m_calc_shadows && (scene.m_accel_structure->Intersect(shadow_ray, &shadow_data) &&
-		//					shadow_data.t < glm::distance(isect_data.position, pl->position));
-
-		//				if (!shadowed)
-		//				{
-		//					float d = glm::distance(pl->position, isect_data.position);
-
-		//					//Kd * I * cos(theta) /d^2 
-		//					glm::vec3 diffuse = isect_data.material->m_diffuse * pl->intensity *
-		//						glm::max(glm::dot(isect_data.normal, l_vec), 0.0f) / (glm::length(isect_data.normal) * glm::length(l_vec)) / (d * d);
-		//					//Ks* I * max(0, h . n)^s / d^2
-		//					glm::vec3 h = glm::normalize((e_vec + l_vec) / glm::length(e_vec + l_vec));
-		//					glm::vec3 specular = isect_data.material->m_specular * pl->intensity *
-		//						glm::pow(glm::max(0.0f, glm::dot(h, glm::normalize(isect_data.normal))), isect_data.material->m_shininess) / (d * d);
-		//					color += specular + diffuse;
-		//				}
-		//			}
-		//			//Ka * Ia
-		//			glm::vec3 ambient = scene.m_ambient_l * isect_data.material->m_ambient;
-		//			color += ambient;
-		//		}
-		//		m_rendered_image->SetPixel(i, j, color);
-		//	}
-
-		//	progress_pers = progress_pers + (1.0f) / ((float)(m_settings->m_resolution.x));
-		//	/*if(idx == m_settings->m_thread_count - 1)
-		//		CH_TRACE(std::to_string(progress_pers * 100.0f) + std::string("% complete"));*/
-		//}
-	}
-
-	int tile_size = 8;
-	void RayTracer::RecursiveTraceWorker(Camera* cam, Scene& scene, int thread_idx)
+	RayTracer::CameraRays::CameraRays(Camera* camera, glm::ivec2 resolution)
+		:cam(camera)
 	{
-		glm::vec3 cam_pos = cam->GetPosition();
+		cam_pos = cam->GetPosition();
 		glm::vec2 top_left = cam->GetNearPlane()[0];
 		glm::vec2 bottom_right = cam->GetNearPlane()[1];
 		float dist = cam->GetNearDist();
 
-		glm::vec3 up = glm::normalize(cam->GetUp());
+		up = glm::normalize(cam->GetUp());
 		glm::vec3 forward = glm::normalize(cam->GetGaze());
 		glm::vec3 down = -up;
-		glm::vec3 right = cam->m_left_handed ? -glm::normalize(glm::cross(forward, up)) : 
+		right = cam->m_left_handed ? -glm::normalize(glm::cross(forward, up)) :
 			glm::normalize(glm::cross(forward, up));
 		glm::vec3 left = -right;
 
-		const glm::vec3 top_left_w = cam_pos + forward * dist + up * top_left.y + left * glm::abs(top_left.x);
-		Ray primary_ray(cam_pos);
+		top_left_w = cam_pos + forward * dist + up * top_left.y + left * glm::abs(top_left.x);
 
-		const glm::vec3 right_step = (right)*glm::abs(top_left.x - bottom_right.x) / (float)m_settings->GetResolution().x;
-		const glm::vec3 down_step = (down)*glm::abs(top_left.y - bottom_right.y) / (float)m_settings->GetResolution().y;
+		right_step = (right)*glm::abs(top_left.x - bottom_right.x) / (float)resolution.x;
+		down_step = (down)*glm::abs(top_left.y - bottom_right.y) / (float)resolution.y;
+	}
 
-		IntersectionData intersection_data;
-		IntersectionData shadow_data;
+	Ray RayTracer::CameraRays::Generate(int i, int j) const
+	{
+		auto offset = CHR_UTILS::UnifSampleUnitSquare();
+		auto lens_offset = CHR_UTILS::UnifSampleUnitDisk();
+		//DoF Lens calculation
+		glm::vec3 lens_point = cam_pos +
+			cam->GetApertureSize() * (lens_offset.x * right + lens_offset.y * up);
+		glm::vec3 pixel_point = top_left_w +
+			right_step * (i + offset.x)
+			+ down_step * (j + offset.y);
+		glm::vec3 dir = glm::normalize(pixel_point - cam_pos);
+		glm::vec3 focal_point = cam_pos +
+			cam->GetFocalDistance() / glm::dot(dir, cam->GetGaze()) * dir;
+
+		Ray primary_ray(lens_point);
+		primary_ray.direction = glm::normalize(focal_point - primary_ray.origin);
+		primary_ray.jitter_t = CHR_UTILS::RandFloat();
+
+		if (cam->GetNumberOfSamples() == 1)
+			primary_ray.direction = glm::normalize(top_left_w + right_step * (i + 0.5f) + down_step * (j + 0.5f) - primary_ray.origin);
+		return primary_ray;
+	}
 
+	void RayTracer::GetTileRect(int tile_idx, glm::ivec2& rect_min, glm::ivec2& rect_max) const
+	{
 		const int tile_count_x = (m_settings->GetResolution().x + tile_size - 1) / tile_size;
-		const int tile_count_y = (m_settings->GetResolution().y + tile_size - 1) / tile_size;
-		const int max_job_index = tile_count_x * tile_count_y;
 
-		int idx = thread_idx;
+		rect_min = glm::ivec2((tile_idx % tile_count_x) * tile_size, (tile_idx / tile_count_x) * tile_size);
+		rect_max = rect_min + glm::ivec2(tile_size, tile_size);
 
+		rect_max = (glm::min)(rect_max, m_settings->GetResolution());
+	}
 
-		while (idx < max_job_index)
-		{
-			glm::ivec2 rect_min = glm::ivec2((idx % tile_count_x) * tile_size, (idx / tile_count_x) * tile_size);
-			glm::ivec2 rect_max = rect_min + glm::ivec2(tile_size, tile_size);
+	glm::ivec2 RayTracer::GetPacketBlock() const
+	{
+		int packet_size = m_settings->m_packet_size;
+		return packet_size >= 16 ? glm::ivec2(4, 4) : packet_size >= 8 ? glm::ivec2(4, 2) :
+			packet_size >= 4 ? glm::ivec2(2, 2) : glm::ivec2(1, 1);
+	}
+
+	void RayTracer::TraceTile(Camera* cam, Scene& scene, int tile_idx, TraceFunction trace)
+	{
+		CameraRays camera_rays(cam, m_settings->GetResolution());
+		glm::ivec2 rect_min, rect_max;
+		GetTileRect(tile_idx, rect_min, rect_max);
 
-			rect_max = (glm::min)(rect_max, m_settings->GetResolution());
+		// Pixel blocks of one packet, a sample of each of their pixels is traced together
+		glm::ivec2 block = GetPacketBlock();
 
-			for (int j = rect_min.y; j < rect_max.y; j++)
+		for (int by = rect_min.y; by < rect_max.y; by += block.y)
+		{
+			for (int bx = rect_min.x; bx < rect_max.x; bx += block.x)
 			{
-				for (int i = rect_min.x; i < rect_max.x ; i++)
+				glm::ivec2 pixels[RayPacket::MAX_SIZE];
+				glm::vec3 colors[RayPacket::MAX_SIZE];
+				int n_pixels = 0;
+				for (int j = by; j < std::min(by + block.y, rect_max.y); j++)
+					for (int i = bx; i < std::min(bx + block.x, rect_max.x); i++)
+					{
+						pixels[n_pixels] = { i, j };
+						colors[n_pixels++] = scene.m_sky_color;
+					}
+
+				RayPacket packet;
+				IntersectionData hits[RayPacket::MAX_SIZE];
+				for (int n = 0; n < cam->GetNumberOfSamples(); n++)
 				{
-					glm::vec3 color = scene.m_sky_color;
-					//if(j > 105 && j < 121 && i > 349 && i < 366)
-					for (int n = 0; n < cam->GetNumberOfSamples(); n++)
+					packet.size = n_pixels;
+					for (int k = 0; k < n_pixels; k++)
+						packet.rays[k] = camera_rays.Generate(pixels[k].x, pixels[k].y);
+					if (n_pixels > 1)
+					{
+						for (int k = 0; k < n_pixels; k++)
+							hits[k] = IntersectionData();
+						scene.Intersect(packet, hits);
+					}
+					for (int k = 0; k < n_pixels; k++)
 					{
-						auto offset = CHR_UTILS::UnifSampleUnitSquare();
-						auto lens_offset = CHR_UTILS::UnifSampleUnitDisk();
-						//DoF Lens calculation
-						glm::vec3 lens_point = cam_pos +
-							cam->GetApertureSize() * (lens_offset.x * right + lens_offset.y * up);
-						glm::vec3 pixel_point = top_left_w +
-							right_step * (i + offset.x)
-							+ down_step * (j + offset.y);
-						glm::vec3 dir = glm::normalize(pixel_point - cam_pos);
-						glm::vec3 focal_point = cam_pos +
-							cam->GetFocalDistance() / glm::dot(dir, cam->GetGaze()) * dir;
-
-						primary_ray.origin = lens_point;
-						primary_ray.direction = glm::normalize(focal_point - primary_ray.origin);
-						primary_ray.jitter_t = CHR_UTILS::RandFloat();
-
-						if(cam->GetNumberOfSamples() ==1)
-							primary_ray.direction = glm::normalize(top_left_w + right_step * (i + 0.5f) + down_step * (j + 0.5f) - primary_ray.origin);
-
-						glm::vec3 sample_color = RecursiveTrace(primary_ray, scene, 0, {i,j});
-						color += sample_color / (float)cam->GetNumberOfSamples();//Box Filter
+						glm::vec3 sample_color = (this->*trace)(packet.rays[k], scene, 0, pixels[k], n_pixels > 1 ? &hits[k] : nullptr);
+						colors[k] += sample_color / (float)cam->GetNumberOfSamples();//Box Filter
 					}
-					m_rendered_image->SetPixel(i, j, color);
-					progress_pers = progress_pers + (1.0f) / ((float)(glm::compMul(m_settings->GetResolution())));
 				}
-				/*if (idx == m_settings->m_thread_count - 1)
-					CH_TRACE(std::to_string(progress_pers * 100.0f) + std::string("% complete"));*/
+				for (int k = 0; k < n_pixels; k++)
+					m_rendered_image->SetPixel(pixels[k].x, pixels[k].y, colors[k]);
 			}
-			idx = job_index++;
 		}
 	}
 
-	void RayTracer::PathTraceWorker(Camera* cam, Scene& scene, int thread_idx)
+	void RayTracer::RayCastWorker(Camera* cam, Scene& scene, int tile_idx)
 	{
-		glm::vec3 cam_pos = cam->GetPosition();
-		glm::vec2 top_left = cam->GetNearPlane()[0];
-		glm::vec2 bottom_right = cam->GetNearPlane()[1];
-		float dist = cam->GetNearDist();
+		TraceTile(cam, scene, tile_idx, &RayTracer::RayCast);
+	}
 
-		glm::vec3 up = glm::normalize(cam->GetUp());
-		glm::vec3 forward = glm::normalize(cam->GetGaze());
-		glm::vec3 down = -up;
-		glm::vec3 right = cam->m_left_handed ? -glm::normalize(glm::cross(forward, up)) :
-			glm::normalize(glm::cross(forward, up));
-		glm::vec3 left = -right;
+	void RayTracer::RecursiveTraceWorker(Camera* cam, Scene& scene, int tile_idx)
+	{
+		TraceTile(cam, scene, tile_idx, &RayTracer::RecursiveTrace);
+	}
 
-		const glm::vec3 top_left_w = cam_pos + forward * dist + up * top_left.y + left * glm::abs(top_left.x);
-		Ray primary_ray(cam_pos);
+	void RayTracer::PathTraceWorker(Camera* cam, Scene& scene, int tile_idx)
+	{
+		TraceTile(cam, scene, tile_idx, &RayTracer::PathTrace);
+	}
 
-		const glm::vec3 right_step = (right)*glm::abs(top_left.x - bottom_right.x) / (float)m_settings->GetResolution().x;
-		const glm::vec3 down_step = (down)*glm::abs(top_left.y - bottom_right.y) / (float)m_settings->GetResolution().y;
+	//Queues of each worker, kept across tiles so their storage is reused
+	thread_local WavefrontQueues t_queues;
 
-		IntersectionData intersection_data;
-		IntersectionData shadow_data;
+	void RayTracer::WavefrontPathTraceWorker(Camera* cam, Scene& scene, int tile_idx)
+	{
+		CameraRays camera_rays(cam, m_settings->GetResolution());
+		glm::ivec2 rect_min, rect_max;
+		GetTileRect(tile_idx, rect_min, rect_max);
+		glm::ivec2 block = GetPacketBlock();
+
+		//Pixels of the tile in packet block order, so a block's camera rays are adjacent in the queue
+		std::vector<glm::ivec2> pixels;
+		std::vector<int> block_sizes;
+		for (int by = rect_min.y; by < rect_max.y; by += block.y)
+			for (int bx = rect_min.x; bx < rect_max.x; bx += block.x)
+			{
+				int first = (int)pixels.size();
+				for (int j = by; j < std::min(by + block.y, rect_max.y); j++)
+					for (int i = bx; i < std::min(bx + block.x, rect_max.x); i++)
+						pixels.push_back({ i, j });
+				block_sizes.push_back((int)pixels.size() - first);
+			}
+		std::vector<glm::vec3> colors(pixels.size(), glm::vec3(0.0f));
 
-		const int tile_count_x = (m_settings->GetResolution().x + tile_size - 1) / tile_size;
-		const int tile_count_y = (m_settings->GetResolution().y + tile_size - 1) / tile_size;
-		const int max_job_index = tile_count_x * tile_count_y;
+		WavefrontQueues& queues = t_queues;
+		const int spp = cam->GetNumberOfSamples();
+		const int batch_spp = std::max(1, WavefrontQueues::MAX_CAMERA_RAYS / (int)pixels.size());
+		const glm::vec3 sample_weight(1.0f / spp);//Box Filter
 
-		int idx = thread_idx;
+		for (int first_sample = 0; first_sample < spp; first_sample += batch_spp)
+		{
+			const int last_sample = std::min(first_sample + batch_spp, spp);
+
+			//Generate
+			queues.rays.Clear();
+			queues.rays.Reserve((last_sample - first_sample) * (int)pixels.size());
+			queues.camera_packets.clear();
+			int first_pixel = 0;
+			for (int block_size : block_sizes)
+			{
+				for (int n = first_sample; n < last_sample; n++)
+				{
+					for (int k = first_pixel; k < first_pixel + block_size; k++)
+						queues.rays.Push(camera_rays.Generate(pixels[k].x, pixels[k].y), sample_weight, 1.0f, k, 0);
+					queues.camera_packets.push_back(block_size);
+				}
+				first_pixel += block_size;
+			}
 
+			for (int depth = 0; queues.rays.Size() > 0; depth++)
+			{
+				ExtendRays(scene, queues, depth == 0);
+				SortByMaterial(queues);
+				queues.next_rays.Clear();
+				queues.shadow_rays.Clear();
+				ShadeHits(scene, cam, queues, pixels, colors);
+				TraceShadowRays(scene, queues.shadow_rays, colors);
+				std::swap(queues.rays, queues.next_rays);
+			}
+		}
 
-		while (idx < max_job_index)
+		for (size_t k = 0; k < pixels.size(); k++)
+			m_rendered_image->SetPixel(pixels[k].x, pixels[k].y, glm::vec3(scene.m_sky_color) + colors[k]);
+	}
+
+	void RayTracer::ExtendRays(Scene& scene, WavefrontQueues& queues, bool camera_rays)
+	{
+		const RayQueue& rays = queues.rays;
+		queues.hits.assign(rays.Size(), IntersectionData());
+		if (!camera_rays)
 		{
-			glm::ivec2 rect_min = glm::ivec2((idx % tile_count_x) * tile_size, (idx / tile_count_x) * tile_size);
-			glm::ivec2 rect_max = rect_min + glm::ivec2(tile_size, tile_size);
+			for (int i = 0; i < rays.Size(); i++)
+				scene.Intersect(rays.GetRay(i), &queues.hits[i]);
+			return;
+		}
 
-			rect_max = (glm::min)(rect_max, m_settings->GetResolution());
+		t_stats.camera_rays += rays.Size();
+		int first = 0;
+		for (int packet_size : queues.camera_packets)
+		{
+			if (packet_size > 1)
+			{
+				RayPacket packet;
+				packet.size = packet_size;
+				for (int k = 0; k < packet_size; k++)
+					packet.rays[k] = rays.GetRay(first + k);
+				scene.Intersect(packet, &queues.hits[first]);
+			}
+			else
+				scene.Intersect(rays.GetRay(first), &queues.hits[first]);
+			first += packet_size;
+		}
+	}
+
+	void RayTracer::SortByMaterial(WavefrontQueues& queues)
+	{
+		const std::vector<IntersectionData>& hits = queues.hits;
+		queues.shade_order.resize(hits.size());
+		for (int i = 0; i < (int)hits.size(); i++)
+			queues.shade_order[i] = i;
+
+		std::less<const Material*> less;
+		std::stable_sort(queues.shade_order.begin(), queues.shade_order.end(), [&hits, &less](int a, int b) {
+			const Material* mat_a = hits[a].hit ? hits[a].material : nullptr;
+			const Material* mat_b = hits[b].hit ? hits[b].material : nullptr;
+			return less(mat_a, mat_b);
+		});
+	}
+
+	void RayTracer::ShadeHits(Scene& scene, Camera* cam, WavefrontQueues& queues, const std::vector<glm::ivec2>& pixels,
+		std::vector<glm::vec3>& colors)
+	{
+		bool nee = cam->IsNextEventEstimationOn();
+		bool rr = cam->IsRussianRouletteOn();
+		bool is = cam->IsImportanceSamplingOn();
+
+		const RayQueue& rays = queues.rays;
+		RayQueue& next_rays = queues.next_rays;
+		ShadowQueue& shadow_rays = queues.shadow_rays;
+
+		for (int i : queues.shade_order)
+		{
+			Ray ray = rays.GetRay(i);
+			IntersectionData& isect_data = queues.hits[i];
+			glm::vec3 weight = rays.GetWeight(i);
+			int depth = rays.depth[i];
+			int pixel = rays.pixel[i];
+
+			if (!isect_data.hit)
+			{
+				colors[pixel] += weight * BackgroundColor(ray, scene, pixels[pixel]);
+				continue;
+			}
+
+			//What PathTrace would return for the hit is decided up front, so no ray is queued only to be discarded
+			float cos_i = glm::dot(ray.direction, isect_data.normal);
+			bool inside = isect_data.material->type == MAT_TYPE::dielectric &&
+				depth < m_settings->m_recur_depth && cos_i > 0.0f;
+			bool replace_all = ((isect_data.tex_map) &&
+				(isect_data.tex_map[0].GetDecalMode() == DECAL_M::re_all));
+			//A light sample replaces everything else found at the hit
+			bool lights_replace_all = !inside && replace_all && nee && !scene.m_lights.empty();
+			bool emitter = (depth == 0 || !nee) && glm::compAdd(isect_data.radiance) > 0.0f;
+			if (!inside && emitter && glm::dot(-isect_data.normal, ray.direction) <= 0.0f)
+				continue;
+			float chi_1 = CHR_UTILS::RandFloat();
+
+			if (!lights_replace_all && m_settings->m_calc_reflections &&
+				(isect_data.material->type == MAT_TYPE::mirror || isect_data.material->type == MAT_TYPE::conductor) &&
+				(depth < m_settings->m_recur_depth))
+			{
+				Ray reflection_ray = ReflectionRay(ray, isect_data, isect_data.normal);
 
-			for (int j = rect_min.y; j < rect_max.y; j++)
+				glm::vec3 reflectance;
+				if (isect_data.material->type == MAT_TYPE::conductor)
+					reflectance = ((Conductor*)isect_data.material)->GetFr(-cos_i) *
+						((Conductor*)(isect_data.material))->m_mirror_reflec;
+				else
+					reflectance = ((Mirror*)(isect_data.material))->m_mirror_reflec;
+
+				t_stats.reflection_rays++;
+				next_rays.Push(reflection_ray, weight * reflectance, 1.0f, pixel, depth + 1);
+			}
+			else if (!lights_replace_all && isect_data.material->type == MAT_TYPE::dielectric &&
+				(depth < m_settings->m_recur_depth))
 			{
-				for (int i = rect_min.x; i < rect_max.x; i++)
+				float ni = 1.0f;
+				float nt = ((Dielectric*)(isect_data.material))->m_refraction_ind;
+
+				glm::vec3 proper_normal = isect_data.normal;
+				glm::vec3 child_weight = weight;
+				if (inside)
+				{
+					std::swap(ni, nt);
+					proper_normal = -isect_data.normal;
+					child_weight *= Absorption(ray, isect_data);
+				}
+
+				float fr = ((Dielectric*)isect_data.material)->GetFr(cos_i);
+				if (m_settings->m_calc_reflections)
 				{
-					glm::vec3 color = scene.m_sky_color;
-					for (int n = 0; n < cam->GetNumberOfSamples(); n++)
+					Ray reflection_ray = ReflectionRay(ray, isect_data, proper_normal);
+
+					t_stats.dielectric_reflection_rays++;
+					next_rays.Push(reflection_ray, child_weight * fr, 1.0f, pixel, depth + 1);
+				}
+
+				if (fr < 1.0f && m_settings->m_calc_refractions)
+				{
+					Ray refraction_ray = RefractionRay(ray, isect_data, proper_normal, ni / nt);
+
+					t_stats.refraction_rays++;
+					next_rays.Push(refraction_ray, child_weight * (1.0f - fr), 1.0f, pixel, depth + 1);
+				}
+			}
+			if (inside)
+				continue;
+
+			// point is illuminated
+			glm::vec3 e_vec = glm::normalize(ray.origin - isect_data.position);
+			//Ka * Ia
+			glm::vec3 color = lights_replace_all ? glm::vec3(0.0f) : scene.m_ambient_l * isect_data.material->m_ambient;
+
+			//direct lighting, only the last light counts when it replaces everything
+			for (auto it = scene.m_lights.begin(); nee && it != scene.m_lights.end(); it++)
+			{
+				if (lights_replace_all && std::next(it) != scene.m_lights.end())
+					continue;
+				glm::vec3 radiance;
+				float li_distance;
+				Ray shadow_ray = LightSampleRay(isect_data, it->second, radiance, li_distance);
+				shadow_rays.Push(shadow_ray, li_distance, weight * isect_data.Shade(radiance, e_vec, shadow_ray.direction), pixel);
+			}
+
+			if (emitter) //light source hit
+				color += isect_data.radiance;
+			else if (depth < m_settings->m_recur_depth || rr)
+			{
+				float p_wi;
+				Ray global_ilum_ray = GlobalIlluminationRay(isect_data, is, p_wi);
+				glm::vec3 rand_dir = global_ilum_ray.direction;
+				//The texture replaces the shading, whatever the bounce brings back
+				if (replace_all)
+					color += isect_data.Shade(glm::vec3(0.0f), e_vec, rand_dir) / p_wi;
+				else
+				{
+					// L * BRDF * cos(th) / p_w, with L still to be found by the continuation ray
+					glm::vec3 gi_weight = weight * isect_data.Shade(glm::vec3(1.0f), e_vec, rand_dir) / p_wi;
+					if (depth < m_settings->m_recur_depth)
 					{
-						auto offset = CHR_UTILS::UnifSampleUnitSquare();
-						auto lens_offset = CHR_UTILS::UnifSampleUnitDisk();
-						//DoF Lens calculation
-						glm::vec3 lens_point = cam_pos +
-							cam->GetApertureSize() * (lens_offset.x * right + lens_offset.y * up);
-						glm::vec3 pixel_point = top_left_w +
-							right_step * (i + offset.x)
-							+ down_step * (j + offset.y);
-						glm::vec3 dir = glm::normalize(pixel_point - cam_pos);
-						glm::vec3 focal_point = cam_pos +
-							cam->GetFocalDistance() / glm::dot(dir, cam->GetGaze()) * dir;
-
-						primary_ray.origin = lens_point;
-						primary_ray.direction = glm::normalize(focal_point - primary_ray.origin);
-						primary_ray.jitter_t = CHR_UTILS::RandFloat();
-
-						if (cam->GetNumberOfSamples() == 1)
-							primary_ray.direction = glm::normalize(top_left_w + right_step * (i + 0.5f) + down_step * (j + 0.5f) - primary_ray.origin);
-
-						glm::vec3 sample_color = PathTrace(primary_ray, scene, 0, { i,j });
-						color += sample_color / (float)cam->GetNumberOfSamples();//Box Filter
+						t_stats.gi_rays++;
+						next_rays.Push(global_ilum_ray, gi_weight, 1.0f, pixel, depth + 1);
+					}
+					else
+					{
+						float throughput = rays.rr_throughput[i] *
+							(glm::compAdd(isect_data.material->Shade(rand_dir, e_vec, isect_data.normal)) / 3.0f);
+						float q = 1.0f - throughput;
+						if (chi_1 > q)
+						{
+							t_stats.gi_rays++;
+							next_rays.Push(global_ilum_ray, gi_weight / (1 - q), throughput, pixel, depth + 1);
+						}
+						else
+							t_stats.rr_terminations++;
 					}
-					m_rendered_image->SetPixel(i, j, color);
-					progress_pers = progress_pers + (1.0f) / ((float)(glm::compMul(m_settings->GetResolution())));
 				}
-				/*if (idx == m_settings->m_thread_count - 1)
-					CH_TRACE(std::to_string(progress_pers * 100.0f) + std::string("% complete"));*/
 			}
-			idx = job_index++;
+			colors[pixel] += weight * color;
 		}
 	}
 
-	glm::vec3 RayTracer::RecursiveTrace(const Ray& ray, Scene& scene, int depth, glm::ivec2 pixel_cood)
+	void RayTracer::TraceShadowRays(const Scene& scene, const ShadowQueue& shadow_rays, std::vector<glm::vec3>& colors)
 	{
-		IntersectionData isect_data;
-		scene.Intersect(ray, &isect_data);
-
-		glm::vec3 color = { 0,0,0 };
-		bool inside = false;
+		for (int i = 0; i < shadow_rays.Size(); i++)
+			if (!TestShadow(scene, shadow_rays.GetRay(i), shadow_rays.distance[i]))
+				colors[shadow_rays.pixel[i]] += shadow_rays.GetRadiance(i);
+	}
 
-		if (!isect_data.hit)
+	glm::vec3 RayTracer::BackgroundColor(const Ray& ray, Scene& scene, glm::ivec2 pixel_cood)
+	{
+		if (scene.m_sky_texture)
 		{
-			if (scene.m_sky_texture)
+			if (scene.m_map_texture_to_sphere)
 			{
-				if (scene.m_map_texture_to_sphere)
-				{
-					auto dir = glm::normalize(ray.direction);
-					float u = 0.5f - atan2(dir.z, dir.x) * (0.5f / CHR_UTILS::PI);
-					float v = acosf(dir.y) / CHR_UTILS::PI;
-					auto t_coord = glm::vec3(u, v, NAN);
-					return scene.m_sky_texture->SampleAt(t_coord) * 255.0f;
-				}
-				else
-					return scene.m_sky_texture->SampleAt({ pixel_cood.x / (float)m_settings->GetResolution().x,
-						pixel_cood.y / (float)m_settings->GetResolution().y, 0 }) * 255.0f;
+				auto dir = glm::normalize(ray.direction);
+				float u = 0.5f - atan2(dir.z, dir.x) * (0.5f / CHR_UTILS::PI);
+				float v = acosf(dir.y) / CHR_UTILS::PI;
+				auto t_coord = glm::vec3(u, v, NAN);
+				return scene.m_sky_texture->SampleAt(t_coord) * 255.0f;
 			}
 			else
-				return scene.m_sky_color;
+				return scene.m_sky_texture->SampleAt({ pixel_cood.x / (float)m_settings->GetResolution().x,
+					pixel_cood.y / (float)m_settings->GetResolution().y, 0 }) * 255.0f;
+		}
+		else
+			return scene.m_sky_color;
+	}
+
+	glm::vec3 RayTracer::RayCast(const Ray& ray, Scene& scene, int /*depth*/, glm::ivec2 pixel_cood, const IntersectionData* hit)
+	{
+		IntersectionData isect_data;
+		if (hit)
+			isect_data = *hit;
+		else
+			scene.Intersect(ray, &isect_data);
+		t_stats.camera_rays++;
+
+		if (!isect_data.hit)
+			return BackgroundColor(ray, scene, pixel_cood);
+
+		//Ka * Ia
+		glm::vec3 color = scene.m_ambient_l * isect_data.material->m_ambient;
+		if (glm::compAdd(isect_data.radiance) > 0.0f)
+			return color + isect_data.radiance;
+
+		bool replace_all = ((isect_data.tex_map) &&
+			(isect_data.tex_map[0].GetDecalMode() == DECAL_M::re_all));
+		for (auto it = scene.m_lights.begin(); it != scene.m_lights.end(); it++)
+		{
+			glm::vec3 shaded_color = CastLightRay(scene, isect_data, it->second, ray);
+			if (replace_all)
+				color = shaded_color;
+			else
+				color += shaded_color;
 		}
+		return color;
+	}
+
+	glm::vec3 RayTracer::RecursiveTrace(const Ray& ray, Scene& scene, int depth, glm::ivec2 pixel_cood, const IntersectionData* hit)
+	{
+		IntersectionData isect_data;
+		if (hit)
+			isect_data = *hit;
+		else
+			scene.Intersect(ray, &isect_data);
+		if (depth == 0)
+			t_stats.camera_rays++;
+
+		glm::vec3 color = { 0,0,0 };
+		bool inside = false;
+
+		if (!isect_data.hit)
+			return BackgroundColor(ray, scene, pixel_cood);
 		else if (m_settings->m_calc_reflections &&
 			isect_data.material->type == MAT_TYPE::mirror && depth < m_settings->m_recur_depth)
 		{
 			// compute reflection
-			Ray reflection_ray(isect_data.position + isect_data.normal * m_settings->m_shadow_eps);
-
-			//For glossy objects
-			glm::vec3 r = glm::normalize(glm::reflect(ray.direction, isect_data.normal));
-			glm::vec3 u, v;
-			CHR_UTILS::GenerateONB(r, u, v);
-			reflection_ray.direction = glm::normalize(r + isect_data.material->m_roughness *
-				(CHR_UTILS::RandFloat(-0.5, 0.5) * u + CHR_UTILS::RandFloat(-0.5, 0.5) * v));
-			reflection_ray.intersect_eps = m_settings->m_intersection_eps;
-			reflection_ray.jitter_t = CHR_UTILS::RandFloat();
+			Ray reflection_ray = ReflectionRay(ray, isect_data, isect_data.normal);
 
+			t_stats.reflection_rays++;
 			glm::vec3 reflection_color = RecursiveTrace(reflection_ray, scene, depth + 1, pixel_cood) * ((Mirror*)(isect_data.material))->m_mirror_reflec;
 			color += reflection_color;
 		}
@@ -465,19 +727,11 @@ namespace CHR
 			isect_data.material->type == MAT_TYPE::conductor && depth < m_settings->m_recur_depth)
 		{
 			// compute reflection
-			Ray reflection_ray(isect_data.position + isect_data.normal * m_settings->m_shadow_eps);
-			//For glossy objects
-			glm::vec3 r = glm::normalize(glm::reflect(ray.direction, isect_data.normal));
-			glm::vec3 u, v;
-			CHR_UTILS::GenerateONB(r, u, v);
-
-			reflection_ray.direction = glm::normalize(r + isect_data.material->m_roughness *
-				(CHR_UTILS::RandFloat(-0.5, 0.5) * u + CHR_UTILS::RandFloat(-0.5, 0.5) * v));
-			reflection_ray.intersect_eps = m_settings->m_intersection_eps;
-			reflection_ray.jitter_t = CHR_UTILS::RandFloat();
+			Ray reflection_ray = ReflectionRay(ray, isect_data, isect_data.normal);
 
 			float cos_theta = glm::dot(-ray.direction, isect_data.normal);
 
+			t_stats.reflection_rays++;
 			glm::vec3 reflection_color = RecursiveTrace(reflection_ray, scene, depth + 1, pixel_cood) * ((Conductor*)isect_data.material)->GetFr(cos_theta) *
 				((Conductor*)(isect_data.material))->m_mirror_reflec;
 			color += reflection_color;
@@ -501,17 +755,9 @@ namespace CHR
 			glm::vec3 reflection_color = { 0,0,0 };
 			if (m_settings->m_calc_reflections)
 			{
-				Ray reflection_ray(isect_data.position + proper_normal * m_settings->m_shadow_eps);
-				//For glossy objects
-				glm::vec3 r = glm::normalize(glm::reflect(ray.direction, isect_data.normal));
-				glm::vec3 u, v;
-				CHR_UTILS::GenerateONB(r, u, v);
-
-				reflection_ray.direction = glm::normalize(r + isect_data.material->m_roughness *
-					(CHR_UTILS::RandFloat(-0.5, 0.5) * u + CHR_UTILS::RandFloat(-0.5, 0.5) * v));
-				reflection_ray.intersect_eps = m_settings->m_intersection_eps;
-				reflection_ray.jitter_t = CHR_UTILS::RandFloat();
+				Ray reflection_ray = ReflectionRay(ray, isect_data, proper_normal);
 
+				t_stats.dielectric_reflection_rays++;
 				reflection_color = RecursiveTrace(reflection_ray, scene, depth + 1, pixel_cood) * fr;
 			}
 
@@ -519,20 +765,16 @@ namespace CHR
 			glm::vec3 refraction_color = { 0,0,0 };
 			if (fr < 1.0f && m_settings->m_calc_refractions)
 			{
-				Ray refraction_ray(isect_data.position - proper_normal * m_settings->m_shadow_eps);
-				refraction_ray.direction = glm::normalize(glm::refract(ray.direction, proper_normal, ni / nt));
-				refraction_ray.intersect_eps = m_settings->m_intersection_eps;
-				refraction_ray.jitter_t = CHR_UTILS::RandFloat();
+				Ray refraction_ray = RefractionRay(ray, isect_data, proper_normal, ni / nt);
 
+				t_stats.refraction_rays++;
 				refraction_color = RecursiveTrace(refraction_ray, scene, depth + 1, pixel_cood) * (1.0f - fr);
 			}
 
 			color += (reflection_color + refraction_color);
 			if (inside)
 			{
-				glm::vec3 absorbance = -((Dielectric*)(isect_data.material))->m_absorption_coeff *
-					glm::distance(ray.origin, isect_data.position) * 1.0f;
-				color *= exp(absorbance);
+				color *= Absorption(ray, isect_data);
 			}
 		}
 		// point is illuminated
@@ -563,54 +805,34 @@ namespace CHR
 		return color;
 	}
 
-	glm::vec3 RayTracer::PathTrace(const Ray& ray, Scene& scene, int depth, glm::ivec2 pixel_cood)
+	glm::vec3 RayTracer::PathTrace(const Ray& ray, Scene& scene, int depth, glm::ivec2 pixel_cood, const IntersectionData* hit)
 	{
 		bool nee = scene.GetCamera(m_settings->m_act_rt_cam_name)->IsNextEventEstimationOn();
 		bool rr = scene.GetCamera(m_settings->m_act_rt_cam_name)->IsRussianRouletteOn();
 		bool is = scene.GetCamera(m_settings->m_act_rt_cam_name)->IsImportanceSamplingOn();
 
 		IntersectionData isect_data;
-		scene.Intersect(ray, &isect_data);
+		if (hit)
+			isect_data = *hit;
+		else
+			scene.Intersect(ray, &isect_data);
+		if (depth == 0)
+			t_stats.camera_rays++;
 
 		glm::vec3 color = { 0,0,0 };
 		bool inside = false;
 		float chi_1 = CHR_UTILS::RandFloat();
 
 		if (!isect_data.hit)
-		{
-			if (scene.m_sky_texture)
-			{
-				if (scene.m_map_texture_to_sphere)
-				{
-					auto dir = glm::normalize(ray.direction);
-					float u = 0.5f - atan2(dir.z, dir.x) * (0.5f / CHR_UTILS::PI);
-					float v = acosf(dir.y)  / CHR_UTILS::PI;
-					auto t_coord = glm::vec3(u, v, NAN);
-					return scene.m_sky_texture->SampleAt(t_coord)*255.0f;
-				}
-				else
-					return scene.m_sky_texture->SampleAt({ pixel_cood.x / (float)m_settings->GetResolution().x,
-						pixel_cood.y / (float)m_settings->GetResolution().y, 0 }) * 255.0f;
-			}
-			else
-				return scene.m_sky_color;
-		}
+			return BackgroundColor(ray, scene, pixel_cood);
 		else if (m_settings->m_calc_reflections && 
 			isect_data.material->type == MAT_TYPE::mirror && 
 			(depth < m_settings->m_recur_depth)) 
 		{
 			// compute reflection
-			Ray reflection_ray(isect_data.position + isect_data.normal * m_settings->m_shadow_eps);
-
-			//For glossy objects
-			glm::vec3 r = glm::normalize(glm::reflect(ray.direction, isect_data.normal));
-			glm::vec3 u, v;
-			CHR_UTILS::GenerateONB(r, u, v);
-			reflection_ray.direction = glm::normalize(r + isect_data.material->m_roughness * 
-				(CHR_UTILS::RandFloat(-0.5, 0.5) * u + CHR_UTILS::RandFloat(-0.5, 0.5) * v));
-			reflection_ray.intersect_eps = m_settings->m_intersection_eps;
-			reflection_ray.jitter_t = CHR_UTILS::RandFloat();
+			Ray reflection_ray = ReflectionRay(ray, isect_data, isect_data.normal);
 
+			t_stats.reflection_rays++;
 			glm::vec3 reflection_color = PathTrace(reflection_ray, scene, depth + 1, pixel_cood) * 
 				((Mirror*)(isect_data.material))->m_mirror_reflec;
 			color += reflection_color;
@@ -620,19 +842,11 @@ namespace CHR
 			(depth < m_settings->m_recur_depth))
 		{
 			// compute reflection
-			Ray reflection_ray(isect_data.position + isect_data.normal * m_settings->m_shadow_eps);
-			//For glossy objects
-			glm::vec3 r = glm::normalize(glm::reflect(ray.direction, isect_data.normal));
-			glm::vec3 u, v;
-			CHR_UTILS::GenerateONB(r, u, v);
-
-			reflection_ray.direction = glm::normalize(r + isect_data.material->m_roughness *
-				(CHR_UTILS::RandFloat(-0.5, 0.5) * u + CHR_UTILS::RandFloat(-0.5, 0.5) * v));
-			reflection_ray.intersect_eps = m_settings->m_intersection_eps;
-			reflection_ray.jitter_t = CHR_UTILS::RandFloat();
+			Ray reflection_ray = ReflectionRay(ray, isect_data, isect_data.normal);
 
 			float cos_theta = glm::dot(-ray.direction, isect_data.normal);
 
+			t_stats.reflection_rays++;
 			glm::vec3 reflection_color = PathTrace(reflection_ray, scene, depth + 1, pixel_cood) * 
 				((Conductor*)isect_data.material)->GetFr(cos_theta) *
 				((Conductor*)(isect_data.material))->m_mirror_reflec;
@@ -658,17 +872,9 @@ namespace CHR
 			glm::vec3 reflection_color = { 0,0,0 };
 			if (m_settings->m_calc_reflections)
 			{
-				Ray reflection_ray(isect_data.position + proper_normal * m_settings->m_shadow_eps);
-				//For glossy objects
-				glm::vec3 r = glm::normalize(glm::reflect(ray.direction, isect_data.normal));
-				glm::vec3 u, v;
-				CHR_UTILS::GenerateONB(r, u, v);
-
-				reflection_ray.direction = glm::normalize(r + isect_data.material->m_roughness *
-					(CHR_UTILS::RandFloat(-0.5, 0.5) * u + CHR_UTILS::RandFloat(-0.5, 0.5) * v));
-				reflection_ray.intersect_eps = m_settings->m_intersection_eps;
-				reflection_ray.jitter_t = CHR_UTILS::RandFloat();
+				Ray reflection_ray = ReflectionRay(ray, isect_data, proper_normal);
 
+				t_stats.dielectric_reflection_rays++;
 				reflection_color = PathTrace(reflection_ray, scene, depth + 1, pixel_cood) * fr;
 			}
 
@@ -676,20 +882,16 @@ namespace CHR
 			glm::vec3 refraction_color = { 0,0,0 };
 			if (fr < 1.0f && m_settings->m_calc_refractions)
 			{
-				Ray refraction_ray(isect_data.position - proper_normal * m_settings->m_shadow_eps);
-				refraction_ray.direction = glm::normalize(glm::refract(ray.direction, proper_normal, ni / nt));
-				refraction_ray.intersect_eps = m_settings->m_intersection_eps;
-				refraction_ray.jitter_t = CHR_UTILS::RandFloat();
+				Ray refraction_ray = RefractionRay(ray, isect_data, proper_normal, ni / nt);
 
+				t_stats.refraction_rays++;
 				refraction_color = PathTrace(refraction_ray, scene, depth + 1, pixel_cood) * (1.0f - fr);
 			}
 
 			color += (reflection_color + refraction_color);
 			if (inside)
 			{
-				glm::vec3 absorbance = -((Dielectric*)(isect_data.material))->m_absorption_coeff *
-					glm::distance(ray.origin, isect_data.position) * 1.0f;
-				color *= exp(absorbance);
+				color *= Absorption(ray, isect_data);
 			}
 		}
 		// point is illuminated
@@ -732,31 +934,27 @@ namespace CHR
 
 			if (depth < m_settings->m_recur_depth || rr)
 			{
-				//Sample random direction
-				glm::vec3 rand_dir;
 				float p_wi;
-				if (is) //Importance sampling
-				{
-					rand_dir = CHR_UTILS::CosSampleUnitHemisphere(isect_data.normal);
-					p_wi = 1 / (CHR_UTILS::PI) * glm::abs(glm::dot(rand_dir, isect_data.normal)) + 0.0000001f; // to avoid NAN values TODO
-				}
-				else
-				{
-					rand_dir = CHR_UTILS::UnifSampleUnitHemisphere(isect_data.normal);
-					p_wi = 1 / (2.0f * CHR_UTILS::PI); //* sqrt(1.0f - cos_theta * cos_theta);
-				}
-
-				Ray global_ilum_ray(isect_data.position + isect_data.normal * m_settings->m_shadow_eps, rand_dir);
+				Ray global_ilum_ray = GlobalIlluminationRay(isect_data, is, p_wi);
+				glm::vec3 rand_dir = global_ilum_ray.direction;
 				glm::vec3 radiance = { 0,0,0 };
 				if (depth < m_settings->m_recur_depth)
+				{
+					t_stats.gi_rays++;
 					radiance = PathTrace(global_ilum_ray, scene, depth + 1, pixel_cood);
+				}
 				else if (rr)
 				{
 					global_ilum_ray.throughput = ray.throughput *
 						(glm::compAdd(isect_data.material->Shade(rand_dir, glm::normalize(ray.origin - isect_data.position), isect_data.normal)) / 3.0f);
 						float q = 1.0f - global_ilum_ray.throughput;
-					if(chi_1 > q)
+					if (chi_1 > q)
+					{
+						t_stats.gi_rays++;
 						radiance = PathTrace(global_ilum_ray, scene, depth + 1, pixel_cood) / (1-q);
+					}
+					else
+						t_stats.rr_terminations++;
 				}
 				glm::vec3 e_vec = glm::normalize(ray.origin - isect_data.position);
 
@@ -798,6 +996,9 @@ namespace CHR
 		case CHR::path_trace:
 			m_rt_worker = &RayTracer::PathTraceWorker;
 			break;
+		case CHR::wavefront_path_trace:
+			m_rt_worker = &RayTracer::WavefrontPathTraceWorker;
+			break;
 		case CHR::rt_size:
 			break;
 		default:
@@ -3,14 +3,40 @@
 #include <ray-tracer/main/Image.h>
 #include <ray-tracer/main/Ray.h>
 #include <ray-tracer/main/Scene.h>
+#include <ray-tracer/main/Wavefront.h>
 #include <ray-tracer/editor/Settings.h>
 
+#include <atomic>
+#include <mutex>
+
 namespace CHR
 {
-	enum RT_MODE{ray_cast=0, recursive_trace, path_trace, rt_size};
+	enum RT_MODE{ray_cast=0, recursive_trace, path_trace, wavefront_path_trace, rt_size};
 	class RayTracer : public Observer
 	{
 	public:
+		//Numbers of the last Render call
+		struct RenderStats
+		{
+			float render_time = 0.0f;//seconds
+
+			unsigned long long camera_rays = 0;
+			unsigned long long shadow_rays = 0;
+			unsigned long long reflection_rays = 0;//mirror and conductor
+			unsigned long long dielectric_reflection_rays = 0;
+			unsigned long long refraction_rays = 0;
+			unsigned long long gi_rays = 0;//path tracing bounces
+			unsigned long long rr_terminations = 0;//paths ended by russian roulette
+
+			TraversalStats traversal;
+
+			inline unsigned long long GetPrimaryRays() const { return camera_rays; }
+			inline unsigned long long GetSecondaryRays() const
+			{
+				return shadow_rays + reflection_rays + dielectric_reflection_rays + refraction_rays + gi_rays;
+			}
+		};
+
 		RayTracer();
 
 		void GetNotified();
@@ -21,6 +47,8 @@ namespace CHR
 
 
 		void SetRenderMode(RT_MODE mode);
+		inline Image* GetRenderedImage() const { return m_rendered_image; }
+		inline const RenderStats& GetRenderStats() const { return m_stats; }
 
 
 	private:
@@ -28,16 +56,75 @@ namespace CHR
 		Image* m_rendered_image ;
 
 		Settings* m_settings;
-		std::atomic<int> job_index{ 0 };
 
-		void(RayTracer::* m_rt_worker)(Camera* cam, Scene& scene, int idx);
+		//Tiles of the current Render, progress is reported as they finish
+		int m_tile_count = 0;
+		std::atomic<int> m_tiles_done{ 0 };
+		std::atomic<int> m_progress_shown{ -1 };
+		bool m_print_progress = true;
+		std::mutex m_progress_mutex;
+		void ReportProgress();
+
+		RenderStats m_stats;
+		std::mutex m_stats_mutex;
+		void MergeThreadStats();
+
+		//Renders one tile_size x tile_size tile, run on the thread pool
+		void(RayTracer::* m_rt_worker)(Camera* cam, Scene& scene, int tile_idx);
+
+		//Camera frame of a render, computed once per tile
+		struct CameraRays
+		{
+			CameraRays(Camera* camera, glm::ivec2 resolution);
+			//A sample of pixel (i, j), jittered over the pixel and the lens
+			Ray Generate(int i, int j) const;
+
+			Camera* cam;
+			glm::vec3 cam_pos, right, up;
+			glm::vec3 top_left_w, right_step, down_step;
+		};
+		//Pixels of a tile_size x tile_size tile, rect_max excluded
+		void GetTileRect(int tile_idx, glm::ivec2& rect_min, glm::ivec2& rect_max) const;
+		//Pixel block whose camera rays are traced as one packet, from m_packet_size
+		glm::ivec2 GetPacketBlock() const;
+
+		//Follows a camera ray, hit is its closest hit when a packet already found it
+		typedef glm::vec3(RayTracer::* TraceFunction)(const Ray& ray, Scene& scene, int depth, glm::ivec2 pixel_cood,
+			const IntersectionData* hit);
+		//Camera rays of a tile, m_packet_size pixels' rays are intersected as one packet before trace follows each
+		void TraceTile(Camera* cam, Scene& scene, int tile_idx, TraceFunction trace);
 
-		void RayCastWorker(Camera* cam, Scene& scene, int idx);
-		void RecursiveTraceWorker(Camera* cam, Scene& scene, int idx);
-		void PathTraceWorker(Camera* cam, Scene& scene, int idx);
-		glm::vec3 RecursiveTrace(const Ray& ray, Scene& scene, int depth, glm::ivec2 pixel_cood);
-		glm::vec3 PathTrace(const Ray& ray, Scene& scene, int depth, glm::ivec2 pixel_cood);
+		void RayCastWorker(Camera* cam, Scene& scene, int tile_idx);
+		void RecursiveTraceWorker(Camera* cam, Scene& scene, int tile_idx);
+		void PathTraceWorker(Camera* cam, Scene& scene, int tile_idx);
+		//PathTrace one bounce at a time, every path of a batch of samples goes through each stage before the next
+		void WavefrontPathTraceWorker(Camera* cam, Scene& scene, int tile_idx);
+		//Closest hits of queues.rays, camera rays are intersected in their packets
+		void ExtendRays(Scene& scene, WavefrontQueues& queues, bool camera_rays);
+		//Fills queues.shade_order so that rays hitting the same material are shaded together, misses first
+		void SortByMaterial(WavefrontQueues& queues);
+		//Adds the local lighting of each hit to colors and queues its shadow rays and continuation rays
+		void ShadeHits(Scene& scene, Camera* cam, WavefrontQueues& queues, const std::vector<glm::ivec2>& pixels,
+			std::vector<glm::vec3>& colors);
+		void TraceShadowRays(const Scene& scene, const ShadowQueue& shadow_rays, std::vector<glm::vec3>& colors);
+		//Direct lighting of the camera ray's hit, no secondary rays besides shadow rays
+		glm::vec3 RayCast(const Ray& ray, Scene& scene, int depth, glm::ivec2 pixel_cood, const IntersectionData* hit = nullptr);
+		glm::vec3 RecursiveTrace(const Ray& ray, Scene& scene, int depth, glm::ivec2 pixel_cood, const IntersectionData* hit = nullptr);
+		glm::vec3 PathTrace(const Ray& ray, Scene& scene, int depth, glm::ivec2 pixel_cood, const IntersectionData* hit = nullptr);
+		glm::vec3 BackgroundColor(const Ray& ray, Scene& scene, glm::ivec2 pixel_cood);
+		//Secondary rays of a hit, shared by the recursive, path and wavefront path tracers
+		//Reflection perturbed by the material's roughness, leaving from the side offset_normal points to
+		Ray ReflectionRay(const Ray& ray, const IntersectionData& isect_data, const glm::vec3& offset_normal) const;
+		//Transmission through a dielectric, proper_normal faces the incoming ray and eta is ni / nt
+		Ray RefractionRay(const Ray& ray, const IntersectionData& isect_data, const glm::vec3& proper_normal, float eta) const;
+		//Attenuation of a ray that travelled inside the hit dielectric
+		glm::vec3 Absorption(const Ray& ray, const IntersectionData& isect_data) const;
+		//Bounce off a diffuse hit, cosine weighted with importance sampling and uniform otherwise, p_wi is its density
+		Ray GlobalIlluminationRay(const IntersectionData& isect_data, bool importance_sampling, float& p_wi) const;
+		//Shadow ray to a sample of the light and the radiance arriving along it when nothing occludes it
+		Ray LightSampleRay(const IntersectionData& isect_data, const std::shared_ptr<Light>& li,
+			glm::vec3& radiance, float& li_distance) const;
 		glm::vec3 CastLightRay(Scene& scene, IntersectionData isect_data, std::shared_ptr<Light> li, Ray ray);
-		bool TestShadow(const Scene& scene, const IntersectionData* isect_data, const std::shared_ptr<Light> l, const Ray shadow_ray);
+		bool TestShadow(const Scene& scene, const Ray shadow_ray, float li_distance);
 	};
 }
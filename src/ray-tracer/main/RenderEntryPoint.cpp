@@ -0,0 +1,274 @@
+//Headless entry point: renders the cameras of a scene xml and writes the images
+//without creating a window, a GL context or a shader.
+
+#include <algorithm>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <ray-tracer/editor/AssetImporter.h>
+#include <ray-tracer/editor/Logger.h>
+#include <ray-tracer/editor/Profiler.h>
+#include <ray-tracer/editor/Settings.h>
+#include <ray-tracer/main/RayTracer.h>
+#include <ray-tracer/main/Scene.h>
+
+static void PrintUsage()
+{
+	std::cout << "usage: chroma-render <scene.xml> [options]\n"
+		<< "\t-c <name>\trender only the camera with this name (e.g. camera_1), default all cameras\n"
+		<< "\t-o <dir>\toutput directory, default current directory\n"
+		<< "\t-t <count>\tthread count\n"
+		<< "\t-a <1|4|8|16>\tcamera rays of neighbouring pixels traced as one packet, default 16\n"
+		<< "\t-m <cast|rt|pt|wpt>\tray casting, recursive ray tracing, path tracing or wavefront path tracing, default from the camera's Renderer tag\n"
+		<< "\t-s <sah|hlbvh|sbvh|middle|eq>\tBVH split method, default sah, hlbvh builds fastest, sbvh traces fastest\n"
+		<< "\t-p <count>\tmax primitives in a BVH leaf, default 8\n"
+		<< "\t-w <2|4|8>\tchildren per BVH node, default 2\n"
+		<< "\t-u <count>\tSAH buckets per BVH split, 2 to 64, default 12\n"
+		<< "\t-g <fraction>\tprimitive references an sbvh may add by spatial splits, relative to the primitive count, default 0.3\n"
+		<< "\t-r <passes>\ttreelet restructuring passes over the built BVH, lowers its SAH cost, default 0\n"
+		<< "\t-l <scalar|sse|avx>\tinstruction set of the BVH leaf triangle and node box tests, default the widest supported\n"
+		<< "\t-k\t\tcache line clustered layout for binary BVH nodes\n"
+		<< "\t-q\t\t8 bit quantized child bounds in 4 and 8 wide BVH nodes\n"
+		<< "\t-b <dir>\tcache built BVHs in this directory, a later run of the same geometry and BVH options loads them\n"
+		<< "\t-P\t\tlog a per phase time breakdown after each render\n"
+		<< "\t-C\t\tstore mesh normals and uvs compressed, 4 bytes each\n";
+}
+
+//Whole option value as a number, throws std::invalid_argument or std::out_of_range for anything else
+static int ToInt(const std::string& val)
+{
+	size_t end = 0;
+	int number = std::stoi(val, &end);
+	if (end != val.size())
+		throw std::invalid_argument(val);
+	return number;
+}
+
+static float ToFloat(const std::string& val)
+{
+	size_t end = 0;
+	float number = std::stof(val, &end);
+	if (end != val.size())
+		throw std::invalid_argument(val);
+	return number;
+}
+
+int main(int argc, char** argv)
+{
+	CHR::Logger::Init("1.19.0");
+
+	if (argc < 2)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	std::string scene_path = argv[1];
+	std::string cam_name = "";
+	std::string out_dir = ".";
+	std::optional<CHR::RT_MODE> mode;//Unset: picked per camera
+	CHR::BVHBuildOptions bvh_options;
+	bvh_options.max_prims_in_node = 8;
+
+	auto settings = CHR::Settings::GetInstance();
+
+	for (int i = 2; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg.compare("-P") == 0)
+		{
+			CHR::Profiler::SetEnabled(true);
+			continue;
+		}
+		if (arg.compare("-k") == 0)
+		{
+			bvh_options.clustered_layout = true;
+			continue;
+		}
+		if (arg.compare("-q") == 0)
+		{
+			bvh_options.quantized_nodes = true;
+			continue;
+		}
+		if (arg.compare("-C") == 0)
+		{
+			settings->m_compress_mesh_data = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			CH_ERROR("Missing value for option " + arg);
+			PrintUsage();
+			return 1;
+		}
+		std::string val = argv[++i];
+
+		try
+		{
+			if (arg.compare("-c") == 0)
+				cam_name = val;
+			else if (arg.compare("-o") == 0)
+				out_dir = val;
+			else if (arg.compare("-t") == 0)
+				settings->m_thread_count = std::max(1, ToInt(val));
+			else if (arg.compare("-a") == 0)
+			{
+				settings->m_packet_size = ToInt(val);
+				if (settings->m_packet_size != 1 && settings->m_packet_size != 4 &&
+					settings->m_packet_size != 8 && settings->m_packet_size != 16)
+				{
+					CH_ERROR("Packet size must be 1, 4, 8 or 16");
+					return 1;
+				}
+			}
+			else if (arg.compare("-b") == 0)
+				settings->m_bvh_cache_dir = val;
+			else if (arg.compare("-p") == 0)
+				bvh_options.max_prims_in_node = std::max(1, ToInt(val));
+			else if (arg.compare("-u") == 0)
+			{
+				bvh_options.sah_buckets = ToInt(val);
+				if (bvh_options.sah_buckets < 2 || bvh_options.sah_buckets > CHR::BVH::MAX_SAH_BUCKETS)
+				{
+					CH_ERROR("SAH buckets must be 2 to " + std::to_string(CHR::BVH::MAX_SAH_BUCKETS));
+					return 1;
+				}
+			}
+			else if (arg.compare("-g") == 0)
+				bvh_options.sbvh_budget = std::max(0.0f, ToFloat(val));
+			else if (arg.compare("-r") == 0)
+				bvh_options.treelet_passes = std::max(0, ToInt(val));
+			else if (arg.compare("-w") == 0)
+			{
+				bvh_options.width = ToInt(val);
+				if (bvh_options.width != 2 && bvh_options.width != 4 && bvh_options.width != 8)
+				{
+					CH_ERROR("BVH width must be 2, 4 or 8");
+					return 1;
+				}
+			}
+			else if (arg.compare("-m") == 0)
+			{
+				if (val.compare("cast") == 0)
+					mode = CHR::RT_MODE::ray_cast;
+				else if (val.compare("rt") == 0)
+					mode = CHR::RT_MODE::recursive_trace;
+				else if (val.compare("pt") == 0)
+					mode = CHR::RT_MODE::path_trace;
+				else if (val.compare("wpt") == 0)
+					mode = CHR::RT_MODE::wavefront_path_trace;
+				else
+				{
+					CH_ERROR("Unknown render mode " + val);
+					return 1;
+				}
+			}
+			else if (arg.compare("-l") == 0)
+			{
+				if (val.compare("scalar") == 0)
+					bvh_options.simd = CHR::SIMD_T::scalar;
+				else if (val.compare("sse") == 0)
+					bvh_options.simd = CHR::SIMD_T::sse;
+				else if (val.compare("avx") == 0)
+					bvh_options.simd = CHR::SIMD_T::avx;
+				else
+				{
+					CH_ERROR("Unknown instruction set " + val);
+					return 1;
+				}
+			}
+			else if (arg.compare("-s") == 0)
+			{
+				if (val.compare("sah") == 0)
+					bvh_options.split_method = CHR::SplitMethod::SAH;
+				else if (val.compare("hlbvh") == 0)
+					bvh_options.split_method = CHR::SplitMethod::HLBVH;
+				else if (val.compare("sbvh") == 0)
+					bvh_options.split_method = CHR::SplitMethod::SBVH;
+				else if (val.compare("middle") == 0)
+					bvh_options.split_method = CHR::SplitMethod::Middle;
+				else if (val.compare("eq") == 0)
+					bvh_options.split_method = CHR::SplitMethod::EqualCounts;
+				else
+				{
+					CH_ERROR("Unknown split method " + val);
+					return 1;
+				}
+			}
+			else
+			{
+				CH_ERROR("Unknown option " + arg);
+				PrintUsage();
+				return 1;
+			}
+		}
+		catch (const std::logic_error&)
+		{
+			//Thrown by ToInt and ToFloat
+			CH_ERROR("Invalid value " + val + " for option " + arg);
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if (!std::ifstream(scene_path).good())
+	{
+		CH_ERROR("Can not open scene file " + scene_path);
+		return 1;
+	}
+
+	//No shader: the scene is never drawn, so no GL resources are created
+	CHR::Scene* scene = nullptr;
+	try
+	{
+		scene = CHR::AssetImporter::LoadSceneFromXML(nullptr, scene_path);
+		scene->InitBVH(bvh_options);
+	}
+	catch (const std::exception& e)
+	{
+		//Loaders throw on missing or malformed assets, e.g. a ply file the scene refers to
+		CH_ERROR("Can not load scene " + scene_path + ": " + e.what());
+		delete scene;
+		return 1;
+	}
+
+	CHR::RayTracer ray_tracer;
+	settings->Attach(&ray_tracer);
+
+	int rendered = 0;
+	for (auto it = scene->GetCameras().begin(); it != scene->GetCameras().end(); it++)
+	{
+		if (!cam_name.empty() && cam_name.compare(it->first) != 0)
+			continue;
+
+		CHR::Camera* cam = it->second;
+		std::string image_name = cam->GetImageName().empty() ? it->first + ".png" : cam->GetImageName();
+		bool hdr = image_name.substr(image_name.find_last_of(".") + 1).compare("exr") == 0;
+
+		//Image is recreated on resolution change with the post process type as its hdr flag
+		settings->m_ldr_post_process = hdr ? CHR::IM_POST_PROC_T::tone_map : CHR::IM_POST_PROC_T::none;
+		settings->SetResolution(cam->GetResolution());
+		settings->m_act_rt_cam_name = it->first;
+		if (mode)
+			ray_tracer.SetRenderMode(*mode);
+		else
+			ray_tracer.SetRenderMode(cam->m_path_trace ? CHR::RT_MODE::path_trace : CHR::RT_MODE::recursive_trace);
+
+		CH_INFO("Rendering " + it->first + " of " + scene_path);
+		ray_tracer.Render(cam, *scene);
+		ray_tracer.GetRenderedImage()->SaveToDisk((out_dir + "/" + image_name).c_str());
+		rendered++;
+	}
+
+	settings->Detach(&ray_tracer);
+	delete scene;
+
+	if (rendered == 0)
+	{
+		CH_ERROR("No camera named " + cam_name + " in " + scene_path);
+		return 1;
+	}
+	return 0;
+}
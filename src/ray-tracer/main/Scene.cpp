@@ -8,6 +8,10 @@ namespace CHR
 	{
 		m_scene_data = new SceneData(shader);
 
+		//Headless scenes have no shader and are never preview rendered
+		if (!m_scene_data->m_shader)
+			return;
+
 		m_scene_data->m_shader->Bind();
 		m_scene_data->m_shader->CreateUniform(Shader::MODEL_SH, ShaderDataType::Mat4, m_scene_data->GetModel());
 		m_scene_data->m_shader->CreateUniform(Shader::VIEW_SH, ShaderDataType::Mat4, m_scene_data->GetView());
@@ -20,6 +24,7 @@ namespace CHR
 	Scene::~Scene()
 	{
 		delete m_scene_data;
+		delete m_accel_structure;
 		m_cameras.erase(m_cameras.begin(), m_cameras.end());
 	}
 
@@ -36,6 +41,9 @@ namespace CHR
 	void Scene::AddLight(std::string name, std::shared_ptr<Light> li)
 	{
 		m_lights[name] = li;
+		if (!m_scene_data->m_shader)
+			return;
+
 		switch (li->m_li_type)
 		{
 		case LIGHT_T::point:
@@ -51,12 +59,40 @@ namespace CHR
 		}
 	}
 
-	void Scene::InitBVH(int maxPrimsInNode, SplitMethod splitMethod)
+	void Scene::InitBVH(const BVHBuildOptions& options)
 	{
-		if (m_accel_structure)
-			delete m_accel_structure;
+		std::function<AccelerationStructure*()> build_accel = [this, options]() {
+			return new BVH(*this, options);
+		};
+		//The build sees the current transforms
+		for (auto& obj : m_scene_objects)
+			obj.second->ClearTransformDirty();
+		//Replaced only once the new one is built, a build that throws leaves the old one in use
+		AccelerationStructure* accel = build_accel();
+		delete m_accel_structure;
+		m_accel_structure = accel;
+		m_build_accel = build_accel;
+	}
 
-		m_accel_structure = new BVH(*this, maxPrimsInNode, splitMethod);
+	bool Scene::UpdateBVH()
+	{
+		std::vector<const glm::mat4*> moved;
+		for (auto& obj : m_scene_objects)
+		{
+			if (obj.second->IsTransformDirty())
+			{
+				moved.push_back(obj.second->GetModelMatrixPtr());
+				obj.second->ClearTransformDirty();
+			}
+		}
+		if (moved.empty() || !m_accel_structure || m_accel_structure->Refit(moved))
+			return false;
+
+		CH_TRACE("Rebuilding the BVH, a refit can not keep its quality");
+		AccelerationStructure* accel = m_build_accel();
+		delete m_accel_structure;
+		m_accel_structure = accel;
+		return true;
 	}
 
 	bool Scene::Intersect(const Ray ray, IntersectionData* isect_data) const
@@ -64,6 +100,16 @@ namespace CHR
 		return m_accel_structure->Intersect(ray, isect_data);
 	}
 
+	void Scene::Intersect(const RayPacket& packet, IntersectionData* isect_data) const
+	{
+		m_accel_structure->Intersect(packet, isect_data);
+	}
+
+	bool Scene::IntersectP(const Ray ray, float t_max) const
+	{
+		return m_accel_structure->IntersectP(ray, t_max);
+	}
+
 
 	void Scene::Render(Camera* cam, DrawMode mode)
 	{
@@ -71,6 +117,8 @@ namespace CHR
 			cam = m_cameras.begin()->second;
 		if (!cam)
 			CH_FATAL("Failed to render no valid Camera Provided!");
+		if (!m_scene_data->m_shader)
+			return;
 
 		m_scene_data->SetView(cam->GetViewMatrix());
 		m_scene_data->SetProj(cam->GetProjectionMatrix());
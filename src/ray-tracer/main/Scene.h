@@ -5,6 +5,7 @@
 #include <ray-tracer/main/SceneObject.h>
 
 #include <stdio.h>
+#include <functional>
 #include <map>
 #include <vector>
 
@@ -14,7 +15,7 @@ namespace CHR
 	class Scene
 	{
 	public:
-		Scene(std::string name, Shader* shader);
+		Scene(std::string name, Shader* shader = nullptr);
 		~Scene();
 
 		void AddSceneObject(std::string name, std::shared_ptr<SceneObject> object);
@@ -22,13 +23,20 @@ namespace CHR
 
 		std::shared_ptr<SceneObject> GetSceneObject(std::string name) { return m_scene_objects[name]; }
 		inline Camera* GetCamera(std::string name) { return m_cameras[name]; }
+		inline const std::map<std::string, Camera*>& GetCameras() const { return m_cameras; }
 		//inline Camera* GetActiveCamera() { return m_cameras[active_cam_name]; }
 
 		void AddLight(std::string name, std::shared_ptr<Light> li);
 
-		void InitBVH(int maxPrimsInNode = 1, SplitMethod splitMethod = (SplitMethod)0);
+		void InitBVH(const BVHBuildOptions& options = BVHBuildOptions());
+		//Refits the BVH to the objects moved since it was built or last updated, and rebuilds it with
+		//the same settings once the refits have degraded it too far. Returns true when it was rebuilt
+		bool UpdateBVH();
 		inline bool IsAccelerationReady() { return m_accel_structure != NULL; }
+		inline const AccelerationStructure* GetAccelerationStructure() const { return m_accel_structure; }
 		bool Intersect(const Ray ray, IntersectionData* isect_data) const;
+		void Intersect(const RayPacket& packet, IntersectionData* isect_data) const;
+		bool IntersectP(const Ray ray, float t_max) const;
 
 		inline std::shared_ptr<Light> GetLight(std::string name) { return m_lights[name]; } //TODO: add null check
 
@@ -45,6 +53,7 @@ namespace CHR
 
 	private:
 		AccelerationStructure* m_accel_structure = nullptr;
+		std::function<AccelerationStructure*()> m_build_accel;//Builds it with the options of the last InitBVH
 		friend class Editor;
 		std::string m_name;
 
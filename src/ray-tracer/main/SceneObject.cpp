@@ -12,21 +12,17 @@
 namespace CHR
 {
 	Mesh::Mesh()
+		:m_data(std::make_shared<MeshData>())
 	{
 		m_bound_min = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
 		m_bound_max = { std::numeric_limits<float>::min(), std::numeric_limits<float>::min(), std::numeric_limits<float>::min() };
 	}
 
-	Mesh::Mesh(std::vector<std::shared_ptr<glm::vec3>> vertices, std::vector<std::shared_ptr<glm::vec3>> normals, 
-		std::vector<std::shared_ptr<glm::vec2>> texcoords, std::vector<std::shared_ptr<glm::vec3>> colors, unsigned int face_count, bool cntr_piv)
+	Mesh::Mesh(std::shared_ptr<MeshData> data, bool cntr_piv)
+		:m_data(data)
 	{
-		m_vertex_positions = vertices;
-		m_vertex_normals = normals;
-		m_vertex_colors = colors;
-		m_vertex_texcoords = texcoords;
-
-		m_vertex_count = vertices.size();
-		m_face_count = face_count;
+		m_vertex_count = m_data->positions.size();
+		m_face_count = m_data->GetFaceCount();
 
 		m_bound_min = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
 		m_bound_max = { std::numeric_limits<float>::min(), std::numeric_limits<float>::min(), std::numeric_limits<float>::min() };
@@ -37,24 +33,25 @@ namespace CHR
 			CenterToPivot();
 	}
 
-	Mesh::Mesh(std::vector<std::shared_ptr<glm::vec3>> vertices, std::vector<std::shared_ptr<glm::vec3>> normals,
-		std::vector<std::shared_ptr<glm::vec2>> texcoords, std::vector<std::shared_ptr<glm::vec3>> colors, std::vector<unsigned int> indices, bool cntr_piv)
-		:Mesh(vertices, normals, texcoords, colors, indices.size() / 3, cntr_piv)
+	Mesh::Mesh(std::vector<glm::vec3> vertices, std::vector<glm::vec3> normals,
+		std::vector<glm::vec2> texcoords, std::vector<glm::vec3> colors, std::vector<unsigned int> indices, bool cntr_piv)
+		:Mesh(std::make_shared<MeshData>(MeshData{ std::move(vertices), std::move(normals), std::move(colors),
+			std::move(texcoords), std::move(indices), {}, {}, {} }), cntr_piv)
 	{
-		m_indices = indices;
 	}
 
 	void Mesh::OrderVerticesCCW()
 	{
-		for (int i = 0; i < m_indices.size(); i+=3)
+		std::vector<unsigned int>& indices = m_data->indices;
+		for (size_t i = 0; i < indices.size(); i+=3)
 		{
-			glm::mat3 mat(*(m_vertex_positions[m_indices[i]]), 
-				*(m_vertex_positions[m_indices[i+1]]),
-				*(m_vertex_positions[m_indices[i+2]]));
+			glm::mat3 mat(m_data->positions[indices[i]], 
+				m_data->positions[indices[i+1]],
+				m_data->positions[indices[i+2]]);
 			if (glm::determinant(mat) < 0)
 			{
 				//CH_INFO("CW traingle swapped to be CCW");
-				std::swap(m_indices[i], m_indices[i + 2]);
+				std::swap(indices[i], indices[i + 2]);
 			}
 		}
 	}
@@ -64,10 +61,10 @@ namespace CHR
 		glm::vec3 center(0, 0, 0);
 
 		for (int i = 0; i < m_vertex_count; i++)
-			center += *(m_vertex_positions[i]) / (1.0f * m_vertex_count);
+			center += m_data->positions[i] / (1.0f * m_vertex_count);
 
 		for (int i = 0; i < m_vertex_count; i++)
-			*m_vertex_positions[i] -= center;
+			m_data->positions[i] -= center;
 
 		m_bound_max -= center;
 		m_bound_min -= center;
@@ -82,37 +79,43 @@ namespace CHR
 		}
 		else
 		{
-			m_bound_min = *m_vertex_positions[0];
-			m_bound_max = *m_vertex_positions[0];
+			m_bound_min = m_data->positions[0];
+			m_bound_max = m_data->positions[0];
 
 			for (int i = 0; i < m_vertex_count; i++)
 			{
-				m_bound_min = glm::min(*m_vertex_positions[i], m_bound_min);
-				m_bound_max = glm::max(*m_vertex_positions[i], m_bound_max);
+				m_bound_min = glm::min(m_data->positions[i], m_bound_min);
+				m_bound_max = glm::max(m_data->positions[i], m_bound_max);
 			}
 		}
 	}
 	void Mesh::SmoothNormals()
 	{
-		for (int i = 0; i < m_indices.size(); i ++)
+		const std::vector<unsigned int>& indices = m_data->indices;
+		const std::vector<glm::vec3>& positions = m_data->positions;
+		std::vector<glm::vec3>& normals = m_data->normals;
+		if (normals.size() < positions.size())
+			normals.resize(positions.size());
+
+		for (size_t i = 0; i < indices.size(); i ++)
 		{
-			*m_vertex_normals[m_indices[i]] = {0,0,0};
+			normals[indices[i]] = {0,0,0};
 		}
-		for (int i = 0; i < m_indices.size(); i += 3)
+		for (size_t i = 0; i < indices.size(); i += 3)
 		{
 			glm::vec3 a, b;
-			a = *m_vertex_positions[m_indices[i + 1]] - *m_vertex_positions[m_indices[i + 0]];
-			b = *m_vertex_positions[m_indices[i + 2]] - *m_vertex_positions[m_indices[i + 0]];
+			a = positions[indices[i + 1]] - positions[indices[i + 0]];
+			b = positions[indices[i + 2]] - positions[indices[i + 0]];
 
 			glm::vec3 normal = glm::normalize(glm::cross(a, b));
 
-			*m_vertex_normals[m_indices[i]] += normal;
-			*m_vertex_normals[m_indices[i+1]] += normal;
-			*m_vertex_normals[m_indices[i+2]] += normal;
+			normals[indices[i]] += normal;
+			normals[indices[i+1]] += normal;
+			normals[indices[i+2]] += normal;
 		}
-		for (int i = 0; i < m_indices.size(); i++)
+		for (size_t i = 0; i < indices.size(); i++)
 		{
-			*m_vertex_normals[m_indices[i]] = glm::normalize(*m_vertex_normals[m_indices[i]]);
+			normals[indices[i]] = glm::normalize(normals[indices[i]]);
 		}
 	}
 
@@ -122,39 +125,18 @@ namespace CHR
 		: m_mesh(mesh), m_position(pos), m_rotation(rot), m_scale(scale), m_shape_t(t)
 	{
 		m_name = name;
-		m_texture = CHR::Texture("../../assets/textures/white.png");//Set texture to white to avoid black shaded objects
 		m_material = std::shared_ptr<Material>();
 
-		if(m_shape_t != SHAPE_T::sphere)
+		if(m_shape_t == SHAPE_T::triangle)
 		{
-			for (int j = 0; j < mesh->m_indices.size(); j += 3)
+			if (!tex_inds.empty() && mesh->m_data->HasTexCoords())
+				mesh->m_data->texcoord_indices = tex_inds;
+
+			m_mesh->m_shapes.reserve(mesh->m_data->GetFaceCount());
+			for (unsigned int face = 0; face < mesh->m_data->GetFaceCount(); face++)
 			{
 
-				Triangle tri = Triangle(GetMaterial(), IsVisible());
-
-				tri.m_vertices[0] = (mesh->m_vertex_positions[mesh->m_indices[j]]);
-				tri.m_vertices[1] = (mesh->m_vertex_positions[mesh->m_indices[j + 1]]);
-				tri.m_vertices[2] = (mesh->m_vertex_positions[mesh->m_indices[j + 2]]);
-
-				tri.m_normals[0] = (mesh->m_vertex_normals[mesh->m_indices[j]]);
-				tri.m_normals[1] = (mesh->m_vertex_normals[mesh->m_indices[j + 1]]);
-				tri.m_normals[2] = (mesh->m_vertex_normals[mesh->m_indices[j + 2]]);
-
-				if (mesh->m_vertex_texcoords.size() > 0)
-				{
-					if (tex_inds.size() == 0)
-					{
-						tri.m_uvs[0] = (mesh->m_vertex_texcoords[mesh->m_indices[j]]);
-						tri.m_uvs[1] = (mesh->m_vertex_texcoords[mesh->m_indices[j + 1]]);
-						tri.m_uvs[2] = (mesh->m_vertex_texcoords[mesh->m_indices[j + 2]]);
-					}
-					else
-					{
-						tri.m_uvs[0] = (mesh->m_vertex_texcoords[tex_inds[j]]);
-						tri.m_uvs[1] = (mesh->m_vertex_texcoords[tex_inds[j + 1]]);
-						tri.m_uvs[2] = (mesh->m_vertex_texcoords[tex_inds[j + 2]]);
-					}
-				}
+				Triangle tri = Triangle(mesh->m_data.get(), face, GetMaterial(), IsVisible());
 
 
 				tri.SetTransform(m_tranform_matrix, m_inverse_tranform_matrix);
@@ -174,8 +156,6 @@ namespace CHR
 					std::make_shared<LightTriangle>(radiance, std::make_shared<Triangle>(tri))); // Insert Lighttriangle
 			}
 			m_mesh->m_shapes.shrink_to_fit();
-			//For editor preview render
-			InitOpenGLBuffers();
 		}
 	}
 
@@ -200,31 +180,22 @@ namespace CHR
 
 		obj->m_mesh->m_shapes.push_back(s);
 		obj->m_mesh->m_shapes.shrink_to_fit();
-		//For editor preview render
-		obj->InitOpenGLBuffers();
 		return obj;
 	}
 
 	SceneObject* SceneObject::CreateInstance(std::string name, std::shared_ptr<SceneObject> base, bool reset_transforms)
 	{
-		auto mesh = std::make_shared<Mesh>(base->m_mesh->m_vertex_positions, 
-			base->m_mesh->m_vertex_normals, base->m_mesh->m_vertex_texcoords,
-			base->m_mesh->m_vertex_colors, base->m_mesh->m_indices);
+		auto mesh = std::make_shared<Mesh>(base->m_mesh->m_data);
 
-		for (int i = 0; i< base->m_mesh->m_shapes.size(); i++)//deep copy mesh
-		{
-			mesh->m_shapes.push_back(std::make_shared<Instance>(base->m_mesh->m_shapes[i].get(), reset_transforms));
-		}
+		//No triangles of its own, the base mesh is traced through one MeshInstance shape
+		SceneObject* instance = new SceneObject(mesh, name, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f),
+			glm::vec3(1.0f, 1.0f, 1.0f), SHAPE_T::instance);
 
-		SceneObject* instance = new SceneObject(mesh, name);
-		instance->m_mesh->m_shapes.resize(instance->m_mesh->m_shapes.size() / 2);
-		instance->m_mesh->m_shapes.shrink_to_fit();
+		auto shape = std::make_shared<MeshInstance>(base->m_mesh, base->m_tranform_matrix, base->m_inverse_tranform_matrix);
+		shape->SetTransform(instance->m_tranform_matrix, instance->m_inverse_tranform_matrix);
+		shape->m_visible = base->IsVisible();
+		mesh->m_shapes.push_back(shape);
 
-		for (int i = 0; i < base->m_mesh->m_shapes.size(); i++)//deep copy mesh
-		{
-			mesh->m_shapes[i]->SetTransform(instance->m_tranform_matrix, instance->m_inverse_tranform_matrix);
-			mesh->m_shapes[i]->m_material = instance->m_material;
-		}
 		if (!reset_transforms)
 		{
 			instance->SetTransforms(base->GetModelMatrix());
@@ -250,8 +221,14 @@ namespace CHR
 
 	void SceneObject::Draw(DrawMode mode)
 	{
+		//GL resources are only needed by the editor preview, create them on first draw
+		if (!m_vao)
+			InitOpenGLBuffers();
+		if (m_texture.GetFilePath().empty())
+			m_texture = CHR::Texture("../../assets/textures/white.png");//Set texture to white to avoid black shaded objects
+
 		m_texture.Bind();
-		m_vao.Bind();
+		m_vao->Bind();
 		glDrawElements(mode, m_index_buffer->GetSize(), GL_UNSIGNED_INT, NULL);
 	}
 
@@ -264,27 +241,43 @@ namespace CHR
 
 		//scale[3][3] = 1.0f;
 
-		*m_tranform_matrix = translation * rotation * scale;
+		//The editor sets the transform every frame, only a change dirties it
+		glm::mat4 model = translation * rotation * scale;
+		m_transform_dirty = m_transform_dirty || *m_tranform_matrix != model;
+		*m_tranform_matrix = model;
 		*m_inverse_tranform_matrix = glm::inverse(*m_tranform_matrix);
 	}
+	void SceneObject::SetMotion(const std::vector<MotionKey>& keys)
+	{
+		std::shared_ptr<Motion> motion = std::make_shared<Motion>(keys);
+		if (motion->IsStatic())
+			motion = nullptr;
+		//The editor sets the motion every frame, only a change replaces it
+		bool changed = !motion != !m_motion || (motion && motion->GetKeys() != m_motion->GetKeys());
+		if (changed)
+		{
+			m_motion = motion;
+			m_transform_dirty = true;
+		}
+		for (auto shape : m_mesh->m_shapes)
+			shape->m_motion = m_motion.get();
+	}
+
 	void SceneObject::InitOpenGLBuffers()
 	{
 		//Vertex positions buffer
-		std::vector<glm::vec3> positions(m_mesh->m_vertex_positions.size()), normals(m_mesh->m_vertex_normals.size());
-		std::vector<glm::vec2> uvs(m_mesh->m_vertex_texcoords.size());
-
-		for (int i = 0; i < m_mesh->m_vertex_positions.size(); i++)
-			positions[i] = *m_mesh->m_vertex_positions[i];
+		const MeshData& data = *m_mesh->m_data;
+		std::vector<glm::vec3> normals(data.GetNormalCount());
+		std::vector<glm::vec2> uvs(data.GetTexCoordCount());
 
-		for (int i = 0; i<m_mesh->m_vertex_normals.size(); i++)
-			if(m_mesh->m_vertex_normals[i].get())
-				normals[i] = *m_mesh->m_vertex_normals[i];
+		for (size_t i = 0; i < normals.size(); i++)
+			normals[i] = data.NormalAt(i);
 
-		for (int i = 0; i<m_mesh->m_vertex_texcoords.size(); i++)
-			uvs[i] = *m_mesh->m_vertex_texcoords[i];
+		for (size_t i = 0; i < uvs.size(); i++)
+			uvs[i] = data.TexCoordAt(i);
 
-		std::shared_ptr<CHR::OpenGLVertexBuffer> position_buffer = std::make_shared<CHR::OpenGLVertexBuffer>((void*)positions.data(),
-			m_mesh->m_vertex_positions.size() * sizeof(GLfloat) * 3);
+		std::shared_ptr<CHR::OpenGLVertexBuffer> position_buffer = std::make_shared<CHR::OpenGLVertexBuffer>((void*)data.positions.data(),
+			data.positions.size() * sizeof(GLfloat) * 3);
 
 		CHR::VertexAttribute layout_attribute("in_Position", CHR::Shader::POS_LAY, CHR::ShaderDataType::Float3, GL_FALSE);
 		CHR::VertexBufferLayout vertex_buffer_layout;
@@ -295,7 +288,7 @@ namespace CHR
 
 		//Vertex normals buffer
 		std::shared_ptr<CHR::OpenGLVertexBuffer> normal_buffer = std::make_shared<CHR::OpenGLVertexBuffer>((void*)normals.data(),
-			m_mesh->m_vertex_normals.size() * sizeof(GLfloat) * 3);
+			normals.size() * sizeof(GLfloat) * 3);
 
 		CHR::VertexAttribute layout_attribute2("in_Normal", CHR::Shader::NORM_LAY, CHR::ShaderDataType::Float3, GL_FALSE);
 		CHR::VertexBufferLayout vertex_buffer_layout2;
@@ -306,7 +299,7 @@ namespace CHR
 
 		//Vertex texture coords buffer
 		std::shared_ptr<CHR::OpenGLVertexBuffer> tex_coord_buffer = std::make_shared<CHR::OpenGLVertexBuffer>((void*)uvs.data(),
-			m_mesh->m_vertex_texcoords.size() * sizeof(GLfloat) * 2);
+			uvs.size() * sizeof(GLfloat) * 2);
 
 		CHR::VertexAttribute layout_attribute3("in_TexCoord", CHR::Shader::TEXC_LAY, CHR::ShaderDataType::Float2, GL_FALSE);
 		CHR::VertexBufferLayout vertex_buffer_layout3;
@@ -316,13 +309,14 @@ namespace CHR
 		m_vertex_buffers.push_back(tex_coord_buffer);
 
 		//index buffer
-		std::shared_ptr<CHR::OpenGLIndexBuffer> index_buffer = std::make_shared<CHR::OpenGLIndexBuffer>(m_mesh->m_indices.data(), m_mesh->m_indices.size());
+		std::shared_ptr<CHR::OpenGLIndexBuffer> index_buffer = std::make_shared<CHR::OpenGLIndexBuffer>(data.indices.data(), data.indices.size());
 		m_index_buffer = index_buffer;
 
 		//vertex array object
-		m_vao.AddVertexBuffer(position_buffer);
-		m_vao.AddVertexBuffer(normal_buffer);
-		m_vao.AddVertexBuffer(tex_coord_buffer);
-		m_vao.SetIndexBuffer(index_buffer);
+		m_vao = std::make_shared<CHR::OpenGLVertexArrayObject>();
+		m_vao->AddVertexBuffer(position_buffer);
+		m_vao->AddVertexBuffer(normal_buffer);
+		m_vao->AddVertexBuffer(tex_coord_buffer);
+		m_vao->SetIndexBuffer(index_buffer);
 	}
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <ray-tracer/main/ImageTextureMap.h>
 #include <ray-tracer/main/Material.h>
+#include <ray-tracer/main/MeshData.h>
 #include <ray-tracer/main/Shape.h>
 #include <ray-tracer/main/Ray.h>
 #include <ray-tracer/main/Texture.h>
@@ -31,11 +32,10 @@ namespace CHR
 	{
 	public:
 		Mesh();
-		Mesh(std::vector<std::shared_ptr<glm::vec3>> vertices, std::vector<std::shared_ptr<glm::vec3>> normals,
-			std::vector<std::shared_ptr<glm::vec2>> texcoords, std::vector<std::shared_ptr<glm::vec3>> colors, unsigned int face_count, bool cntr_piv);
-		Mesh(std::vector<std::shared_ptr<glm::vec3>> vertices, std::vector<std::shared_ptr<glm::vec3>> normals,
-			std::vector<std::shared_ptr<glm::vec2>> texcoords, std::vector<std::shared_ptr<glm::vec3>> colors,
-			std::vector<unsigned int> m_indices, bool cntr_piv = false);
+		Mesh(std::shared_ptr<MeshData> data, bool cntr_piv = false);
+		Mesh(std::vector<glm::vec3> vertices, std::vector<glm::vec3> normals,
+			std::vector<glm::vec2> texcoords, std::vector<glm::vec3> colors,
+			std::vector<unsigned int> indices, bool cntr_piv = false);
 
 
 		inline unsigned int GetFaceCount() const { return m_face_count; }
@@ -50,12 +50,7 @@ namespace CHR
 
 		void SmoothNormals();
 
-		std::vector<std::shared_ptr<glm::vec3>> m_vertex_positions;
-		std::vector<std::shared_ptr<glm::vec3>> m_vertex_normals;
-		std::vector<std::shared_ptr<glm::vec3>> m_vertex_colors;
-		std::vector<std::shared_ptr<glm::vec2>> m_vertex_texcoords;
-
-		std::vector<unsigned int> m_indices;
+		std::shared_ptr<MeshData> m_data;
 		std::vector<std::shared_ptr<Shape>> m_shapes;
 		SHADING_MODE m_shading_mode = SHADING_MODE::flat;
 
@@ -120,11 +115,19 @@ namespace CHR
 		inline void SetScale(const glm::vec3 sca) { m_scale = sca; RecalculateModelMatrix(); }
 
 		inline glm::mat4 GetModelMatrix() const { return *m_tranform_matrix; }
+		//The object's shapes point at this matrix
+		inline const glm::mat4* GetModelMatrixPtr() const { return m_tranform_matrix; }
+		//Set when the transform or the motion blur changed since the last ClearTransformDirty,
+		//the scene refits its BVH to the dirty objects before the next render
+		inline bool IsTransformDirty() const { return m_transform_dirty; }
+		inline void ClearTransformDirty() { m_transform_dirty = false; }
 		inline glm::vec3 GetPosition() const { return m_position; }
 		inline glm::vec3 GetRotation() const { return m_rotation; }
 		inline glm::vec3 GetScale() const { return m_scale; }
 
-		inline glm::vec3 GetMotionBlur() { return m_motion_blur; }
+		//Translation of the last motion key
+		inline glm::vec3 GetMotionBlur() const { return m_motion ? m_motion->GetKeys().back().translation : glm::vec3(0.0f); }
+		inline const Motion* GetMotion() const { return m_motion.get(); }
 
 		inline void Translate(const glm::vec3 vec) { m_position += vec; RecalculateModelMatrix(); }
 		/*inline void RotateAngleAxis(const float angle, const glm::vec3 axis) {
@@ -141,13 +144,18 @@ namespace CHR
 			glm::vec3 dummy;
 			glm::vec4 dummy2;
 			glm::decompose(mat, m_scale, rot, m_position, dummy, dummy2);
+			m_transform_dirty = m_transform_dirty || *m_tranform_matrix != mat;
 			*m_tranform_matrix = mat; 
 			*m_inverse_tranform_matrix = glm::inverse(mat);
 			glm::vec3 rad_angles = glm::eulerAngles(rot);
 			m_rotation = { glm::degrees(rad_angles) };
 		}
 		inline void Scale(const glm::vec3 scale) { m_scale *= scale; RecalculateModelMatrix(); }
-		inline void ResetTransforms() { *m_tranform_matrix = glm::mat4(1.0f); }
+		inline void ResetTransforms()
+		{
+			m_transform_dirty = m_transform_dirty || *m_tranform_matrix != glm::mat4(1.0f);
+			*m_tranform_matrix = glm::mat4(1.0f);
+		}
 
 
 		inline void SetTexture(Texture tex) { m_texture = tex; }
@@ -179,12 +187,18 @@ namespace CHR
 
 		//inline std::string GetName() const { return m_name; }
 		//inline void SetName(std::string n) { m_name = n; }
+		//Sets the translation of the last motion key, one at shutter close when the object does not move yet
 		inline void SetMotionBlur(glm::vec3 mb) 
 		{ 
-			m_motion_blur = mb; 
-			for (auto shape : m_mesh->m_shapes)
-				shape->m_motion_blur = mb;
+			std::vector<MotionKey> keys = m_motion ? m_motion->GetKeys() : std::vector<MotionKey>();
+			if (keys.size() < 2)
+				keys.resize(2);
+			keys[0].time = 0.0f;
+			keys.back().translation = mb;
+			SetMotion(keys);
 		}
+		//Keyframed motion over the shutter interval, see Motion
+		void SetMotion(const std::vector<MotionKey>& keys);
 
 		void DrawGUI()
 		{
@@ -335,7 +349,8 @@ namespace CHR
 		glm::vec3 m_rotation;
 		glm::vec3 m_scale;
 
-		glm::vec3 m_motion_blur = { 0,0,0 };
+		std::shared_ptr<Motion> m_motion;//nullptr while the object does not move
+		bool m_transform_dirty = false;
 
 		glm::mat4* m_tranform_matrix = new glm::mat4(1.0);
 		glm::mat4* m_inverse_tranform_matrix = new glm::mat4(1.0);
@@ -345,7 +360,7 @@ namespace CHR
 
 		SHAPE_T m_shape_t;
 
-		CHR::OpenGLVertexArrayObject m_vao;
+		std::shared_ptr<CHR::OpenGLVertexArrayObject> m_vao;
 		std::vector<std::shared_ptr<CHR::VertexBuffer>> m_vertex_buffers;
 		std::shared_ptr<CHR::IndexBuffer> m_index_buffer;
 	};
@@ -5,13 +5,18 @@
 #include <thirdparty/glm/glm/gtc/constants.hpp>
 #include <thirdparty/glm/glm/gtx/vector_angle.hpp>
 #include <thirdparty/glm/glm/gtc/matrix_access.hpp>
+#include <ray-tracer/accelerationStructures/AccelerationStructure.h>
 #include <ray-tracer/main/Geometry.h>
 #include <ray-tracer/main/Material.h>
+#include <ray-tracer/main/MeshData.h>
+#include <ray-tracer/main/Motion.h>
 #include <ray-tracer/main/Ray.h>
 
 namespace CHR
 {
-	enum class SHAPE_T { none, triangle, sphere };
+	class Mesh;
+
+	enum class SHAPE_T { none, triangle, sphere, instance };
 	enum class SHADING_MODE { flat, smooth };
 
 	class Shape
@@ -21,24 +26,75 @@ namespace CHR
 			:m_material(mat), m_visible(visible)
 		{}
 		virtual bool Intersect(const Ray ray, IntersectionData* data) const = 0;
+		//Closest hit search during traversal, records t and what FinalizeHit needs and nothing else.
+		//Hits at or beyond ray.t_max are ignored
+		virtual bool IntersectHit(const Ray& ray, SurfaceHit& hit) const
+		{
+			IntersectionData data;
+			if (!Intersect(ray, &data) || data.t >= ray.t_max)
+				return false;
+			hit.t = data.t;
+			hit.shape = this;
+			hit.instance_depth = 0;
+			return true;
+		}
+		//Builds the surface interaction of a hit IntersectHit found with the same ray
+		virtual void FinalizeHit(const Ray& ray, const SurfaceHit& /*hit*/, IntersectionData* data) const
+		{
+			Ray unbounded_ray(ray);
+			unbounded_ray.t_max = INFINITY;
+			Intersect(unbounded_ray, data);
+		}
+		//Occlusion test: true for a hit closer than t_max, emissive shapes never occlude
+		virtual bool IntersectP(const Ray ray, float t_max) const
+		{
+			Ray bounded_ray(ray);
+			bounded_ray.t_max = std::min(ray.t_max, t_max);
+			SurfaceHit hit;
+			return IntersectHit(bounded_ray, hit);
+		}
 		inline void SetTransform(glm::mat4* transform, glm::mat4* inv_transform)
 		{
 			m_transform = transform;
 			m_inv_transform = inv_transform;
 		}
 
+		//Bounds over the whole shutter interval for a moving shape
 		virtual Bounds3 GetWorldBounds() const = 0;
 		virtual Bounds3 GetLocalBounds() const = 0;
+		//World bounds with transform as the model matrix, the bounds of a moving shape at one time.
+		//Shapes that never move keep the default
+		virtual Bounds3 GetWorldBoundsUnder(const glm::mat4& /*transform*/) const { return GetWorldBounds(); }
+		//Bounds at shutter open and close whose interpolation contains the shape at every time in between
+		LinearBounds GetMotionBounds() const
+		{
+			if (!m_motion)
+			{
+				Bounds3 b = GetWorldBounds();
+				return { { b, b } };
+			}
+			return m_motion->Bound(*m_transform, [this](const glm::mat4& transform) { return GetWorldBoundsUnder(transform); });
+		}
+		//Model matrix and its inverse at the time of a ray
+		inline glm::mat4 TransformAt(float time) const
+		{
+			return m_motion ? m_motion->TransformAt(*m_transform, time) : *m_transform;
+		}
+		inline glm::mat4 InverseTransformAt(float time) const
+		{
+			return m_motion ? m_motion->InverseTransformAt(*m_inv_transform, (*m_transform)[3], time) : *m_inv_transform;
+		}
 		virtual glm::vec3 ObjectSpaceNormalAt(glm::vec3 p, glm::vec3 normal, glm::vec2 uv) const = 0;
 
 		bool m_visible = true;
 		std::shared_ptr<Material> m_material = nullptr;
 		std::shared_ptr<TextureMap> m_tex_maps[2] = {nullptr, nullptr};		//0 = shading, 1 = normal perturbation
 		SHAPE_T m_shape_type = SHAPE_T::none;
-		glm::vec3 m_motion_blur = { 0,0,0 };
+		const Motion* m_motion = nullptr;//Of the scene object, nullptr while it does not move
 
 	protected:
-		friend class Instance;
+		friend class MeshInstance;
+		friend class BVH;
 		glm::mat4* m_transform = nullptr;
 		glm::mat4* m_inv_transform = nullptr;
 	};
@@ -53,78 +109,66 @@ namespace CHR
 
 		/*Triangle(const Triangle& othr)
 		{
-			for (int i = 0; i < 3; i++)
-			{
-				m_vertices[i] = othr.m_vertices[i];
-				m_normals[i] = othr.m_normals[i];
-				m_uvs[i] = othr.m_uvs[i];
-			}
+			m_mesh_data = othr.m_mesh_data;
+			m_face = othr.m_face;
 			m_shading_mode = othr.m_shading_mode;
 			m_shape_type = SHAPE_T::triangle;
 			m_material = othr.m_material;
 			m_tex_maps[0] = othr.m_tex_maps[0];
 			m_tex_maps[1] = othr.m_tex_maps[1];
 			m_visible = othr.m_visible;
-			m_motion_blur = othr.m_motion_blur;
+			m_motion = othr.m_motion;
 		}*/
 
-		Triangle(std::vector<std::shared_ptr<glm::vec3>>verts,
-			std::vector<std::shared_ptr<glm::vec3>> norms,
-			std::vector<std::shared_ptr<glm::vec2>> uvs,
+		//Face of a mesh, the mesh data has to outlive the triangle
+		Triangle(const MeshData* mesh_data, unsigned int face,
 			std::shared_ptr<Material> mat, bool visible = true)
-			: Shape(mat, visible)
+			: Shape(mat, visible), m_mesh_data(mesh_data), m_face(face)
 		{
 			m_shape_type = SHAPE_T::triangle;
-			if (verts.size() != 3)
-				CH_WARN("Non-Triangle object passed to Triangle class");
-			if (verts.size() >= 3)
-			{
-				for (size_t i = 0; i < 3; i++)
-				{
-					m_vertices[i] = verts[i];
-
-					if (norms.size() >= 3)
-						m_normals[i] = norms[i];
-
-					if (i != 2 && !uvs.empty())
-						m_uvs[i] = uvs[i];
-				}
-			}
+			if (face >= mesh_data->GetFaceCount())
+				CH_WARN("Triangle face index out of the mesh range");
 		}
 
-		std::shared_ptr<glm::vec3> m_vertices[3];
-		std::shared_ptr<glm::vec3> m_normals[3];
-		std::shared_ptr<glm::vec2> m_uvs[3];
+		inline const glm::vec3& Vertex(int i) const { return m_mesh_data->Position(m_face, i); }
+		inline glm::vec3 Normal(int i) const { return m_mesh_data->Normal(m_face, i); }
+		inline glm::vec2 UV(int i) const { return m_mesh_data->TexCoord(m_face, i); }
+		inline bool HasUVs() const { return m_mesh_data->HasTexCoords(); }
+
+		const MeshData* m_mesh_data = nullptr;
+		unsigned int m_face = 0;
 
 		SHADING_MODE m_shading_mode = SHADING_MODE::flat;
 
 		Bounds3 GetWorldBounds() const
 		{
-			glm::vec3 b_min = *m_transform * glm::vec4(*m_vertices[0], 1.0f);
-			glm::vec3 b_max = *m_transform * glm::vec4(*m_vertices[0], 1.0f);
+			return m_motion ? GetMotionBounds().Union() : GetWorldBoundsUnder(*m_transform);
+		}
 
-			b_min = glm::min(b_min, glm::vec3(*m_transform * glm::vec4(*m_vertices[1], 1.0f)));
-			b_min = glm::min(b_min, glm::vec3(*m_transform * glm::vec4(*m_vertices[2], 1.0f)));
+		Bounds3 GetWorldBoundsUnder(const glm::mat4& transform) const
+		{
+			glm::vec3 b_min = transform * glm::vec4(Vertex(0), 1.0f);
+			glm::vec3 b_max = b_min;
 
-			b_max = glm::max(b_max, glm::vec3(*m_transform * glm::vec4(*m_vertices[1], 1.0f)));
-			b_max = glm::max(b_max, glm::vec3(*m_transform * glm::vec4(*m_vertices[2], 1.0f)));
+			b_min = glm::min(b_min, glm::vec3(transform * glm::vec4(Vertex(1), 1.0f)));
+			b_min = glm::min(b_min, glm::vec3(transform * glm::vec4(Vertex(2), 1.0f)));
 
-			b_min = glm::min(b_min, b_min + m_motion_blur);
-			b_max = glm::max(b_max, b_max + m_motion_blur);
+			b_max = glm::max(b_max, glm::vec3(transform * glm::vec4(Vertex(1), 1.0f)));
+			b_max = glm::max(b_max, glm::vec3(transform * glm::vec4(Vertex(2), 1.0f)));
 
 			return Bounds3(b_min, b_max);
 		}
 
 		Bounds3 GetLocalBounds() const
 		{
-			glm::vec3 b_min = *m_vertices[0];
-			glm::vec3 b_max = *m_vertices[0];
+			glm::vec3 b_min = Vertex(0);
+			glm::vec3 b_max = Vertex(0);
 
-			b_min = glm::min(b_min, *m_vertices[1]);
-			b_min = glm::min(b_min, *m_vertices[2]);
+			b_min = glm::min(b_min, Vertex(1));
+			b_min = glm::min(b_min, Vertex(2));
 
-			b_max = glm::max(b_max, *m_vertices[1]);
-			b_max = glm::max(b_max, *m_vertices[2]);
+			b_max = glm::max(b_max, Vertex(1));
+			b_max = glm::max(b_max, Vertex(2));
 
 			return Bounds3(b_min, b_max);
 		}
@@ -133,16 +177,16 @@ namespace CHR
 		{
 			glm::vec3 tangent_normal = 
 				glm::normalize(
-					m_tex_maps[1]->SampleAt(glm::vec3(uv.x * (*m_uvs[1]) + uv.y * (*m_uvs[2]) + (1 - uv.x -uv.y) * (*m_uvs[0]), NAN))
+					m_tex_maps[1]->SampleAt(glm::vec3(uv.x * UV(1) + uv.y * UV(2) + (1 - uv.x -uv.y) * UV(0), NAN))
 				);
 			glm::mat2 A_inv = glm::inverse(glm::mat2(
-				*m_uvs[2] - *m_uvs[1],
-				*m_uvs[0] - *m_uvs[1]));
+				UV(2) - UV(1),
+				UV(0) - UV(1)));
 
-			glm::mat2x3 E = { {*m_vertices[2] - *m_vertices[1] }, {*m_vertices[0] - *m_vertices[1]} };
+			glm::mat2x3 E = { {Vertex(2) - Vertex(1) }, {Vertex(0) - Vertex(1)} };
 
 			glm::mat2x3 TB = E * A_inv;
-			glm::vec3 N = glm::cross(*m_vertices[2] - *m_vertices[1], *m_vertices[0] - *m_vertices[1]);
+			glm::vec3 N = glm::cross(Vertex(2) - Vertex(1), Vertex(0) - Vertex(1));
 			glm::mat3 TBN = {glm::column(TB,0), glm::column(TB,1), N};
 
 			if (m_tex_maps[1]->GetDecalMode() == DECAL_M::bump)
@@ -154,7 +198,7 @@ namespace CHR
 				}
 				else //Image
 				{
-					glm::vec2 dudv = m_tex_maps[1]->BumpAt(glm::vec3(uv.x * (*m_uvs[1]) + uv.y * (*m_uvs[2]) + (1 - uv.x - uv.y) * (*m_uvs[0]), NAN));
+					glm::vec2 dudv = m_tex_maps[1]->BumpAt(glm::vec3(uv.x * UV(1) + uv.y * UV(2) + (1 - uv.x - uv.y) * UV(0), NAN));
 					auto normal_prime = glm::normalize(glm::normalize(normal) - dudv.x * glm::normalize(TB[1]) - dudv.y * glm::normalize(TB[0]));
 					if (glm::all(glm::isnan(TBN[0])) || glm::all(glm::isnan(TBN[1])))
 					{
@@ -176,46 +220,32 @@ namespace CHR
 
 		bool Intersect(const Ray ray, IntersectionData* data) const
 		{
-			Ray inverse_ray;
-			glm::mat4 inverse_transform = *m_inv_transform;
-			if (m_motion_blur != glm::vec3(0, 0, 0))
-			{
-				inverse_transform = *m_inv_transform * glm::inverse(glm::translate(glm::mat4(1.0f), ray.jitter_t * m_motion_blur)); //TODO
-			}
-			//inverse_transform = glm::inverse(inverse_transform);
-
-			inverse_ray.direction = inverse_transform * glm::vec4(ray.direction, 0.0f);
-			inverse_ray.origin = inverse_transform * glm::vec4(ray.origin, 1.0f);
-			inverse_ray.intersect_eps = ray.intersect_eps;
-
 			data->t = std::numeric_limits<float>().max();
+			SurfaceHit hit;
+			if (!IntersectHit(ray, hit)) return data->hit = false;
+			FinalizeHit(ray, hit, data);
+			return true;
+		}
 
-			glm::vec3 v0 = *m_vertices[0];
-			glm::vec3 v1 = *m_vertices[1];
-			glm::vec3 v2 = *m_vertices[2];
-
-			glm::vec3 v0v1 = v1 - v0;
-			glm::vec3 v0v2 = v2 - v0;
-
-			glm::vec3 pvec = glm::cross(inverse_ray.direction, v0v2);
-			float det = glm::dot(v0v1, pvec);
-
-			data->hit = true;
-			if (fabs(det) <= inverse_ray.intersect_eps) data->hit = false;
-
-			float invDet = 1 / det;
-
-			glm::vec3 tvec = inverse_ray.origin - v0;
-			float u = glm::dot(tvec, (pvec)) * invDet;
-			if (u < 0 || u > 1) return data->hit = false;
-
-			glm::vec3 qvec = glm::cross(tvec, v0v1);
-			float v = glm::dot(inverse_ray.direction, (qvec)) * invDet;
-			if (v < 0 || u + v > 1) return data->hit = false;
+		bool IntersectHit(const Ray& ray, SurfaceHit& hit) const
+		{
+			float t, u, v;
+			if (!IntersectObjectSpace(InverseRay(ray, InverseTransformAt(ray.jitter_t)), t, u, v) || t >= ray.t_max)
+				return false;
+			hit.t = t;
+			hit.barycentric = { u, v };
+			hit.shape = this;
+			hit.instance_depth = 0;
+			return true;
+		}
 
-			float t = glm::dot(v0v2, qvec) * invDet;
+		void FinalizeHit(const Ray& ray, const SurfaceHit& hit, IntersectionData* data) const
+		{
+			glm::mat4 inverse_transform = InverseTransformAt(ray.jitter_t);
+			float t = hit.t, u = hit.barycentric.x, v = hit.barycentric.y;
 
-			if (t < inverse_ray.intersect_eps) return data->hit = false;
+			glm::vec3 v0v1 = Vertex(1) - Vertex(0);
+			glm::vec3 v0v2 = Vertex(2) - Vertex(0);
 
 			bool smooth_normals = m_shading_mode == SHADING_MODE::smooth;
 			bool replace_normals = false;
@@ -223,22 +253,60 @@ namespace CHR
 				replace_normals = true;
 
 			glm::vec3 normal = smooth_normals ?
-				(u * (*m_normals[1]) + v * (*m_normals[2]) + (1 - u - v) * (*m_normals[0])) :	// Smooth normal
+				(u * Normal(1) + v * Normal(2) + (1 - u - v) * Normal(0)) :	// Smooth normal
 				(glm::cross(v0v1, v0v2));														// Flat normal
 			//normal = glm::normalize(normal);
 
+			data->hit = true;
 			data->t = t;
 			data->position = ray.PointAt(t);
 			data->material = m_material.get();
 			data->tex_map = m_tex_maps[0].get();
-			if(m_uvs[1])
-				data->uv = u * (*m_uvs[1]) + v * (*m_uvs[2]) + (1 - u - v) * (*m_uvs[0]);
+			if(HasUVs())
+				data->uv = u * UV(1) + v * UV(2) + (1 - u - v) * UV(0);
 			data->normal = glm::normalize(glm::mat3(glm::transpose(inverse_transform)) *
 				(replace_normals ?
-					(ObjectSpaceNormalAt(inverse_ray.PointAt(t), normal, { u,v }))	//BumpMap & NormalMap
-					: normal));														// Regular normal
+					(ObjectSpaceNormalAt(InverseRay(ray, inverse_transform).PointAt(t), normal, { u,v }))	//BumpMap & NormalMap
+					: normal));																				// Regular normal
+		}
+
+		bool IntersectP(const Ray ray, float t_max) const
+		{
+			float t, u, v;
+			return IntersectObjectSpace(InverseRay(ray, InverseTransformAt(ray.jitter_t)), t, u, v) && t < t_max;
+		}
+
+	private:
+		inline Ray InverseRay(const Ray& ray, const glm::mat4& inverse_transform) const
+		{
+			Ray inverse_ray(inverse_transform * glm::vec4(ray.origin, 1.0f), inverse_transform * glm::vec4(ray.direction, 0.0f));
+			inverse_ray.intersect_eps = ray.intersect_eps;
+			return inverse_ray;
+		}
+
+		//Moller-Trumbore against the object space vertices, t is along the unnormalized inverse_ray.direction
+		inline bool IntersectObjectSpace(const Ray& inverse_ray, float& t, float& u, float& v) const
+		{
+			glm::vec3 v0 = Vertex(0);
+			glm::vec3 v0v1 = Vertex(1) - v0;
+			glm::vec3 v0v2 = Vertex(2) - v0;
+
+			glm::vec3 pvec = glm::cross(inverse_ray.direction, v0v2);
+			float det = glm::dot(v0v1, pvec);
+			if (fabs(det) <= inverse_ray.intersect_eps) return false;
+
+			float invDet = 1 / det;
+
+			glm::vec3 tvec = inverse_ray.origin - v0;
+			u = glm::dot(tvec, (pvec)) * invDet;
+			if (u < 0 || u > 1) return false;
 
-			return data->hit;
+			glm::vec3 qvec = glm::cross(tvec, v0v1);
+			v = glm::dot(inverse_ray.direction, (qvec)) * invDet;
+			if (v < 0 || u + v > 1) return false;
+
+			t = glm::dot(v0v2, qvec) * invDet;
+			return t >= inverse_ray.intersect_eps;
 		}
 	};
 
@@ -253,8 +321,12 @@ namespace CHR
 
 		Bounds3 GetWorldBounds() const
 		{
-			glm::vec3 r = 1.0f * glm::vec3(1.0f, 1.0f, 1.0f);
-			glm::mat4 tr = *m_transform;
+			return m_motion ? GetMotionBounds().Union() : GetWorldBoundsUnder(*m_transform);
+		}
+
+		Bounds3 GetWorldBoundsUnder(const glm::mat4& transform) const
+		{
+			const glm::mat4& tr = transform;
 
 			glm::vec3 box[8] = {
 				{1,1,1},
@@ -263,7 +335,8 @@ namespace CHR
 				{-1,-1,-1},
 				{-1,-1,1},
 				{1,-1,1},
-				{1,-1,-1} };
+				{1,-1,-1},
+				{-1,1,1} };
 
 			glm::vec3 b_min = tr * glm::vec4(box[0], 1);
 			glm::vec3 b_max = tr * glm::vec4(box[4], 1);
@@ -275,10 +348,6 @@ namespace CHR
 				b_max = glm::max(b_max, tmp);
 			}
 
-			b_min = glm::min(b_min, b_min + m_motion_blur);
-			b_max = glm::max(b_max, b_max + m_motion_blur);
-
-
 			return Bounds3(b_min, b_max);
 		}
 
@@ -332,16 +401,20 @@ namespace CHR
 
 		bool Intersect(const Ray ray, IntersectionData* data) const
 		{
+			SurfaceHit hit;
+			if (!IntersectHit(ray, hit)) return data->hit = false;
+			FinalizeHit(ray, hit, data);
+			return true;
+		}
+
+		bool IntersectHit(const Ray& ray, SurfaceHit& hit) const
+		{
+			glm::mat4 inverse_transform = InverseTransformAt(ray.jitter_t);
 			Ray inverse_ray;
-			glm::mat4 inverse_transform = *m_inv_transform;
-			if (m_motion_blur != glm::vec3(0, 0, 0))
-			{
-				inverse_transform *= glm::inverse(glm::translate(glm::mat4(1.0f), ray.jitter_t * m_motion_blur));
-			}
-			//glm::mat4 inverse_transform = glm::inverse(f_transform);
 			inverse_ray.direction = inverse_transform * glm::vec4(ray.direction, 0.0f);
 			inverse_ray.origin = inverse_transform * glm::vec4(ray.origin, 1.0f);
-			inverse_ray.direction = glm::normalize(inverse_ray.direction);
+			float inverse_length = glm::length(inverse_ray.direction);
+			inverse_ray.direction /= inverse_length;
 
 			float t0, t1;
 
@@ -351,10 +424,7 @@ namespace CHR
 
 			double discr = b * b - 4.0 * a * c;
 			if (discr < ray.intersect_eps)
-			{
-				data->hit = false;
 				return false;
-			}
 			else {
 				float q = (b > 0.0f) ?
 					-0.5 * (b + (double)glm::sqrt(discr)) : -0.5 * (b - (double)glm::sqrt(discr));
@@ -365,20 +435,34 @@ namespace CHR
 			if (t0 > t1)
 				std::swap(t0, t1);
 
-			data->hit = discr >= 0.0f;
 			if (t0 < 0.0f) {
 				t0 = t1; // if t0 is negative, let's use t1 instead 
-				if (t0 < 0.0f) data->hit = false; // both t0 and t1 are negative 
+				if (t0 < 0.0f) return false; // both t0 and t1 are negative 
 			}
 
+			//World space distance, t0 is along the normalized object space direction
+			float t = t0 * glm::length(ray.direction) / inverse_length;
+			if (t >= ray.t_max)
+				return false;
+			hit.t = t;
+			hit.shape = this;
+			hit.instance_depth = 0;
+			return true;
+		}
+
+		void FinalizeHit(const Ray& ray, const SurfaceHit& hit, IntersectionData* data) const
+		{
+			glm::mat4 inverse_transform = InverseTransformAt(ray.jitter_t);
+
 			bool replace_normals = false;
 			if (m_tex_maps[1])
 				replace_normals = true;
 
-			glm::vec3 local_p = inverse_ray.PointAt(t0);
-
-			data->t = glm::distance(glm::vec3( glm::inverse(inverse_transform) * glm::vec4(local_p,1.0f)), ray.origin);
+			data->hit = true;
+			data->t = hit.t;
 			data->position = ray.PointAt(data->t);
+			glm::vec3 local_p = inverse_transform * glm::vec4(data->position, 1.0f);
+
 			data->material = m_material.get();
 			data->tex_map = m_tex_maps[0].get();
 			data->uv = glm::vec2( (glm::pi<float>() - glm::atan(local_p.z, local_p.x)) / (2*glm::pi<float>()),
@@ -388,78 +472,130 @@ namespace CHR
 				(replace_normals ?
 					ObjectSpaceNormalAt(local_p, local_p, data->uv) :		//Bump Map & Normal Map
 					local_p));												//Regular Normal
-			return data->hit;
 		}
+
 	};
 
-	class Instance : public Shape
+	//A whole MeshInstance object as one shape. The base mesh gets a BVH of its own, shared by
+	//all of its instances, and rays are moved into the base object's space once per instance.
+	class MeshInstance : public Shape
 	{
 	public:
-		Instance(Shape* s, bool reset_transform = false)
-			:Shape(*s), m_base_ptr(s), m_reset_transform(reset_transform)
+		MeshInstance(std::shared_ptr<Mesh> base_mesh, glm::mat4* base_transform, glm::mat4* base_inv_transform)
+			:m_base_mesh(base_mesh), m_base_transform(base_transform), m_base_inv_transform(base_inv_transform)
 		{
-			m_base_ptr = s;
+			m_shape_type = SHAPE_T::instance;
 		}
 
-		Bounds3 GetWorldBounds() const
-		{
-
-			Bounds3 base_bounds = m_base_ptr->GetLocalBounds();
+		inline const std::shared_ptr<Mesh>& GetBaseMesh() const { return m_base_mesh; }
 
-			base_bounds.min = *m_transform * glm::vec4(base_bounds.min, 1.0f);
-			base_bounds.max = *m_transform * glm::vec4(base_bounds.max, 1.0f);
+		//Set by the scene BVH build, the transforms are cached until the next build or refit
+		void SetAccelerationStructure(std::shared_ptr<AccelerationStructure> accel)
+		{
+			m_accel = accel;
+			UpdateTransforms();
+		}
+		inline const std::shared_ptr<AccelerationStructure>& GetAccelerationStructure() const { return m_accel; }
+		inline const glm::mat4* GetBaseTransform() const { return m_base_transform; }
 
-			glm::vec3 b_min, b_max;
-			b_min = glm::min(base_bounds.min, base_bounds.max);
-			b_max = glm::max(base_bounds.min, base_bounds.max);
+		void UpdateTransforms()
+		{
+			m_world_to_base = *m_base_transform * *m_inv_transform;
+			m_base_to_world = *m_transform * *m_base_inv_transform;
+			m_normal_to_world = glm::transpose(glm::mat3(m_world_to_base));
+		}
 
-			b_min = glm::min(b_min, b_min + m_motion_blur);
-			b_max = glm::max(b_max, b_max + m_motion_blur);
+		Bounds3 GetWorldBounds() const
+		{
+			return m_motion ? GetMotionBounds().Union() : GetWorldBoundsUnder(*m_transform);
+		}
 
-			return Bounds3(b_min, b_max);
+		Bounds3 GetWorldBoundsUnder(const glm::mat4& transform) const
+		{
+			if (!m_accel)
+				return Bounds3();
+			return m_accel->WorldBound().Transform(transform * *m_base_inv_transform);
 		}
-		
+
 		Bounds3 GetLocalBounds() const
 		{
-			Bounds3 base_bounds = m_base_ptr->GetLocalBounds();
-			return base_bounds;
+			if (!m_accel)
+				return Bounds3();
+			return m_accel->WorldBound().Transform(*m_base_inv_transform);
 		}
 
-		glm::vec3 ObjectSpaceNormalAt(glm::vec3 p, glm::vec3 normal, glm::vec2 uv) const
+		glm::vec3 ObjectSpaceNormalAt(glm::vec3 /*p*/, glm::vec3 /*normal*/, glm::vec2 /*uv*/) const
 		{
 			return glm::vec3();
 		}
 
 		bool Intersect(const Ray ray, IntersectionData* data) const
 		{
-			bool hit = false;
-			glm::mat4 inverse_transform = *m_inv_transform;
-			if (m_motion_blur != glm::vec3(0, 0, 0))
-			{
-				inverse_transform = *m_inv_transform * glm::inverse(glm::translate(glm::mat4(1.0f), ray.jitter_t * m_motion_blur));
-			}
-			//inverse_transform = glm::inverse(inverse_transform);
-			Ray inv_ray;
-			inv_ray.origin = *(m_base_ptr->m_transform) * inverse_transform * glm::vec4(ray.origin, 1.0f);
-			inv_ray.direction = *(m_base_ptr->m_transform) * inverse_transform * glm::vec4(ray.direction, 0.0f);
-			inv_ray.intersect_eps = ray.intersect_eps;
-			inv_ray.jitter_t = 0.0f;
-
-			if (hit = m_base_ptr->Intersect(inv_ray, data))
-			{
-				data->normal = glm::normalize(glm::mat3(glm::transpose(inverse_transform)) *
-					glm::inverse(glm::mat3(glm::transpose(glm::inverse(*(m_base_ptr->m_transform))))) * data->normal);
-				data->position = ray.PointAt(data->t);
-				if (m_material.get())
-					data->material = m_material.get();
-				if(m_tex_maps[0].get())
-					data->tex_map = m_tex_maps[0].get();
-			}
-			return hit;
+			SurfaceHit hit;
+			if (!IntersectHit(ray, hit))
+				return data->hit = false;
+			FinalizeHit(ray, hit, data);
+			return true;
+		}
+
+		bool IntersectHit(const Ray& ray, SurfaceHit& hit) const
+		{
+			SurfaceHit base_hit;
+			//Deeper nesting than the hit can record is not supported
+			if (!m_accel->IntersectHit(ToBaseSpace(ray), base_hit) || base_hit.instance_depth == SurfaceHit::MAX_INSTANCE_DEPTH)
+				return false;
+
+			hit = base_hit;
+			for (int i = base_hit.instance_depth; i > 0; i--)
+				hit.instances[i] = base_hit.instances[i - 1];
+			hit.instances[0] = this;
+			hit.instance_depth++;
+			return true;
+		}
+
+		void FinalizeHit(const Ray& ray, const SurfaceHit& hit, IntersectionData* data) const
+		{
+			hit.Below(this)->FinalizeHit(ToBaseSpace(ray), hit, data);
+			glm::mat3 normal_to_world = m_motion && !m_motion->IsTranslation() ?
+				glm::transpose(glm::mat3(WorldToBaseAt(ray.jitter_t))) : m_normal_to_world;
+			data->normal = glm::normalize(normal_to_world * data->normal);
+			data->position = ray.PointAt(data->t);
+			if (m_material.get())
+				data->material = m_material.get();
+			if (m_tex_maps[0].get())
+				data->tex_map = m_tex_maps[0].get();
+		}
+
+		bool IntersectP(const Ray ray, float t_max) const
+		{
+			return m_accel->IntersectP(ToBaseSpace(ray), t_max);
 		}
 
 	private:
-		const Shape* m_base_ptr;
-		bool m_reset_transform = false;
+		glm::mat4 WorldToBaseAt(float time) const
+		{
+			if (!m_motion)
+				return m_world_to_base;
+			return m_motion->InverseTransformAt(m_world_to_base, (*m_transform)[3], time);
+		}
+
+		Ray ToBaseSpace(const Ray& ray) const
+		{
+			glm::mat4 world_to_base = WorldToBaseAt(ray.jitter_t);
+
+			Ray base_ray(world_to_base * glm::vec4(ray.origin, 1.0f), world_to_base * glm::vec4(ray.direction, 0.0f));
+			base_ray.intersect_eps = ray.intersect_eps;
+			base_ray.t_max = ray.t_max;	//the transform is affine, t is the same in both spaces
+			return base_ray;
+		}
+
+		std::shared_ptr<Mesh> m_base_mesh;
+		glm::mat4* m_base_transform;
+		glm::mat4* m_base_inv_transform;
+
+		std::shared_ptr<AccelerationStructure> m_accel;
+		glm::mat4 m_world_to_base = glm::mat4(1.0f);
+		glm::mat4 m_base_to_world = glm::mat4(1.0f);
+		glm::mat3 m_normal_to_world = glm::mat3(1.0f);
 	};
-}
\ No newline at end of file
+}
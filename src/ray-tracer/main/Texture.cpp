@@ -5,7 +5,7 @@
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <thirdparty/stb_image/stb_image.h>
-#include <ray-tracer\editor\Logger.h>
+#include <ray-tracer/editor/Logger.h>
 
 namespace CHR
 {
@@ -22,21 +22,6 @@ namespace CHR
 		{
 			stbi_set_flip_vertically_on_load(false);
 			m_localbuffer = stbi_load(path.c_str(), &m_width, &m_height, &m_BPP, 4);
-
-			glGenTextures(1, &m_renderer_id);
-			glBindTexture(GL_TEXTURE_2D, m_renderer_id);
-
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
-
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_width, m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, m_localbuffer);
-			glBindTexture(GL_TEXTURE_2D, 0);
-
-			/*if (m_localbuffer)
-				stbi_image_free(m_localbuffer);*/
 		}
 		else
 		{
@@ -61,7 +46,9 @@ namespace CHR
             m_filepath = rhs.m_filepath;
             m_height = rhs.m_height;
             //m_localbuffer = nullptr;
-            m_renderer_id = rhs.m_renderer_id;
+            if (m_renderer_id)
+                glDeleteTextures(1, &m_renderer_id);
+            m_renderer_id = 0;
             //m_uniform_name = rhs.m_uniform_name;
             m_width = rhs.m_width;
             m_t_wrap = rhs.m_t_wrap;
@@ -74,21 +61,6 @@ namespace CHR
 
 				stbi_set_flip_vertically_on_load(false);
 				m_localbuffer = stbi_load(m_filepath.c_str(), &m_width, &m_height, &m_BPP, 4);
-
-				glGenTextures(1, &m_renderer_id);
-				glBindTexture(GL_TEXTURE_2D, m_renderer_id);
-
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, rhs.m_t_wrap);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, rhs.m_t_wrap);
-
-				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_width, m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, m_localbuffer);
-				glBindTexture(GL_TEXTURE_2D, 0);
-
-				/*if (m_localbuffer)
-					stbi_image_free(m_localbuffer);*/
 			}
 
         }
@@ -96,43 +68,27 @@ namespace CHR
     }
 
     Texture::Texture(const Texture & other)
-        :m_renderer_id(other.m_renderer_id),
+        :m_renderer_id(0),
         m_filepath(other.m_filepath),
         //m_localbuffer(other.m_localbuffer),
         m_width(other.m_width),
         m_height(other.m_height),
         m_BPP(other.m_BPP),
-        m_t_wrap(other.m_t_wrap)/*,
+        m_t_wrap(other.m_t_wrap),
+        m_hdr_localbuffer(other.m_hdr_localbuffer),
+        m_hdr(other.m_hdr)/*,
         m_uniform_name(other.m_uniform_name)*/
     {
-		if (!m_hdr)
+		if (!m_hdr && !m_filepath.empty())
 		{
-			if (!m_hdr)
-			{
-				stbi_set_flip_vertically_on_load(false);
-				m_localbuffer = stbi_load(m_filepath.c_str(), &m_width, &m_height, &m_BPP, 4);
-
-				glGenTextures(1, &m_renderer_id);
-				glBindTexture(GL_TEXTURE_2D, m_renderer_id);
-
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, other.m_t_wrap);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, other.m_t_wrap);
-
-				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_width, m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, m_localbuffer);
-				glBindTexture(GL_TEXTURE_2D, 0);
-				/*if (m_localbuffer)
-					stbi_image_free(m_localbuffer);*/
-			}
-
+			stbi_set_flip_vertically_on_load(false);
+			m_localbuffer = stbi_load(m_filepath.c_str(), &m_width, &m_height, &m_BPP, 4);
 		}
     }
 
     Texture::~Texture()
     {
-		if(!m_hdr)
+		if(!m_hdr && m_renderer_id)
 			glDeleteTextures(1, &m_renderer_id);
     }
 
@@ -140,11 +96,28 @@ namespace CHR
     {
 		if (!m_hdr)
 		{
+			if (!m_renderer_id)
+				UploadToGPU();
 			glActiveTexture(GL_TEXTURE0 + slot);
 			glBindTexture(GL_TEXTURE_2D, m_renderer_id);
 		}
     }
 
+    void Texture::UploadToGPU() const
+    {
+		glGenTextures(1, &m_renderer_id);
+		glBindTexture(GL_TEXTURE_2D, m_renderer_id);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, m_t_wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, m_t_wrap);
+
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_width, m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, m_localbuffer);
+		glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
     void Texture::Unbind() const
     {
 		if (!m_hdr)
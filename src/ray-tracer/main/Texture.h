@@ -28,13 +28,16 @@ namespace CHR
 		glm::vec4 SampleAt(glm::ivec2 p);
 
     private:
-        unsigned int m_renderer_id;
+		void UploadToGPU() const;
+
+		//GL texture is created on first Bind so headless renders never touch GL
+        mutable unsigned int m_renderer_id = 0;
         std::string m_filepath;
-        unsigned char* m_localbuffer;
-        int m_width, m_height, m_BPP;
-        TextureWrap m_t_wrap;
+        unsigned char* m_localbuffer = nullptr;
+        int m_width = 0, m_height = 0, m_BPP = 0;
+        TextureWrap m_t_wrap = EDGE_CLAMP;
 
-		float* m_hdr_localbuffer;
+		float* m_hdr_localbuffer = nullptr;
 		bool m_hdr = false;
     };
 }
\ No newline at end of file
@@ -0,0 +1,222 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace CHR
+{
+	thread_local int t_worker_idx = -1;
+
+	ThreadPool::ThreadPool()
+	{
+		int hw_threads = (int)std::thread::hardware_concurrency();
+		Start(std::max(hw_threads, 1) - 1);
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		Stop();
+	}
+
+	void ThreadPool::SetThreadCount(int thread_count)
+	{
+		thread_count = std::max(thread_count, 1);
+		if (thread_count == GetThreadCount())
+			return;
+		Stop();
+		Start(thread_count - 1);
+	}
+
+	int ThreadPool::GetWorkerIndex()
+	{
+		return t_worker_idx;
+	}
+
+	void ThreadPool::Start(int worker_count)
+	{
+		m_stop = false;
+		m_queues.clear();
+		for (int i = 0; i < worker_count; i++)
+			m_queues.push_back(std::make_unique<WorkerQueue>());
+		for (int i = 0; i < worker_count; i++)
+			m_threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+	}
+
+	void ThreadPool::Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_wake_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		//Workers leave once every queue is drained
+		for (auto& thread : m_threads)
+			thread.join();
+		m_threads.clear();
+	}
+
+	void ThreadPool::WorkerLoop(int idx)
+	{
+		t_worker_idx = idx;
+		while (true)
+		{
+			if (RunPendingTask())
+				continue;
+
+			std::unique_lock<std::mutex> lock(m_wake_mutex);
+			m_wake.wait(lock, [this]() { return m_stop || m_queued > 0; });
+			if (m_stop && m_queued == 0)
+				break;
+		}
+		t_worker_idx = -1;
+	}
+
+	void ThreadPool::Submit(std::function<void()> task, TaskGroup* group)
+	{
+		if (group)
+			group->m_remaining++;
+
+		if (m_threads.empty())
+		{
+			task();
+			if (group)
+				group->m_remaining--;
+			return;
+		}
+
+		std::vector<Task> tasks;
+		tasks.push_back({ std::move(task), group });
+		Push(tasks);
+	}
+
+	void ThreadPool::Wait(TaskGroup& group)
+	{
+		while (!group.IsDone())
+		{
+			if (RunPendingTask())
+				continue;
+
+			//Nothing left to help with, sleep until a task of the group finishes.
+			//The timeout covers work pushed by tasks still running elsewhere.
+			std::unique_lock<std::mutex> lock(m_wake_mutex);
+			m_task_done.wait_for(lock, std::chrono::milliseconds(1),
+				[this, &group]() { return group.IsDone() || m_queued > 0; });
+		}
+	}
+
+	void ThreadPool::ParallelFor(int count, const std::function<void(int)>& func, int chunk)
+	{
+		chunk = std::max(chunk, 1);
+		if (m_threads.empty() || count <= chunk)
+		{
+			for (int i = 0; i < count; i++)
+				func(i);
+			return;
+		}
+
+		TaskGroup group;
+		std::vector<Task> tasks;
+		tasks.reserve((count + chunk - 1) / chunk);
+		for (int begin = 0; begin < count; begin += chunk)
+		{
+			int end = std::min(begin + chunk, count);
+			tasks.push_back({ [&func, begin, end]() {
+				for (int i = begin; i < end; i++)
+					func(i);
+			}, &group });
+		}
+		group.m_remaining = (int)tasks.size();
+		Push(tasks);
+		Wait(group);
+	}
+
+	void ThreadPool::Push(std::vector<Task>& tasks)
+	{
+		int queue_count = (int)m_queues.size();
+		if (t_worker_idx >= 0 && t_worker_idx < queue_count)
+		{
+			//Keep nested work local, idle workers steal it
+			std::lock_guard<std::mutex> lock(m_queues[t_worker_idx]->mutex);
+			for (auto& task : tasks)
+				m_queues[t_worker_idx]->tasks.push_back(std::move(task));
+		}
+		else
+		{
+			//Deal the tasks out in contiguous runs so each worker starts on its own share
+			int first = (int)(m_next_queue++ % queue_count);
+			int per_queue = ((int)tasks.size() + queue_count - 1) / queue_count;
+			for (int q = 0; q < queue_count; q++)
+			{
+				int begin = q * per_queue;
+				int end = std::min(begin + per_queue, (int)tasks.size());
+				if (begin >= end)
+					break;
+				WorkerQueue& queue = *m_queues[(first + q) % queue_count];
+				std::lock_guard<std::mutex> lock(queue.mutex);
+				for (int i = end - 1; i >= begin; i--)//popped from the back, so the run starts at its first task
+					queue.tasks.push_back(std::move(tasks[i]));
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_wake_mutex);
+			m_queued += (int)tasks.size();
+		}
+		m_wake.notify_all();
+		m_task_done.notify_all();
+	}
+
+	bool ThreadPool::RunPendingTask()
+	{
+		Task task;
+		int idx = t_worker_idx < (int)m_queues.size() ? t_worker_idx : -1;
+		if (!PopTask(idx, task) && !StealTask(idx, task))
+			return false;
+
+		{
+			std::lock_guard<std::mutex> lock(m_wake_mutex);
+			m_queued--;
+		}
+
+		task.func();
+
+		if (task.group && --task.group->m_remaining == 0)
+		{
+			std::lock_guard<std::mutex> lock(m_wake_mutex);
+			m_task_done.notify_all();
+		}
+		return true;
+	}
+
+	bool ThreadPool::PopTask(int idx, Task& task)
+	{
+		if (idx < 0)
+			return false;
+		WorkerQueue& queue = *m_queues[idx];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty())
+			return false;
+		task = std::move(queue.tasks.back());
+		queue.tasks.pop_back();
+		return true;
+	}
+
+	bool ThreadPool::StealTask(int thief, Task& task)
+	{
+		int queue_count = (int)m_queues.size();
+		for (int i = 1; i <= queue_count; i++)
+		{
+			int victim = (thief + i) % queue_count;
+			if (victim == thief)
+				continue;
+			WorkerQueue& queue = *m_queues[victim];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.tasks.empty())
+				continue;
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+			return true;
+		}
+		return false;
+	}
+}
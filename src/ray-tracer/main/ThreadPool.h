@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace CHR
+{
+	//Process wide pool of persistent workers. Every worker owns a deque, it pops its own
+	//tasks from the back and steals from the front of the others when it runs dry.
+	//A thread waiting in ParallelFor or Wait runs pending tasks instead of blocking,
+	//so work can be submitted from inside a task.
+	class ThreadPool
+	{
+	public:
+		//Counts the unfinished tasks submitted with it
+		class TaskGroup
+		{
+		public:
+			inline bool IsDone() const { return m_remaining.load() == 0; }
+		private:
+			friend class ThreadPool;
+			std::atomic<int> m_remaining{ 0 };
+		};
+
+		//Created on first use, thread safe. Its workers are stopped and joined at exit
+		static ThreadPool* GetInstance()
+		{
+			static ThreadPool pool;
+			return &pool;
+		}
+
+		//Threads taking part in ParallelFor, the calling thread included
+		inline int GetThreadCount() const { return (int)m_threads.size() + 1; }
+		//Waits for the queued work and restarts the workers when the count changes
+		void SetThreadCount(int thread_count);
+
+		void Submit(std::function<void()> task, TaskGroup* group = nullptr);
+		void Wait(TaskGroup& group);
+
+		//Calls func(i) for every i in [0, count), chunk indices per task, returns when all are done
+		void ParallelFor(int count, const std::function<void(int)>& func, int chunk = 1);
+
+		//Index of the calling worker, -1 for threads outside the pool
+		static int GetWorkerIndex();
+
+	private:
+		struct Task
+		{
+			std::function<void()> func;
+			TaskGroup* group;
+		};
+		struct WorkerQueue
+		{
+			std::mutex mutex;
+			std::deque<Task> tasks;
+		};
+
+		ThreadPool();
+		~ThreadPool();
+
+		void Start(int worker_count);
+		void Stop();
+		void WorkerLoop(int idx);
+		void Push(std::vector<Task>& tasks);
+		bool RunPendingTask();
+		bool PopTask(int idx, Task& task);
+		bool StealTask(int thief, Task& task);
+
+		std::vector<std::thread> m_threads;
+		std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+		std::atomic<unsigned int> m_next_queue{ 0 };
+
+		std::mutex m_wake_mutex;
+		std::condition_variable m_wake;
+		std::condition_variable m_task_done;
+		int m_queued = 0;//guarded by m_wake_mutex
+		bool m_stop = false;
+	};
+}
@@ -2,9 +2,9 @@
 #include <random>
 #include <limits>
 
-#include <thirdparty\glm\glm\glm.hpp>
-#include <thirdparty\glm\glm\gtx\norm.hpp>
-#include <thirdparty\glm\glm\gtx\component_wise.hpp>
+#include <thirdparty/glm/glm/glm.hpp>
+#include <thirdparty/glm/glm/gtx/norm.hpp>
+#include <thirdparty/glm/glm/gtx/component_wise.hpp>
 
 
 namespace CHR_UTILS
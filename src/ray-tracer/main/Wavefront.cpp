@@ -0,0 +1,73 @@
+#include "Wavefront.h"
+
+namespace CHR
+{
+	void RayQueue::Clear()
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			origin[k].clear();
+			direction[k].clear();
+			weight[k].clear();
+		}
+		intersect_eps.clear();
+		jitter_t.clear();
+		rr_throughput.clear();
+		pixel.clear();
+		depth.clear();
+	}
+
+	void RayQueue::Reserve(int count)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			origin[k].reserve(count);
+			direction[k].reserve(count);
+			weight[k].reserve(count);
+		}
+		intersect_eps.reserve(count);
+		jitter_t.reserve(count);
+		rr_throughput.reserve(count);
+		pixel.reserve(count);
+		depth.reserve(count);
+	}
+
+	void RayQueue::Push(const Ray& ray, const glm::vec3& ray_weight, float ray_rr_throughput, int ray_pixel, int ray_depth)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			origin[k].push_back(ray.origin[k]);
+			direction[k].push_back(ray.direction[k]);
+			weight[k].push_back(ray_weight[k]);
+		}
+		intersect_eps.push_back(ray.intersect_eps);
+		jitter_t.push_back(ray.jitter_t);
+		rr_throughput.push_back(ray_rr_throughput);
+		pixel.push_back(ray_pixel);
+		depth.push_back(ray_depth);
+	}
+
+	void ShadowQueue::Clear()
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			origin[k].clear();
+			direction[k].clear();
+			radiance[k].clear();
+		}
+		distance.clear();
+		pixel.clear();
+	}
+
+	void ShadowQueue::Push(const Ray& ray, float light_distance, const glm::vec3& ray_radiance, int ray_pixel)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			origin[k].push_back(ray.origin[k]);
+			direction[k].push_back(ray.direction[k]);
+			radiance[k].push_back(ray_radiance[k]);
+		}
+		distance.push_back(light_distance);
+		pixel.push_back(ray_pixel);
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+
+#include <thirdparty/glm/glm/glm.hpp>
+
+#include <ray-tracer/main/Ray.h>
+
+namespace CHR
+{
+	//Rays of one bounce of the wavefront path tracer, stored SoA so each stage streams over contiguous arrays
+	struct RayQueue
+	{
+		std::vector<float> origin[3];
+		std::vector<float> direction[3];
+		std::vector<float> intersect_eps;
+		std::vector<float> jitter_t;
+		std::vector<float> rr_throughput;	//Ray::throughput of the recursive path tracer, its russian roulette weight
+		std::vector<float> weight[3];		//What the ray's radiance adds to its pixel per unit, 1 / spp for camera rays
+		std::vector<int> pixel;				//Index into the tile's pixels
+		std::vector<int> depth;
+
+		inline int Size() const { return (int)pixel.size(); }
+		void Clear();
+		void Reserve(int count);
+		void Push(const Ray& ray, const glm::vec3& ray_weight, float ray_rr_throughput, int ray_pixel, int ray_depth);
+
+		inline Ray GetRay(int i) const
+		{
+			Ray ray(glm::vec3(origin[0][i], origin[1][i], origin[2][i]),
+				glm::vec3(direction[0][i], direction[1][i], direction[2][i]));
+			ray.intersect_eps = intersect_eps[i];
+			ray.jitter_t = jitter_t[i];
+			return ray;
+		}
+		inline glm::vec3 GetWeight(int i) const { return glm::vec3(weight[0][i], weight[1][i], weight[2][i]); }
+	};
+
+	//Shadow rays with the radiance they add to their pixel when nothing occludes their light sample
+	struct ShadowQueue
+	{
+		std::vector<float> origin[3];
+		std::vector<float> direction[3];
+		std::vector<float> distance;		//To the light sample, INFINITY for directional and environment lights
+		std::vector<float> radiance[3];
+		std::vector<int> pixel;
+
+		inline int Size() const { return (int)pixel.size(); }
+		void Clear();
+		void Push(const Ray& ray, float light_distance, const glm::vec3& ray_radiance, int ray_pixel);
+
+		inline Ray GetRay(int i) const
+		{
+			return Ray(glm::vec3(origin[0][i], origin[1][i], origin[2][i]),
+				glm::vec3(direction[0][i], direction[1][i], direction[2][i]));
+		}
+		inline glm::vec3 GetRadiance(int i) const { return glm::vec3(radiance[0][i], radiance[1][i], radiance[2][i]); }
+	};
+
+	//Queues and hit buffers of a wavefront path tracing worker, reused across its tiles
+	struct WavefrontQueues
+	{
+		//Samples of a tile are split into batches of at most this many camera rays
+		static const int MAX_CAMERA_RAYS = 1 << 14;
+
+		RayQueue rays;			//Extended and shaded this bounce
+		RayQueue next_rays;		//Spawned by the shading of this bounce
+		ShadowQueue shadow_rays;
+		std::vector<IntersectionData> hits;
+		std::vector<int> shade_order;	//Indices of rays, grouped by the material they hit
+		std::vector<int> camera_packets;//Sizes of the packets the camera rays were generated in
+	};
+}
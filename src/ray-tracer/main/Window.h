@@ -1,5 +1,5 @@
 #pragma once
-#include <thirdparty\glad\include\glad\glad.h>
+#include <thirdparty/glad/include/glad/glad.h>
 #include <thirdparty/glfw-3.3/include/GLFW/glfw3.h>
 
 #include <iostream>